@@ -0,0 +1,410 @@
+// Load generator, stub backend and benchmark suite for comparing the server modes.
+//
+// Usage:
+//   ./bin/crabby_bench load --url=http://127.0.0.1:8080/ [load options]
+//   ./bin/crabby_bench backend --port=9081 [--name=B1] [--threads=N] [--fail-rate=F]
+//   ./bin/crabby_bench suite [--crabby=./bin/crabbyLB] [--modes=a,b] [--scenarios=a,b] [load options]
+//
+// Load options: --connections=N --threads=N --duration-ms=MS --warmup-ms=MS --timeout-ms=MS
+//               --rate=RPS (open loop; default closed loop) --no-keep-alive
+
+#include "load_generator.h"
+#include "stub_backend.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// Value of "--name=value", or nullptr if arg is another option
+const char* option_value(const std::string& arg, const char* name) {
+    size_t length = strlen(name);
+    if (arg.compare(0, length, name) == 0 && arg.size() > length && arg[length] == '=') {
+        return arg.c_str() + length + 1;
+    }
+    return nullptr;
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// "http://host:port/path" (scheme and port optional)
+bool parse_url(std::string url, LoadOptions& options) {
+    if (url.compare(0, 7, "http://") == 0) {
+        url.erase(0, 7);
+    }
+    size_t slash = url.find('/');
+    std::string authority = url.substr(0, slash);
+    options.path = slash == std::string::npos ? "/" : url.substr(slash);
+    size_t colon = authority.find(':');
+    options.host = authority.substr(0, colon);
+    if (colon != std::string::npos) {
+        options.port = std::atoi(authority.c_str() + colon + 1);
+    }
+    return !options.host.empty() && options.port > 0;
+}
+
+// Shared load options; false if arg is not one of them
+bool parse_load_option(const std::string& arg, LoadOptions& options) {
+    const char* value;
+    if ((value = option_value(arg, "--connections"))) {
+        options.connections = std::strtoul(value, nullptr, 10);
+    } else if ((value = option_value(arg, "--threads"))) {
+        options.threads = std::strtoul(value, nullptr, 10);
+    } else if ((value = option_value(arg, "--duration-ms"))) {
+        options.duration = std::chrono::milliseconds(std::atol(value));
+    } else if ((value = option_value(arg, "--warmup-ms"))) {
+        options.warmup = std::chrono::milliseconds(std::atol(value));
+    } else if ((value = option_value(arg, "--timeout-ms"))) {
+        options.timeout = std::chrono::milliseconds(std::atol(value));
+    } else if ((value = option_value(arg, "--rate"))) {
+        options.rate = std::atof(value);
+    } else if (arg == "--no-keep-alive") {
+        options.keep_alive = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+double milliseconds(uint64_t microseconds) {
+    return microseconds / 1000.0;
+}
+
+void print_result(const LoadOptions& options, const LoadResult& result) {
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << (options.rate > 0 ? "Open loop at " + std::to_string(static_cast<long>(options.rate)) + " req/s"
+                                   : std::string("Closed loop"))
+              << ", " << options.connections << " connection(s), " << options.threads << " thread(s), "
+              << (options.keep_alive ? "keep-alive" : "new connection per request") << "\n";
+    std::cout << "  requests      " << result.requests << " in " << result.seconds << " s ("
+              << result.requests_per_second() << " req/s, "
+              << result.bytes / result.seconds / (1024 * 1024) << " MB/s)\n";
+    std::cout << "  latency ms    p50 " << milliseconds(result.latency.quantile(0.5))
+              << "  p99 " << milliseconds(result.latency.quantile(0.99))
+              << "  p999 " << milliseconds(result.latency.quantile(0.999))
+              << "  max " << milliseconds(result.latency.quantile(1.0)) << "\n";
+    std::cout << "  non-2xx       " << result.non_2xx << "\n";
+    std::cout << "  errors        " << result.errors << "\n";
+    std::cout << "  connections   " << result.connects << " opened\n";
+    if (result.late > 0) {
+        std::cout << "  late          " << result.late << " request(s) never sent: add connections\n";
+    }
+}
+
+int run_load_command(const std::vector<std::string>& args) {
+    LoadOptions options;
+    for (const std::string& arg : args) {
+        const char* value = option_value(arg, "--url");
+        if (value != nullptr) {
+            if (!parse_url(value, options)) {
+                std::cerr << "Invalid URL: " << value << "\n";
+                return 1;
+            }
+        } else if (!parse_load_option(arg, options)) {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    LoadResult result = run_load(options);
+    print_result(options, result);
+    return 0;
+}
+
+int run_backend_command(const std::vector<std::string>& args) {
+    StubOptions options;
+    for (const std::string& arg : args) {
+        const char* value;
+        if ((value = option_value(arg, "--port"))) {
+            options.port = std::atoi(value);
+        } else if ((value = option_value(arg, "--name"))) {
+            options.name = value;
+        } else if ((value = option_value(arg, "--threads"))) {
+            options.threads = std::strtoul(value, nullptr, 10);
+        } else if ((value = option_value(arg, "--fail-rate"))) {
+            options.fail_rate = std::atof(value);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    return run_stub_backend(options);
+}
+
+// Suite
+
+struct SuiteMode {
+    const char* name;
+    const char* mode;  // Passed to crabbyLB
+    const char* extra; // Extra crabbyLB option, or nullptr
+    bool proxy;        // Forwards to the backends (the other modes answer by themselves)
+};
+
+const SuiteMode SUITE_MODES[] = {
+    {"basic", "basic", nullptr, false},
+    {"multi_thread", "multi_thread", nullptr, false},
+    {"thread_pool", "thread_pool", nullptr, false},
+    {"load_balancer", "load_balancer", nullptr, true},
+    {"event_loop", "event_loop", nullptr, true},
+    {"event_loop_uring", "event_loop", "--io-engine=io_uring", true},
+};
+
+struct Scenario {
+    const char* name;
+    const char* path;
+    bool keep_alive;
+    size_t max_connections; // Caps the connection count (0: no cap)
+    bool proxy_only;        // Needs the backends' pages
+};
+
+const Scenario SCENARIOS[] = {
+    {"keepalive", "/", true, 0, false},
+    {"new_conn", "/", false, 0, false},
+    {"large_1mb", "/bytes/1048576", true, 16, true},
+    {"slow_50ms", "/delay/50", true, 0, true},
+    {"failing", "/flaky", true, 0, true}, // One backend of three answers 503
+};
+
+const int BACKEND_COUNT = 3;
+
+bool port_open(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    bool open = connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    close(fd);
+    return open;
+}
+
+bool wait_for_port(int port, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (port_open(port)) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+// SIGTERM, then SIGKILL if the process is still there after a few seconds
+void stop_process(pid_t pid) {
+    kill(pid, SIGTERM);
+    for (int i = 0; i < 100; ++i) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+pid_t start_stub_backend(const StubOptions& options) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(run_stub_backend(options));
+    }
+    return pid;
+}
+
+pid_t start_crabby(const std::string& crabby, const SuiteMode& mode, const std::vector<std::string>& backends,
+                   int port) {
+    std::vector<std::string> args = {crabby, mode.mode};
+    if (mode.proxy) {
+        args.insert(args.end(), backends.begin(), backends.end());
+    }
+    args.push_back("--port=" + std::to_string(port));
+    args.push_back("--log-level=error");
+    if (mode.extra != nullptr) {
+        args.push_back(mode.extra);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        execv(crabby.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+int run_suite_command(const std::vector<std::string>& args) {
+    std::string crabby = "./bin/crabbyLB";
+    std::vector<std::string> modes;
+    std::vector<std::string> scenarios;
+    int port = 8080;
+    int backend_port = 9081;
+    LoadOptions base;
+    base.duration = std::chrono::milliseconds(5000);
+
+    for (const std::string& arg : args) {
+        const char* value;
+        if ((value = option_value(arg, "--crabby"))) {
+            crabby = value;
+        } else if ((value = option_value(arg, "--modes"))) {
+            modes = split_list(value);
+        } else if ((value = option_value(arg, "--scenarios"))) {
+            scenarios = split_list(value);
+        } else if ((value = option_value(arg, "--port"))) {
+            port = std::atoi(value);
+        } else if ((value = option_value(arg, "--backend-port"))) {
+            backend_port = std::atoi(value);
+        } else if (!parse_load_option(arg, base)) {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    auto selected = [](const std::vector<std::string>& names, const char* name) {
+        if (names.empty()) {
+            return true;
+        }
+        for (const std::string& candidate : names) {
+            if (candidate == name) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (access(crabby.c_str(), X_OK) != 0) {
+        std::cerr << "crabbyLB not found at " << crabby << " (use --crabby=PATH)\n";
+        return 1;
+    }
+
+    // The last backend fails every /flaky request
+    std::vector<pid_t> backend_pids;
+    std::vector<std::string> backends;
+    for (int i = 0; i < BACKEND_COUNT; ++i) {
+        StubOptions stub;
+        stub.port = backend_port + i;
+        stub.name = "B" + std::to_string(i + 1);
+        stub.fail_rate = i == BACKEND_COUNT - 1 ? 1.0 : 0.0;
+        backend_pids.push_back(start_stub_backend(stub));
+        backends.push_back("127.0.0.1:" + std::to_string(stub.port));
+    }
+    for (int i = 0; i < BACKEND_COUNT; ++i) {
+        if (!wait_for_port(backend_port + i, std::chrono::milliseconds(5000))) {
+            std::cerr << "Stub backend on port " << backend_port + i << " did not start\n";
+            for (pid_t pid : backend_pids) {
+                stop_process(pid);
+            }
+            return 1;
+        }
+    }
+
+    std::cout << (base.rate > 0 ? "Open loop at " + std::to_string(static_cast<long>(base.rate)) + " req/s"
+                                : std::string("Closed loop"))
+              << ", " << base.connections << " connection(s), " << base.threads << " thread(s), "
+              << base.duration.count() << " ms per scenario\n\n";
+    std::cout << std::left << std::setw(18) << "mode" << std::setw(12) << "scenario" << std::right
+              << std::setw(12) << "req/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+              << std::setw(10) << "p999 ms" << std::setw(10) << "non-2xx" << std::setw(9) << "errors" << "\n";
+
+    for (const SuiteMode& mode : SUITE_MODES) {
+        if (!selected(modes, mode.name)) {
+            continue;
+        }
+        pid_t crabby_pid = start_crabby(crabby, mode, backends, port);
+        if (!wait_for_port(port, std::chrono::milliseconds(5000))) {
+            std::cerr << mode.name << ": crabbyLB did not start listening on port " << port << "\n";
+            stop_process(crabby_pid);
+            continue;
+        }
+
+        for (const Scenario& scenario : SCENARIOS) {
+            if (!selected(scenarios, scenario.name) || (scenario.proxy_only && !mode.proxy)) {
+                continue;
+            }
+            LoadOptions options = base;
+            options.port = port;
+            options.path = scenario.path;
+            options.keep_alive = base.keep_alive && scenario.keep_alive;
+            if (scenario.max_connections > 0) {
+                options.connections = std::min(options.connections, scenario.max_connections);
+            }
+
+            LoadResult result = run_load(options);
+            std::cout << std::left << std::setw(18) << mode.name << std::setw(12) << scenario.name << std::right
+                      << std::fixed << std::setprecision(0) << std::setw(12) << result.requests_per_second()
+                      << std::setprecision(2)
+                      << std::setw(10) << milliseconds(result.latency.quantile(0.5))
+                      << std::setw(10) << milliseconds(result.latency.quantile(0.99))
+                      << std::setw(10) << milliseconds(result.latency.quantile(0.999))
+                      << std::setw(10) << result.non_2xx << std::setw(9) << result.errors << std::endl;
+        }
+        stop_process(crabby_pid);
+    }
+
+    for (pid_t pid : backend_pids) {
+        stop_process(pid);
+    }
+    return 0;
+}
+
+void usage() {
+    std::cerr << "Usage: ./crabby_bench load --url=http://HOST:PORT/PATH [load options]\n";
+    std::cerr << "       ./crabby_bench backend --port=N [--name=NAME] [--threads=N] [--fail-rate=F]\n";
+    std::cerr << "       ./crabby_bench suite [--crabby=PATH] [--modes=NAME,...] [--scenarios=NAME,...]\n";
+    std::cerr << "                            [--port=N] [--backend-port=N] [load options]\n";
+    std::cerr << "Load options: --connections=N --threads=N --duration-ms=MS --warmup-ms=MS --timeout-ms=MS\n";
+    std::cerr << "              --rate=RPS (open loop) --no-keep-alive\n";
+    std::cerr << "Suite modes: basic, multi_thread, thread_pool, load_balancer, event_loop, event_loop_uring\n";
+    std::cerr << "Suite scenarios: keepalive, new_conn, large_1mb, slow_50ms, failing\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string command = argv[1];
+    std::vector<std::string> args(argv + 2, argv + argc);
+    if (command == "load") {
+        return run_load_command(args);
+    }
+    if (command == "backend") {
+        return run_backend_command(args);
+    }
+    if (command == "suite") {
+        return run_suite_command(args);
+    }
+    usage();
+    return 1;
+}
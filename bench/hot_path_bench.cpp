@@ -0,0 +1,258 @@
+// Google Benchmark microbenchmarks of the per-request hot paths: request parsing, response
+// serialization, backend selection under contention, thread pool hand-off and access logging.
+//
+// Usage: ./bin/hot_path_bench [--benchmark_filter=REGEX] [--benchmark_format=json] ...
+// See scripts/profile.sh for recording a flame graph of one of them.
+
+#include "core/header_rewrite.h"
+#include "core/http_parser.h"
+#include "core/load_balancer.h"
+#include "core/logger.h"
+#include "core/request.h"
+#include "core/response.h"
+#include "core/thread_pool.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// A GET with the given number of extra headers of the given value size
+std::string make_request(size_t header_count, size_t value_size) {
+    std::string request = "GET /api/v1/items?id=42&sort=desc&page=3 HTTP/1.1\r\nHost: localhost:8080\r\n";
+    for (size_t i = 0; i < header_count; ++i) {
+        request += "X-Custom-Header-" + std::to_string(i) + ": " + std::string(value_size, 'v') + "\r\n";
+    }
+    request += "\r\n";
+    return request;
+}
+
+void request_shapes(benchmark::internal::Benchmark* bench) {
+    bench->ArgNames({"headers", "value_size"});
+    for (int headers : {2, 10, 40, 100}) {
+        for (int value_size : {16, 256}) {
+            bench->Args({headers, value_size});
+        }
+    }
+}
+
+// Parsing in place, as the event loop does with its receive buffer
+void BM_HttpRequestParser(benchmark::State& state) {
+    std::string raw = make_request(state.range(0), state.range(1));
+    HttpRequestParser parser;
+    for (auto _ : state) {
+        parser.reset();
+        benchmark::DoNotOptimize(parser.parse(raw));
+        benchmark::DoNotOptimize(parser.get_header("host"));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw.size()));
+}
+BENCHMARK(BM_HttpRequestParser)->Apply(request_shapes);
+
+// Request owns a copy of the raw bytes, as the threaded modes use it
+void BM_Request(benchmark::State& state) {
+    std::string raw = make_request(state.range(0), state.range(1));
+    for (auto _ : state) {
+        Request request(raw);
+        benchmark::DoNotOptimize(request.header_view("host"));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw.size()));
+}
+BENCHMARK(BM_Request)->Apply(request_shapes);
+
+// Serving a request parsed in the receive buffer where it is, as handle_request does
+void BM_RequestInPlace(benchmark::State& state) {
+    std::string raw = make_request(state.range(0), state.range(1));
+    HttpRequestParser parser;
+    parser.parse(raw);
+    for (auto _ : state) {
+        Request request(raw, parser);
+        benchmark::DoNotOptimize(request.header_view("host"));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw.size()));
+}
+BENCHMARK(BM_RequestInPlace)->Apply(request_shapes);
+
+// Rewriting the head with every option on and turning it into the iovec list that is sent
+void BM_RewrittenHead(benchmark::State& state) {
+    std::string raw = make_request(state.range(0), state.range(1));
+    HttpRequestParser parser;
+    parser.parse(raw);
+    HeaderRewriteOptions options;
+    options.forwarded_for = true;
+    options.request_id = true;
+    options.host = "backend.internal:8080";
+    options.strip_hop_by_hop = true;
+    RewrittenHead rewritten;
+    struct iovec iov[RewrittenHead::MAX_SEGMENTS];
+    for (auto _ : state) {
+        rewritten.build(raw, parser, "192.168.1.20:51234", options);
+        benchmark::DoNotOptimize(rewritten.to_iov(raw.data(), 0, iov, RewrittenHead::MAX_SEGMENTS));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw.size()));
+}
+BENCHMARK(BM_RewrittenHead)->Apply(request_shapes);
+
+Response make_response(size_t body_size) {
+    Response response(200);
+    response.add_header("Content-Type", "text/plain");
+    response.add_header("Cache-Control", "max-age=60");
+    response.add_header("Connection", "keep-alive");
+    response.set_body(std::string(body_size, 'x'));
+    return response;
+}
+
+void BM_ResponseBuild(benchmark::State& state) {
+    for (auto _ : state) {
+        Response response = make_response(state.range(0));
+        benchmark::DoNotOptimize(response.build_response());
+    }
+}
+BENCHMARK(BM_ResponseBuild)->ArgName("body")->Arg(0)->Arg(1024)->Arg(64 * 1024);
+
+// Serializing an already built response into a reused buffer, without the string
+void BM_ResponseWriteTo(benchmark::State& state) {
+    Response response = make_response(state.range(0));
+    std::vector<char> buffer(response.serialized_size());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(response.write_to(buffer.data(), buffer.size()));
+    }
+}
+BENCHMARK(BM_ResponseWriteTo)->ArgName("body")->Arg(0)->Arg(1024)->Arg(64 * 1024);
+
+// One LoadBalancer per algorithm, shared by every benchmark thread. Health checks are stopped:
+// the backends do not exist, and probes must not mark them down mid-run.
+LoadBalancer& shared_load_balancer(BalancingAlgorithm algorithm) {
+    static std::mutex mutex;
+    static std::map<BalancingAlgorithm, std::unique_ptr<LoadBalancer>> balancers;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<LoadBalancer>& balancer = balancers[algorithm];
+    if (!balancer) {
+        LoadBalancerOptions options;
+        options.balancing = algorithm;
+        std::vector<std::string> addresses;
+        for (int i = 0; i < 8; ++i) {
+            addresses.push_back("10.0.0." + std::to_string(i + 1) + ":80");
+        }
+        balancer.reset(new LoadBalancer(addresses, options));
+        balancer->stop_health_check();
+    }
+    return *balancer;
+}
+
+const char* const ALGORITHM_NAMES[] = {"round_robin", "least_conn", "p2c", "random", "ring_hash", "maglev"};
+
+// Pick and release a backend, as every proxied request does, from 1 to 64 threads at once
+void BM_GetNextBackend(benchmark::State& state) {
+    BalancingAlgorithm algorithm = static_cast<BalancingAlgorithm>(state.range(0));
+    LoadBalancer& balancer = shared_load_balancer(algorithm);
+    state.SetLabel(ALGORITHM_NAMES[state.range(0)]);
+    uint64_t hash = 0x9e3779b97f4a7c15ULL * (state.thread_index() + 1);
+    for (auto _ : state) {
+        hash = hash * 6364136223846793005ULL + 1442695040888963407ULL; // Distinct routing keys
+        Backend& backend = balancer.get_next_backend(hash);
+        balancer.release_backend(backend, RequestOutcome::SUCCESS);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetNextBackend)
+    ->ArgName("algorithm")
+    ->DenseRange(static_cast<int>(BalancingAlgorithm::ROUND_ROBIN), static_cast<int>(BalancingAlgorithm::MAGLEV))
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+const size_t POOL_THREADS = 4;
+
+ThreadPool& shared_thread_pool() {
+    static ThreadPool pool(POOL_THREADS);
+    return pool;
+}
+
+// Tasks handed to the pool per second from 1 to 8 producers; the queue is bounded,
+// so once it is full this is as fast as the workers drain it
+void BM_ThreadPoolEnqueue(benchmark::State& state) {
+    ThreadPool& pool = shared_thread_pool();
+    static std::atomic<uint64_t> executed{0};
+    uint64_t enqueued = 0;
+    for (auto _ : state) {
+        pool.enqueue_task([] { executed.fetch_add(1, std::memory_order_relaxed); });
+        ++enqueued;
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(enqueued));
+}
+BENCHMARK(BM_ThreadPoolEnqueue)->ThreadRange(1, 8)->UseRealTime();
+
+// Time from enqueue_task until a worker runs the task
+void BM_ThreadPoolLatency(benchmark::State& state) {
+    ThreadPool& pool = shared_thread_pool();
+    std::atomic<bool> done{false};
+    for (auto _ : state) {
+        done.store(false, std::memory_order_relaxed);
+        pool.enqueue_task([&done] { done.store(true, std::memory_order_release); });
+        while (!done.load(std::memory_order_acquire)) {
+            std::this_thread::yield(); // Leaves the CPU to the worker on small machines
+        }
+    }
+}
+BENCHMARK(BM_ThreadPoolLatency)->UseRealTime();
+
+// The access log on, written to /dev/null; configured once, before any benchmark thread logs
+void enable_access_log() {
+    static bool configured = [] {
+        LogOptions options;
+        options.level = LogLevel::ERROR;
+        options.access_log = "/dev/null";
+        return Logger::instance().configure(options);
+    }();
+    benchmark::DoNotOptimize(configured);
+}
+
+AccessLogEntry sample_access() {
+    AccessLogEntry access;
+    access.client = "127.0.0.1:51234";
+    access.method = "GET";
+    access.path = "/api/v1/items";
+    access.status = 200;
+    access.response_bytes = 151;
+    access.backend = "127.0.0.1:9001";
+    access.started = std::chrono::steady_clock::now();
+    return access;
+}
+
+// One access-log line from 1 to 8 threads at once, as reactors and pool workers write them
+void BM_AccessLog(benchmark::State& state) {
+    enable_access_log();
+    AccessLogEntry access = sample_access();
+    for (auto _ : state) {
+        Logger::instance().log_access(access);
+    }
+}
+BENCHMARK(BM_AccessLog)->ThreadRange(1, 8)->UseRealTime();
+
+// A thread that writes one line and exits, as each connection's thread does in load_balancer mode;
+// BM_ThreadOnly is the cost of the thread alone
+void BM_AccessLogNewThread(benchmark::State& state) {
+    enable_access_log();
+    AccessLogEntry access = sample_access();
+    for (auto _ : state) {
+        std::thread([&access] { Logger::instance().log_access(access); }).join();
+    }
+}
+BENCHMARK(BM_AccessLogNewThread)->UseRealTime();
+
+void BM_ThreadOnly(benchmark::State& state) {
+    for (auto _ : state) {
+        std::thread([] {}).join();
+    }
+}
+BENCHMARK(BM_ThreadOnly)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,415 @@
+#include "load_generator.h"
+#include "core/http_framing.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const size_t RECEIVE_CHUNK = 64 * 1024;
+const int MAX_WAIT_MS = 100; // Also how often requests are checked for timeouts
+
+struct BenchConnection {
+    enum class State { IDLE, CONNECTING, SENDING, RECEIVING };
+
+    int fd = -1;
+    State state = State::IDLE;
+    size_t sent = 0;
+    Clock::time_point due;     // When the request was meant to be sent (latency is measured from here)
+    Clock::time_point started; // When it actually was, for the timeout
+    std::string head_buffer;   // Response bytes until the head is complete
+    bool have_head = false;
+    MessageHead head;
+    BodyFramer body{MessageHead()};
+    size_t response_size = 0;
+};
+
+// One thread's share of the connections, driven by its own epoll instance
+class LoadWorker {
+public:
+    LoadWorker(const LoadOptions& options, const sockaddr_in& address, size_t connection_count, double rate,
+               Clock::time_point start, Histogram& latency)
+        : options(options), address(address), connections(connection_count), latency(latency),
+          start(start), measure_start(start + options.warmup), end(measure_start + options.duration),
+          next_due(start) {
+        request = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + ":" + std::to_string(options.port) +
+                  "\r\nUser-Agent: crabby_bench\r\n";
+        if (!options.keep_alive) {
+            request += "Connection: close\r\n";
+        }
+        request += "\r\n";
+        if (rate > 0) {
+            interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+        }
+    }
+
+    ~LoadWorker() {
+        for (BenchConnection& conn : connections) {
+            if (conn.fd >= 0) {
+                close(conn.fd);
+            }
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    void run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            result.errors += connections.size();
+            return;
+        }
+
+        std::this_thread::sleep_until(start);
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (open_loop()) {
+                idle.push_back(i);
+            } else {
+                start_request(i, start);
+            }
+        }
+
+        std::vector<epoll_event> events(connections.size() + 1);
+        auto last_timeout_check = start;
+        while (true) {
+            auto now = Clock::now();
+            if (now >= end) {
+                break;
+            }
+            if (open_loop()) {
+                issue_due_requests(now);
+            } else {
+                restart_failed(now);
+            }
+
+            auto wait = std::min<Clock::duration>(end - now, std::chrono::milliseconds(MAX_WAIT_MS));
+            if (open_loop() && !idle.empty()) {
+                wait = std::min<Clock::duration>(wait, next_due - now);
+            }
+            int wait_ms = static_cast<int>(
+                std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count()));
+
+            int count = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), wait_ms);
+            for (int i = 0; i < count; ++i) {
+                size_t index = events[i].data.u64;
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                    on_writable(index);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    on_readable(index);
+                }
+            }
+
+            now = Clock::now();
+            if (now - last_timeout_check >= std::chrono::milliseconds(MAX_WAIT_MS)) {
+                expire_requests(now);
+                last_timeout_check = now;
+            }
+        }
+
+        // Due in the window, but never sent because every connection was busy
+        if (open_loop() && next_due < end) {
+            auto from = std::max(next_due, measure_start);
+            result.late = static_cast<uint64_t>((end - from) / interval);
+        }
+    }
+
+    struct Result {
+        uint64_t requests = 0;
+        uint64_t non_2xx = 0;
+        uint64_t errors = 0;
+        uint64_t bytes = 0;
+        uint64_t connects = 0;
+        uint64_t late = 0;
+    };
+    const Result& results() const { return result; }
+
+private:
+    const LoadOptions& options;
+    sockaddr_in address;
+    std::vector<BenchConnection> connections;
+    std::vector<size_t> idle; // Connections free to send the next due request (closed loop: after a failure)
+    Histogram& latency;
+    std::string request;
+    int epoll_fd = -1;
+
+    Clock::time_point start;
+    Clock::time_point measure_start;
+    Clock::time_point end;
+    Clock::duration interval{0};
+    Clock::time_point next_due;
+    Result result;
+
+    bool open_loop() const { return interval.count() > 0; }
+
+    bool measured(const BenchConnection& conn) const { return conn.due >= measure_start; }
+
+    // Hand every request due by now to a free connection; the rest wait, and their latency grows
+    void issue_due_requests(Clock::time_point now) {
+        while (next_due <= now && !idle.empty()) {
+            size_t index = idle.back();
+            idle.pop_back();
+            start_request(index, next_due);
+            next_due += interval;
+        }
+    }
+
+    // Closed loop: connections whose last request failed start again once per loop iteration,
+    // so a refused connection does not spin
+    void restart_failed(Clock::time_point now) {
+        std::vector<size_t> failed;
+        failed.swap(idle);
+        for (size_t index : failed) {
+            start_request(index, now);
+        }
+    }
+
+    void start_request(size_t index, Clock::time_point due) {
+        BenchConnection& conn = connections[index];
+        conn.due = due;
+        conn.started = Clock::now();
+        conn.sent = 0;
+        conn.head_buffer.clear();
+        conn.have_head = false;
+        conn.response_size = 0;
+
+        if (conn.fd >= 0) {
+            conn.state = BenchConnection::State::SENDING;
+            send_request(index);
+            return;
+        }
+
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0) {
+            fail(index);
+            return;
+        }
+        int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        // Edge-triggered on both directions: the state says which one matters
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.u64 = index;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn.fd, &event);
+        ++result.connects;
+
+        if (connect(conn.fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0) {
+            conn.state = BenchConnection::State::SENDING;
+            send_request(index);
+        } else if (errno == EINPROGRESS) {
+            conn.state = BenchConnection::State::CONNECTING;
+        } else {
+            fail(index);
+        }
+    }
+
+    void on_writable(size_t index) {
+        BenchConnection& conn = connections[index];
+        if (conn.state == BenchConnection::State::CONNECTING) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                fail(index);
+                return;
+            }
+            conn.state = BenchConnection::State::SENDING;
+        }
+        if (conn.state == BenchConnection::State::SENDING) {
+            send_request(index);
+        }
+    }
+
+    void send_request(size_t index) {
+        BenchConnection& conn = connections[index];
+        while (conn.sent < request.size()) {
+            ssize_t sent = send(conn.fd, request.data() + conn.sent, request.size() - conn.sent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fail(index);
+                }
+                return; // The next writable edge resumes it
+            }
+            conn.sent += static_cast<size_t>(sent);
+        }
+        conn.state = BenchConnection::State::RECEIVING; // The response arrives with a new readable edge
+    }
+
+    void on_readable(size_t index) {
+        char chunk[RECEIVE_CHUNK];
+        while (connections[index].state == BenchConnection::State::RECEIVING) {
+            BenchConnection& conn = connections[index];
+            ssize_t received = recv(conn.fd, chunk, sizeof(chunk), 0);
+            if (received < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    fail(index);
+                }
+                return;
+            }
+            if (received == 0) {
+                // A body delimited by the close ends here; anything else was cut short
+                if (conn.have_head && conn.head.framing == BodyFraming::UNTIL_CLOSE) {
+                    finish(index);
+                } else {
+                    fail(index);
+                }
+                return;
+            }
+            if (!consume_response(conn, chunk, static_cast<size_t>(received))) {
+                fail(index);
+                return;
+            }
+            if (conn.have_head && conn.body.complete()) {
+                finish(index);
+            }
+        }
+    }
+
+    // Follow the framing of the response; false if it is malformed
+    bool consume_response(BenchConnection& conn, const char* data, size_t length) {
+        if (conn.have_head) {
+            conn.response_size += conn.body.consume(data, length);
+            return !conn.body.failed();
+        }
+
+        conn.head_buffer.append(data, length);
+        while (parse_response_head(conn.head_buffer.data(), conn.head_buffer.size(), false, conn.head)) {
+            if (!is_interim_response(conn.head)) {
+                conn.have_head = true;
+                conn.body = BodyFramer(conn.head);
+                size_t header_length = conn.head.header_length;
+                conn.response_size = header_length + conn.body.consume(conn.head_buffer.data() + header_length,
+                                                                       conn.head_buffer.size() - header_length);
+                conn.head_buffer.clear();
+                return !conn.body.failed();
+            }
+            conn.head_buffer.erase(0, conn.head.header_length);
+        }
+        return conn.head_buffer.size() <= RECEIVE_CHUNK;
+    }
+
+    void finish(size_t index) {
+        BenchConnection& conn = connections[index];
+        auto now = Clock::now();
+        if (measured(conn) && now <= end) {
+            latency.record(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(now - conn.due).count()));
+            ++result.requests;
+            result.bytes += conn.response_size;
+            if (conn.head.status_code < 200 || conn.head.status_code >= 400) {
+                ++result.non_2xx;
+            }
+        }
+
+        if (!options.keep_alive || !conn.head.keep_alive || conn.head.framing == BodyFraming::UNTIL_CLOSE) {
+            close_socket(conn);
+        }
+        conn.state = BenchConnection::State::IDLE;
+        next_request(index, now);
+    }
+
+    void fail(size_t index) {
+        BenchConnection& conn = connections[index];
+        if (measured(conn)) {
+            ++result.errors;
+        }
+        close_socket(conn);
+        conn.state = BenchConnection::State::IDLE;
+        idle.push_back(index); // Restarted from the loop, never from inside the failed call
+    }
+
+    void next_request(size_t index, Clock::time_point now) {
+        if (open_loop()) {
+            idle.push_back(index);
+            issue_due_requests(now);
+        } else if (now < end) {
+            start_request(index, now);
+        }
+    }
+
+    void expire_requests(Clock::time_point now) {
+        for (size_t i = 0; i < connections.size(); ++i) {
+            if (connections[i].state != BenchConnection::State::IDLE && now - connections[i].started > options.timeout) {
+                fail(i);
+            }
+        }
+    }
+
+    void close_socket(BenchConnection& conn) {
+        if (conn.fd >= 0) {
+            close(conn.fd); // Also removes it from the epoll set
+            conn.fd = -1;
+        }
+    }
+};
+
+bool resolve(const std::string& host, int port, sockaddr_in& address) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0 || found == nullptr) {
+        return false;
+    }
+    address = *reinterpret_cast<sockaddr_in*>(found->ai_addr);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    freeaddrinfo(found);
+    return true;
+}
+
+} // namespace
+
+LoadResult run_load(const LoadOptions& options) {
+    LoadResult result;
+    sockaddr_in address{};
+    if (!resolve(options.host, options.port, address)) {
+        result.errors = 1;
+        return result;
+    }
+
+    size_t threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+    std::unique_ptr<Histogram> latency(new Histogram());
+
+    // Every worker starts from the same instant, so their open-loop schedules line up
+    auto start = Clock::now() + std::chrono::milliseconds(50);
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        size_t share = options.connections / threads + (i < options.connections % threads ? 1 : 0);
+        workers.emplace_back(new LoadWorker(options, address, share, options.rate / threads, start, *latency));
+    }
+
+    std::vector<std::thread> running;
+    for (auto& worker : workers) {
+        running.emplace_back(&LoadWorker::run, worker.get());
+    }
+    for (std::thread& thread : running) {
+        thread.join();
+    }
+
+    for (const auto& worker : workers) {
+        const LoadWorker::Result& part = worker->results();
+        result.requests += part.requests;
+        result.non_2xx += part.non_2xx;
+        result.errors += part.errors;
+        result.bytes += part.bytes;
+        result.connects += part.connects;
+        result.late += part.late;
+    }
+    result.seconds = std::chrono::duration<double>(options.duration).count();
+    result.latency = latency->snapshot();
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include "core/metrics.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::string path = "/";
+    size_t connections = 64;  // Spread evenly over the threads
+    size_t threads = 4;
+    std::chrono::milliseconds duration{10000};
+    std::chrono::milliseconds warmup{1000};    // Run before measuring, to fill pools and caches
+    std::chrono::milliseconds timeout{10000};  // A request unanswered for this long is an error
+
+    // 0: closed loop, every connection sends its next request as soon as the previous one is answered.
+    // Otherwise: open loop at this many requests per second, whatever the server's pace.
+    double rate = 0;
+
+    bool keep_alive = true; // Otherwise every request opens a new connection
+};
+
+struct LoadResult {
+    uint64_t requests = 0;     // Answered during the measured window
+    uint64_t non_2xx = 0;      // Of those, answered with a status other than 2xx/3xx
+    uint64_t errors = 0;       // Connection failures, resets, malformed responses and timeouts
+    uint64_t bytes = 0;        // Response bytes received
+    uint64_t connects = 0;     // Connections opened
+    uint64_t late = 0;         // Open loop: due in the window but never sent, every connection being busy
+    double seconds = 0;        // Length of the measured window
+
+    // Microseconds from the time each request was due to the end of its response. In open loop,
+    // a request waiting for a free connection is late from the start, so stalls are not hidden
+    // (coordinated omission).
+    Histogram::Snapshot latency;
+
+    double requests_per_second() const { return seconds > 0 ? requests / seconds : 0; }
+};
+
+// Drive HTTP/1.1 GET load against host:port and measure it; blocks for warmup + duration
+LoadResult run_load(const LoadOptions& options);
+
+#endif
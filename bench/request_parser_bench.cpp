@@ -0,0 +1,155 @@
+// Microbenchmarks for request parsing: the original istringstream/std::map parser
+// versus HttpRequestParser and the Request class built on top of it.
+//
+// Usage: ./bin/request_parser_bench [iterations]
+
+#include "core/http_parser.h"
+#include "core/request.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The Request parser as it was before HttpRequestParser, kept here as the baseline
+class LegacyRequest {
+public:
+    explicit LegacyRequest(const std::string& raw_request) : raw_request(raw_request) {
+        std::istringstream request_stream(raw_request);
+        std::string request_line;
+        getline(request_stream, request_line);
+
+        std::istringstream request_line_stream(request_line);
+        request_line_stream >> method >> path;
+
+        size_t query_pos = path.find('?');
+        if (query_pos != std::string::npos) {
+            std::string query_string = path.substr(query_pos + 1);
+            path = path.substr(0, query_pos);
+            parse_query_params(query_string);
+        }
+
+        std::string header_lines;
+        while (getline(request_stream, header_lines) && header_lines != "\r") {
+            parse_headers(header_lines);
+        }
+    }
+
+    std::string get_header(const std::string& key) const {
+        std::string lower_key = key;
+        std::transform(lower_key.begin(), lower_key.end(), lower_key.begin(), ::tolower);
+        auto it = headers.find(lower_key);
+        return it != headers.end() ? it->second : "";
+    }
+
+private:
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> headers;
+    std::map<std::string, std::string> query_params;
+    std::string raw_request;
+
+    void parse_headers(const std::string& header_lines) {
+        size_t colon_pos = header_lines.find(':');
+        if (colon_pos != std::string::npos) {
+            std::string key = header_lines.substr(0, colon_pos);
+            std::string value = header_lines.substr(colon_pos + 2);
+            std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+            headers[key] = value;
+        }
+    }
+
+    void parse_query_params(const std::string& query_string) {
+        std::istringstream query_stream(query_string);
+        std::string query_param;
+        while (getline(query_stream, query_param, '&')) {
+            size_t equal_pos = query_param.find('=');
+            if (equal_pos != std::string::npos) {
+                query_params[query_param.substr(0, equal_pos)] = query_param.substr(equal_pos + 1);
+            }
+        }
+    }
+};
+
+// Build a GET request with the given number of extra headers and header value size
+std::string make_request(size_t header_count, size_t value_size) {
+    std::string request = "GET /api/v1/items?id=42&sort=desc&page=3 HTTP/1.1\r\nHost: localhost:8080\r\n";
+    for (size_t i = 0; i < header_count; ++i) {
+        request += "X-Custom-Header-" + std::to_string(i) + ": " + std::string(value_size, 'v') + "\r\n";
+    }
+    request += "\r\n";
+    return request;
+}
+
+// Keep the optimizer from discarding benchmark results
+volatile size_t sink = 0;
+
+template <typename Fn>
+double nanoseconds_per_op(size_t iterations, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+
+    struct Scenario {
+        const char* name;
+        size_t header_count;
+        size_t value_size;
+    };
+    const std::vector<Scenario> scenarios = {
+        {"small (2 headers)", 2, 16},
+        {"typical (10 headers)", 10, 32},
+        {"large (40 headers)", 40, 64},
+    };
+
+    std::cout << std::left << std::setw(24) << "scenario"
+              << std::right << std::setw(16) << "legacy ns/op"
+              << std::setw(16) << "parser ns/op"
+              << std::setw(16) << "Request ns/op"
+              << std::setw(12) << "speedup" << "\n";
+
+    for (const Scenario& scenario : scenarios) {
+        std::string raw = make_request(scenario.header_count, scenario.value_size);
+
+        double legacy = nanoseconds_per_op(iterations, [&] {
+            LegacyRequest request(raw);
+            sink += request.get_header("host").size();
+        });
+
+        // The parser works directly on the receive buffer
+        HttpRequestParser parser;
+        double parsed = nanoseconds_per_op(iterations, [&] {
+            parser.reset();
+            parser.parse(raw);
+            sink += parser.get_header("host").size();
+        });
+
+        // Request still owns a copy of the raw bytes
+        double request_time = nanoseconds_per_op(iterations, [&] {
+            Request request(raw);
+            sink += request.header_view("host").size();
+        });
+
+        std::cout << std::left << std::setw(24) << scenario.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(16) << legacy
+                  << std::setw(16) << parsed
+                  << std::setw(16) << request_time
+                  << std::setw(11) << legacy / parsed << "x\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,340 @@
+#include "stub_backend.h"
+#include "core/http_framing.h"
+#include "core/http_parser.h"
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const size_t MAX_BODY_BYTES = 64 * 1024 * 1024;
+const size_t RECEIVE_CHUNK = 64 * 1024;
+
+struct StubConnection {
+    uint64_t id = 0;
+    int fd = -1;
+    std::string in;
+    HttpRequestParser parser;
+    bool have_head = false;
+    BodyFramer body{MessageHead()};
+    size_t request_length = 0; // Bytes of in framed as the current request
+    bool delayed = false;      // A /delay response is waiting for its timer
+    std::string delayed_response;
+    std::string out;
+    size_t out_sent = 0;
+    bool close_after = false;  // Close once out has been sent
+};
+
+struct Timer {
+    Clock::time_point at;
+    uint64_t connection_id;
+    int fd;
+    bool operator>(const Timer& other) const { return at > other.at; }
+};
+
+std::string make_response(int status, const char* reason, const std::string& body, bool keep_alive) {
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + reason +
+                           "\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    if (!keep_alive) {
+        response += "Connection: close\r\n";
+    }
+    response += "\r\n";
+    response += body;
+    return response;
+}
+
+const char* reason_phrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 404: return "Not Found";
+        case 500: return "Internal Server Error";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return "Status";
+    }
+}
+
+// Number following a path prefix ("/bytes/1024" -> 1024); false if the path does not start with it
+bool path_number(std::string_view path, std::string_view prefix, size_t& number) {
+    if (path.substr(0, prefix.size()) != prefix) {
+        return false;
+    }
+    number = std::strtoul(std::string(path.substr(prefix.size())).c_str(), nullptr, 10);
+    return true;
+}
+
+class StubWorker {
+public:
+    StubWorker(const StubOptions& options, int listen_socket)
+        : options(options), listen_socket(listen_socket), hello("Hello from " + options.name),
+          random(std::random_device()()) {}
+
+    void run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        watch(listen_socket, EPOLLIN);
+
+        std::vector<epoll_event> events(256);
+        while (true) {
+            int wait_ms = -1;
+            if (!timers.empty()) {
+                auto until = std::chrono::ceil<std::chrono::milliseconds>(timers.top().at - Clock::now()).count();
+                wait_ms = static_cast<int>(std::max<int64_t>(0, until));
+            }
+            int count = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), wait_ms);
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listen_socket) {
+                    accept_connections();
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                StubConnection& conn = *it->second;
+                if (events[i].events & EPOLLOUT) {
+                    if (flush(conn)) {
+                        serve(conn); // Pipelined requests waited for the response to go out
+                    }
+                } else if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    receive(conn);
+                }
+            }
+            run_timers();
+        }
+    }
+
+private:
+    const StubOptions& options;
+    int listen_socket;
+    int epoll_fd = -1;
+    std::string hello;
+    std::minstd_rand random;
+    std::unordered_map<int, std::unique_ptr<StubConnection>> connections;
+    uint64_t last_connection_id = 0;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    void watch(int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void rewatch(int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    void accept_connections() {
+        while (true) {
+            int fd = accept4(listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::unique_ptr<StubConnection> conn(new StubConnection());
+            conn->id = ++last_connection_id;
+            conn->fd = fd;
+            connections[fd] = std::move(conn);
+            watch(fd, EPOLLIN);
+        }
+    }
+
+    void receive(StubConnection& conn) {
+        char chunk[RECEIVE_CHUNK];
+        ssize_t received = recv(conn.fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_connection(conn);
+            }
+            return;
+        }
+        conn.in.append(chunk, static_cast<size_t>(received));
+        serve(conn);
+    }
+
+    // Answer the buffered requests in order, one at a time
+    void serve(StubConnection& conn) {
+        while (!conn.delayed && conn.out_sent == conn.out.size()) {
+            if (!conn.have_head) {
+                ParseStatus status = conn.parser.parse(conn.in);
+                if (status == ParseStatus::INCOMPLETE) {
+                    return;
+                }
+                if (status == ParseStatus::ERROR) {
+                    close_connection(conn);
+                    return;
+                }
+                conn.have_head = true;
+                conn.body = BodyFramer(conn.parser.head());
+                conn.request_length = conn.parser.head().header_length;
+            }
+
+            // Bodies are read and ignored
+            size_t scanned = conn.request_length;
+            conn.request_length += conn.body.consume(conn.in.data() + scanned, conn.in.size() - scanned);
+            if (conn.body.failed()) {
+                close_connection(conn);
+                return;
+            }
+            if (!conn.body.complete()) {
+                return;
+            }
+
+            bool keep_alive = conn.parser.head().keep_alive;
+            respond(conn, keep_alive);
+            conn.in.erase(0, conn.request_length);
+            conn.parser.reset();
+            conn.have_head = false;
+            conn.request_length = 0;
+
+            if (!conn.delayed && !flush(conn)) {
+                return; // Closed
+            }
+        }
+    }
+
+    void respond(StubConnection& conn, bool keep_alive) {
+        std::string_view path = conn.parser.path();
+        conn.close_after = !keep_alive;
+        conn.out.clear();
+        conn.out_sent = 0;
+
+        size_t number = 0;
+        if (path == "/health") {
+            conn.out = make_response(200, "OK", "OK", keep_alive);
+        } else if (path_number(path, "/bytes/", number)) {
+            conn.out = make_response(200, "OK", std::string(std::min(number, MAX_BODY_BYTES), 'x'), keep_alive);
+        } else if (path_number(path, "/status/", number)) {
+            int status = static_cast<int>(number);
+            conn.out = make_response(status, reason_phrase(status), hello, keep_alive);
+        } else if (path == "/flaky" && std::uniform_real_distribution<double>(0, 1)(random) < options.fail_rate) {
+            conn.out = make_response(503, "Service Unavailable", hello, keep_alive);
+        } else if (path_number(path, "/delay/", number)) {
+            conn.delayed = true;
+            conn.delayed_response = make_response(200, "OK", hello, keep_alive);
+            timers.push(Timer{Clock::now() + std::chrono::milliseconds(number), conn.id, conn.fd});
+        } else {
+            conn.out = make_response(200, "OK", hello, keep_alive);
+        }
+    }
+
+    void run_timers() {
+        auto now = Clock::now();
+        while (!timers.empty() && timers.top().at <= now) {
+            Timer timer = timers.top();
+            timers.pop();
+            auto it = connections.find(timer.fd);
+            if (it == connections.end() || it->second->id != timer.connection_id) {
+                continue; // The connection closed meanwhile
+            }
+            StubConnection& conn = *it->second;
+            conn.delayed = false;
+            conn.out.swap(conn.delayed_response);
+            conn.out_sent = 0;
+            if (flush(conn)) {
+                serve(conn);
+            }
+        }
+    }
+
+    // Send what is pending; false if the connection was closed
+    bool flush(StubConnection& conn) {
+        while (conn.out_sent < conn.out.size()) {
+            ssize_t sent = send(conn.fd, conn.out.data() + conn.out_sent, conn.out.size() - conn.out_sent,
+                                MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    rewatch(conn.fd, EPOLLOUT);
+                    return true;
+                }
+                close_connection(conn);
+                return false;
+            }
+            conn.out_sent += static_cast<size_t>(sent);
+        }
+
+        conn.out.clear();
+        conn.out_sent = 0;
+        if (conn.close_after) {
+            close_connection(conn);
+            return false;
+        }
+        rewatch(conn.fd, EPOLLIN);
+        return true;
+    }
+
+    void close_connection(StubConnection& conn) {
+        int fd = conn.fd;
+        close(fd);
+        connections.erase(fd);
+    }
+};
+
+int open_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 1024) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int run_stub_backend(const StubOptions& options) {
+    std::vector<int> listeners;
+    for (size_t i = 0; i < std::max<size_t>(1, options.threads); ++i) {
+        int fd = open_listener(options.port);
+        if (fd < 0) {
+            std::cerr << "Stub backend " << options.name << ": cannot listen on port " << options.port << ": "
+                      << strerror(errno) << "\n";
+            return 1;
+        }
+        listeners.push_back(fd);
+    }
+
+    std::vector<std::unique_ptr<StubWorker>> workers;
+    std::vector<std::thread> threads;
+    for (int fd : listeners) {
+        workers.emplace_back(new StubWorker(options, fd));
+    }
+    for (auto& worker : workers) {
+        threads.emplace_back(&StubWorker::run, worker.get());
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef STUB_BACKEND_H
+#define STUB_BACKEND_H
+
+#include <cstddef>
+#include <string>
+
+// Minimal HTTP/1.1 backend for benchmarks, fast enough that the proxy is what gets measured.
+// Each thread runs its own epoll loop on its own SO_REUSEPORT listener. Pages:
+//   /health          200 "OK"
+//   /bytes/N         200 with an N-byte body
+//   /delay/MS        200 "Hello from NAME" after MS milliseconds (without holding up other requests)
+//   /status/N        status N
+//   /flaky           503 for a fail_rate fraction of the requests, 200 otherwise
+//   anything else    200 "Hello from NAME"
+struct StubOptions {
+    int port = 9081;
+    std::string name = "B1";
+    size_t threads = 2;
+    double fail_rate = 0; // Of /flaky requests answered with 503
+};
+
+// Serve until the process is killed; returns 1 if the backend cannot start
+int run_stub_backend(const StubOptions& options);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <array>
+#include "core/metrics.h"
+
+// How a request routed to a backend ended, as seen by the proxy
+enum class RequestOutcome {
+    SUCCESS,            // Response with a status below 500
+    SERVER_ERROR,       // 5xx response
+    CONNECTION_FAILURE, // Connect error, or the backend closed/reset the connection without responding
+    TIMEOUT,            // The backend did not respond in time
+    ABORTED             // Says nothing about the backend (e.g. the client went away first)
+};
+constexpr size_t REQUEST_OUTCOMES = 5;
+
+// SUCCESS or SERVER_ERROR, depending on a response's status code
+inline RequestOutcome outcome_for_status(int status_code) {
+    return status_code >= 500 ? RequestOutcome::SERVER_ERROR : RequestOutcome::SUCCESS;
+}
+
+// How long the phases of one request to a backend took; zero for phases that did not happen
+struct BackendTiming {
+    std::chrono::microseconds connect{0};    // Opening a new connection (pooled ones cost nothing)
+    std::chrono::microseconds first_byte{0}; // From sending the request to the response head
+    std::chrono::microseconds total{0};      // From picking the backend to releasing it
+};
+
+// Traffic statistics of a backend, recorded when a request releases it
+struct BackendMetrics {
+    std::array<Counter, REQUEST_OUTCOMES> requests; // Indexed by RequestOutcome
+    Histogram connect_time;
+    Histogram first_byte_time;
+    Histogram total_time;
+};
+
+// A backend server and the live counters the balancing strategies read.
+// Aligned to a cache line so counters of neighbouring backends don't false-share.
+struct alignas(64) Backend {
+    std::string address;  // IP:PORT of the backend server
+    unsigned int weight;  // Relative share of traffic (weighted strategies only)
+    std::atomic<int> active_connections{0}; // Requests routed to the backend and not yet released
+    std::atomic<bool> is_alive{true};       // Cleared while the backend is failing health checks
+    std::atomic<bool> retired{false};       // Removed by a reload: requests in flight finish, no connection is pooled
+
+    // Passive outlier detection state, maintained by OutlierDetector from live traffic
+    std::atomic<int64_t> ejected_until{0}; // steady_clock nanoseconds; 0 if never ejected or fully recovered
+    std::atomic<unsigned int> ejection_level{0}; // Each ejection lasts twice as long as the previous one
+    std::atomic<unsigned int> consecutive_server_errors{0};
+    std::atomic<unsigned int> consecutive_connection_failures{0};
+    std::atomic<uint64_t> latency_ewma_us{0}; // Smoothed time to first response byte
+    std::atomic<uint64_t> latency_samples{0};
+
+    BackendMetrics metrics;
+
+    // How long a request waits for its first byte before it is hedged: a quantile of the recent
+    // first_byte_time samples, refreshed by LoadBalancer::hedge_delay(); 0 until enough were seen
+    std::atomic<uint64_t> hedge_delay_us{0};
+    std::atomic<int64_t> hedge_delay_refreshed{0}; // steady_clock nanoseconds
+    std::atomic<bool> hedge_delay_refreshing{false}; // Held by the one thread recomputing the delay
+    Histogram::Snapshot hedge_delay_baseline;        // first_byte_time when the delay was last recomputed
+
+    Backend(const std::string& address, unsigned int weight) : address(address), weight(weight) {}
+
+    // Alive and not ejected. Ejections expire on their own; the clock is only read while one is recorded.
+    bool is_available() const {
+        if (!is_alive.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        int64_t until = ejected_until.load(std::memory_order_relaxed);
+        return until == 0 || std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch()).count() >= until;
+    }
+};
+
+// Immutable snapshot of the backend list. The selection path reads it without locks;
+// it is replaced as a whole, never modified in place.
+struct BackendSet {
+    std::vector<std::shared_ptr<Backend>> backends;
+    std::vector<uint32_t> schedule;           // Smooth weighted round-robin order (indices into backends)
+    std::vector<uint64_t> cumulative_weights; // Running weight totals, for weighted random picks
+    uint64_t total_weight = 0;
+
+    explicit BackendSet(std::vector<std::shared_ptr<Backend>> backends);
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef BALANCING_STRATEGY_H
+#define BALANCING_STRATEGY_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "core/backend.h"
+#include "core/read_section.h"
+
+// Backend selection algorithms
+enum class BalancingAlgorithm {
+    ROUND_ROBIN,       // Weighted round-robin
+    LEAST_CONNECTIONS, // Fewest active connections relative to weight
+    POWER_OF_TWO,      // Better of two random picks (P2C), relative to weight
+    RANDOM,            // Weighted random
+    RING_HASH,         // Consistent hashing of the request's routing key on a ring (ketama)
+    MAGLEV             // Consistent hashing of the request's routing key through a Maglev table
+};
+
+// Parse "round_robin", "least_conn", "p2c", "random", "ring_hash" or "maglev"
+bool parse_balancing_algorithm(const std::string& name, BalancingAlgorithm& algorithm);
+
+// Strategies that route on a hash of the request instead of spreading requests
+inline bool is_hash_based(BalancingAlgorithm algorithm) {
+    return algorithm == BalancingAlgorithm::RING_HASH || algorithm == BalancingAlgorithm::MAGLEV;
+}
+
+// Picks a backend for each request. Implementations are called concurrently from every
+// worker thread and must not lock: shared state is limited to relaxed atomics.
+class BalancingStrategy {
+public:
+    virtual ~BalancingStrategy() = default;
+
+    // Choose an available backend (alive, not ejected) from the snapshot, or nullptr if there is none.
+    // request_hash is the hash of the request's routing key (0 if it has none); only hash-based
+    // strategies use it.
+    virtual Backend* select(const BackendSet& backends, uint64_t request_hash) = 0;
+
+    // Free what was derived from a replaced snapshot, once no reader can still be selecting from it
+    virtual void forget(const BackendSet&) {}
+};
+
+// balance_factor bounds the load of hash-based strategies (see BoundedLoad); 0 leaves it unbounded
+std::unique_ptr<BalancingStrategy> make_balancing_strategy(BalancingAlgorithm algorithm, double balance_factor = 0);
+
+// Lookup table derived from one BackendSet snapshot. It is built by the first request that
+// sees the snapshot and freed by forget() once the snapshot is replaced, after a grace period
+// (see ReadSection), so readers never lock or see one freed under them.
+template <typename Table>
+class SnapshotTable {
+public:
+    template <typename Build>
+    const Table& get(const BackendSet& set, Build build) {
+        const Table* table = current.load(std::memory_order_acquire);
+        if (table != nullptr && table->set == &set) {
+            return *table;
+        }
+
+        std::lock_guard<std::mutex> lock(build_mutex);
+        for (const std::unique_ptr<const Table>& built : tables) {
+            if (built->set == &set) {
+                current.store(built.get(), std::memory_order_release);
+                return *built;
+            }
+        }
+        tables.emplace_back(build(set));
+        current.store(tables.back().get(), std::memory_order_release);
+        return *tables.back();
+    }
+
+    // Drop the table of a replaced snapshot nobody selects from any more. A reader may still
+    // have loaded current before it was cleared, so the table is freed after a grace period.
+    void forget(const BackendSet& set) {
+        std::vector<std::unique_ptr<const Table>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(build_mutex);
+            for (auto it = tables.begin(); it != tables.end();) {
+                if ((*it)->set != &set) {
+                    ++it;
+                    continue;
+                }
+                const Table* expected = it->get();
+                current.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
+                dropped.push_back(std::move(*it));
+                it = tables.erase(it);
+            }
+        }
+        if (!dropped.empty()) {
+            ReadSection::wait_for_readers();
+        }
+    }
+
+private:
+    std::atomic<const Table*> current{nullptr};
+    std::mutex build_mutex; // Only taken when a new snapshot is first seen
+    std::vector<std::unique_ptr<const Table>> tables;
+};
+
+class RoundRobinStrategy : public BalancingStrategy {
+public:
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+
+private:
+    std::atomic<uint64_t> next{0};
+};
+
+class LeastConnectionsStrategy : public BalancingStrategy {
+public:
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+
+private:
+    std::atomic<uint64_t> next{0}; // Rotates the scan start so ties are spread out
+};
+
+class PowerOfTwoChoicesStrategy : public BalancingStrategy {
+public:
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+};
+
+class RandomStrategy : public BalancingStrategy {
+public:
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+};
+
+// Consistent hashing with bounded loads (Mirrokni et al.): a backend takes a request only while it
+// has fewer than balance_factor times its weighted share of the requests in flight, counting the
+// new one, so a hot key spills over to the next backend instead of overloading its own
+class BoundedLoad {
+public:
+    BoundedLoad(const BackendSet& set, double balance_factor);
+
+    // Available and, when the load is bounded, under its capacity
+    bool accepts(const Backend& backend) const;
+
+private:
+    double balance_factor;
+    double requests_per_weight; // Share of the requests in flight per unit of weight, before the factor
+};
+
+// Ring of virtual nodes, several per unit of weight, each at the hash of its backend's address and
+// index. A key goes to the first node clockwise of its hash; when that backend is down, ejected or
+// full the walk continues, so only the keys of a failed backend move, spread over the others.
+class RingHashStrategy : public BalancingStrategy {
+public:
+    static constexpr size_t POINTS_PER_WEIGHT = 100;
+
+    explicit RingHashStrategy(double balance_factor) : balance_factor(balance_factor) {}
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+    void forget(const BackendSet& backends) override { rings.forget(backends); }
+
+private:
+    struct Point {
+        uint64_t hash;
+        uint32_t backend; // Index into the snapshot's backends
+    };
+    struct Ring {
+        const BackendSet* set;
+        std::vector<Point> points; // Sorted by hash
+    };
+
+    double balance_factor;
+    SnapshotTable<Ring> rings;
+
+    static std::unique_ptr<const Ring> build(const BackendSet& set);
+};
+
+// Maglev hashing (Eisenbud et al., NSDI '16): a prime-sized table filled from per-backend
+// permutations, giving O(1) lookups and an even, weighted spread. Membership changes rebuild the
+// table and move about 1/N of the keys. A key whose backend is down, ejected or full probes
+// further slots with rehashed keys, so keys of healthy backends never move.
+class MaglevStrategy : public BalancingStrategy {
+public:
+    static constexpr uint32_t TABLE_SIZE = 65537; // Prime, much larger than any backend count
+
+    explicit MaglevStrategy(double balance_factor) : balance_factor(balance_factor) {}
+    Backend* select(const BackendSet& backends, uint64_t request_hash) override;
+    void forget(const BackendSet& backends) override { tables.forget(backends); }
+
+private:
+    struct Table {
+        const BackendSet* set;
+        std::vector<uint32_t> slots; // Backend index of every slot
+    };
+
+    double balance_factor;
+    SnapshotTable<Table> tables;
+
+    static std::unique_ptr<const Table> build(const BackendSet& set);
+};
+
+// 64-bit hash used for routing keys and backend placement (FNV-1a with a final avalanche)
+uint64_t routing_hash_of(const char* data, size_t length, uint64_t seed = 0);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Default largest buffer allocation kept for reuse (see BufferPool::configure). A buffer grown past
+// it by one large message is freed instead, so a single upload does not pin its size for the life
+// of the thread or connection.
+const size_t MAX_POOLED_BUFFER = 64 * 1024;
+
+// Empty a buffer for the next message, keeping its allocation unless it grew past the pooled maximum
+void recycle_buffer(std::string& buffer);
+
+// Per-thread free list of connection buffers. Each is a string reserved to a fixed size, so the
+// reads appending to it do not reallocate for ordinary requests and responses; it returns to the
+// pool instead of being freed when the connection or exchange using it ends.
+// Not thread-safe: each thread has its own (see local()).
+class BufferPool {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 16 * 1024;
+    static constexpr size_t MAX_IDLE_BUFFERS = 64;
+
+    // Set the capacity new buffers are reserved to and the largest kept for reuse, for every
+    // thread. Call at startup, before connections are served.
+    static void configure(size_t buffer_size, size_t max_pooled);
+
+    // Largest buffer capacity kept for reuse
+    static size_t max_pooled();
+
+    BufferPool() = default;
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // An empty buffer with at least the configured buffer size of capacity
+    std::string acquire();
+
+    // Give a buffer back; kept unless the pool is full or the buffer grew past max_pooled()
+    void release(std::string buffer);
+
+    size_t idle() const { return buffers.size(); }
+
+    // The calling thread's pool
+    static BufferPool& local();
+
+private:
+    std::vector<std::string> buffers;
+};
+
+// A buffer borrowed from the thread's pool for the lifetime of this object
+class PooledBuffer {
+public:
+    PooledBuffer() : buffer(BufferPool::local().acquire()) {}
+    ~PooledBuffer() { BufferPool::local().release(std::move(buffer)); }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    std::string& operator*() { return buffer; }
+
+private:
+    std::string buffer;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef CONCURRENCY_LIMITER_H
+#define CONCURRENCY_LIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "core/backend.h"
+
+// When and how far the number of requests in flight to the backends is limited
+struct ConcurrencyLimitOptions {
+    bool adaptive = false;      // Off: every request is admitted
+    size_t initial_limit = 20;
+    size_t min_limit = 4;
+    size_t max_limit = 1000;
+    double tolerance = 1.5;     // Latency may grow this much over its long-term average before the limit shrinks
+    double smoothing = 0.2;     // Weight of each new estimate in the limit
+};
+
+// Adaptive limit on requests in flight to the backends, after the gradient algorithm of
+// Netflix's concurrency-limits. Times to first byte are averaged over windows of about
+// limit samples (roughly one round trip of the whole limit), and each window's average
+// is compared with a long-term average. While latency holds steady the limit grows by
+// about sqrt(limit) per window; once queueing makes latency rise, it shrinks in proportion.
+// Timeouts count as drops and cut the limit multiplicatively.
+//
+// Admission and updates are lock-free: a CAS on the in-flight count, atomic window totals,
+// and only the request that fills a window updates the limit.
+class ConcurrencyLimiter {
+public:
+    explicit ConcurrencyLimiter(const ConcurrencyLimitOptions& options = ConcurrencyLimitOptions());
+
+    // Admit a request, or refuse it when the limit is reached
+    bool try_acquire();
+
+    // Give back the slot of an admitted request and learn from how it went
+    void release(RequestOutcome outcome, std::chrono::microseconds first_byte_latency);
+
+    bool enabled() const { return options.adaptive; }
+    size_t limit() const { return current_limit.load(std::memory_order_relaxed); }
+    size_t in_flight() const { return requests_in_flight.load(std::memory_order_relaxed); }
+
+private:
+    ConcurrencyLimitOptions options;
+
+    std::atomic<size_t> requests_in_flight;
+    std::atomic<size_t> current_limit;   // Rounded estimated_limit, read on every admission
+    std::atomic<double> estimated_limit;
+    std::atomic<uint64_t> window_samples;
+    std::atomic<uint64_t> window_latency_us; // Sum of the window's samples
+    std::atomic<size_t> window_peak_in_flight;
+    std::atomic<double> long_latency_us; // Average over many windows: the latency the backends normally deliver
+
+    void update_limit(double target);
+};
+
+#endif
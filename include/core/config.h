@@ -0,0 +1,28 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <vector>
+#include "core/server_options.h"
+
+// Everything the server is started with, from the command line and an optional configuration file
+struct ServerConfig {
+    ServerOptions options;
+    std::vector<std::string> backends; // "IP:PORT" or "IP:PORT@WEIGHT"
+};
+
+// Apply one setting by its option name, without the leading "--" (e.g. "reactors", "4").
+// "backend" adds a backend. Returns false with a message in error for unknown names and bad values.
+bool apply_config_option(const std::string& name, const std::string& value, ServerConfig& config, std::string& error);
+
+// Apply a configuration file of "name = value" lines using the option names, with # comments.
+// On/off options take a bare name or on/off; every "backend = IP:PORT[@WEIGHT]" line together
+// replaces the backend list. config is left untouched if the file cannot be read or is invalid.
+bool load_config_file(const std::string& path, ServerConfig& config, std::string& error);
+
+// Build the configuration from the arguments that follow the mode: --config=PATH is read first
+// (and remembered for reloads), then every other --option overrides it. Backends named on the
+// command line (bare addresses or --backend=) replace those of the file.
+bool load_server_config(const std::vector<std::string>& arguments, ServerConfig& config, std::string& error);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+// Sizing of the per-backend idle connection pool
+struct PoolOptions {
+    size_t min_idle = 0;                           // Connections kept open even past the idle timeout
+    size_t max_idle = 32;                          // Idle connections kept per backend; extras are closed
+    std::chrono::milliseconds idle_timeout{30000}; // Idle connections older than this are closed
+};
+
+// Pool of idle keep-alive connections, keyed by backend address
+class BackendConnectionPool {
+public:
+    explicit BackendConnectionPool(const PoolOptions& options = PoolOptions());
+    ~BackendConnectionPool();
+
+    BackendConnectionPool(const BackendConnectionPool&) = delete;
+    BackendConnectionPool& operator=(const BackendConnectionPool&) = delete;
+
+    // Take an idle connection to the backend, or -1 if none is usable.
+    // Connections the backend already closed are detected and discarded here.
+    int checkout(const std::string& address);
+
+    // Give a connection back; it is closed instead when it is not reusable or the pool is full
+    void checkin(const std::string& address, int socket, bool reusable);
+
+    // Open connections until the backend has min_idle idle ones
+    void prewarm(const std::string& address);
+
+    // Close every idle connection to the backend (e.g. after it was marked down)
+    void drain(const std::string& address);
+
+    // Close the idle connections to every backend not listed (e.g. after a reload removed it)
+    void retain_only(const std::vector<std::string>& addresses);
+
+private:
+    struct IdleConnection {
+        int socket;
+        std::chrono::steady_clock::time_point idle_since;
+    };
+
+    PoolOptions options;
+    std::mutex pool_mutex;
+    std::unordered_map<std::string, std::deque<IdleConnection>> idle_connections;
+
+    // Close connections idle for longer than the timeout, keeping min_idle of them
+    void evict_expired(std::deque<IdleConnection>& idle, std::chrono::steady_clock::time_point now);
+};
+
+// Check that an idle connection has neither been closed by the peer nor received stray bytes
+bool is_connection_reusable(int socket);
+
+#endif
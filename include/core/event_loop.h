@@ -0,0 +1,260 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include "core/load_balancer.h"
+#include "core/connection_pool.h"
+#include "core/header_rewrite.h"
+#include "core/http_framing.h"
+#include "core/http_parser.h"
+#include "core/splice_pipe.h"
+#include "core/server_options.h"
+#include "core/server_metrics.h"
+#include "core/logger.h"
+#include "core/response_cache.h"
+
+// States of a proxied connection, advanced by the event loop as sockets become ready
+enum class ConnectionState {
+    READING_REQUEST,    // Accumulating the client request
+    CONNECTING_BACKEND, // Waiting for the non-blocking connect() to the backend to finish
+    WRITING_REQUEST,    // Forwarding the request to the backend, streaming its body as it arrives
+    RELAYING_RESPONSE   // Streaming the backend response back to the client
+};
+
+// Second copy of a request, sent to another backend when the first is slow to answer
+struct Hedge {
+    int socket = -1;
+    Backend* backend = nullptr; // Counted in its active connections until the hedge is promoted or cancelled
+    bool reused = false;        // socket came from the idle pool
+    bool connecting = false;
+    size_t head_sent = 0;       // Bytes of the rewritten head written, if the head is rewritten
+    size_t sent = 0;            // Bytes of the request written (see Connection::request_sent)
+    BackendTiming timing;
+    std::chrono::steady_clock::time_point selected;
+    std::chrono::steady_clock::time_point connect_started;
+    std::chrono::steady_clock::time_point forwarded; // The whole request reached the backend
+};
+
+// Per-connection state shared by the client fd and its backend fds
+struct Connection {
+    int client_socket = -1;
+    int backend_socket = -1;
+    std::string client_address;    // "IP:PORT", looked up only for the access log or source-IP hashing
+    ConnectionState state = ConnectionState::READING_REQUEST;
+    Backend* backend = nullptr;    // Chosen for the current request and counted in its active connections
+    RequestOutcome backend_outcome = RequestOutcome::ABORTED; // Reported to outlier detection on release
+    BackendTiming backend_timing;
+    std::chrono::steady_clock::time_point backend_selected;
+    std::chrono::steady_clock::time_point connect_started;
+    std::chrono::steady_clock::time_point request_forwarded;  // The whole request reached the backend
+    bool backend_reused = false;   // backend_socket came from the idle pool
+    uint64_t request_hash = 0;     // Routing key hash of the current request, for retries and hedges
+    size_t retries = 0;            // Other backends tried for the current request
+    bool hedged = false;           // The current request was hedged (or hedging was refused)
+    std::chrono::microseconds hedge_delay{0}; // Hedge once the backend has been silent this long; 0 never
+    Hedge hedge;
+
+    // The connection's pending deadline timer (see EventLoop::check_deadlines); sequence 0 if none
+    uint64_t timer_sequence = 0;
+    std::chrono::steady_clock::time_point timer_due;
+
+    std::string request_buffer;  // Bytes read from the client, possibly several pipelined requests
+    HttpRequestParser request_parser; // Resumes over request_buffer as bytes arrive
+    BodyFramer request_body{MessageHead()};
+    size_t request_length = 0;   // Bytes of request_buffer framed as part of the current request so far
+    size_t request_sent = 0;     // Bytes of the current request already written to the backend
+    bool request_streamed = false;      // Forwarded body bytes were dropped, so the request cannot be replayed
+
+    // The current request's head as forwarded, when headers are rewritten (empty otherwise). Until
+    // all head_sent bytes of it are out, request_sent stays 0; it then skips the original head.
+    RewrittenHead rewritten_head;
+    size_t head_sent = 0;
+    bool awaiting_request_body = false; // Client is watched for more body bytes while the backend is idle
+    bool head_request = false;   // HEAD responses carry no body whatever their headers say
+
+    // Access log of the request in flight, written when it finishes or the connection closes
+    bool request_active = false;
+    std::chrono::steady_clock::time_point request_started;
+    std::string request_method;  // Copied when the request starts: a streamed body erases its head
+    std::string request_path;
+    std::string served_by;       // Backend address, kept after the backend is released
+    int response_status = 0;
+    size_t response_delivered = 0; // Bytes written to the client
+
+    bool client_keep_alive = false; // Serve another request on this client connection afterwards
+    bool client_eof = false;        // Client closed its sending side
+    size_t requests_served = 0;
+    std::chrono::steady_clock::time_point last_activity; // Last byte moved between client, proxy and backend
+
+    std::string response_head;   // Response bytes buffered until the head is complete
+    bool have_response_head = false;
+    MessageHead response_info;
+    bool backend_keep_alive = false; // Backend will accept another request on this connection
+    BodyFramer response_body{MessageHead()};
+    size_t response_bytes = 0;   // Total response bytes received from the backend
+    bool response_complete = false;
+    bool backend_in_sync = true; // No bytes arrived past the end of the response
+
+    // Set while this request leads the cache fetch of its key; the response is copied into cache_fill
+    // as it is relayed, until it proves too large or is spliced (cache_filling turns false)
+    std::string cache_key;
+    std::string cache_fill;
+    bool cache_filling = false;
+
+    std::string response_buffer; // Backend bytes not yet written to the client
+    size_t response_sent = 0;    // Bytes of response_buffer already written to the client
+    std::unique_ptr<SplicePipe> relay_pipe; // Carries large bodies after response_buffer, without copies
+    bool backend_eof = false;    // Backend closed its side of the connection
+};
+
+// Single-threaded epoll reactor that proxies client connections to backends
+// using non-blocking sockets and per-connection state machines
+class EventLoop {
+public:
+    // drain_event becomes readable when the server starts draining (-1 if it never does)
+    EventLoop(int listen_socket, int drain_event, LoadBalancer& load_balancer, ResponseCache& cache,
+              ServerMetrics& metrics, const ServerOptions& options = ServerOptions());
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Run the reactor until it has drained after the drain event, or fails
+    void run();
+
+private:
+    int listen_socket; // Shared with other reactors or a successor process: never closed here
+    int drain_event;
+    int epoll_fd;
+    bool draining;
+    std::chrono::steady_clock::time_point drain_deadline;
+    LoadBalancer& load_balancer;
+    ResponseCache& cache; // Shared by every reactor
+    ServerMetrics& metrics;
+    ServerOptions options;
+
+    // Idle keep-alive backend connections owned by this reactor
+    BackendConnectionPool connection_pool;
+    uint64_t pooled_backends_version; // LoadBalancer::backends_version() the pool was last pruned for
+
+    // Connections indexed by both their client and backend fds
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+    size_t client_connections; // Open client connections, bounded by options.max_connections
+
+    // Response reads land here before being framed; requests are received into their own buffer
+    std::vector<char> read_buffer;
+
+    // Empty relay pipes kept for the next large response
+    std::vector<std::unique_ptr<SplicePipe>> idle_pipes;
+
+    // Closed connections kept for the next clients, with the buffers they grew
+    std::vector<std::shared_ptr<Connection>> spare_connections;
+
+    // Deadlines of backend exchanges, as a min-heap on due. Entries are never removed: one whose
+    // sequence no longer matches its connection's is skipped when it comes due, and the heap is
+    // compacted once such stale entries outnumber the live ones.
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        uint64_t sequence;
+        int client_socket;
+        bool operator>(const Timer& other) const { return due > other.due; }
+    };
+    std::vector<Timer> timers;
+    size_t live_timers;
+    uint64_t last_timer_sequence;
+
+    // Event handlers
+    void accept_connections();
+    void close_idle_connections();
+
+    // Stop accepting. Keep-alive connections are not cut, which would race a request the client is
+    // sending: the next response on each says "Connection: close", and idle ones time out as usual.
+    void start_draining();
+    void handle_client_event(const std::shared_ptr<Connection>& conn, uint32_t events);
+    void handle_backend_event(const std::shared_ptr<Connection>& conn, uint32_t events);
+
+    // State machine steps
+    void read_request(const std::shared_ptr<Connection>& conn);
+    void dispatch_request(const std::shared_ptr<Connection>& conn);
+    void read_request_body(const std::shared_ptr<Connection>& conn);
+    bool frame_request(const std::shared_ptr<Connection>& conn);
+    void finish_request(const std::shared_ptr<Connection>& conn);
+    void connect_to_backend(const std::shared_ptr<Connection>& conn);
+    void open_backend_connection(const std::shared_ptr<Connection>& conn, bool allow_reuse);
+    void finish_connect(const std::shared_ptr<Connection>& conn);
+    void write_request(const std::shared_ptr<Connection>& conn);
+    void read_response(const std::shared_ptr<Connection>& conn);
+    bool frame_response(const std::shared_ptr<Connection>& conn, const char* data, size_t length);
+    void splice_response(const std::shared_ptr<Connection>& conn);
+    void write_response(const std::shared_ptr<Connection>& conn);
+
+    // Copy relayed response bytes for the cache while this request leads a fetch
+    void fill_cache(const std::shared_ptr<Connection>& conn, const char* data, size_t length);
+
+    // Store (or give up) the fetched response once it is complete or the connection closes
+    void finish_cache_fill(const std::shared_ptr<Connection>& conn, bool complete);
+
+    // Retry on a fresh connection after a pooled one turned out to be stale
+    void retry_backend(const std::shared_ptr<Connection>& conn);
+
+    // Pick a backend for the request (other than avoid, for a retry), answering 503 when none can take it
+    bool select_backend(const std::shared_ptr<Connection>& conn, const Backend* avoid);
+
+    // The backend failed or timed out. If nothing has reached the client, an idempotent request
+    // goes to another backend (within the retry budget) and otherwise the client gets a 502 or 504;
+    // a hedge already sent takes over instead. Past that point the connection is closed.
+    void backend_failed(const std::shared_ptr<Connection>& conn, RequestOutcome outcome);
+
+    // Hedging: send the request to a second backend, and keep whichever answers first
+    void start_hedge(const std::shared_ptr<Connection>& conn);
+    void handle_hedge_event(const std::shared_ptr<Connection>& conn, uint32_t events);
+    void write_hedge(const std::shared_ptr<Connection>& conn);
+    void promote_hedge(const std::shared_ptr<Connection>& conn);
+    void cancel_hedge(const std::shared_ptr<Connection>& conn, RequestOutcome outcome);
+
+    // Make sure check_deadlines() runs for the connection by due
+    void arm_timer(const std::shared_ptr<Connection>& conn, std::chrono::steady_clock::time_point due);
+
+    // Run the timers that have come due
+    void run_timers();
+
+    // Milliseconds until the next timer, at most max_wait
+    int next_timer_wait(int max_wait);
+
+    // Whether the timer is still its connection's pending one
+    bool is_live(const Timer& timer) const;
+
+    // Enforce the connect, idle and first-byte timeouts of the connection's backend exchange and
+    // send its hedge when due; re-arms the timer for the next deadline
+    void check_deadlines(const std::shared_ptr<Connection>& conn);
+
+    // Detach the backend socket, returning it to the pool when it can carry another request
+    void release_backend(const std::shared_ptr<Connection>& conn, bool reusable);
+
+    // Relay pipes are reused across responses instead of being created per response
+    std::unique_ptr<SplicePipe> acquire_pipe();
+    void release_pipe(const std::shared_ptr<Connection>& conn);
+
+    // Connection state is reused across clients instead of being allocated per accept
+    std::shared_ptr<Connection> acquire_connection();
+
+    // Answer the request from the proxy itself (the metrics page) instead of a backend
+    void respond_locally(const std::shared_ptr<Connection>& conn, const std::string& response);
+
+    // Write the access-log line of the request in flight, if any
+    void log_request(const std::shared_ptr<Connection>& conn);
+
+    // Send a short error response and close the connection
+    void fail_connection(const std::shared_ptr<Connection>& conn, const std::string& response);
+
+    // epoll registration helpers
+    void watch(int fd, uint32_t events, bool add);
+    void close_connection(const std::shared_ptr<Connection>& conn);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef HEADER_REWRITE_H
+#define HEADER_REWRITE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include "core/http_parser.h"
+
+// Changes made to request heads on their way to a backend (all off by default)
+struct HeaderRewriteOptions {
+    bool forwarded_for = false;    // Append the client's IP to X-Forwarded-For, adding the header if absent
+    bool request_id = false;       // Add a random X-Request-Id to requests that do not carry one
+    std::string host;              // Replace the Host header with this value; empty keeps the client's
+    bool strip_hop_by_hop = false; // Remove hop-by-hop headers and those the Connection header names
+
+    bool enabled() const { return forwarded_for || request_id || !host.empty() || strip_hop_by_hop; }
+};
+
+// Longest --rewrite-host value: a DNS name (253 bytes) with a port
+const size_t MAX_REWRITE_HOST = 253 + 6;
+
+// A request head with headers added, replaced or removed, kept as a list of segments instead of
+// being re-serialized: unchanged runs of the original head (by offset, so the buffer holding it
+// may grow or move) and the few inserted fragments, stored here. to_iov() turns them into an
+// iovec list for writev/sendmsg, from any byte of the rewritten head, to resume partial sends.
+class RewrittenHead {
+public:
+    static constexpr size_t MAX_SEGMENTS = 2 * HttpRequestParser::MAX_HEADERS + 8;
+
+    RewrittenHead();
+
+    // Rewrite the head of a request parsed at the start of head (at least its header_length bytes).
+    // client_address is the client's "IP:PORT", needed for X-Forwarded-For.
+    void build(std::string_view head, const HttpRequestParser& parsed, std::string_view client_address,
+               const HeaderRewriteOptions& options);
+
+    // Forget the head; an empty RewrittenHead has no segments and size 0
+    void clear();
+
+    bool empty() const { return segment_count == 0; }
+
+    // Bytes of the rewritten head
+    size_t size() const { return total; }
+
+    // Bytes of the original head it replaces
+    size_t original_size() const { return original_length; }
+
+    // Point iov (room for max entries) at the rewritten head from offset on, for a head now held
+    // at head. Returns the number of entries used; at most MAX_SEGMENTS are ever needed.
+    size_t to_iov(const char* head, size_t offset, struct iovec* iov, size_t max) const;
+
+    // Append the rewritten head, for a head now held at head, to out
+    void append_to(const char* head, std::string& out) const;
+
+private:
+    struct Segment {
+        bool fragment;   // In fragments rather than the original head
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    Segment segments[MAX_SEGMENTS];
+    size_t segment_count;
+    size_t total;
+    size_t original_length;
+
+    // X-Forwarded-For, X-Request-Id and Host text; the Host value is bounded by MAX_REWRITE_HOST
+    char fragments[512];
+    size_t fragments_used;
+
+    // Append a segment, merging it with the previous one when they are contiguous
+    void add_segment(bool fragment, size_t offset, size_t length);
+
+    // Copy text into fragments; returns its offset there
+    size_t store(std::string_view text);
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef HEALTH_CHECKER_H
+#define HEALTH_CHECKER_H
+
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include "core/backend.h"
+
+// Active health check settings
+struct HealthCheckOptions {
+    std::chrono::milliseconds interval{5000};        // Time between probe rounds
+    std::chrono::milliseconds connect_timeout{1000}; // A probe fails if the connect takes longer
+    std::chrono::milliseconds read_timeout{2000};    // ... or if the status line takes longer after that
+    std::string path = "/health";                    // Probed with GET; any 2xx status is healthy
+    unsigned int rise = 2; // Consecutive successes before a down backend is marked up
+    unsigned int fall = 3; // Consecutive failures before an up backend is marked down
+};
+
+// Probes every backend in parallel from one background thread using non-blocking
+// sockets and epoll. Verdicts are published through each Backend's is_alive flag,
+// so the request path never waits on a probe.
+class HealthChecker {
+public:
+    HealthChecker(const std::atomic<const BackendSet*>& backend_set, const HealthCheckOptions& options);
+    ~HealthChecker();
+
+    HealthChecker(const HealthChecker&) = delete;
+    HealthChecker& operator=(const HealthChecker&) = delete;
+
+    void start();
+    void stop();
+
+private:
+    // Streak of identical probe results for one backend
+    struct BackendHealth {
+        unsigned int successes = 0;
+        unsigned int failures = 0;
+    };
+
+    // One probe in flight
+    struct Probe {
+        Backend* backend = nullptr;
+        int socket = -1;
+        bool connected = false;
+        bool request_sent = false;
+        std::string response;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    const std::atomic<const BackendSet*>& backend_set;
+    HealthCheckOptions options;
+    int epoll_fd;
+
+    // Only touched by the checker thread
+    std::unordered_map<Backend*, BackendHealth> health;
+
+    std::thread checker_thread;
+    std::mutex stop_mutex;
+    std::condition_variable stop_condition;
+    bool stopping;
+
+    // Probe every backend once, waiting at most for the probe timeouts
+    void run_round();
+
+    bool start_probe(Probe& probe);
+    // Advance a probe after an epoll event; returns true once it has a verdict in healthy
+    bool advance_probe(Probe& probe, bool& healthy);
+    void record(Backend& backend, bool healthy);
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef HTTP_FRAMING_H
+#define HTTP_FRAMING_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// How the end of an HTTP message body is determined
+enum class BodyFraming {
+    NONE,           // No body (HEAD responses, 1xx/204/304, requests without a body)
+    CONTENT_LENGTH, // Exactly content_length bytes follow the head
+    CHUNKED,        // Transfer-Encoding: chunked
+    UNTIL_CLOSE     // Body runs until the peer closes the connection
+};
+
+// Framing information extracted from an HTTP request or response head
+// (requests are parsed by HttpRequestParser, responses by parse_response_head)
+struct MessageHead {
+    size_t header_length = 0; // Bytes up to and including the blank line
+    int status_code = 0;      // Responses only
+    BodyFraming framing = BodyFraming::NONE;
+    size_t content_length = 0;
+    bool keep_alive = false;  // Connection may carry another message afterwards
+};
+
+// Parse a response head once it is fully buffered.
+// Returns false while the blank line has not arrived yet.
+bool parse_response_head(const char* data, size_t length, bool head_request, MessageHead& head);
+
+// 1xx responses other than 101 (e.g. 100 Continue) precede the final response of the same exchange
+bool is_interim_response(const MessageHead& head);
+
+// Insert "Connection: close" before the blank line of a head stored at buffer[head_offset]
+void add_connection_close(std::string& buffer, size_t head_offset, MessageHead& head);
+
+// Incremental scanner for a chunked body. It does not decode anything, it only
+// tells how many bytes of the stream belong to the body so they can be relayed as-is.
+class ChunkedDecoder {
+public:
+    ChunkedDecoder();
+
+    // Consume bytes; returns how many of them belong to the body (stops at the end of the body)
+    size_t consume(const char* data, size_t length);
+
+    bool done() const { return state == State::DONE; }
+    bool failed() const { return state == State::ERROR; }
+
+private:
+    enum class State {
+        SIZE, SIZE_EXTENSION, SIZE_LF,
+        DATA, DATA_CR, DATA_LF,
+        TRAILER_START, TRAILER_LINE, TRAILER_LF, FINAL_LF,
+        DONE, ERROR
+    };
+
+    State state;
+    uint64_t chunk_remaining;
+    bool saw_size_digit;
+};
+
+// Tracks how much of a message body is still expected, whatever its framing
+class BodyFramer {
+public:
+    explicit BodyFramer(const MessageHead& head);
+
+    // Consume body bytes; returns how many of them belong to this message
+    size_t consume(const char* data, size_t length);
+
+    // The whole body has been seen (never true for UNTIL_CLOSE)
+    bool complete() const;
+
+    // Body bytes that can be relayed without looking at them: the rest of a Content-Length
+    // body, unlimited for UNTIL_CLOSE, none for chunked bodies whose end must be scanned for
+    size_t opaque_remaining() const;
+
+    // Account for bytes relayed without being looked at (at most opaque_remaining())
+    void skip(size_t length);
+    bool failed() const { return chunked.failed(); }
+
+private:
+    BodyFraming framing;
+    size_t remaining;
+    ChunkedDecoder chunked;
+};
+
+#endif
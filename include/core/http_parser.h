@@ -0,0 +1,131 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "core/http_framing.h"
+
+// Progress of an HttpRequestParser over the bytes received so far
+enum class ParseStatus {
+    INCOMPLETE, // Need more bytes; call parse() again once they arrive
+    COMPLETE,   // The request head is complete
+    ERROR       // The request is malformed; see error()
+};
+
+// Why a request was rejected
+enum class ParseError {
+    NONE,
+    BAD_METHOD,            // Method is empty or contains a non-token character
+    BAD_TARGET,            // Request target is empty or contains whitespace/control characters
+    BAD_VERSION,           // Version is not HTTP/1.0 or HTTP/1.1
+    BAD_LINE_ENDING,       // CR not followed by LF
+    BAD_HEADER_NAME,       // Empty name, non-token character or obsolete line folding
+    BAD_HEADER_VALUE,      // Control character inside a header value
+    TOO_MANY_HEADERS,      // More than HttpRequestParser::MAX_HEADERS header fields
+    HEAD_TOO_LARGE,        // No blank line within HttpRequestParser::MAX_HEAD_SIZE bytes
+    BAD_CONTENT_LENGTH,    // Non-numeric or conflicting Content-Length values
+    BAD_TRANSFER_ENCODING  // Encoding not ending in chunked, or combined with Content-Length
+};
+
+// Human-readable description of a parse error
+const char* parse_error_message(ParseError error);
+
+// A header field as views into the receive buffer
+struct HeaderField {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Incremental HTTP/1.x request head parser.
+//
+// parse() is handed everything received so far (the same buffer, possibly grown or
+// reallocated) and resumes where the previous call stopped. Nothing is copied or
+// allocated: positions are recorded as offsets into the buffer and exposed as
+// std::string_views into the buffer last passed to parse() (or rebase()).
+class HttpRequestParser {
+public:
+    static constexpr size_t MAX_HEADERS = 64;
+    static constexpr size_t MAX_HEAD_SIZE = 64 * 1024;
+
+    HttpRequestParser();
+
+    // Parse the request head at the start of buffer
+    ParseStatus parse(std::string_view buffer);
+
+    // Forget the current request so the parser can be reused for the next one
+    void reset();
+
+    // Point the views at a copy of the buffer that starts at base
+    void rebase(const char* base) { buffer_base = base; }
+
+    ParseStatus status() const;
+    ParseError error() const { return error_code; }
+    size_t error_offset() const { return error_position; }
+
+    // Framing of the request (header length, body framing, keep-alive); valid once COMPLETE
+    const MessageHead& head() const { return message_head; }
+
+    std::string_view method() const { return view(method_span); }
+    std::string_view target() const { return view(target_span); }
+    std::string_view path() const;
+    std::string_view query_string() const;
+    int version_minor() const { return minor_version; }
+
+    size_t header_count() const { return header_total; }
+    HeaderField header(size_t index) const;
+
+    // Case-insensitive header lookup; empty if absent
+    std::string_view get_header(std::string_view name) const;
+
+    // Case-sensitive query parameter lookup (e.g. /path?key=value); empty if absent
+    std::string_view get_query_param(std::string_view key) const;
+
+    // The client waits for 100 Continue before sending the body (HTTP/1.1 Expect: 100-continue)
+    bool expects_continue() const;
+
+private:
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+
+    struct HeaderSpan {
+        Span name;
+        Span value;
+    };
+
+    enum class State {
+        METHOD, TARGET, VERSION, REQUEST_LINE_LF,
+        HEADER_LINE_START, HEADER_NAME, HEADER_VALUE_START, HEADER_VALUE, HEADER_LF,
+        FINAL_LF, DONE, FAILED
+    };
+
+    const char* buffer_base;
+    size_t offset; // Next byte to examine
+    State state;
+    ParseError error_code;
+    size_t error_position;
+
+    Span method_span;
+    Span target_span;
+    uint32_t version_start;
+    int minor_version;
+
+    // Headers live inline in a flat array: no map, no per-header allocation
+    std::array<HeaderSpan, MAX_HEADERS> headers;
+    size_t header_total;
+    HeaderSpan current_header;
+    uint32_t value_end; // One past the last non-whitespace byte of the current value
+
+    MessageHead message_head;
+
+    std::string_view view(Span span) const { return std::string_view(buffer_base + span.offset, span.length); }
+    ParseStatus fail(ParseError error, size_t position);
+
+    // Validate the framing headers and fill message_head
+    ParseStatus finish_head();
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// Minimal io_uring ring driven through the raw system calls (no liburing): one submission queue
+// filled by a single thread, completions consumed in place. Submission is batched: entries are
+// only handed to the kernel by submit() or submit_and_wait(), or when the queue is full.
+class IoUring {
+public:
+    // entries: submission queue size (a power of two); the completion queue is four times larger
+    // because multishot requests post several completions each
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // False if the kernel refused to set the ring up (too old, or io_uring disabled)
+    bool is_open() const { return ring_fd >= 0; }
+    int fd() const { return ring_fd; }
+
+    // A zeroed submission entry, submitting what is queued first if the queue is full
+    io_uring_sqe* get_sqe();
+
+    // Make room for count entries, submitting what is queued if needed, so that a linked
+    // chain is not split across two submissions. False if the room cannot be made.
+    bool reserve(unsigned count);
+
+    // Hand queued entries to the kernel without waiting
+    int submit();
+
+    // Hand queued entries to the kernel and wait up to timeout for at least one completion.
+    // Returns false on a failure other than the wait timing out or being interrupted.
+    bool submit_and_wait(std::chrono::milliseconds timeout);
+
+    // The oldest completion not consumed yet, or nullptr
+    const io_uring_cqe* peek_completion();
+
+    // Give the entry returned by peek_completion() back to the kernel
+    void consume_completion();
+
+    // Register a provided buffer ring (see BufferRing)
+    int register_buffer_ring(io_uring_buf_reg& registration);
+    int unregister_buffer_ring(uint16_t group);
+
+private:
+    int ring_fd;
+    unsigned features;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head; // Advanced by the kernel as it consumes entries
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail; // Entries handed out by get_sqe(); published to sq_tail on submission
+
+    unsigned* cq_head;
+    unsigned* cq_tail; // Advanced by the kernel as it posts completions
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* argument, size_t argument_size);
+};
+
+// Buffers the kernel picks from for receives flagged IOSQE_BUFFER_SELECT, so a multishot receive
+// needs no buffer of its own per connection. A completion that used one carries IORING_CQE_F_BUFFER
+// and the buffer id; the buffer must be recycled once its bytes have been consumed.
+class BufferRing {
+public:
+    // count must be a power of two
+    BufferRing(IoUring& ring, uint16_t group, unsigned count, size_t buffer_size);
+    ~BufferRing();
+
+    BufferRing(const BufferRing&) = delete;
+    BufferRing& operator=(const BufferRing&) = delete;
+
+    bool is_open() const { return registered; }
+    uint16_t group() const { return group_id; }
+    size_t buffer_size() const { return size; }
+
+    const char* buffer(uint16_t id) const { return buffers + static_cast<size_t>(id) * size; }
+
+    // Make a consumed buffer available to the kernel again
+    void recycle(uint16_t id);
+
+private:
+    IoUring& ring;
+    uint16_t group_id;
+    unsigned count;
+    size_t size;
+    bool registered;
+    io_uring_buf* entries; // The ring, as entries: C++ compilers misplace io_uring_buf_ring's flexible array
+    size_t entries_size;
+    char* buffers;
+    uint16_t tail;
+};
+
+#endif
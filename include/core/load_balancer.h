@@ -4,40 +4,139 @@
 #include <vector>
 #include <string>
 #include <mutex>
-#include <thread>
 #include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include "core/backend.h"
+#include "core/balancing_strategy.h"
+#include "core/health_checker.h"
+#include "core/http_parser.h"
+#include "core/outlier_detector.h"
+#include "core/concurrency_limiter.h"
+#include "core/retry_budget.h"
 
-struct Backend {
-    std::string address; // IP:PORT of the backend server
-    int active_connections; // Number of active connections to the backend
-    bool is_alive; // Flag to indicate if the backend is alive
+// What hash-based strategies route on
+struct HashKeyOptions {
+    enum Source {
+        SOURCE_IP,   // The client's address
+        HEADER,      // A request header (case-insensitive name)
+        COOKIE,      // A cookie from the Cookie header
+        QUERY_PARAM  // A query parameter
+    };
+
+    Source source = SOURCE_IP;
+    std::string name; // Header, cookie or parameter name
+};
+
+// Parse "ip", "header:NAME", "cookie:NAME" or "query:NAME"
+bool parse_hash_key(const std::string& spec, HashKeyOptions& key);
+
+// How backends are chosen and how their health is judged
+struct LoadBalancerOptions {
+    BalancingAlgorithm balancing = BalancingAlgorithm::ROUND_ROBIN; // How each request picks its backend
+    HashKeyOptions hash_key;           // Routing key of ring_hash and maglev
+    double hash_balance_factor = 1.25; // Bound on a backend's share of the load under hashing; 0 for none
+    HealthCheckOptions health_check;   // Active probes of every backend
+    OutlierOptions outlier_detection;  // Passive ejection driven by live traffic
+    ConcurrencyLimitOptions concurrency_limit; // Adaptive limit on requests in flight to the backends
+    RetryOptions retries;              // Retries of failed requests and hedges of slow ones, within a budget
+};
+
+// Thrown by get_next_backend() when the concurrency limit sheds the request
+class OverloadedError : public std::runtime_error {
+public:
+    OverloadedError() : std::runtime_error("Concurrency limit reached") {}
 };
 
 class LoadBalancer {
 public:
-    LoadBalancer(const std::vector<std::string>& backend_addresses);
+    // Backends are given as "IP:PORT" or "IP:PORT@WEIGHT"
+    LoadBalancer(const std::vector<std::string>& backend_addresses,
+                 const LoadBalancerOptions& options = LoadBalancerOptions());
+    ~LoadBalancer();
+
+    // Pick an available backend and count the request against it; throws OverloadedError when
+    // the concurrency limit is reached and std::runtime_error if no backend is available.
+    // request_hash comes from routing_hash() and only matters to hash-based strategies.
+    // A retry or hedge passes the backend it should not go back to as avoid; it is only picked
+    // again when no other is available. First attempts (no avoid) add to the retry budget.
+    // The backend stays valid for the lifetime of the LoadBalancer.
+    Backend& get_next_backend(uint64_t request_hash = 0, const Backend* avoid = nullptr);
+
+    const RetryOptions& retry_options() const { return retries; }
+
+    // Take one retry or hedge from the retry budget; false when it is spent
+    bool try_retry() { return retry_budget.try_withdraw(); }
+
+    // How long a request to the backend waits for its first byte before it is hedged: the
+    // configured quantile of its recent times to first byte, at least hedge_min_delay.
+    // 0 when hedging is off or the backend has not answered enough requests to tell.
+    std::chrono::microseconds hedge_delay(Backend& backend);
 
-    // Get the next available backend server
-    Backend get_next_backend();
+    // Whether routing_hash() needs the client's address, so callers only look it up when it does
+    bool routes_on_client_address() const;
 
-    // Mark a backend as unavailable
-    void mark_backend_down(const std::string& address);
+    // Hash of the request's routing key under a hash-based strategy; 0 when the strategy spreads
+    // requests or the request lacks the key. client_address is "IP:PORT"; only the IP is hashed.
+    uint64_t routing_hash(const HttpRequestParser& request, std::string_view client_address) const;
+
+    // Release a backend returned by get_next_backend() once its request has completed,
+    // reporting how it went to the backend's metrics, outlier detection and the concurrency limit
+    void release_backend(Backend& backend, RequestOutcome outcome, const BackendTiming& timing = BackendTiming());
+
+    // Backend and concurrency-limit metrics, for the metrics page
+    void write_metrics(MetricsWriter& out) const;
+
+    // Addresses of all configured backends
+    std::vector<std::string> get_backend_addresses() const;
+
+    // Replace the backends (same format as the constructor) without interrupting traffic: new
+    // requests see the new list at once, while requests in flight finish on the backends they
+    // picked. Backends kept keep their health and ejection state; removed ones are marked retired.
+    void update_backends(const std::vector<std::string>& backend_addresses);
+
+    // Incremented by every update_backends(), so connection pools can tell when to drop retired backends
+    uint64_t backends_version() const { return version.load(std::memory_order_acquire); }
 
     // Check backend health periodically
     void start_health_check();
     void stop_health_check();
 
 private:
-    std::vector<Backend> backends;
-    std::mutex backend_mutex;
-    int current_backend_index; 
+    // Current snapshot, read without locks inside a ReadSection. A replaced one is freed, with
+    // the strategy's tables built from it, once every reader that could see it is done.
+    std::atomic<const BackendSet*> backend_set;
+    std::unique_ptr<const BackendSet> owned_set; // What backend_set points to
+    std::mutex update_mutex; // Serializes snapshot replacement, never taken by readers
+
+    // Backends dropped from the list (removed, or replaced by a reweighted copy). Requests in
+    // flight may still hold them, and one comes back if its address and weight are configured
+    // again, so this grows with the backends ever configured, not with the number of reloads.
+    std::vector<std::shared_ptr<Backend>> retired_backends;
+    std::atomic<uint64_t> version{0};
+
+    std::unique_ptr<BalancingStrategy> strategy;
+    bool hash_routing;
+    HashKeyOptions hash_key;
+
+    // Probes the backends in the background
+    HealthChecker health_checker;
+
+    // Ejects backends that fail live requests
+    OutlierDetector outlier_detector;
+
+    // Sheds requests once the backends' latency shows they are saturated
+    ConcurrencyLimiter concurrency_limiter;
+
+    RetryOptions retries;
+    RetryBudget retry_budget;
 
-    // Health check thread
-    std::thread health_check_thread;
-    std::atomic<bool> stop_checking;
+    // Least loaded available backend other than avoid, for a retry the strategy kept sending back
+    Backend* least_loaded_other(const BackendSet& set, const Backend* avoid) const;
 
-    // Health check function
-    void perform_health_check();
+    // Replace the backend snapshot and free the previous one; update_mutex must be held
+    void publish_backends(std::vector<std::shared_ptr<Backend>> backends);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,153 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class LogLevel : uint8_t {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+// "debug", "info", "warn", "error" or "off"
+bool parse_log_level(const std::string& name, LogLevel& level);
+
+struct LogOptions {
+    LogLevel level = LogLevel::INFO; // Events below this level are discarded before formatting
+    std::string event_log;           // File for events; empty for stderr
+    std::string access_log;          // File for the access log, "-" for stdout; empty disables it
+    double access_log_sample = 1.0;  // Fraction of requests written to the access log
+    size_t buffer_size = 64 * 1024;  // Bytes of each ring buffer (there are two per CPU)
+    bool block_when_full = false;    // Wait for the writer instead of dropping records when a buffer is full
+    std::chrono::milliseconds flush_interval{50}; // Longest a record waits in its buffer
+};
+
+// One line of the access log
+struct AccessLogEntry {
+    std::string_view client;  // "IP:PORT"
+    std::string_view method;
+    std::string_view path;
+    int status = 0;           // 0 if no response was sent
+    size_t response_bytes = 0;
+    std::string_view backend; // Empty when the proxy answered itself
+    std::chrono::steady_clock::time_point started;
+};
+
+// Process-wide asynchronous logger.
+//
+// A logging thread formats its record and copies it into one of a fixed set of ring buffers,
+// shared by all threads: it starts at the ring it used last (first picked by hashing its id) and
+// takes the first one whose try-lock it wins, so contention is rare and a thread that only lives
+// for one connection neither allocates nor registers a ring. No system call is made.
+// Timestamps are stored raw and formatted by a background writer, which drains every ring in
+// batches and issues one write() per destination.
+// When a ring is full the record is dropped and counted (or the thread waits, if
+// block_when_full is set); the writer reports drops in the event log.
+// Ordering: a record is stamped once its ring is locked, so each ring is in time order, and each
+// batch is merged across rings by timestamp. A record stamped just before a flush but pushed after
+// it can still trail a later one from another ring, by at most one flush interval.
+class Logger {
+public:
+    static Logger& instance();
+
+    // Apply options (until then, INFO and above go to stderr); call once at startup, before
+    // other threads log. Returns false if a log file cannot be opened.
+    bool configure(const LogOptions& options);
+
+    // Write out everything logged so far and stop the writer; later records are dropped
+    void shutdown();
+
+    bool enabled(LogLevel level) const { return level >= minimum_level.load(std::memory_order_relaxed); }
+
+    // Change the event log level at run time (e.g. on a configuration reload)
+    void set_level(LogLevel level) { minimum_level.store(level, std::memory_order_relaxed); }
+    bool access_log_enabled() const { return access_enabled.load(std::memory_order_relaxed); }
+
+    void log(LogLevel level, const char* format, va_list arguments);
+
+    // Writes the entry if the access log is enabled and the request is sampled
+    void log_access(const AccessLogEntry& entry);
+
+    uint64_t dropped_records() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    enum class RecordKind : uint8_t { EVENT, ACCESS };
+
+    struct RecordHeader {
+        uint32_t length; // Payload bytes that follow the header
+        RecordKind kind;
+        LogLevel level;
+        int64_t timestamp_ns; // system_clock
+    };
+
+    // Byte ring with one producer at a time (whoever holds producing) and the writer as consumer
+    struct Ring {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        alignas(64) std::atomic<bool> producing{false}; // Try-lock taken by the thread pushing
+        std::atomic<size_t> head{0};             // Written by the producer
+        alignas(64) std::atomic<size_t> tail{0}; // Written by the writer
+        std::atomic<bool> abandoned{false};      // Replaced by configure(); freed once drained
+
+        explicit Ring(size_t capacity);
+        bool push(const RecordHeader& header, const char* payload);
+        void copy_in(size_t position, const void* source, size_t length);
+        void copy_out(size_t position, void* destination, size_t length) const;
+    };
+
+    Logger(); // Never destroyed, so detached threads can log until the process exits
+
+    std::atomic<LogLevel> minimum_level;
+    std::atomic<bool> access_enabled;
+    std::atomic<uint64_t> access_sample_threshold; // Sampled when a random 64-bit number is below it
+    std::atomic<size_t> ring_capacity;
+    std::atomic<bool> block_when_full;
+    std::atomic<bool> accepting; // Cleared by shutdown()
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> flush_requested; // A blocked thread is waiting for room
+
+    // The rings producers pick from; replaced only by configure(), before other threads log
+    struct RingSet {
+        std::vector<Ring*> rings;
+    };
+    std::atomic<RingSet*> ring_set;
+
+    std::mutex rings_mutex; // Guards rings; taken by configure() and the writer
+    std::vector<std::shared_ptr<Ring>> rings; // Every ring not yet drained and freed, for the writer
+
+    std::thread writer;
+    std::mutex writer_mutex; // Held by the writer while it drains; guards the fields below
+    std::condition_variable writer_wakeup;
+    std::chrono::milliseconds flush_interval;
+    int event_fd;
+    int access_fd;
+    bool stopping;
+
+    RingSet* make_ring_set(size_t capacity);
+    Ring* lock_ring();
+    void append(RecordKind kind, LogLevel level, const char* payload, size_t length);
+
+    void run_writer();
+    void drain(std::string& events, std::string& access);
+};
+
+// printf-style event logging; formatting is skipped below the configured level
+void log_debug(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void log_info(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void log_warn(const char* format, ...) __attribute__((format(printf, 1, 2)));
+void log_error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
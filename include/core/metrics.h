@@ -0,0 +1,109 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Metric primitives for the hot path. Recording a sample is a relaxed atomic add on a
+// cache line owned (mostly) by the calling thread: no lock, no allocation, no false sharing
+// between threads. Reading sums the shards, which only happens when metrics are scraped.
+
+// Writers are spread over this many shards; threads beyond it share them
+constexpr size_t METRIC_SHARDS = 8;
+
+// Shard of the calling thread, assigned round-robin on first use
+size_t next_metric_shard();
+inline size_t this_thread_metric_shard() {
+    static thread_local const size_t shard = next_metric_shard();
+    return shard;
+}
+
+// Monotonic count of events
+class Counter {
+public:
+    void add(uint64_t amount = 1) {
+        shards[this_thread_metric_shard()].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards;
+};
+
+// Value that goes up and down (open connections, queued requests)
+class Gauge {
+public:
+    // Both return the value before the change
+    int64_t add(int64_t amount = 1) { return current.fetch_add(amount, std::memory_order_relaxed); }
+    int64_t sub(int64_t amount = 1) { return current.fetch_sub(amount, std::memory_order_relaxed); }
+    void set(int64_t value) { current.store(value, std::memory_order_relaxed); }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> current{0};
+};
+
+// HDR-style histogram of non-negative integers (latencies in microseconds). Values below
+// 16 have their own bucket; above that, every power of two is split into 16 linear
+// sub-buckets, so any recorded value is known within 1/16 (6.25%) of itself, up to 2^40.
+class Histogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BUCKET_BITS;
+    static constexpr unsigned MAX_VALUE_BITS = 40; // Larger values are clamped
+    static constexpr size_t BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value) {
+        Shard& shard = shards[this_thread_metric_shard()];
+        shard.counts[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    // Merged counts of every shard, for reporting
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // Upper bound of the bucket holding the given quantile (0..1); 0 when empty
+        uint64_t quantile(double q) const;
+    };
+    Snapshot snapshot() const;
+
+    static size_t bucket_index(uint64_t value);
+    static uint64_t bucket_upper_bound(size_t index); // Largest value stored in the bucket
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+        std::atomic<uint64_t> sum{0};
+    };
+    std::array<Shard, METRIC_SHARDS> shards;
+};
+
+// Renders metrics in the Prometheus text exposition format (version 0.0.4)
+class MetricsWriter {
+public:
+    // Start a metric family: "# HELP" and "# TYPE" lines
+    void family(const char* name, const char* type, const char* help);
+
+    // One sample; labels are pre-formatted (e.g. backend="10.0.0.1:80") or empty
+    void sample(const char* name, const std::string& labels, double value);
+
+    // _bucket, _sum and _count samples of a histogram recorded in microseconds, reported in seconds
+    void histogram(const char* name, const std::string& labels, const Histogram& histogram);
+
+    const std::string& text() const { return output; }
+
+private:
+    std::string output;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef OUTLIER_DETECTOR_H
+#define OUTLIER_DETECTOR_H
+
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include "core/backend.h"
+
+// Passive outlier detection settings
+struct OutlierOptions {
+    unsigned int consecutive_server_errors = 5;       // 5xx responses in a row that eject a backend; 0 disables
+    unsigned int consecutive_connection_failures = 3; // Connection failures/timeouts in a row that eject; 0 disables
+    double latency_factor = 3.0;                      // Eject when first-byte latency exceeds this multiple of the
+                                                      // other backends' average; 0 disables
+    std::chrono::milliseconds min_outlier_latency{50}; // Latencies below this are never outliers
+    std::chrono::milliseconds base_ejection_time{10000}; // First ejection; doubles with every repeat
+    std::chrono::milliseconds max_ejection_time{300000};
+    unsigned int max_ejection_percent = 50; // Never eject more than this share of the backends
+};
+
+// Ejects backends that misbehave on live traffic for an exponentially growing period.
+// Called concurrently from every worker thread: counters are per-backend atomics and
+// only the (rare) ejection decision takes a lock.
+class OutlierDetector {
+public:
+    OutlierDetector(const std::atomic<const BackendSet*>& backend_set, const OutlierOptions& options);
+
+    // Account for a finished request; first_byte_latency is the time until the response head
+    void record(Backend& backend, RequestOutcome outcome, std::chrono::microseconds first_byte_latency);
+
+private:
+    const std::atomic<const BackendSet*>& backend_set;
+    OutlierOptions options;
+    std::mutex ejection_mutex; // Keeps concurrent ejections within max_ejection_percent
+
+    void track_latency(Backend& backend, std::chrono::microseconds latency, int64_t now);
+    void eject(Backend& backend, int64_t now, const char* reason);
+};
+
+#endif
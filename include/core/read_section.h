@@ -0,0 +1,23 @@
+#ifndef READ_SECTION_H
+#define READ_SECTION_H
+
+// Grace periods for snapshots read without locks (BackendSet and the strategy tables built from it).
+//
+// A reader keeps a ReadSection alive while it uses a snapshot: entering one stores the current
+// epoch into a slot of the thread's own, on its own cache line, and leaving clears it. A writer
+// that has unpublished a snapshot calls wait_for_readers(); once it returns, every section that
+// could still see the old snapshot has ended and it can be freed (RCU's grace period).
+// Sections nest, must stay short, and must not wait for a writer.
+class ReadSection {
+public:
+    ReadSection();
+    ~ReadSection();
+
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+
+    // Block until every ReadSection entered before the call has ended; never call it from inside one
+    static void wait_for_readers();
+};
+
+#endif
@@ -2,13 +2,30 @@
 #define REQUEST_H
 
 #include <string>
+#include <string_view>
 #include <map>
+#include "core/http_parser.h"
 
 
 class Request {
 public:
     Request(const std::string& raw_request);
 
+    // Adopt a request whose head was already parsed (e.g. while framing it off the socket)
+    Request(std::string raw_request, const HttpRequestParser& parsed);
+
+    // Refer to a parsed request's bytes where they are, without copying them; the caller keeps
+    // them in place and unchanged for as long as the Request (and its copies) are used
+    Request(std::string_view raw_request, const HttpRequestParser& parsed);
+
+    Request(const Request& other);
+    Request(Request&& other) noexcept;
+    Request& operator=(const Request& other);
+    Request& operator=(Request&& other) noexcept;
+
+    bool is_valid() const;
+    ParseError get_parse_error() const;
+
     std::string get_method() const;
     std::string get_path() const;
     std::string get_header(const std::string& key) const;
@@ -16,15 +33,18 @@ public:
     std::map<std::string, std::string> get_query_params() const;
     std::string get_raw_request() const;
 
+    // Views into the raw request; valid for the lifetime of this Request
+    std::string_view method_view() const;
+    std::string_view path_view() const;
+    std::string_view header_view(std::string_view key) const;
+    std::string_view raw_request_view() const;
+    const HttpRequestParser& parsed() const;
+
 private:
-    std::string method;
-    std::string path;
-    std::map<std::string, std::string> headers;
-    std::map<std::string, std::string> query_params;
-    std::string raw_request;
-
-    void parse_headers(const std::string& header_lines);
-    void parse_query_params(const std::string& query_string);
+    std::string storage;      // The bytes, unless they live in the caller's buffer
+    std::string_view raw_request;
+    bool owned;               // raw_request views storage
+    HttpRequestParser parser; // Offsets into raw_request
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,25 +2,68 @@
 #define RESPONSE_H
 
 #include <string>
-#include <map>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <sys/uio.h>
 
+// Fixed responses the proxy sends often enough to keep fully serialized
+enum class CannedResponse {
+    CONTINUE,            // "100 Continue" interim response
+    BAD_REQUEST,         // 400, closing the connection
+    NOT_FOUND,           // 404 page
+    SERVICE_UNAVAILABLE, // 503 with Retry-After, closing the connection
+    BAD_GATEWAY,         // 502 when the backends failed before responding, closing the connection
+    GATEWAY_TIMEOUT,     // 504 when the backends did not respond in time, closing the connection
+    HEALTH_OK,           // 200 "OK" for /health
+    WELCOME              // 200 landing page for /
+};
 
+// Builds a response and serializes it in one pass, into a caller's buffer, an iovec list for
+// writev/sendmsg, or a string. Content-Length is added from the body unless a Content-Length or
+// Transfer-Encoding header was set, or the status never has a body (1xx, 204, 304).
 class Response {
 public:
     Response(int status_code);
 
-    void set_body(const std::string& body);
+    void set_body(std::string body);
 
+    // Add a header, replacing one of the same name (compared case-insensitively); headers are
+    // sent in the order they were first added
     void add_header(const std::string& key, const std::string& value);
 
+    // Bytes the serialized response takes
+    size_t serialized_size() const;
+
+    // Serialize into buffer; returns the length, or 0 if it needs more than size bytes
+    size_t write_to(char* buffer, size_t size) const;
+
+    // Serialize the head into head_buffer and point iov at it and at the body, which is not copied.
+    // Returns the number of iovec entries used (1 without a body, else 2), or 0 if the head does not fit.
+    // The iovecs reference this Response, which must outlive the write.
+    size_t write_iov(char* head_buffer, size_t head_size, struct iovec iov[2]) const;
+
     std::string build_response() const;
 
+    // "HTTP/1.1 NNN Reason\r\n" for the standard status codes, fixed at compile time; empty for others
+    static std::string_view status_line(int status_code);
+
+    // A canned response, serialized once per process. keep_alive chooses the Connection header of
+    // responses that leave the connection open; the error responses (4xx, 5xx) always close it.
+    static const std::string& canned(CannedResponse which, bool keep_alive = false);
+
+    // Prebuilt "503 Service Unavailable" (closing the connection) for shedding load without building a response
+    static const std::string& service_unavailable() { return canned(CannedResponse::SERVICE_UNAVAILABLE); }
+
 private:
     int status_code;
     std::string body;
-    std::map<std::string, std::string> headers;
+    std::vector<std::pair<std::string, std::string>> headers; // Few per response: a flat list beats a map
 
-    std::string get_status_message() const;
+    bool automatic_content_length() const;
+    size_t head_size() const;
+    size_t write_head(char* buffer, size_t size) const;
 };
 
-#endif
\ No newline at end of file
+#endif
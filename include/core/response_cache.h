@@ -0,0 +1,137 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "core/http_parser.h"
+#include "core/metrics.h"
+
+// What the proxy caches and how much memory it may use
+struct CacheOptions {
+    bool enabled = false;
+    size_t memory_budget = 64 * 1024 * 1024; // Bytes of responses and keys kept, over all shards
+    size_t max_object_size = 1024 * 1024;    // Larger responses are relayed but not stored
+    size_t shards = 16;                      // Independently locked LRU lists
+
+    // Query parameters that are part of the key, in this order; empty keys on the whole query string
+    std::vector<std::string> key_params;
+
+    // Longest a miss waits for a concurrent fetch of the same key before fetching itself
+    std::chrono::milliseconds coalesce_timeout{5000};
+
+    // Misses of a key whose response was not cacheable skip coalescing for this long
+    std::chrono::milliseconds uncacheable_ttl{30000};
+};
+
+// A response stored exactly as it is sent to clients, minus the headers that differ per client
+struct CachedResponse {
+    std::string bytes;   // Status line, headers and body; no Connection, Keep-Alive or Age header
+    size_t head_end = 0; // Offset of the blank line ending the head, where per-client headers go
+    int status_code = 0;
+    bool uncacheable = false; // Marker left by a fetch whose response could not be stored
+    int64_t initial_age = 0;  // Seconds, from the backend's Age header
+    std::chrono::steady_clock::time_point stored;
+    std::chrono::steady_clock::time_point expires;
+
+    // Write the Age header (and "Connection: close" unless keep_alive) into buffer; returns its length
+    size_t client_headers(bool keep_alive, char* buffer, size_t size) const;
+
+    // The whole response for one client, for callers that send from a single buffer
+    std::string serialize(bool keep_alive) const;
+};
+
+// How a lookup went
+enum class CacheLookup {
+    HIT,   // A fresh response was found
+    FETCH, // Miss; the caller fetches the response and must end with finish_fetch() or abandon_fetch()
+    BYPASS // Miss that another request is already fetching, or a known uncacheable key: just forward it
+};
+
+// In-memory HTTP cache for GET responses, shared by every thread and reactor.
+//
+// Keys hash to shards, each an LRU list behind its own mutex with an equal share of the
+// memory budget. Lookups and stores hold the lock only to find, link or unlink an entry;
+// entries are immutable and shared, so a hit is sent after the lock is released and
+// survives eviction until it has been sent.
+//
+// Concurrent misses of one key are coalesced: the first becomes the fetch leader and the
+// others wait (when they can block) for its response instead of all going to a backend.
+class ResponseCache {
+public:
+    explicit ResponseCache(const CacheOptions& options = CacheOptions());
+
+    bool enabled() const { return options.enabled; }
+
+    // Build the key of a request that may be answered from the cache: GET over HTTP/1.1,
+    // without a body, credentials or a client request to bypass caches. Returns false otherwise.
+    // The key is the Host plus the path and query: the backends are taken to be one origin per
+    // host, interchangeable for any request.
+    bool make_key(const HttpRequestParser& request, std::string& key) const;
+
+    // Find a fresh response. With wait_for_fetch, a miss on a key being fetched waits for
+    // that fetch (up to coalesce_timeout); otherwise it is told to BYPASS.
+    CacheLookup lookup(const std::string& key, bool wait_for_fetch, std::shared_ptr<const CachedResponse>& response);
+
+    // End a FETCH with the entry made from the response (see make_entry), or nullptr when the
+    // response may not be stored, which marks the key uncacheable for uncacheable_ttl
+    void finish_fetch(const std::string& key, std::shared_ptr<CachedResponse> response);
+
+    // End a FETCH that produced no complete response; waiters retry on their own
+    void abandon_fetch(const std::string& key);
+
+    // Parse a complete response (head and body, as relayed to the client) and decide whether
+    // and for how long it may be cached, following Cache-Control, Expires, Date and Age; nullptr if it may not
+    static std::shared_ptr<CachedResponse> make_entry(const std::string& response_bytes);
+
+    size_t max_object_size() const { return options.max_object_size; }
+
+    // Hit, miss and eviction counters and memory use, in the Prometheus text format
+    void write_metrics(MetricsWriter& out) const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const CachedResponse> response;
+        size_t charge; // Bytes counted against the budget
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::condition_variable fetch_done;
+        std::list<Entry> lru; // Most recently used first
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // Keys view Entry::key
+        std::unordered_set<std::string> fetching; // Keys with a leader fetching them
+        size_t bytes = 0;
+    };
+
+    CacheOptions options;
+    size_t shard_budget;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    Counter hits;
+    Counter misses;
+    Counter coalesced; // Hits served after waiting for another request's fetch
+    Counter bypassed;
+    Counter stores;
+    Counter evictions;
+    Gauge bytes_used;
+    Gauge entries;
+
+    Shard& shard_for(const std::string& key);
+
+    // Link a response at the front of the shard's LRU list, evicting from the back to stay in budget
+    void insert(Shard& shard, const std::string& key, std::shared_ptr<const CachedResponse> response);
+    void erase(Shard& shard, std::list<Entry>::iterator entry);
+};
+
+#endif
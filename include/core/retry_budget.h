@@ -0,0 +1,48 @@
+#ifndef RETRY_BUDGET_H
+#define RETRY_BUDGET_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Retries of failed requests and hedges of slow ones, both limited to idempotent requests
+struct RetryOptions {
+    size_t max_retries = 1;            // Further attempts after a failure, each on another backend if there is one
+    double budget_ratio = 0.2;         // Retries and hedges add at most this share to the requests sent...
+    size_t budget_min_per_second = 10; // ...but this many per second are always allowed
+    bool hedging = false;              // Send a second copy of a request its backend is slow to answer
+    double hedge_quantile = 0.95;      // Hedge once the backend's recent times to first byte say it is late
+    std::chrono::milliseconds hedge_min_delay{5}; // Never hedge sooner than this
+};
+
+// Methods whose requests can safely be sent twice (RFC 9110, section 9.2.2)
+bool is_idempotent_method(std::string_view method);
+
+// Keeps retries and hedges to a share of the traffic, so that when the backends struggle the
+// proxy does not multiply their load. Every first attempt deposits budget_ratio of a token and
+// every retry or hedge takes a whole one; unused tokens are banked up to ten seconds' worth of
+// the minimum. The minimum is a separate per-second allowance, so a quiet proxy can still retry.
+//
+// Lock-free: a CAS on the token balance, and one on the packed second and count of the allowance.
+class RetryBudget {
+public:
+    explicit RetryBudget(const RetryOptions& options = RetryOptions());
+
+    // Account for a first attempt
+    void deposit();
+
+    // Take one retry or hedge from the budget; false when it is spent
+    bool try_withdraw();
+
+private:
+    int64_t deposit_millitokens;
+    int64_t max_millitokens;
+    uint64_t min_per_second;
+
+    std::atomic<int64_t> balance;     // In thousandths of a retry
+    std::atomic<uint64_t> allowance;  // Current second << ALLOWANCE_BITS | retries taken from the minimum in it
+};
+
+#endif
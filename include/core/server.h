@@ -4,47 +4,194 @@
 #include <string>
 #include <vector>
 #include <mutex>
+#include <chrono>
+#include <atomic>
+#include <thread>
 #include "core/thread_pool.h"
 #include "core/load_balancer.h"
+#include "core/connection_pool.h"
+#include "core/server_options.h"
+#include "core/server_metrics.h"
 #include "core/request.h"
 #include "core/response.h"
+#include "core/http_framing.h"
+#include "core/header_rewrite.h"
+#include "core/logger.h"
+#include "core/response_cache.h"
+
+// Environment variable telling a process started by a binary upgrade which descriptor leads back
+// to the process it replaces (see Server::upgrade_binary)
+constexpr const char* UPGRADE_FD_VARIABLE = "CRABBY_UPGRADE_FD";
 
 // Define server modes
 enum class ServerMode {
     BASIC,
     MULTI_THREAD,
     THREAD_POOL,
-    LOAD_BALANCER
+    LOAD_BALANCER,
+    EVENT_LOOP
+};
+
+// Outcome of one request/response exchange with a backend
+enum class ExchangeResult {
+    REUSABLE, // Full response relayed; the backend connection can go back to the pool
+    COMPLETE, // Full response relayed; the backend connection must be closed
+    STALE,      // Backend failed or timed out before sending any response byte, so the request can be retried
+    UNANSWERED, // Backend failed before any response byte reached the client, but the request cannot be sent again
+    FAILED      // Backend or client failed mid-response
+};
+
+// How a backend handled an exchange, for passive outlier detection
+struct BackendResponse {
+    RequestOutcome outcome = RequestOutcome::ABORTED;
+    BackendTiming timing;
+    int status_code = 0;  // Final response status; 0 until its head arrives
+    size_t bytes = 0;     // Response bytes relayed to the client
+    bool capture = false; // Copy the final response into captured for the cache; cleared if it grows too large
+    std::string captured;
+};
+
+// One backend a request was sent to, and the connection it went out on
+struct BackendAttempt {
+    Backend* backend = nullptr;
+    int socket = -1;
+    bool reused = false; // socket came from the idle pool
+    std::chrono::steady_clock::time_point selected; // When the backend was picked
+    std::chrono::steady_clock::time_point sent;     // When the whole request had been sent
+    BackendResponse response;
 };
 
 class Server {
 public:
-    Server(int port, ServerMode mode, const std::vector<std::string>& backends = {});
+    Server(int port, ServerMode mode, const std::vector<std::string>& backends = {},
+           const ServerOptions& options = ServerOptions());
     ~Server();
 
-    // Start server based on selected mode
+    // Remember how the process was started, so a binary upgrade can exec the same command line and
+    // a reload can apply its options over the file again.
+    // argv[0] is resolved to the executable's path now: after a deploy replaces the file there,
+    // that path is the new binary.
+    void set_command_line(int argc, char* argv[]);
+
+    // Take over the listening sockets of the process upgrading to this one, sent over
+    // upgrade_socket; start() tells that process once it is ready. False if none arrived.
+    bool inherit_listeners(int upgrade_socket);
+
+    // Serve in the selected mode until a shutdown or upgrade has drained every connection
     void start();
 
 private:
     int port;
     ServerMode mode;
+    ServerOptions options;
+
+    std::vector<int> listen_sockets;      // One per reactor in EVENT_LOOP mode, otherwise one
+    std::vector<int> inherited_listeners; // Received from the process being upgraded
+    int upgrade_socket;                   // To that process, until it is told we are ready; else -1
+    std::string executable;
+    std::vector<std::string> command_line;
+
+    // Written once to wake every accept loop and reactor when the server starts draining
+    int drain_event;
+    std::atomic<bool> draining;
+
+    // Runs handle_signals() from start() until start() returns; written to make it exit
+    std::thread signal_thread;
+    int signal_stop_event;
     ThreadPool thread_pool;
     LoadBalancer load_balancer;
+    BackendConnectionPool connection_pool;
+    ResponseCache cache;
+    ServerMetrics metrics;
+
+    // Bind (or adopt inherited) listening sockets, then tell an upgrading parent we are ready
+    void open_listeners();
 
     // Core server logic
     void start_basic();
     void start_multi_threaded();
     void start_thread_pool();
     void start_load_balancer();
+    void start_event_loop();
+
+    // Run one event-loop reactor on its own SO_REUSEPORT listener
+    void run_reactor(size_t reactor_index);
 
-    // Handle incoming requests
+    // Wait for the signals blocked in every other thread: SIGHUP reloads the configuration file,
+    // SIGUSR2 upgrades the binary, SIGTERM and SIGINT shut down gracefully (a second one at once).
+    // Returns once signal_stop_event is written.
+    void handle_signals();
+
+    // Start a new process of the (possibly replaced) binary, hand it the listening sockets and,
+    // once it is serving, drain this one. If it fails to start, this process carries on.
+    void upgrade_binary();
+
+    // Stop accepting and let the connections in flight finish
+    void begin_drain();
+
+    // Accept the next client on a threaded-mode listener; -1 once the server is draining
+    int accept_client(int server_fd);
+
+    // Threaded modes: wait for the connections still open once accepting stopped, up to drain_timeout
+    void wait_for_connections();
+
+    // Re-read the configuration file and apply what can change without a restart: the backends
+    // and the log level. Options given on the command line still override the file. An invalid
+    // file is reported and leaves the running configuration alone.
+    void reload_config();
+
+    // Count an accepted connection against max_connections; over the limit it gets a 503 and is closed
+    bool admit_connection(int client_socket);
+
+    // Serve an admitted connection, then release its slot
+    void serve_connection(int client_socket);
+
+    // Handle incoming requests, serving keep-alive and pipelined requests in order
     void handle_request(int client_socket);
 
-    // Process request and generate response
-    void process_request(int client_socket, const Request& request);
+    // Process request and generate response; the status and size sent are noted in access.
+    // Returns false if the client connection cannot carry another request.
+    bool process_request(int client_socket, const Request& request, bool keep_alive, AccessLogEntry& access);
+
+    // Forward request to backend and send response. The part of the body that body still expects
+    // is streamed from the client; bytes read past it are left in client_buffer. An idempotent
+    // request that fails before any response byte is retried on another backend, within the
+    // retry budget; otherwise the client gets a 502, or a 504 if the backend timed out.
+    // keep_alive is cleared when the response forces the client connection to close.
+    // The backend, status and size sent are noted in access.
+    bool forward_request_to_backend(int client_socket, const Request& request, BodyFramer& body,
+                                    std::string& client_buffer, bool& keep_alive, AccessLogEntry& access);
+
+    // Answer a request from a cached response, without copying it
+    bool send_cached_response(int client_socket, const CachedResponse& cached, bool keep_alive,
+                              AccessLogEntry& access);
+
+    // Send the request to the attempt's backend on a pooled connection, or a new one if none is
+    // idle or the pooled one turns out to be closed. hedgeable requests may also go to a second
+    // backend when the first is slow (see await_first_byte). The head sent is rewritten unless
+    // rewritten is empty.
+    ExchangeResult attempt_backend(BackendAttempt& attempt, int client_socket, const Request& request,
+                                   const RewrittenHead& rewritten, BodyFramer& body, std::string& client_buffer, uint64_t request_hash,
+                                   bool hedgeable, bool& keep_alive);
+
+    // Open a new connection to the attempt's backend; on failure its outcome says whether the connect timed out
+    bool connect_attempt(BackendAttempt& attempt);
+
+    // Give the attempt's connection back to the pool (or close it) and release its backend
+    void finish_attempt(BackendAttempt& attempt, bool reusable);
+
+    // Wait up to the first-byte timeout for the backend to start answering. Past the backend's hedge
+    // delay, a hedgeable request is also sent to another backend (within the retry budget); whichever
+    // answers first is left in attempt, the other is released. False if neither answered in time.
+    bool await_first_byte(BackendAttempt& attempt, std::string_view raw_request, const RewrittenHead& rewritten,
+                          uint64_t request_hash, bool hedgeable);
 
-    // Forward request to backend and send response
-    void forward_request_to_backend(int client_socket, const Request& request);
+    // Send the request on the attempt's connection, stream the rest of its body and relay the framed response to the client
+    ExchangeResult exchange_with_backend(BackendAttempt& attempt, int client_socket,
+                                         std::string_view raw_request, const RewrittenHead& rewritten,
+                                         BodyFramer& request_body,
+                                         std::string& client_buffer, bool head_request, uint64_t request_hash,
+                                         bool hedgeable, bool& keep_alive);
 };
 
 #endif
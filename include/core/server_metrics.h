@@ -0,0 +1,26 @@
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <string>
+#include "core/metrics.h"
+#include "core/load_balancer.h"
+#include "core/response_cache.h"
+
+// Process-wide traffic metrics, shared by every mode, reactor and worker
+struct ServerMetrics {
+    Counter connections_accepted;
+    Counter connections_rejected; // Turned away by max_connections or a full accept queue
+    Gauge open_connections;       // Accepted client connections not yet closed
+    Gauge queued_connections;     // THREAD_POOL: accepted connections waiting for a worker
+    Counter requests;             // Request heads read from clients
+    Counter requests_shed;        // Refused by the adaptive concurrency limit
+    Counter retries;              // Requests sent again after a failed attempt
+    Counter hedges;               // Second copies of requests a backend was slow to answer
+    Counter hedges_won;           // Hedged requests the second copy answered first
+    Counter retries_denied;       // Retries and hedges the retry budget did not allow
+
+    // Complete HTTP response with every metric in the Prometheus text format
+    std::string build_response(const LoadBalancer& load_balancer, const ResponseCache& cache, bool keep_alive) const;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include "core/connection_pool.h"
+#include "core/header_rewrite.h"
+#include "core/load_balancer.h"
+#include "core/logger.h"
+#include "core/response_cache.h"
+
+// How EVENT_LOOP reactors wait for and perform socket I/O
+enum class IoEngine {
+    EPOLL,   // Readiness notifications, then one system call per read or write
+    IO_URING // Operations queued and submitted in batches (Linux 6.0+; falls back to epoll)
+};
+
+// Sizes of the buffers requests and responses pass through
+struct BufferOptions {
+    size_t read_size = 16 * 1024;           // Bytes read from a socket at a time; pooled buffers start this large
+    size_t max_request_buffer = 64 * 1024;  // Request bytes held ahead of the backend; the rest of a body streams
+    size_t max_response_buffer = 64 * 1024; // Response bytes held ahead of the client, and the copy buffer of threaded modes
+};
+
+// Tuning knobs that are not tied to a particular mode
+struct ServerOptions {
+    int port = 8080;           // Port every listener binds
+    int listen_backlog = 1024; // Connections the kernel queues per listener before accept()
+
+    // Configuration file the options came from; SIGHUP reloads its backends and log level
+    std::string config_path;
+
+    // After SIGTERM, SIGINT or a binary upgrade (SIGUSR2), connections still open after this long are cut
+    std::chrono::milliseconds drain_timeout{30000};
+
+    size_t worker_threads = 10; // THREAD_POOL: workers serving client connections (0 = one per CPU)
+    size_t max_queued_connections = 1024; // THREAD_POOL: accepted connections waiting for a worker
+
+    // Client connections open at once per listener; further clients get an immediate 503 (0 = unlimited)
+    size_t max_connections = 1024;
+    size_t reactor_threads = 1; // EVENT_LOOP: number of independent epoll reactors
+    bool pin_reactors = false;  // EVENT_LOOP: pin reactor i to CPU i (mod CPU count)
+    IoEngine io_engine = IoEngine::EPOLL; // EVENT_LOOP: how reactors do their I/O
+    PoolOptions backend_pool;   // Idle keep-alive connections kept per backend
+    LoadBalancerOptions load_balancing; // Backend selection, active health checks and outlier ejection
+
+    // Client connections stay open between requests (HTTP/1.1 keep-alive)
+    std::chrono::milliseconds keep_alive_timeout{5000}; // Close client connections idle for longer
+    size_t max_requests_per_connection = 100;           // Close after serving this many requests
+
+    // Deadlines of requests forwarded to backends (0 disables one). A request that misses one
+    // counts as a backend timeout, and is retried if it can be or answered with 504.
+    std::chrono::milliseconds backend_connect_timeout{2000};     // Opening a new connection
+    std::chrono::milliseconds backend_first_byte_timeout{30000}; // From the whole request sent to the first response byte
+    std::chrono::milliseconds backend_idle_timeout{60000};       // No byte moving while the request or response flows
+
+    // Response bodies with at least this many bytes left to relay (Content-Length or until-close)
+    // move backend -> client through a pipe with splice(2) instead of being copied; 0 disables it
+    size_t splice_threshold = 64 * 1024;
+
+    // Socket reads and the request and response bytes buffered per connection
+    BufferOptions buffers;
+
+    // Proxy modes: headers added, replaced or removed on requests forwarded to backends
+    HeaderRewriteOptions header_rewrite;
+
+    // Requests for this path are answered by the proxy itself with Prometheus metrics; empty disables it
+    std::string metrics_path = "/metrics";
+
+    // Proxy modes answer cacheable GETs from memory (off by default)
+    CacheOptions cache;
+
+    // Event log level and destination, and the per-request access log (off by default)
+    LogOptions logging;
+};
+
+#endif
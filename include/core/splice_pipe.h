@@ -0,0 +1,42 @@
+#ifndef SPLICE_PIPE_H
+#define SPLICE_PIPE_H
+
+#include <cstddef>
+#include <sys/types.h>
+
+// A kernel pipe used to relay bytes between two sockets with splice(2), so that response
+// bodies move backend -> pipe -> client without being copied through user space
+class SplicePipe {
+public:
+    SplicePipe();
+    ~SplicePipe();
+
+    SplicePipe(const SplicePipe&) = delete;
+    SplicePipe& operator=(const SplicePipe&) = delete;
+
+    // False if the pipe could not be created; callers fall back to read()/send()
+    bool is_open() const { return read_end >= 0; }
+
+    // Bytes sitting in the pipe, waiting to be written out
+    size_t buffered() const { return pending; }
+
+    // Room left in the pipe
+    size_t space() const { return capacity - pending; }
+
+    // Move up to length bytes from a socket into the pipe.
+    // Returns the number of bytes moved, 0 on EOF and -1 on error (EAGAIN when a
+    // non-blocking socket has nothing to read).
+    ssize_t fill(int socket, size_t length);
+
+    // Move buffered bytes from the pipe to a socket.
+    // Returns the number of bytes moved and -1 on error (EAGAIN when a non-blocking socket is full).
+    ssize_t drain(int socket);
+
+private:
+    int read_end;
+    int write_end;
+    size_t capacity;
+    size_t pending;
+};
+
+#endif
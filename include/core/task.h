@@ -0,0 +1,122 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only, type-erased void() callable for the thread pool.
+//
+// Callables up to INLINE_SIZE bytes (e.g. a lambda capturing [this, client_socket]) are
+// stored inside the Task itself, so creating and queueing one never touches the heap.
+// Larger callables, or ones that may throw while being moved, fall back to a heap copy.
+class Task {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    Task() noexcept : ops(nullptr) {}
+
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+    Task(F&& function) : ops(&operations<std::decay_t<F>>) {
+        using Callable = std::decay_t<F>;
+        if constexpr (stored_inline<Callable>()) {
+            new (&storage) Callable(std::forward<F>(function));
+        } else {
+            *reinterpret_cast<Callable**>(&storage) = new Callable(std::forward<F>(function));
+        }
+    }
+
+    Task(Task&& other) noexcept : ops(other.ops) {
+        if (ops != nullptr) {
+            ops->relocate(&other.storage, &storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops = other.ops;
+            if (ops != nullptr) {
+                ops->relocate(&other.storage, &storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+    void operator()() { ops->invoke(&storage); }
+
+    void reset() noexcept {
+        if (ops != nullptr) {
+            ops->destroy(&storage);
+            ops = nullptr;
+        }
+    }
+
+private:
+    using Storage = std::aligned_storage_t<INLINE_SIZE, alignof(std::max_align_t)>;
+
+    // One table of operations per callable type, shared by every Task holding that type
+    struct Operations {
+        void (*invoke)(void* storage);
+        void (*relocate)(void* from, void* to) noexcept; // Move into to and destroy from
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Callable>
+    static constexpr bool stored_inline() {
+        return sizeof(Callable) <= INLINE_SIZE && alignof(Callable) <= alignof(Storage) &&
+               std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+    template <typename Callable>
+    static Callable* target(void* storage) {
+        if constexpr (stored_inline<Callable>()) {
+            return std::launder(reinterpret_cast<Callable*>(storage));
+        } else {
+            return *reinterpret_cast<Callable**>(storage);
+        }
+    }
+
+    template <typename Callable>
+    static void invoke(void* storage) {
+        (*target<Callable>(storage))();
+    }
+
+    template <typename Callable>
+    static void relocate(void* from, void* to) noexcept {
+        if constexpr (stored_inline<Callable>()) {
+            Callable* source = target<Callable>(from);
+            new (to) Callable(std::move(*source));
+            source->~Callable();
+        } else {
+            *reinterpret_cast<Callable**>(to) = *reinterpret_cast<Callable**>(from);
+        }
+    }
+
+    template <typename Callable>
+    static void destroy(void* storage) noexcept {
+        if constexpr (stored_inline<Callable>()) {
+            target<Callable>(storage)->~Callable();
+        } else {
+            delete target<Callable>(storage);
+        }
+    }
+
+    template <typename Callable>
+    static constexpr Operations operations = {&invoke<Callable>, &relocate<Callable>, &destroy<Callable>};
+
+    const Operations* ops;
+    Storage storage;
+};
+
+#endif
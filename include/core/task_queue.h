@@ -0,0 +1,78 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "core/task.h"
+
+// Lock-free queues holding Tasks inline in fixed rings, so queueing a task never allocates.
+// push() leaves the task untouched when it fails, so the caller can put it elsewhere.
+
+// Chase-Lev work-stealing deque. Only the owning worker pushes and pops, at the bottom
+// (LIFO, cache-warm); any thread may steal from the top (FIFO, oldest work first).
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity); // Rounded up to a power of two
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only; false when the deque is full
+    bool push(Task& task);
+    bool pop(Task& task);
+
+    // Any thread; false when the deque is empty or another thread won the race for the task
+    bool steal(Task& task);
+
+    // Approximate, for idle heuristics
+    bool empty() const;
+
+private:
+    struct Slot {
+        // Set while the slot holds a task. A thief clears it only after moving the task out,
+        // so the owner never overwrites a task that is still being stolen.
+        std::atomic<bool> full{false};
+        Task task;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    alignas(64) std::atomic<int64_t> top;    // Next task to steal
+    alignas(64) std::atomic<int64_t> bottom; // Next free slot for the owner
+};
+
+// Bounded multi-producer multi-consumer FIFO (Vyukov's sequenced ring). Tasks submitted
+// from outside the pool land here and are picked up by whichever worker is free first.
+class BoundedTaskQueue {
+public:
+    explicit BoundedTaskQueue(size_t capacity); // Rounded up to a power of two
+
+    BoundedTaskQueue(const BoundedTaskQueue&) = delete;
+    BoundedTaskQueue& operator=(const BoundedTaskQueue&) = delete;
+
+    // false when the queue is full
+    bool push(Task& task);
+
+    // false when the queue is empty
+    bool pop(Task& task);
+
+    // Approximate, for idle heuristics
+    bool empty() const;
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence; // Tells producers and consumers whose turn the cell is
+        Task task;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueue_position;
+    alignas(64) std::atomic<size_t> dequeue_position;
+};
+
+#endif
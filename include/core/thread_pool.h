@@ -1,38 +1,82 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
+#include <cstdint>
 #include <vector>
-#include <queue>
+#include <memory>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
+#include "core/task.h"
+#include "core/task_queue.h"
 
 
+// Work-stealing thread pool.
+//
+// Each worker owns a lock-free deque: tasks enqueued by a worker go to its own deque, tasks
+// enqueued from other threads go to a shared lock-free injection queue. An idle worker takes
+// work from its deque, then the injection queue, then steals from its peers. Workers that
+// stay idle spin briefly, then yield, then park; enqueue_task only wakes a parked worker
+// when there is one, so a busy pool never touches the mutex.
 class ThreadPool {
 public:
+    static constexpr size_t DEFAULT_QUEUE_CAPACITY = 4096;
+
     // Constructor to create a thread pool with a specified number of threads
-    ThreadPool(size_t num_threads);
+    // (0 = one per hardware thread); queue_capacity bounds the tasks waiting to be picked up
+    // from outside the pool and is rounded up to a power of two
+    explicit ThreadPool(size_t num_threads, size_t queue_capacity = DEFAULT_QUEUE_CAPACITY);
 
-    // Destructor to clean up and stop all threads
+    // Destructor to run the queued tasks and stop all threads
     ~ThreadPool();
 
-    void enqueue_task(std::function<void()> task);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Blocks while the injection queue is full
+    void enqueue_task(Task task);
+
+    // Like enqueue_task, but drops the task and returns false when the queue is full
+    bool try_enqueue_task(Task task);
+
+    size_t size() const { return workers.size(); }
 
 private:
+    static constexpr size_t DEQUE_CAPACITY = 1024;
+    static constexpr size_t YIELD_ROUNDS = 16;
+
+    struct alignas(64) Worker {
+        WorkStealingDeque deque{DEQUE_CAPACITY};
+        std::thread thread;
+    };
+
     // Worker threads that will execute tasks
-    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // Tasks enqueued from outside the pool
+    BoundedTaskQueue injection_queue;
+
+    std::atomic<bool> stop;
 
-    // Task queue to hold incoming tasks
-    std::queue<std::function<void()>> tasks_queue;
+    // Idle workers sleep on the condition variable; wake_epoch changes on every wake-up
+    std::mutex park_mutex;
+    std::condition_variable park_condition;
+    std::atomic<size_t> parked;
+    uint64_t wake_epoch;
 
-    // Mutex and condition variable to synchronize access to the task queue
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop;
+    // Empty polls spent spinning before yielding (none on a single CPU, where it only delays the producer)
+    size_t spin_rounds;
 
     // Function that worker threads will execute
-    void worker_thread();
+    void worker_thread(size_t index);
+
+    // Own deque, then the injection queue, then the other workers' deques
+    bool find_task(size_t index, Task& task);
+    bool has_work() const;
+
+    void park();
+    void wake_one();
 };
 
-#endif
\ No newline at end of file
+#endif
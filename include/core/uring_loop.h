@@ -0,0 +1,239 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "core/event_loop.h"
+#include "core/io_uring.h"
+#include "core/load_balancer.h"
+#include "core/connection_pool.h"
+#include "core/header_rewrite.h"
+#include "core/http_framing.h"
+#include "core/http_parser.h"
+#include "core/server_options.h"
+#include "core/server_metrics.h"
+#include "core/response_cache.h"
+
+// Per-connection state of the io_uring reactor. Operations complete asynchronously, so every buffer
+// handed to the kernel (client_out, backend_out, backend_address, timeout) stays where it is until
+// the operation using it has completed, and the connection outlives all of its operations.
+struct UringConnection {
+    uint64_t id = 0; // Names the connection in the user data of its operations
+    int client_socket = -1;
+    int backend_socket = -1;
+    std::string client_address;    // "IP:PORT", looked up only for the access log or source-IP hashing
+    ConnectionState state = ConnectionState::READING_REQUEST;
+    bool closed = false;           // Both sockets are shut; freed once no operation is pending
+    unsigned pending = 0;          // Operations submitted whose last completion has not arrived
+
+    Backend* backend = nullptr;    // Chosen for the current request and counted in its active connections
+    RequestOutcome backend_outcome = RequestOutcome::ABORTED; // Reported to outlier detection on release
+    BackendTiming backend_timing;
+    std::chrono::steady_clock::time_point backend_selected;
+    std::chrono::steady_clock::time_point connect_started;
+    std::chrono::steady_clock::time_point request_forwarded;  // The whole request reached the backend
+    bool backend_reused = false;   // backend_socket came from the idle pool
+    bool backend_timed_out = false; // Shut down by the idle timeout rather than failed
+    uint16_t attempt = 0;          // Tags backend operations; those of an abandoned socket are ignored
+    uint64_t request_hash = 0;     // Routing key hash of the current request, for retries
+    size_t retries = 0;            // Other backends tried for the current request
+    struct sockaddr_in backend_address;
+    __kernel_timespec timeout;     // Of the linked timeout of a connect or a first-byte wait
+
+    // In-flight state of the client's multishot receive and of each direction's send
+    bool client_receiving = false;
+    bool client_paused = false;    // Its cancellation was requested, to stop buffering the client
+    bool client_sending = false;
+    bool backend_receiving = false;
+    bool backend_sending = false;
+
+    std::string request_buffer;  // Bytes read from the client, possibly several pipelined requests
+    HttpRequestParser request_parser; // Resumes over request_buffer as bytes arrive
+    BodyFramer request_body{MessageHead()};
+    size_t request_length = 0;   // Bytes of request_buffer framed as part of the current request so far
+    size_t request_sent = 0;     // Bytes of the current request copied into backend_out, not necessarily sent
+    bool request_streamed = false; // Forwarded body bytes were dropped, so the request cannot be replayed
+    bool head_request = false;   // HEAD responses carry no body whatever their headers say
+    RewrittenHead rewritten_head; // The head as forwarded, when headers are rewritten (empty otherwise)
+    std::string backend_out;     // Request bytes being sent; request_buffer grows while they are
+    size_t backend_out_sent = 0;
+
+    // Access log of the request in flight, written when it finishes or the connection closes
+    bool request_active = false;
+    std::chrono::steady_clock::time_point request_started;
+    std::string request_method;  // Copied when the request starts: a streamed body erases its head
+    std::string request_path;
+    std::string served_by;       // Backend address, kept after the backend is released
+    int response_status = 0;
+    size_t response_delivered = 0; // Bytes written to the client
+
+    bool client_keep_alive = false; // Serve another request on this client connection afterwards
+    bool client_eof = false;        // Client closed its sending side
+    size_t requests_served = 0;
+    std::chrono::steady_clock::time_point last_activity; // Last byte moved between client, proxy and backend
+
+    std::string response_head;   // Response bytes buffered until the head is complete
+    bool have_response_head = false;
+    MessageHead response_info;
+    bool backend_keep_alive = false; // Backend will accept another request on this connection
+    BodyFramer response_body{MessageHead()};
+    size_t response_bytes = 0;   // Total response bytes received from the backend
+    bool response_complete = false;
+    bool backend_in_sync = true; // No bytes arrived past the end of the response
+    bool backend_eof = false;    // Backend closed its side of the connection
+
+    // Set while this request leads the cache fetch of its key (see Connection)
+    std::string cache_key;
+    std::string cache_fill;
+    bool cache_filling = false;
+
+    std::string response_buffer; // Response bytes waiting for client_out to be sent
+    std::string client_out;      // Response bytes being sent to the client
+    size_t client_out_sent = 0;
+};
+
+// Single-threaded reactor on io_uring, an alternative to the epoll EventLoop for the same proxying.
+// Where the epoll loop makes a system call per socket operation, this one queues operations and
+// hands each batch to the kernel in the io_uring_enter() that also waits for completions:
+//   - the listener is served by one multishot accept, and clients by one multishot receive each,
+//     filling buffers the kernel picks from a shared provided-buffer ring
+//   - a new backend connection is a connect linked to the send of the request (and to a linked
+//     timeout), submitted together
+//   - the connect and first-byte timeouts are linked timeouts; idle timeouts are swept every second
+// Response bodies are copied rather than spliced, and requests are not hedged.
+class UringLoop {
+public:
+    // drain_event becomes readable when the server starts draining (-1 if it never does)
+    UringLoop(int listen_socket, int drain_event, LoadBalancer& load_balancer, ResponseCache& cache,
+              ServerMetrics& metrics, const ServerOptions& options = ServerOptions());
+    ~UringLoop();
+
+    UringLoop(const UringLoop&) = delete;
+    UringLoop& operator=(const UringLoop&) = delete;
+
+    // False if the kernel does not support what the loop needs; use the epoll loop instead
+    bool is_open() const { return buffers.is_open(); }
+
+    // Run the reactor until it has drained after the drain event, or fails
+    void run();
+
+private:
+    // What a completion is for, in the low byte of its user data
+    enum class Operation : uint8_t {
+        ACCEPT = 1,
+        DRAIN,
+        CLIENT_RECEIVE,
+        CLIENT_SEND,
+        CONNECT,
+        BACKEND_SEND,
+        BACKEND_RECEIVE,
+        LINK_TIMEOUT,
+        CANCEL
+    };
+
+    int listen_socket; // Shared with other reactors or a successor process: never closed here
+    int drain_event;
+    bool draining;
+    std::chrono::steady_clock::time_point drain_deadline;
+    LoadBalancer& load_balancer;
+    ResponseCache& cache; // Shared by every reactor
+    ServerMetrics& metrics;
+    ServerOptions options;
+
+    // Idle keep-alive backend connections owned by this reactor
+    BackendConnectionPool connection_pool;
+    uint64_t pooled_backends_version; // LoadBalancer::backends_version() the pool was last pruned for
+
+    std::unordered_map<uint64_t, std::unique_ptr<UringConnection>> connections;
+    uint64_t last_connection_id;
+    size_t client_connections; // Open client connections, bounded by options.max_connections
+    bool accepting;            // The multishot accept is armed
+
+    // Sockets shut down since the last submission. They are closed only after it, so that no
+    // queued operation can reach a descriptor number that was closed and reused.
+    std::vector<int> closing_sockets;
+    std::vector<uint64_t> closed_connections; // Closed since the last batch, freed once idle
+
+    // Freed connections kept for the next clients, with the buffers they grew
+    std::vector<std::unique_ptr<UringConnection>> spare_connections;
+
+    // Declared last: the ring goes before the connections whose buffers its operations use
+    IoUring ring;
+    BufferRing buffers;
+
+    // Completion dispatch
+    void handle_completion(const io_uring_cqe& cqe);
+    void handle_client_receive(UringConnection& conn, int result, const char* data);
+    void handle_client_send(UringConnection& conn, int result);
+    void handle_connect(UringConnection& conn, int result);
+    void handle_backend_send(UringConnection& conn, int result);
+    void handle_backend_receive(UringConnection& conn, int result, const char* data);
+
+    // Queue an operation of the connection (nullptr for the listener); nullptr if the ring is full
+    io_uring_sqe* queue(UringConnection* conn, Operation operation);
+
+    // Listener
+    void accept_connections();
+    void add_connection(int client_socket);
+
+    // Drop a connection none of whose operations is pending, keeping it as a spare if there is room
+    void free_connection(std::unordered_map<uint64_t, std::unique_ptr<UringConnection>>::iterator it);
+    void start_draining();
+
+    // Close client connections idle between requests, and backend exchanges idle for too long
+    void sweep_idle_connections();
+
+    // Client reads: one multishot receive, cancelled while too much is buffered
+    void receive_client(UringConnection& conn);
+    void pause_client(UringConnection& conn);
+    void resume_client(UringConnection& conn);
+
+    // State machine steps, as in EventLoop
+    void dispatch_request(UringConnection& conn);
+    bool frame_request(UringConnection& conn);
+    void finish_request(UringConnection& conn);
+    void connect_to_backend(UringConnection& conn);
+    bool select_backend(UringConnection& conn, const Backend* avoid);
+    void open_backend_connection(UringConnection& conn, bool allow_reuse);
+    void send_request(UringConnection& conn);
+    void receive_response(UringConnection& conn);
+    bool frame_response(UringConnection& conn, const char* data, size_t length);
+    void send_response(UringConnection& conn);
+
+    // The response is out: serve the next request, close, or read more of it
+    void response_drained(UringConnection& conn);
+
+    // Copy relayed response bytes for the cache while this request leads a fetch
+    void fill_cache(UringConnection& conn, const char* data, size_t length);
+
+    // Store (or give up) the fetched response once it is complete or the connection closes
+    void finish_cache_fill(UringConnection& conn, bool complete);
+
+    // Retry on a fresh connection after a pooled one turned out to be stale
+    void retry_backend(UringConnection& conn);
+
+    // Retry an idempotent request elsewhere, or answer 502/504, as EventLoop::backend_failed
+    void backend_failed(UringConnection& conn, RequestOutcome outcome);
+
+    // Detach the backend socket, returning it to the pool when it can carry another request
+    void release_backend(UringConnection& conn, bool reusable);
+
+    // Shut a socket down now (ending its pending operations) and close it after the next submission
+    void retire_socket(int socket);
+
+    // Answer the request from the proxy itself (the metrics page or a cache hit)
+    void respond_locally(UringConnection& conn, const std::string& response);
+
+    // Write the access-log line of the request in flight, if any
+    void log_request(UringConnection& conn);
+
+    // Send a short error response and close the connection
+    void fail_connection(UringConnection& conn, const std::string& response);
+    void close_connection(UringConnection& conn);
+};
+
+#endif
@@ -2,15 +2,71 @@
 #define UTILS_H
 
 #include <string>
+#include <vector>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
-// Create a listening socket
-int create_listening_socket(int port);
+// Create a listening socket; reuse_port lets several sockets share the port (SO_REUSEPORT).
+// backlog bounds the connections the kernel queues before they are accepted.
+int create_listening_socket(int port, bool reuse_port = false, int backlog = 1024);
 
 // Send data over a socket
-void send_data(int socket, const std::string& data);
+bool send_data(int socket, const std::string& data);
 
-// Read data from a socket
-std::string read_data(int socket);
+// Answer a just-accepted connection that will not be served (e.g. "503 Service Unavailable") and close it.
+// Request bytes that already arrived are read first, so closing does not reset the connection
+// before the client has seen the response.
+void reject_connection(int socket, const std::string& response);
+
+// Send a whole buffer, retrying partial writes; never raises SIGPIPE
+bool send_all(int socket, const char* data, size_t length);
+
+// Send every byte of several buffers with as few system calls as possible; never raises SIGPIPE.
+// iov is advanced past what has been sent.
+bool send_iov(int socket, struct iovec* iov, size_t count);
+
+// Read whatever is available from a socket, up to max_bytes, and append it to buffer.
+// Returns the number of bytes read, 0 on EOF and -1 on error or timeout.
+ssize_t read_data(int socket, std::string& buffer, size_t max_bytes = 16 * 1024);
+
+// Receive up to max_bytes straight into the end of buffer, without an intermediate copy, retrying
+// on EINTR. Returns what recv() does, with errno set by it; buffer only grows by the bytes received.
+ssize_t receive_into(int socket, std::string& buffer, size_t max_bytes);
+
+// Bound how long blocking reads on the socket may wait
+void set_receive_timeout(int socket, std::chrono::milliseconds timeout);
+
+// Bound how long blocking writes on the socket may wait
+void set_send_timeout(int socket, std::chrono::milliseconds timeout);
+
+// Switch a socket to non-blocking mode
+bool set_non_blocking(int socket);
+
+// Pin the calling thread to a single CPU
+bool pin_current_thread_to_cpu(int cpu);
+
+// Resolve an "IP:PORT" backend address
+bool parse_backend_address(const std::string& address, struct sockaddr_in& backend_address);
+
+// "IP:PORT" of the remote end of a connected socket; empty if it cannot be determined
+std::string peer_address(int socket);
+
+// Pass file descriptors to another process over a Unix socket (SCM_RIGHTS); at most MAX_PASSED_FDS
+constexpr size_t MAX_PASSED_FDS = 64;
+bool send_fds(int socket, const std::vector<int>& fds);
+
+// Receive file descriptors sent with send_fds(); they arrive close-on-exec.
+// Returns false if the peer closed the socket or sent none.
+bool receive_fds(int socket, std::vector<int>& fds);
+
+// Open a TCP connection to a backend; with non_blocking the connect may still be in progress.
+// Returns -1 if the socket could not be created or the connect failed outright.
+int open_backend_socket(const std::string& address, bool non_blocking);
+
+// Open a blocking TCP connection to a backend, waiting at most connect_timeout (0 = no limit).
+// Returns -1 if it failed; errno is ETIMEDOUT when the timeout expired.
+int open_backend_socket(const std::string& address, std::chrono::milliseconds connect_timeout);
 
 #endif
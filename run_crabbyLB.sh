@@ -7,6 +7,7 @@
 PORT=8080
 MODE=""
 BACKENDS=()
+EXTRA_ARGS=()
 
 # Paths
 BUILD_DIR="build"
@@ -16,11 +17,15 @@ STOP_BACKENDS="scripts/stop_backends.py"
 
 # Print usage
 usage() {
-    echo "Usage: $0 -m <mode> [-b <backend_addresses>]"
-    echo "Modes: basic, multi_thread, thread_pool, load_balancer"
+    echo "Usage: $0 -m <mode> [-b <backend_addresses>] [-a <algorithm>] [-t <threads>] [-r <reactors>] [-p]"
+    echo "Modes: basic, multi_thread, thread_pool, load_balancer, event_loop"
+    echo "Algorithms: round_robin, least_conn, p2c, random"
     echo "Examples:"
     echo "  Run Basic Mode:          $0 -m basic"
     echo "  Run Load Balancer Mode:  $0 -m load_balancer -b 127.0.0.1:8081,127.0.0.1:8082"
+    echo "  Run Weighted P2C:        $0 -m load_balancer -b 127.0.0.1:8081@3,127.0.0.1:8082 -a p2c"
+    echo "  Run 16 Pool Workers:     $0 -m thread_pool -t 16"
+    echo "  Run 4 Pinned Reactors:   $0 -m event_loop -b 127.0.0.1:8081,127.0.0.1:8082 -r 4 -p"
     exit 1
 }
 
@@ -36,7 +41,7 @@ rebuild_crabbyLB() {
 # Rebuild CrabbyLB every time
 rebuild_crabbyLB
 
-# 🎉 Auto-start Python backend servers if using load_balancer mode
+# 🎉 Auto-start Python backend servers if using a proxy mode
 start_backends() {
     echo "🚀 Starting backend servers..."
     if [ -f "$START_BACKENDS" ]; then
@@ -64,7 +69,7 @@ stop_backends() {
 trap stop_backends SIGINT
 
 # Parse command-line arguments
-while getopts ":m:b:" opt; do
+while getopts ":m:b:a:t:r:p" opt; do
     case ${opt} in
         m )  # Mode
             MODE=$OPTARG
@@ -72,6 +77,18 @@ while getopts ":m:b:" opt; do
         b )  # Backend addresses (comma-separated)
             IFS=',' read -r -a BACKENDS <<< "$OPTARG"
             ;;
+        a )  # Backend selection algorithm
+            EXTRA_ARGS+=("--balance=$OPTARG")
+            ;;
+        t )  # Number of thread-pool workers
+            EXTRA_ARGS+=("--threads=$OPTARG")
+            ;;
+        r )  # Number of event-loop reactors
+            EXTRA_ARGS+=("--reactors=$OPTARG")
+            ;;
+        p )  # Pin event-loop reactors to CPUs
+            EXTRA_ARGS+=("--pin-cpus")
+            ;;
         \? )  # Invalid option
             echo "❌ Invalid option: -$OPTARG"
             usage
@@ -89,18 +106,19 @@ if [ -z "$MODE" ]; then
     usage
 fi
 
-# Validate backend addresses if using load_balancer mode
-if [ "$MODE" == "load_balancer" ] && [ "${#BACKENDS[@]}" -eq 0 ]; then
-    echo "❌ Load balancer mode requires at least one backend address. Use -b <addresses>."
+# Validate backend addresses if using a proxy mode
+if [[ "$MODE" == "load_balancer" || "$MODE" == "event_loop" ]] && [ "${#BACKENDS[@]}" -eq 0 ]; then
+    echo "❌ $MODE mode requires at least one backend address. Use -b <addresses>."
     usage
 fi
 
 # Build the command
 CMD="$BIN $MODE"
-if [ "$MODE" == "load_balancer" ]; then
+if [[ "$MODE" == "load_balancer" || "$MODE" == "event_loop" ]]; then
     CMD="$CMD ${BACKENDS[@]}"
     start_backends  # ✅ Start backends before running CrabbyLB
 fi
+CMD="$CMD ${EXTRA_ARGS[@]}"
 
 # 🚀 Run CrabbyLB
 echo "🔄 Running: $CMD"
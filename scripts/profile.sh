@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# 🔥 Profile a CrabbyLB binary with perf and render a flame graph.
+# Build the profiling flavour first so perf can walk stacks through frame pointers:
+#   cmake -S . -B build-prof -DCRABBY_PROFILING=ON -DCMAKE_BUILD_TYPE=RelWithDebInfo && cmake --build build-prof
+#
+# Usage: scripts/profile.sh [-o <output_dir>] [-F <frequency>] -- <command> [args...]
+# Examples:
+#   scripts/profile.sh -- ./bin/hot_path_bench --benchmark_filter=BM_GetNextBackend
+#   scripts/profile.sh -- ./bin/crabbyLB event_loop 127.0.0.1:9081 127.0.0.1:9082   (Ctrl-C to stop)
+#
+# Writes perf.data, the folded stacks (perf.folded) and, when Brendan Gregg's FlameGraph
+# scripts are in PATH or $FLAMEGRAPH_DIR, flamegraph.svg.
+
+OUTPUT_DIR="profile"
+FREQUENCY=999
+
+usage() {
+    echo "Usage: $0 [-o <output_dir>] [-F <frequency>] -- <command> [args...]"
+    exit 1
+}
+
+while getopts "o:F:" opt; do
+    case "$opt" in
+        o) OUTPUT_DIR="$OPTARG" ;;
+        F) FREQUENCY="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ "$1" == "--" ] && shift
+[ $# -eq 0 ] && usage
+
+if ! command -v perf > /dev/null; then
+    echo "❗️ perf not found (install linux-tools for your kernel)"
+    exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+echo "🎯 Recording $* at ${FREQUENCY} Hz..."
+perf record -F "$FREQUENCY" --call-graph fp -o "$OUTPUT_DIR/perf.data" -- "$@"
+
+# Folds perf script samples (a comm line, then one "ip symbol" line per frame, leaf first,
+# then a blank line) into "comm;root;...;leaf count" lines
+FOLD_STACKS='
+function flush(    stack, i) {
+    if (depth > 0) {
+        stack = comm
+        for (i = depth; i >= 1; i--) stack = stack ";" frames[i]
+        counts[stack]++
+    }
+    depth = 0
+}
+/^[^ \t]/ { flush(); comm = $1; next }
+NF >= 2 { line = $0; sub(/^[ \t]*[0-9a-f]+ /, "", line); frames[++depth] = line; next }
+NF == 0 { flush() }
+END { flush(); for (stack in counts) print stack, counts[stack] }
+'
+
+# Locate the FlameGraph scripts
+STACKCOLLAPSE=$(command -v stackcollapse-perf.pl)
+FLAMEGRAPH=$(command -v flamegraph.pl)
+if [ -n "$FLAMEGRAPH_DIR" ]; then
+    STACKCOLLAPSE="$FLAMEGRAPH_DIR/stackcollapse-perf.pl"
+    FLAMEGRAPH="$FLAMEGRAPH_DIR/flamegraph.pl"
+fi
+
+if [ -x "$STACKCOLLAPSE" ] && [ -x "$FLAMEGRAPH" ]; then
+    perf script -i "$OUTPUT_DIR/perf.data" | "$STACKCOLLAPSE" > "$OUTPUT_DIR/perf.folded"
+    "$FLAMEGRAPH" "$OUTPUT_DIR/perf.folded" > "$OUTPUT_DIR/flamegraph.svg"
+    echo "✅ Flame graph: $OUTPUT_DIR/flamegraph.svg"
+else
+    # Folded stacks without the FlameGraph scripts: "frame;frame;frame count" per line
+    perf script -i "$OUTPUT_DIR/perf.data" -F comm,ip,sym | awk "$FOLD_STACKS" > "$OUTPUT_DIR/perf.folded"
+    echo "✅ Folded stacks: $OUTPUT_DIR/perf.folded (set FLAMEGRAPH_DIR to render flamegraph.svg)"
+fi
+echo "📊 Top symbols:"
+perf report -i "$OUTPUT_DIR/perf.data" --no-children --stdio --sort symbol 2>/dev/null | grep -v "^#" | grep -v "^$" | head -15
@@ -0,0 +1,352 @@
+#include "core/balancing_strategy.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace {
+
+// Per-thread xorshift64* generator: random picks never touch shared state
+uint64_t next_random() {
+    thread_local uint64_t state = [] {
+        uint64_t seed = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+                        static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        return seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+    }();
+
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+// Compare active connections relative to weight without dividing
+bool less_loaded(int a_active, const Backend& a, int b_active, const Backend& b) {
+    return static_cast<uint64_t>(a_active) * b.weight < static_cast<uint64_t>(b_active) * a.weight;
+}
+
+// Least-loaded available backend, scanning from start so that ties rotate
+Backend* least_loaded(const BackendSet& set, size_t start) {
+    size_t count = set.backends.size();
+    Backend* best = nullptr;
+    int best_active = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        Backend* backend = set.backends[(start + i) % count].get();
+        if (!backend->is_available()) {
+            continue;
+        }
+
+        int active = backend->active_connections.load(std::memory_order_relaxed);
+        if (best == nullptr || less_loaded(active, *backend, best_active, *best)) {
+            best = backend;
+            best_active = active;
+        }
+    }
+    return best;
+}
+
+// Requests without a routing key still have to go somewhere; spread them at random
+uint64_t key_or_random(uint64_t request_hash) {
+    return request_hash != 0 ? request_hash : next_random();
+}
+
+} // namespace
+
+uint64_t routing_hash_of(const char* data, size_t length, uint64_t seed) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+
+    // FNV-1a alone leaves similar keys (user1, user2, ...) close together; the murmur3
+    // finalizer spreads them over the whole range
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Precompute the smooth weighted round-robin order (as in nginx) and the weight totals
+BackendSet::BackendSet(std::vector<std::shared_ptr<Backend>> backend_list) : backends(std::move(backend_list)) {
+    for (const std::shared_ptr<Backend>& backend : backends) {
+        total_weight += backend->weight;
+        cumulative_weights.push_back(total_weight);
+    }
+
+    // Each round adds every weight to its running score and picks the highest, spreading a
+    // heavy backend's turns out instead of sending it a burst of consecutive requests
+    std::vector<int64_t> score(backends.size(), 0);
+    for (uint64_t turn = 0; turn < total_weight; ++turn) {
+        size_t best = 0;
+        for (size_t i = 0; i < backends.size(); ++i) {
+            score[i] += backends[i]->weight;
+            if (score[i] > score[best]) {
+                best = i;
+            }
+        }
+        score[best] -= static_cast<int64_t>(total_weight);
+        schedule.push_back(static_cast<uint32_t>(best));
+    }
+}
+
+bool parse_balancing_algorithm(const std::string& name, BalancingAlgorithm& algorithm) {
+    if (name == "round_robin") {
+        algorithm = BalancingAlgorithm::ROUND_ROBIN;
+    } else if (name == "least_conn") {
+        algorithm = BalancingAlgorithm::LEAST_CONNECTIONS;
+    } else if (name == "p2c") {
+        algorithm = BalancingAlgorithm::POWER_OF_TWO;
+    } else if (name == "random") {
+        algorithm = BalancingAlgorithm::RANDOM;
+    } else if (name == "ring_hash") {
+        algorithm = BalancingAlgorithm::RING_HASH;
+    } else if (name == "maglev") {
+        algorithm = BalancingAlgorithm::MAGLEV;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<BalancingStrategy> make_balancing_strategy(BalancingAlgorithm algorithm, double balance_factor) {
+    switch (algorithm) {
+        case BalancingAlgorithm::LEAST_CONNECTIONS:
+            return std::unique_ptr<BalancingStrategy>(new LeastConnectionsStrategy());
+        case BalancingAlgorithm::POWER_OF_TWO:
+            return std::unique_ptr<BalancingStrategy>(new PowerOfTwoChoicesStrategy());
+        case BalancingAlgorithm::RANDOM:
+            return std::unique_ptr<BalancingStrategy>(new RandomStrategy());
+        case BalancingAlgorithm::RING_HASH:
+            return std::unique_ptr<BalancingStrategy>(new RingHashStrategy(balance_factor));
+        case BalancingAlgorithm::MAGLEV:
+            return std::unique_ptr<BalancingStrategy>(new MaglevStrategy(balance_factor));
+        case BalancingAlgorithm::ROUND_ROBIN:
+        default:
+            return std::unique_ptr<BalancingStrategy>(new RoundRobinStrategy());
+    }
+}
+
+// Walk the weighted schedule, skipping backends that are down or ejected
+Backend* RoundRobinStrategy::select(const BackendSet& set, uint64_t /*request_hash*/) {
+    size_t length = set.schedule.size();
+    if (length == 0) {
+        return nullptr;
+    }
+
+    uint64_t start = next.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < length; ++i) {
+        Backend* backend = set.backends[set.schedule[(start + i) % length]].get();
+        if (backend->is_available()) {
+            return backend;
+        }
+    }
+    return nullptr;
+}
+
+Backend* LeastConnectionsStrategy::select(const BackendSet& set, uint64_t /*request_hash*/) {
+    if (set.backends.empty()) {
+        return nullptr;
+    }
+    return least_loaded(set, next.fetch_add(1, std::memory_order_relaxed) % set.backends.size());
+}
+
+// Sample two distinct backends and keep the less loaded one: nearly as good as a full
+// least-connections scan, O(1), and it avoids every thread herding onto the same backend
+Backend* PowerOfTwoChoicesStrategy::select(const BackendSet& set, uint64_t /*request_hash*/) {
+    size_t count = set.backends.size();
+    if (count < 2) {
+        return least_loaded(set, 0);
+    }
+
+    size_t first = next_random() % count;
+    size_t second = next_random() % (count - 1);
+    if (second >= first) {
+        ++second;
+    }
+
+    Backend* a = set.backends[first].get();
+    Backend* b = set.backends[second].get();
+    bool a_alive = a->is_available();
+    bool b_alive = b->is_available();
+
+    if (a_alive && b_alive) {
+        int a_active = a->active_connections.load(std::memory_order_relaxed);
+        int b_active = b->active_connections.load(std::memory_order_relaxed);
+        return less_loaded(b_active, *b, a_active, *a) ? b : a;
+    }
+    if (a_alive || b_alive) {
+        return a_alive ? a : b;
+    }
+    return least_loaded(set, first);
+}
+
+// Pick with probability proportional to weight, moving on to the next available backend if needed
+Backend* RandomStrategy::select(const BackendSet& set, uint64_t /*request_hash*/) {
+    if (set.total_weight == 0) {
+        return nullptr;
+    }
+
+    uint64_t point = next_random() % set.total_weight;
+    size_t index = std::upper_bound(set.cumulative_weights.begin(), set.cumulative_weights.end(), point) -
+                   set.cumulative_weights.begin();
+
+    size_t count = set.backends.size();
+    for (size_t i = 0; i < count; ++i) {
+        Backend* backend = set.backends[(index + i) % count].get();
+        if (backend->is_available()) {
+            return backend;
+        }
+    }
+    return nullptr;
+}
+
+BoundedLoad::BoundedLoad(const BackendSet& set, double balance_factor)
+    : balance_factor(balance_factor), requests_per_weight(0) {
+    if (balance_factor <= 0) {
+        return;
+    }
+
+    uint64_t in_flight = 1; // The request being placed
+    uint64_t available_weight = 0;
+    for (const std::shared_ptr<Backend>& backend : set.backends) {
+        in_flight += static_cast<uint64_t>(std::max(0, backend->active_connections.load(std::memory_order_relaxed)));
+        if (backend->is_available()) {
+            available_weight += backend->weight;
+        }
+    }
+    if (available_weight > 0) {
+        requests_per_weight = static_cast<double>(in_flight) / static_cast<double>(available_weight);
+    }
+}
+
+bool BoundedLoad::accepts(const Backend& backend) const {
+    if (!backend.is_available()) {
+        return false;
+    }
+    if (balance_factor <= 0) {
+        return true;
+    }
+
+    double capacity = std::ceil(balance_factor * requests_per_weight * backend.weight);
+    return backend.active_connections.load(std::memory_order_relaxed) < capacity;
+}
+
+std::unique_ptr<const RingHashStrategy::Ring> RingHashStrategy::build(const BackendSet& set) {
+    std::unique_ptr<Ring> ring(new Ring());
+    ring->set = &set;
+
+    for (size_t i = 0; i < set.backends.size(); ++i) {
+        const std::string& address = set.backends[i]->address;
+        uint64_t points = POINTS_PER_WEIGHT * set.backends[i]->weight;
+        for (uint64_t point = 0; point < points; ++point) {
+            std::string name = address + "-" + std::to_string(point);
+            ring->points.push_back({routing_hash_of(name.data(), name.size()), static_cast<uint32_t>(i)});
+        }
+    }
+
+    std::sort(ring->points.begin(), ring->points.end(),
+              [](const Point& a, const Point& b) { return a.hash < b.hash; });
+    return std::unique_ptr<const Ring>(std::move(ring));
+}
+
+// Walk clockwise from the key's position to the first backend that accepts the request
+Backend* RingHashStrategy::select(const BackendSet& set, uint64_t request_hash) {
+    const Ring& ring = rings.get(set, build);
+    size_t length = ring.points.size();
+    if (length == 0) {
+        return nullptr;
+    }
+
+    uint64_t key = key_or_random(request_hash);
+    size_t start = std::lower_bound(ring.points.begin(), ring.points.end(), key,
+                                    [](const Point& point, uint64_t hash) { return point.hash < hash; }) -
+                   ring.points.begin();
+
+    BoundedLoad bound(set, balance_factor);
+    uint32_t previous = UINT32_MAX;
+    for (size_t i = 0; i < length; ++i) {
+        uint32_t index = ring.points[(start + i) % length].backend;
+        if (index == previous) {
+            continue; // Consecutive points of a backend that was just refused
+        }
+        Backend* backend = set.backends[index].get();
+        if (bound.accepts(*backend)) {
+            return backend;
+        }
+        previous = index;
+    }
+
+    // Every available backend is at capacity (or none is available)
+    return least_loaded(set, 0);
+}
+
+// Each backend walks its own permutation of the slots (an offset and a skip derived from its
+// address) and claims the next free slot on its turn; weights give heavier backends more turns
+std::unique_ptr<const MaglevStrategy::Table> MaglevStrategy::build(const BackendSet& set) {
+    std::unique_ptr<Table> table(new Table());
+    table->set = &set;
+
+    size_t count = set.backends.size();
+    if (count == 0) {
+        return std::unique_ptr<const Table>(std::move(table));
+    }
+
+    std::vector<uint64_t> offset(count);
+    std::vector<uint64_t> skip(count);
+    std::vector<uint64_t> next(count, 0);
+    std::vector<double> credit(count, 0);
+    uint32_t max_weight = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const std::string& address = set.backends[i]->address;
+        offset[i] = routing_hash_of(address.data(), address.size(), 0x4d41474c) % TABLE_SIZE;
+        skip[i] = routing_hash_of(address.data(), address.size(), 0x534b4950) % (TABLE_SIZE - 1) + 1;
+        max_weight = std::max(max_weight, set.backends[i]->weight);
+    }
+
+    table->slots.assign(TABLE_SIZE, UINT32_MAX);
+    size_t filled = 0;
+    while (filled < TABLE_SIZE) {
+        for (size_t i = 0; i < count && filled < TABLE_SIZE; ++i) {
+            credit[i] += static_cast<double>(set.backends[i]->weight) / max_weight;
+            if (credit[i] < 1) {
+                continue;
+            }
+            credit[i] -= 1;
+
+            uint64_t slot;
+            do {
+                slot = (offset[i] + next[i] * skip[i]) % TABLE_SIZE;
+                ++next[i];
+            } while (table->slots[slot] != UINT32_MAX);
+
+            table->slots[slot] = static_cast<uint32_t>(i);
+            ++filled;
+        }
+    }
+    return std::unique_ptr<const Table>(std::move(table));
+}
+
+// Look the key up; if its backend refuses, rehash and try again, then fall back to the least loaded
+Backend* MaglevStrategy::select(const BackendSet& set, uint64_t request_hash) {
+    const Table& table = tables.get(set, build);
+    if (table.slots.empty()) {
+        return nullptr;
+    }
+
+    uint64_t key = key_or_random(request_hash);
+    BoundedLoad bound(set, balance_factor);
+    size_t attempts = 4 * set.backends.size();
+    for (size_t attempt = 0; attempt < attempts; ++attempt) {
+        Backend* backend = set.backends[table.slots[key % TABLE_SIZE]].get();
+        if (bound.accepts(*backend)) {
+            return backend;
+        }
+        key = routing_hash_of(reinterpret_cast<const char*>(&key), sizeof(key), attempt + 1);
+    }
+
+    return least_loaded(set, key % set.backends.size());
+}
@@ -0,0 +1,55 @@
+#include "core/buffer_pool.h"
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+std::atomic<size_t> pooled_buffer_size{BufferPool::DEFAULT_BUFFER_SIZE};
+std::atomic<size_t> max_pooled_buffer{MAX_POOLED_BUFFER};
+
+} // namespace
+
+void recycle_buffer(std::string& buffer) {
+    if (buffer.capacity() > BufferPool::max_pooled()) {
+        std::string().swap(buffer);
+    } else {
+        buffer.clear();
+    }
+}
+
+void BufferPool::configure(size_t buffer_size, size_t max_pooled) {
+    pooled_buffer_size.store(buffer_size, std::memory_order_relaxed);
+    max_pooled_buffer.store(std::max(buffer_size, max_pooled), std::memory_order_relaxed);
+}
+
+size_t BufferPool::max_pooled() {
+    return max_pooled_buffer.load(std::memory_order_relaxed);
+}
+
+std::string BufferPool::acquire() {
+    if (buffers.empty()) {
+        std::string buffer;
+        buffer.reserve(pooled_buffer_size.load(std::memory_order_relaxed));
+        return buffer;
+    }
+    std::string buffer = std::move(buffers.back());
+    buffers.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::string buffer) {
+    if (buffers.size() >= MAX_IDLE_BUFFERS || buffer.capacity() > max_pooled()) {
+        return;
+    }
+    buffer.clear();
+    size_t buffer_size = pooled_buffer_size.load(std::memory_order_relaxed);
+    if (buffer.capacity() < buffer_size) {
+        buffer.reserve(buffer_size);
+    }
+    buffers.push_back(std::move(buffer));
+}
+
+BufferPool& BufferPool::local() {
+    thread_local BufferPool pool;
+    return pool;
+}
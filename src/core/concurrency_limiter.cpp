@@ -0,0 +1,102 @@
+#include "core/concurrency_limiter.h"
+#include <algorithm>
+#include <cmath>
+
+// Windows averaged by the long-term latency (as an exponential moving average)
+static const double LONG_WINDOWS = 60;
+
+// Fewest samples a window averages, so a small limit does not react to single requests
+static const uint64_t MIN_WINDOW_SAMPLES = 10;
+
+// Limit kept after a timeout
+static const double DROP_BACKOFF = 0.9;
+
+ConcurrencyLimiter::ConcurrencyLimiter(const ConcurrencyLimitOptions& options)
+    : options(options), requests_in_flight(0), current_limit(0), estimated_limit(0),
+      window_samples(0), window_latency_us(0), window_peak_in_flight(0), long_latency_us(0) {
+    this->options.min_limit = std::max<size_t>(1, options.min_limit);
+    this->options.max_limit = std::max(this->options.min_limit, options.max_limit);
+    update_limit(static_cast<double>(options.initial_limit));
+}
+
+// Admit a request, or refuse it when the limit is reached
+bool ConcurrencyLimiter::try_acquire() {
+    if (!options.adaptive) {
+        return true;
+    }
+
+    size_t in_flight = requests_in_flight.load(std::memory_order_relaxed);
+    do {
+        if (in_flight >= current_limit.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    } while (!requests_in_flight.compare_exchange_weak(in_flight, in_flight + 1, std::memory_order_relaxed));
+    return true;
+}
+
+// Give back the slot of an admitted request and learn from how it went
+void ConcurrencyLimiter::release(RequestOutcome outcome, std::chrono::microseconds first_byte_latency) {
+    if (!options.adaptive) {
+        return;
+    }
+
+    size_t in_flight = requests_in_flight.fetch_sub(1, std::memory_order_relaxed);
+    double limit = estimated_limit.load(std::memory_order_relaxed);
+
+    if (outcome == RequestOutcome::TIMEOUT) {
+        update_limit(limit * DROP_BACKOFF);
+        return;
+    }
+
+    // Dead backends are outlier detection's business, and aborted requests say nothing about latency
+    if ((outcome != RequestOutcome::SUCCESS && outcome != RequestOutcome::SERVER_ERROR) ||
+        first_byte_latency.count() <= 0) {
+        return;
+    }
+
+    size_t peak = window_peak_in_flight.load(std::memory_order_relaxed);
+    while (in_flight > peak && !window_peak_in_flight.compare_exchange_weak(peak, in_flight, std::memory_order_relaxed)) {
+    }
+
+    window_latency_us.fetch_add(static_cast<uint64_t>(first_byte_latency.count()), std::memory_order_relaxed);
+    uint64_t samples = window_samples.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (samples < std::max<uint64_t>(MIN_WINDOW_SAMPLES, static_cast<uint64_t>(limit))) {
+        return;
+    }
+
+    // The request that fills the window closes it; the others see the reset count and carry on
+    if (!window_samples.compare_exchange_strong(samples, 0, std::memory_order_relaxed)) {
+        return;
+    }
+    double short_latency = static_cast<double>(window_latency_us.exchange(0, std::memory_order_relaxed)) / samples;
+    peak = window_peak_in_flight.exchange(0, std::memory_order_relaxed);
+
+    double long_latency = long_latency_us.load(std::memory_order_relaxed);
+    if (long_latency == 0) {
+        long_latency = short_latency;
+    } else {
+        long_latency += (short_latency - long_latency) * 2 / (LONG_WINDOWS + 1);
+    }
+
+    // Latency well below the long-term average means it has come down: forget the old level sooner
+    if (long_latency > 2 * short_latency) {
+        long_latency *= 0.95;
+    }
+    long_latency_us.store(long_latency, std::memory_order_relaxed);
+
+    double gradient = std::max(0.5, std::min(1.0, options.tolerance * long_latency / short_latency));
+
+    // Growing the limit is pointless while far fewer requests than it were in flight
+    if (gradient == 1.0 && peak * 2 < limit) {
+        return;
+    }
+
+    double target = limit * gradient + std::sqrt(limit);
+    update_limit(limit * (1 - options.smoothing) + target * options.smoothing);
+}
+
+void ConcurrencyLimiter::update_limit(double target) {
+    target = std::max(static_cast<double>(options.min_limit), std::min(static_cast<double>(options.max_limit), target));
+    estimated_limit.store(target, std::memory_order_relaxed);
+    current_limit.store(static_cast<size_t>(target), std::memory_order_relaxed);
+}
@@ -0,0 +1,272 @@
+#include "core/config.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// Value of an on/off option: bare on the command line ("--cache") or spelled out in a file ("cache = off")
+bool parse_flag(const std::string& value) {
+    if (value.empty() || value == "true" || value == "on" || value == "yes" || value == "1") {
+        return true;
+    }
+    if (value == "false" || value == "off" || value == "no" || value == "0") {
+        return false;
+    }
+    throw std::invalid_argument(value);
+}
+
+std::string trim(const std::string& text) {
+    size_t start = text.find_first_not_of(" \t\r");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(start, end - start + 1);
+}
+
+} // namespace
+
+// Apply one setting by its option name
+bool apply_config_option(const std::string& name, const std::string& value, ServerConfig& config, std::string& error) {
+    ServerOptions& options = config.options;
+    try {
+        if (name == "backend") {
+            config.backends.push_back(value);
+        } else if (name == "port") {
+            options.port = std::stoi(value);
+        } else if (name == "listen-backlog") {
+            options.listen_backlog = std::max(1, std::stoi(value));
+        } else if (name == "drain-timeout-ms") {
+            options.drain_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "threads") {
+            options.worker_threads = std::stoul(value);
+        } else if (name == "max-queued-connections") {
+            options.max_queued_connections = std::max(1ul, std::stoul(value));
+        } else if (name == "max-connections") {
+            options.max_connections = std::stoul(value);
+        } else if (name == "reactors") {
+            options.reactor_threads = std::stoul(value);
+        } else if (name == "pool-min") {
+            options.backend_pool.min_idle = std::stoul(value);
+        } else if (name == "pool-max") {
+            options.backend_pool.max_idle = std::stoul(value);
+        } else if (name == "pool-idle-timeout-ms") {
+            options.backend_pool.idle_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "keep-alive-timeout-ms") {
+            options.keep_alive_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "connect-timeout-ms") {
+            options.backend_connect_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "first-byte-timeout-ms") {
+            options.backend_first_byte_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "backend-idle-timeout-ms") {
+            options.backend_idle_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "retries") {
+            options.load_balancing.retries.max_retries = std::stoul(value);
+        } else if (name == "retry-budget") {
+            options.load_balancing.retries.budget_ratio = std::stod(value);
+        } else if (name == "retry-budget-min") {
+            options.load_balancing.retries.budget_min_per_second = std::stoul(value);
+        } else if (name == "hedge") {
+            options.load_balancing.retries.hedging = parse_flag(value);
+        } else if (name == "hedge-quantile") {
+            options.load_balancing.retries.hedge_quantile = std::min(1.0, std::max(0.0, std::stod(value)));
+        } else if (name == "hedge-min-delay-ms") {
+            options.load_balancing.retries.hedge_min_delay = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "max-requests-per-connection") {
+            options.max_requests_per_connection = std::stoul(value);
+        } else if (name == "splice-threshold") {
+            options.splice_threshold = std::stoul(value);
+        } else if (name == "read-buffer-kb") {
+            options.buffers.read_size = std::max(1ul, std::stoul(value)) * 1024;
+        } else if (name == "request-buffer-kb") {
+            options.buffers.max_request_buffer = std::max(1ul, std::stoul(value)) * 1024;
+        } else if (name == "response-buffer-kb") {
+            options.buffers.max_response_buffer = std::max(1ul, std::stoul(value)) * 1024;
+        } else if (name == "forwarded-for") {
+            options.header_rewrite.forwarded_for = parse_flag(value);
+        } else if (name == "request-id") {
+            options.header_rewrite.request_id = parse_flag(value);
+        } else if (name == "rewrite-host") {
+            if (value.size() > MAX_REWRITE_HOST || value.find_first_of(" \t\r\n") != std::string::npos) {
+                error = "invalid host " + value + " for rewrite-host";
+                return false;
+            }
+            options.header_rewrite.host = value;
+        } else if (name == "strip-hop-by-hop") {
+            options.header_rewrite.strip_hop_by_hop = parse_flag(value);
+        } else if (name == "metrics-path") {
+            options.metrics_path = value;
+        } else if (name == "cache") {
+            options.cache.enabled = parse_flag(value);
+        } else if (name == "cache-size-mb") {
+            options.cache.memory_budget = std::stoul(value) * 1024 * 1024;
+        } else if (name == "cache-max-object-kb") {
+            options.cache.max_object_size = std::stoul(value) * 1024;
+        } else if (name == "cache-key-params") {
+            options.cache.key_params.clear();
+            size_t start = 0;
+            while (start < value.size()) {
+                size_t comma = value.find(',', start);
+                std::string param = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+                if (!param.empty()) {
+                    options.cache.key_params.push_back(param);
+                }
+                start = comma == std::string::npos ? value.size() : comma + 1;
+            }
+        } else if (name == "log-level") {
+            if (!parse_log_level(value, options.logging.level)) {
+                error = "unknown log level " + value + " (use debug, info, warn, error or off)";
+                return false;
+            }
+        } else if (name == "log-file") {
+            options.logging.event_log = value;
+        } else if (name == "access-log") {
+            options.logging.access_log = value.empty() ? "-" : value;
+        } else if (name == "access-log-sample") {
+            options.logging.access_log_sample = std::stod(value);
+        } else if (name == "log-buffer-kb") {
+            options.logging.buffer_size = std::stoul(value) * 1024;
+        } else if (name == "log-block-when-full") {
+            options.logging.block_when_full = parse_flag(value);
+        } else if (name == "balance") {
+            if (!parse_balancing_algorithm(value, options.load_balancing.balancing)) {
+                error = "unknown balancing algorithm " + value + " (use round_robin, least_conn, p2c, random, ring_hash or maglev)";
+                return false;
+            }
+        } else if (name == "hash-on") {
+            if (!parse_hash_key(value, options.load_balancing.hash_key)) {
+                error = "invalid hash key " + value + " (use ip, header:NAME, cookie:NAME or query:NAME)";
+                return false;
+            }
+        } else if (name == "hash-balance-factor") {
+            options.load_balancing.hash_balance_factor = std::stod(value);
+        } else if (name == "health-interval-ms") {
+            options.load_balancing.health_check.interval = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "health-connect-timeout-ms") {
+            options.load_balancing.health_check.connect_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "health-read-timeout-ms") {
+            options.load_balancing.health_check.read_timeout = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "health-path") {
+            options.load_balancing.health_check.path = value;
+        } else if (name == "health-rise") {
+            options.load_balancing.health_check.rise = std::max(1ul, std::stoul(value));
+        } else if (name == "health-fall") {
+            options.load_balancing.health_check.fall = std::max(1ul, std::stoul(value));
+        } else if (name == "outlier-5xx") {
+            options.load_balancing.outlier_detection.consecutive_server_errors = std::stoul(value);
+        } else if (name == "outlier-connect-failures") {
+            options.load_balancing.outlier_detection.consecutive_connection_failures = std::stoul(value);
+        } else if (name == "outlier-latency-factor") {
+            options.load_balancing.outlier_detection.latency_factor = std::stod(value);
+        } else if (name == "outlier-min-latency-ms") {
+            options.load_balancing.outlier_detection.min_outlier_latency = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "outlier-ejection-ms") {
+            options.load_balancing.outlier_detection.base_ejection_time = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "outlier-max-ejection-ms") {
+            options.load_balancing.outlier_detection.max_ejection_time = std::chrono::milliseconds(std::stoul(value));
+        } else if (name == "outlier-max-percent") {
+            options.load_balancing.outlier_detection.max_ejection_percent = std::stoul(value);
+        } else if (name == "adaptive-concurrency") {
+            options.load_balancing.concurrency_limit.adaptive = parse_flag(value);
+        } else if (name == "concurrency-initial") {
+            options.load_balancing.concurrency_limit.initial_limit = std::stoul(value);
+        } else if (name == "concurrency-min") {
+            options.load_balancing.concurrency_limit.min_limit = std::stoul(value);
+        } else if (name == "concurrency-max") {
+            options.load_balancing.concurrency_limit.max_limit = std::stoul(value);
+        } else if (name == "concurrency-tolerance") {
+            options.load_balancing.concurrency_limit.tolerance = std::max(1.0, std::stod(value));
+        } else if (name == "pin-cpus") {
+            options.pin_reactors = parse_flag(value);
+        } else if (name == "io-engine") {
+            if (value == "epoll") {
+                options.io_engine = IoEngine::EPOLL;
+            } else if (value == "io_uring") {
+                options.io_engine = IoEngine::IO_URING;
+            } else {
+                error = "unknown I/O engine " + value + " (use epoll or io_uring)";
+                return false;
+            }
+        } else {
+            error = "unknown option " + name;
+            return false;
+        }
+    } catch (const std::exception&) {
+        error = "invalid value for " + name + ": " + value;
+        return false;
+    }
+    return true;
+}
+
+// Read "name = value" lines, skipping blank lines and # comments
+bool load_config_file(const std::string& path, ServerConfig& config, std::string& error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // The file replaces the backend list as a whole rather than adding to it
+    ServerConfig loaded = config;
+    loaded.backends.clear();
+
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        std::string name = trim(line.substr(0, equals));
+        std::string value = equals == std::string::npos ? "" : trim(line.substr(equals + 1));
+        if (name == "config" || !apply_config_option(name, value, loaded, error)) {
+            error = path + ":" + std::to_string(number) + ": " + (name == "config" ? "config cannot be nested" : error);
+            return false;
+        }
+    }
+
+    if (loaded.backends.empty()) {
+        loaded.backends = config.backends;
+    }
+    config = loaded;
+    return true;
+}
+
+// Build the configuration from the arguments after the mode
+bool load_server_config(const std::vector<std::string>& arguments, ServerConfig& config, std::string& error) {
+    for (const std::string& argument : arguments) {
+        if (argument.rfind("--config=", 0) == 0) {
+            config.options.config_path = argument.substr(sizeof("--config=") - 1);
+            if (!load_config_file(config.options.config_path, config, error)) {
+                return false;
+            }
+        }
+    }
+
+    // Backends named on the command line replace those of the file
+    std::vector<std::string> backends;
+    for (const std::string& argument : arguments) {
+        if (argument.rfind("--", 0) != 0) {
+            backends.push_back(argument);
+            continue;
+        }
+        if (argument.rfind("--config=", 0) == 0) {
+            continue;
+        }
+
+        size_t equals = argument.find('=');
+        std::string name = argument.substr(2, equals == std::string::npos ? std::string::npos : equals - 2);
+        std::string value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+        if (name == "backend") {
+            backends.push_back(value);
+        } else if (!apply_config_option(name, value, config, error)) {
+            return false;
+        }
+    }
+    if (!backends.empty()) {
+        config.backends = backends;
+    }
+    return true;
+}
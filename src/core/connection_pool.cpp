@@ -0,0 +1,134 @@
+#include "core/connection_pool.h"
+#include "core/utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+BackendConnectionPool::BackendConnectionPool(const PoolOptions& options) : options(options) {}
+
+BackendConnectionPool::~BackendConnectionPool() {
+    for (auto& entry : idle_connections) {
+        for (const IdleConnection& connection : entry.second) {
+            close(connection.socket);
+        }
+    }
+}
+
+// Take an idle connection to the backend, or -1 if none is usable
+int BackendConnectionPool::checkout(const std::string& address) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    auto it = idle_connections.find(address);
+    if (it == idle_connections.end()) {
+        return -1;
+    }
+
+    std::deque<IdleConnection>& idle = it->second;
+    evict_expired(idle, std::chrono::steady_clock::now());
+
+    // Most recently used first: it is the least likely to have been closed by the backend
+    while (!idle.empty()) {
+        int socket = idle.back().socket;
+        idle.pop_back();
+
+        if (is_connection_reusable(socket)) {
+            return socket;
+        }
+        close(socket);
+    }
+
+    return -1;
+}
+
+// Give a connection back to the pool
+void BackendConnectionPool::checkin(const std::string& address, int socket, bool reusable) {
+    if (!reusable) {
+        close(socket);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    std::deque<IdleConnection>& idle = idle_connections[address];
+    auto now = std::chrono::steady_clock::now();
+    evict_expired(idle, now);
+
+    if (idle.size() >= options.max_idle) {
+        close(socket);
+        return;
+    }
+
+    idle.push_back({socket, now});
+}
+
+// Open connections until the backend has min_idle idle ones
+void BackendConnectionPool::prewarm(const std::string& address) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            if (idle_connections[address].size() >= options.min_idle) {
+                return;
+            }
+        }
+
+        int socket = open_backend_socket(address, false);
+        if (socket < 0) {
+            return;
+        }
+        checkin(address, socket, true);
+    }
+}
+
+// Close every idle connection to the backend
+void BackendConnectionPool::drain(const std::string& address) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    auto it = idle_connections.find(address);
+    if (it == idle_connections.end()) {
+        return;
+    }
+
+    for (const IdleConnection& connection : it->second) {
+        close(connection.socket);
+    }
+    it->second.clear();
+}
+
+// Close idle connections to backends that are no longer configured
+void BackendConnectionPool::retain_only(const std::vector<std::string>& addresses) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    for (auto it = idle_connections.begin(); it != idle_connections.end();) {
+        if (std::find(addresses.begin(), addresses.end(), it->first) != addresses.end()) {
+            ++it;
+            continue;
+        }
+        for (const IdleConnection& connection : it->second) {
+            close(connection.socket);
+        }
+        it = idle_connections.erase(it);
+    }
+}
+
+// Close connections idle for longer than the timeout, keeping min_idle of them
+void BackendConnectionPool::evict_expired(std::deque<IdleConnection>& idle,
+                                          std::chrono::steady_clock::time_point now) {
+    while (idle.size() > options.min_idle && now - idle.front().idle_since > options.idle_timeout) {
+        close(idle.front().socket);
+        idle.pop_front();
+    }
+}
+
+// Check that an idle connection has neither been closed by the peer nor received stray bytes
+bool is_connection_reusable(int socket) {
+    char byte;
+    ssize_t result = recv(socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    // 0 means the backend closed the connection, data means an unsolicited response
+    // (e.g. a 408 timeout notice); either way the connection cannot carry a new request
+    if (result >= 0) {
+        return false;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
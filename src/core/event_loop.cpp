@@ -0,0 +1,1288 @@
+#include "core/event_loop.h"
+#include "core/utils.h"
+#include "core/logger.h"
+#include "core/response.h"
+#include "core/buffer_pool.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+namespace {
+
+const int MAX_EVENTS = 256;
+const size_t MAX_RESPONSE_HEAD_SIZE = 64 * 1024;
+const int IDLE_SWEEP_INTERVAL_MS = 1000;
+const size_t MAX_IDLE_PIPES = 64;
+const size_t MAX_SPARE_CONNECTIONS = 64;
+
+// Return a closed connection to its initial state for another client, keeping its buffers
+void reuse_connection(Connection& conn) {
+    std::string request_buffer;
+    std::string response_head;
+    std::string response_buffer;
+    request_buffer.swap(conn.request_buffer);
+    response_head.swap(conn.response_head);
+    response_buffer.swap(conn.response_buffer);
+
+    conn = Connection();
+
+    recycle_buffer(request_buffer);
+    recycle_buffer(response_head);
+    recycle_buffer(response_buffer);
+    conn.request_buffer.swap(request_buffer);
+    conn.response_head.swap(response_head);
+    conn.response_buffer.swap(response_buffer);
+}
+
+// Forget what was sent to and received from a backend that failed before answering
+void reset_exchange(Connection& conn) {
+    conn.head_sent = 0;
+    conn.request_sent = 0;
+    conn.response_bytes = 0;
+    conn.response_head.clear();
+    conn.backend_in_sync = true;
+    conn.cache_fill.clear();
+    conn.cache_filling = !conn.cache_key.empty();
+}
+
+// Write what is left of the current request to a backend, tracking progress in head_sent and sent.
+// A rewritten head goes out as its segments followed by the bytes buffered after the original
+// head, gathered into one sendmsg(). Returns what send() or sendmsg() did.
+ssize_t send_request(int socket, const Connection& conn, size_t& head_sent, size_t& sent) {
+    const RewrittenHead& rewritten = conn.rewritten_head;
+    if (head_sent == rewritten.size()) {
+        ssize_t bytes_sent = send(socket, conn.request_buffer.data() + sent, conn.request_length - sent, MSG_NOSIGNAL);
+        if (bytes_sent > 0) {
+            sent += bytes_sent;
+        }
+        return bytes_sent;
+    }
+
+    struct iovec iov[RewrittenHead::MAX_SEGMENTS + 1];
+    const char* head = conn.request_buffer.data();
+    size_t count = rewritten.to_iov(head, head_sent, iov, RewrittenHead::MAX_SEGMENTS);
+    if (conn.request_length > rewritten.original_size()) {
+        iov[count].iov_base = const_cast<char*>(head) + rewritten.original_size();
+        iov[count].iov_len = conn.request_length - rewritten.original_size();
+        ++count;
+    }
+    struct msghdr message = {};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    ssize_t bytes_sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    if (bytes_sent > 0) {
+        size_t head_left = rewritten.size() - head_sent;
+        if (static_cast<size_t>(bytes_sent) < head_left) {
+            head_sent += bytes_sent;
+        } else {
+            head_sent = rewritten.size();
+            sent = rewritten.original_size() + (bytes_sent - head_left);
+        }
+    }
+    return bytes_sent;
+}
+
+} // namespace
+
+EventLoop::EventLoop(int listen_socket, int drain_event, LoadBalancer& load_balancer, ResponseCache& cache,
+                     ServerMetrics& metrics, const ServerOptions& options)
+    : listen_socket(listen_socket), drain_event(drain_event), epoll_fd(-1), draining(false),
+      load_balancer(load_balancer), cache(cache), metrics(metrics), options(options),
+      connection_pool(options.backend_pool), pooled_backends_version(load_balancer.backends_version()),
+      client_connections(0), live_timers(0), last_timer_sequence(0) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_error("epoll_create1 failed: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    read_buffer.resize(options.buffers.read_size);
+    set_non_blocking(listen_socket);
+    watch(listen_socket, EPOLLIN, true);
+    if (drain_event >= 0) {
+        watch(drain_event, EPOLLIN, true);
+    }
+
+    for (const std::string& address : load_balancer.get_backend_addresses()) {
+        connection_pool.prewarm(address);
+    }
+}
+
+EventLoop::~EventLoop() {
+    for (auto& entry : connections) {
+        close(entry.first);
+    }
+    close(epoll_fd);
+}
+
+// Run the reactor until the process exits
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+    auto last_idle_sweep = std::chrono::steady_clock::now();
+
+    while (true) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, next_timer_wait(IDLE_SWEEP_INTERVAL_MS));
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("epoll_wait failed: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == listen_socket) {
+                if (!draining) {
+                    accept_connections();
+                }
+                continue;
+            }
+            if (fd == drain_event) {
+                start_draining();
+                continue;
+            }
+
+            // The connection may have been closed by an earlier event in this batch
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+
+            std::shared_ptr<Connection> conn = it->second;
+            if (fd == conn->client_socket) {
+                handle_client_event(conn, events[i].events);
+            } else if (fd == conn->hedge.socket) {
+                handle_hedge_event(conn, events[i].events);
+            } else {
+                handle_backend_event(conn, events[i].events);
+            }
+        }
+        run_timers();
+
+        auto now = std::chrono::steady_clock::now();
+        if (draining && (client_connections == 0 || now >= drain_deadline)) {
+            if (client_connections > 0) {
+                log_warn("Drain timeout: cutting %zu connection(s) still open", client_connections);
+            }
+            return;
+        }
+        if (now - last_idle_sweep >= std::chrono::milliseconds(IDLE_SWEEP_INTERVAL_MS)) {
+            close_idle_connections();
+            last_idle_sweep = now;
+
+            // A reload removed backends: their idle connections would never be used again
+            uint64_t backends_version = load_balancer.backends_version();
+            if (backends_version != pooled_backends_version) {
+                connection_pool.retain_only(load_balancer.get_backend_addresses());
+                pooled_backends_version = backends_version;
+            }
+        }
+    }
+}
+
+// Stop accepting; the listener stays open for the other reactors or the process taking over
+void EventLoop::start_draining() {
+    draining = true;
+    drain_deadline = std::chrono::steady_clock::now() + options.drain_timeout;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_socket, nullptr);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, drain_event, nullptr);
+}
+
+// Accept every pending client connection on the listening socket
+void EventLoop::accept_connections() {
+    while (true) {
+        int client_socket = accept4(listen_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_error("Accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+
+        metrics.connections_accepted.add();
+        if (options.max_connections > 0 && client_connections >= options.max_connections) {
+            metrics.connections_rejected.add();
+            reject_connection(client_socket, Response::service_unavailable());
+            continue;
+        }
+        ++client_connections;
+        metrics.open_connections.add();
+
+        std::shared_ptr<Connection> conn = acquire_connection();
+        conn->client_socket = client_socket;
+        if (Logger::instance().access_log_enabled() || load_balancer.routes_on_client_address() ||
+            options.header_rewrite.forwarded_for) {
+            conn->client_address = peer_address(client_socket);
+        }
+        conn->last_activity = std::chrono::steady_clock::now();
+        connections[client_socket] = conn;
+        watch(client_socket, EPOLLIN, true);
+    }
+}
+
+// Close client connections that have waited too long for their next request
+void EventLoop::close_idle_connections() {
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<std::shared_ptr<Connection>> idle;
+    for (const auto& entry : connections) {
+        const std::shared_ptr<Connection>& conn = entry.second;
+        if (entry.first == conn->client_socket && conn->state == ConnectionState::READING_REQUEST &&
+            now - conn->last_activity > options.keep_alive_timeout) {
+            idle.push_back(conn);
+        }
+    }
+
+    for (const std::shared_ptr<Connection>& conn : idle) {
+        close_connection(conn);
+    }
+}
+
+void EventLoop::handle_client_event(const std::shared_ptr<Connection>& conn, uint32_t events) {
+    if (events & EPOLLERR) {
+        close_connection(conn);
+        return;
+    }
+
+    if (conn->state == ConnectionState::READING_REQUEST && (events & (EPOLLIN | EPOLLHUP))) {
+        read_request(conn);
+    } else if (conn->awaiting_request_body && (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))) {
+        read_request_body(conn);
+    } else if (conn->state == ConnectionState::RELAYING_RESPONSE && (events & EPOLLOUT)) {
+        write_response(conn);
+    } else if (events & (EPOLLHUP | EPOLLRDHUP)) {
+        // Client went away mid-response; don't wait for a keep-alive backend to close
+        close_connection(conn);
+    }
+}
+
+void EventLoop::handle_backend_event(const std::shared_ptr<Connection>& conn, uint32_t events) {
+    switch (conn->state) {
+        case ConnectionState::CONNECTING_BACKEND:
+            finish_connect(conn);
+            break;
+        case ConnectionState::WRITING_REQUEST:
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                if (conn->backend_reused && !conn->request_streamed) {
+                    retry_backend(conn);
+                } else {
+                    backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+                }
+            } else {
+                write_request(conn);
+            }
+            break;
+        case ConnectionState::RELAYING_RESPONSE:
+            // EPOLLHUP/EPOLLERR still leave buffered bytes to drain through read()
+            read_response(conn);
+            break;
+        default:
+            close_connection(conn);
+            break;
+    }
+}
+
+// Read from the client until a request head is buffered
+void EventLoop::read_request(const std::shared_ptr<Connection>& conn) {
+    while (true) {
+        ssize_t bytes_read = receive_into(conn->client_socket, conn->request_buffer, options.buffers.read_size);
+        if (bytes_read > 0) {
+            if (conn->request_buffer.size() > options.buffers.max_request_buffer) {
+                break; // The parser rejects heads that do not fit
+            }
+            continue;
+        }
+        if (bytes_read == 0) {
+            conn->client_eof = true;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        close_connection(conn);
+        return;
+    }
+
+    conn->last_activity = std::chrono::steady_clock::now();
+    dispatch_request(conn);
+}
+
+// Start forwarding the first buffered request once its head is complete; the body follows as it arrives
+void EventLoop::dispatch_request(const std::shared_ptr<Connection>& conn) {
+    ParseStatus status = conn->request_parser.parse(conn->request_buffer);
+    if (status == ParseStatus::ERROR) {
+        fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+        return;
+    }
+    if (status == ParseStatus::INCOMPLETE) {
+        if (conn->client_eof) {
+            close_connection(conn);
+        }
+        return;
+    }
+
+    const MessageHead& head = conn->request_parser.head();
+    conn->request_body = BodyFramer(head);
+    conn->request_length = head.header_length;
+    if (!frame_request(conn)) {
+        fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+        return;
+    }
+
+    if (!conn->request_body.complete()) {
+        if (conn->client_eof) {
+            close_connection(conn);
+            return;
+        }
+        if (conn->request_parser.expects_continue()) {
+            const std::string& interim = Response::canned(CannedResponse::CONTINUE);
+            send(conn->client_socket, interim.data(), interim.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    conn->requests_served++;
+    conn->client_keep_alive = head.keep_alive && !conn->client_eof && !draining &&
+                              conn->requests_served < options.max_requests_per_connection;
+    metrics.requests.add();
+    conn->request_active = true;
+    conn->request_started = std::chrono::steady_clock::now();
+    if (Logger::instance().access_log_enabled()) {
+        conn->request_method.assign(conn->request_parser.method());
+        conn->request_path.assign(conn->request_parser.path());
+    }
+
+    if (!options.metrics_path.empty() && conn->request_parser.path() == options.metrics_path) {
+        // A body is not worth waiting for: answer now and close instead of reading it
+        conn->client_keep_alive = conn->client_keep_alive && conn->request_body.complete();
+        conn->response_status = 200;
+        respond_locally(conn, metrics.build_response(load_balancer, cache, conn->client_keep_alive));
+        return;
+    }
+
+    // Cacheable GETs are answered from memory. A reactor cannot wait, so a miss on a key that
+    // another request is fetching goes to a backend instead of being coalesced
+    if (cache.enabled() && cache.make_key(conn->request_parser, conn->cache_key)) {
+        std::shared_ptr<const CachedResponse> cached;
+        CacheLookup lookup = cache.lookup(conn->cache_key, false, cached);
+        if (lookup == CacheLookup::HIT) {
+            conn->cache_key.clear();
+            conn->response_status = cached->status_code;
+            respond_locally(conn, cached->serialize(conn->client_keep_alive));
+            return;
+        }
+        if (lookup == CacheLookup::BYPASS) {
+            conn->cache_key.clear();
+        }
+        conn->cache_filling = lookup == CacheLookup::FETCH;
+    }
+
+    // Headers are rewritten once per request, into spans sent around the buffered bytes
+    if (options.header_rewrite.enabled()) {
+        conn->rewritten_head.build(conn->request_buffer, conn->request_parser, conn->client_address,
+                                   options.header_rewrite);
+        conn->head_sent = 0;
+    }
+    connect_to_backend(conn);
+}
+
+// Read more of a request body that is being streamed to the backend
+void EventLoop::read_request_body(const std::shared_ptr<Connection>& conn) {
+    while (conn->request_buffer.size() - conn->request_sent < options.buffers.max_request_buffer) {
+        ssize_t bytes_read = receive_into(conn->client_socket, conn->request_buffer, options.buffers.read_size);
+        if (bytes_read > 0) {
+            continue;
+        }
+        if (bytes_read == 0) {
+            conn->client_eof = true;
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        close_connection(conn);
+        return;
+    }
+
+    conn->last_activity = std::chrono::steady_clock::now();
+    if (!frame_request(conn)) {
+        fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+        return;
+    }
+    if (conn->client_eof) {
+        if (!conn->request_body.complete()) {
+            close_connection(conn);
+            return;
+        }
+        conn->client_keep_alive = false;
+    }
+
+    write_request(conn);
+}
+
+// Frame newly buffered body bytes; everything framed so far can be forwarded
+bool EventLoop::frame_request(const std::shared_ptr<Connection>& conn) {
+    size_t framed = conn->request_length;
+    conn->request_length += conn->request_body.consume(conn->request_buffer.data() + framed,
+                                                       conn->request_buffer.size() - framed);
+    return !conn->request_body.failed();
+}
+
+// Reset the connection for the next request once a keep-alive response has been sent
+void EventLoop::finish_request(const std::shared_ptr<Connection>& conn) {
+    log_request(conn);
+
+    conn->request_buffer.erase(0, conn->request_length);
+    conn->request_parser.reset();
+    conn->request_length = 0;
+    conn->request_sent = 0;
+    conn->rewritten_head.clear();
+    conn->head_sent = 0;
+    conn->request_streamed = false;
+    conn->head_request = false;
+    conn->retries = 0;
+    conn->hedged = false;
+    conn->hedge_delay = std::chrono::microseconds(0);
+
+    conn->backend_reused = false;
+    conn->response_head.clear();
+    conn->have_response_head = false;
+    conn->response_bytes = 0;
+    conn->response_complete = false;
+    conn->backend_in_sync = true;
+    conn->backend_eof = false;
+    release_pipe(conn);
+
+    conn->state = ConnectionState::READING_REQUEST;
+    conn->last_activity = std::chrono::steady_clock::now();
+    watch(conn->client_socket, EPOLLIN, false);
+
+    // A pipelined request may already be buffered
+    dispatch_request(conn);
+}
+
+// Pick a backend and start forwarding the request to it
+void EventLoop::connect_to_backend(const std::shared_ptr<Connection>& conn) {
+    conn->request_hash = load_balancer.routing_hash(conn->request_parser, conn->client_address);
+    if (!select_backend(conn, nullptr)) {
+        return;
+    }
+
+    conn->head_request = conn->request_parser.method() == "HEAD";
+
+    // Stop reading the client while the request is in flight; errors are still reported
+    watch(conn->client_socket, 0, false);
+
+    open_backend_connection(conn, true);
+}
+
+// Use an idle pooled connection when there is one, otherwise start a non-blocking connect
+void EventLoop::open_backend_connection(const std::shared_ptr<Connection>& conn, bool allow_reuse) {
+    int backend_socket = allow_reuse ? connection_pool.checkout(conn->backend->address) : -1;
+    conn->backend_reused = backend_socket >= 0;
+
+    if (conn->backend_reused) {
+        set_non_blocking(backend_socket);
+        conn->backend_socket = backend_socket;
+        connections[backend_socket] = conn;
+        conn->state = ConnectionState::WRITING_REQUEST;
+        conn->last_activity = std::chrono::steady_clock::now();
+        watch(backend_socket, EPOLLOUT, true);
+        write_request(conn);
+        return;
+    }
+
+    conn->connect_started = std::chrono::steady_clock::now();
+    backend_socket = open_backend_socket(conn->backend->address, true);
+    if (backend_socket < 0) {
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    conn->backend_socket = backend_socket;
+    connections[backend_socket] = conn;
+    conn->state = ConnectionState::CONNECTING_BACKEND;
+    watch(backend_socket, EPOLLOUT, true);
+    check_deadlines(conn);
+}
+
+// Check the outcome of a non-blocking connect
+void EventLoop::finish_connect(const std::shared_ptr<Connection>& conn) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(conn->backend_socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        log_warn("Connection to backend server failed: %s", strerror(error));
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    conn->last_activity = std::chrono::steady_clock::now();
+    conn->backend_timing.connect = std::chrono::duration_cast<std::chrono::microseconds>(
+        conn->last_activity - conn->connect_started);
+    conn->state = ConnectionState::WRITING_REQUEST;
+    write_request(conn);
+}
+
+// Forward the request to the backend, pulling more of its body from the client as needed
+void EventLoop::write_request(const std::shared_ptr<Connection>& conn) {
+    bool progressed = false;
+    while (conn->request_sent < conn->request_length) {
+        ssize_t bytes_sent = send_request(conn->backend_socket, *conn, conn->head_sent, conn->request_sent);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Wait for EPOLLOUT; the client is not read until the backend catches up
+                if (conn->awaiting_request_body) {
+                    conn->awaiting_request_body = false;
+                    watch(conn->client_socket, 0, false);
+                    watch(conn->backend_socket, EPOLLOUT, false);
+                }
+                break;
+            }
+            if (conn->backend_reused && !conn->request_streamed) {
+                retry_backend(conn);
+            } else {
+                backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+            }
+            return;
+        }
+        progressed = true;
+    }
+
+    if (progressed) {
+        conn->last_activity = std::chrono::steady_clock::now();
+    }
+    if (conn->request_sent < conn->request_length) {
+        check_deadlines(conn);
+        return;
+    }
+
+    if (!conn->request_body.complete()) {
+        // Drop what was forwarded so a large body streams through in bounded memory; the head
+        // goes with it, so the rest is sent as it is
+        conn->request_buffer.erase(0, conn->request_sent);
+        conn->request_length -= conn->request_sent;
+        conn->request_sent = 0;
+        conn->request_streamed = true;
+        conn->rewritten_head.clear();
+        conn->head_sent = 0;
+
+        if (!conn->awaiting_request_body) {
+            conn->awaiting_request_body = true;
+            watch(conn->client_socket, EPOLLIN | EPOLLRDHUP, false);
+            watch(conn->backend_socket, 0, false);
+        }
+        check_deadlines(conn);
+        return;
+    }
+
+    if (conn->awaiting_request_body) {
+        conn->awaiting_request_body = false;
+        watch(conn->client_socket, 0, false);
+    }
+    conn->state = ConnectionState::RELAYING_RESPONSE;
+    conn->request_forwarded = std::chrono::steady_clock::now();
+    conn->last_activity = conn->request_forwarded;
+
+    // Only an idempotent request held in full can be hedged, and only once
+    if (!conn->hedged && !conn->request_streamed && is_idempotent_method(conn->request_parser.method())) {
+        conn->hedge_delay = load_balancer.hedge_delay(*conn->backend);
+    }
+    watch(conn->backend_socket, EPOLLIN, false);
+    check_deadlines(conn);
+}
+
+// Pull response bytes from the backend and push them to the client
+void EventLoop::read_response(const std::shared_ptr<Connection>& conn) {
+    char* buffer = read_buffer.data();
+    size_t received = conn->response_bytes;
+
+    while (!conn->response_complete && !conn->relay_pipe &&
+           conn->response_buffer.size() - conn->response_sent < options.buffers.max_response_buffer) {
+        ssize_t bytes_read = recv(conn->backend_socket, buffer, read_buffer.size(), 0);
+        if (bytes_read > 0) {
+            // The first backend to answer serves the request
+            if (conn->hedge.backend != nullptr) {
+                cancel_hedge(conn, RequestOutcome::ABORTED);
+            }
+            if (!frame_response(conn, buffer, bytes_read)) {
+                if (!conn->have_response_head) {
+                    conn->backend_outcome = RequestOutcome::CONNECTION_FAILURE;
+                }
+                conn->backend_eof = true; // Malformed response: relay what we have, then close
+                break;
+            }
+            continue;
+        }
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // The backend closed (or reset) the connection
+        if (conn->response_bytes == 0 && conn->backend_reused && !conn->request_streamed) {
+            retry_backend(conn);
+            return;
+        }
+        if (!conn->have_response_head) {
+            conn->backend_outcome = RequestOutcome::CONNECTION_FAILURE;
+        }
+        conn->backend_eof = true;
+        break;
+    }
+
+    // Nothing usable came back: the client may still get another backend's answer, or an error
+    if (conn->backend_eof && !conn->have_response_head) {
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    if (conn->relay_pipe && !conn->response_complete && !conn->backend_eof) {
+        splice_response(conn);
+    }
+    if (conn->response_bytes > received) {
+        conn->last_activity = std::chrono::steady_clock::now();
+    }
+
+    if (conn->response_complete && conn->backend_socket >= 0) {
+        finish_cache_fill(conn, true);
+        release_backend(conn, conn->backend_keep_alive && conn->backend_in_sync);
+    }
+
+    write_response(conn);
+}
+
+// Queue received bytes for the client, tracking where the response ends
+bool EventLoop::frame_response(const std::shared_ptr<Connection>& conn, const char* data, size_t length) {
+    conn->response_bytes += length;
+
+    if (!conn->have_response_head) {
+        conn->response_head.append(data, length);
+
+        // Relay interim responses (e.g. 100 Continue) as they are and wait for the final one
+        while (parse_response_head(conn->response_head.data(), conn->response_head.size(),
+                                   conn->head_request, conn->response_info)) {
+            if (!is_interim_response(conn->response_info)) {
+                conn->have_response_head = true;
+                break;
+            }
+            conn->response_buffer.append(conn->response_head, 0, conn->response_info.header_length);
+            conn->response_head.erase(0, conn->response_info.header_length);
+        }
+        if (!conn->have_response_head) {
+            return conn->response_head.size() <= MAX_RESPONSE_HEAD_SIZE;
+        }
+
+        conn->backend_outcome = outcome_for_status(conn->response_info.status_code);
+        conn->response_status = conn->response_info.status_code;
+        if (conn->state == ConnectionState::RELAYING_RESPONSE) { // Not an early response to a partial request
+            conn->backend_timing.first_byte = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - conn->request_forwarded);
+        }
+
+        conn->backend_keep_alive = conn->response_info.keep_alive;
+        conn->response_body = BodyFramer(conn->response_info);
+
+        // The client connection can only continue if the response has an end the client can see
+        conn->client_keep_alive = conn->client_keep_alive && conn->backend_keep_alive;
+        if (!conn->client_keep_alive && conn->response_info.keep_alive) {
+            add_connection_close(conn->response_head, 0, conn->response_info);
+        }
+
+        const std::string& head = conn->response_head;
+        size_t header_length = conn->response_info.header_length;
+        size_t body_available = head.size() - header_length;
+        size_t body_used = conn->response_body.consume(head.data() + header_length, body_available);
+
+        conn->response_buffer.append(head, 0, header_length + body_used);
+        fill_cache(conn, head.data(), header_length + body_used);
+        conn->backend_in_sync = body_used == body_available;
+        conn->response_head.clear();
+    } else {
+        size_t used = conn->response_body.consume(data, length);
+        conn->response_buffer.append(data, used);
+        fill_cache(conn, data, used);
+        conn->backend_in_sync = conn->backend_in_sync && used == length;
+    }
+
+    conn->response_complete = conn->response_body.complete();
+
+    // The rest of a large body that needs no scanning is spliced instead of copied,
+    // unless it is small enough to be copied into the cache
+    bool cacheable_size = conn->cache_fill.size() + conn->response_body.opaque_remaining() <= cache.max_object_size();
+    if (!conn->response_complete && options.splice_threshold > 0 &&
+        conn->response_body.opaque_remaining() >= options.splice_threshold &&
+        !(conn->cache_filling && cacheable_size)) {
+        conn->relay_pipe = acquire_pipe();
+        conn->cache_filling = conn->cache_filling && !conn->relay_pipe;
+    }
+    return !conn->response_body.failed();
+}
+
+// Move body bytes from the backend into the connection's pipe without copying them
+void EventLoop::splice_response(const std::shared_ptr<Connection>& conn) {
+    while (!conn->response_complete && conn->relay_pipe->space() > 0) {
+        ssize_t moved = conn->relay_pipe->fill(conn->backend_socket, conn->response_body.opaque_remaining());
+        if (moved > 0) {
+            conn->response_body.skip(moved);
+            conn->response_bytes += moved;
+            conn->response_complete = conn->response_body.complete();
+            continue;
+        }
+        if (moved < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // The backend closed (or reset) the connection
+        conn->backend_eof = true;
+        break;
+    }
+}
+
+// Write pending response bytes to the client, applying backpressure to the backend
+void EventLoop::write_response(const std::shared_ptr<Connection>& conn) {
+    while (conn->response_sent < conn->response_buffer.size()) {
+        ssize_t bytes_sent = send(conn->client_socket,
+                                  conn->response_buffer.data() + conn->response_sent,
+                                  conn->response_buffer.size() - conn->response_sent,
+                                  MSG_NOSIGNAL);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close_connection(conn);
+            return;
+        }
+        conn->response_sent += bytes_sent;
+        conn->response_delivered += bytes_sent;
+        conn->last_activity = std::chrono::steady_clock::now();
+    }
+
+    // Spliced body bytes follow the buffered ones
+    if (conn->relay_pipe && conn->response_sent == conn->response_buffer.size()) {
+        while (conn->relay_pipe->buffered() > 0) {
+            ssize_t drained = conn->relay_pipe->drain(conn->client_socket);
+            if (drained < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                close_connection(conn);
+                return;
+            }
+            conn->response_delivered += static_cast<size_t>(drained);
+            conn->last_activity = std::chrono::steady_clock::now();
+        }
+    }
+
+    bool drained = conn->response_sent == conn->response_buffer.size() &&
+                   (!conn->relay_pipe || conn->relay_pipe->buffered() == 0);
+    if (drained) {
+        conn->response_buffer.clear();
+        conn->response_sent = 0;
+
+        if (conn->response_complete && conn->client_keep_alive) {
+            finish_request(conn);
+            return;
+        }
+        if (conn->backend_eof || conn->response_complete) {
+            close_connection(conn);
+            return;
+        }
+    }
+
+    // Only wait on the client while data is pending, and only read the backend while there is room
+    watch(conn->client_socket, (drained ? 0u : static_cast<uint32_t>(EPOLLOUT)) | EPOLLRDHUP, false);
+    if (conn->backend_socket >= 0 && !conn->backend_eof && !conn->response_complete) {
+        bool has_room = conn->relay_pipe ? conn->relay_pipe->space() > 0
+                                         : conn->response_buffer.size() - conn->response_sent <
+                                               options.buffers.max_response_buffer;
+        watch(conn->backend_socket, has_room ? static_cast<uint32_t>(EPOLLIN) : 0u, false);
+    }
+}
+
+// Retry on a fresh connection after a pooled one turned out to be stale
+void EventLoop::retry_backend(const std::shared_ptr<Connection>& conn) {
+    connections.erase(conn->backend_socket);
+    close(conn->backend_socket);
+    conn->backend_socket = -1;
+    reset_exchange(*conn);
+
+    open_backend_connection(conn, false);
+}
+
+// Pick a backend for the request, answering 503 when none can take it
+bool EventLoop::select_backend(const std::shared_ptr<Connection>& conn, const Backend* avoid) {
+    try {
+        conn->backend = &load_balancer.get_next_backend(conn->request_hash, avoid);
+        conn->backend_selected = std::chrono::steady_clock::now();
+        if (Logger::instance().access_log_enabled()) {
+            conn->served_by = conn->backend->address;
+        }
+        return true;
+    } catch (const OverloadedError&) {
+        metrics.requests_shed.add();
+        fail_connection(conn, Response::service_unavailable()); // Shed quietly: logging would only add to the load
+    } catch (const std::runtime_error& e) {
+        log_warn("⚠️ Error forwarding request: %s", e.what());
+        fail_connection(conn, Response::service_unavailable());
+    }
+    return false;
+}
+
+// Retry on another backend, hand over to the hedge, or tell the client why there is no response
+void EventLoop::backend_failed(const std::shared_ptr<Connection>& conn, RequestOutcome outcome) {
+    conn->backend_outcome = outcome;
+
+    // A hedge that already has the whole request is a retry under way
+    if (conn->hedge.backend != nullptr && !conn->hedge.connecting && conn->hedge.sent == conn->request_length) {
+        promote_hedge(conn);
+        return;
+    }
+    cancel_hedge(conn, RequestOutcome::ABORTED);
+
+    if (conn->response_delivered > 0 || !conn->response_buffer.empty()) {
+        close_connection(conn); // Part of a response is out: the client can only see the connection close
+        return;
+    }
+
+    bool replayable = conn->response_bytes == 0 && !conn->request_streamed &&
+                      is_idempotent_method(conn->request_parser.method());
+    if (replayable && conn->retries < load_balancer.retry_options().max_retries) {
+        if (load_balancer.try_retry()) {
+            ++conn->retries;
+            metrics.retries.add();
+            const Backend* failed = conn->backend;
+            release_backend(conn, false);
+            reset_exchange(*conn);
+            if (select_backend(conn, failed)) {
+                open_backend_connection(conn, true);
+            }
+            return;
+        }
+        metrics.retries_denied.add();
+    }
+
+    fail_connection(conn, Response::canned(outcome == RequestOutcome::TIMEOUT ? CannedResponse::GATEWAY_TIMEOUT
+                                                                              : CannedResponse::BAD_GATEWAY));
+}
+
+// Send the request to a second backend while the first keeps its chance to answer
+void EventLoop::start_hedge(const std::shared_ptr<Connection>& conn) {
+    conn->hedged = true;
+    if (!load_balancer.try_retry()) {
+        metrics.retries_denied.add();
+        return;
+    }
+
+    Hedge& hedge = conn->hedge;
+    try {
+        hedge.backend = &load_balancer.get_next_backend(conn->request_hash, conn->backend);
+    } catch (const std::runtime_error&) {
+        return; // Overloaded or nothing available: the first backend carries on alone
+    }
+    hedge.selected = std::chrono::steady_clock::now();
+    if (hedge.backend == conn->backend) {
+        cancel_hedge(conn, RequestOutcome::ABORTED); // No other backend to ask
+        return;
+    }
+
+    int socket = connection_pool.checkout(hedge.backend->address);
+    hedge.reused = socket >= 0;
+    if (hedge.reused) {
+        set_non_blocking(socket);
+    } else {
+        hedge.connect_started = hedge.selected;
+        socket = open_backend_socket(hedge.backend->address, true);
+        if (socket < 0) {
+            cancel_hedge(conn, RequestOutcome::CONNECTION_FAILURE);
+            return;
+        }
+        hedge.connecting = true;
+    }
+
+    hedge.socket = socket;
+    connections[socket] = conn;
+    watch(socket, EPOLLOUT, true);
+    metrics.hedges.add();
+    if (!hedge.connecting) {
+        write_hedge(conn);
+    }
+}
+
+void EventLoop::handle_hedge_event(const std::shared_ptr<Connection>& conn, uint32_t events) {
+    Hedge& hedge = conn->hedge;
+    if (hedge.connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(hedge.socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            cancel_hedge(conn, RequestOutcome::CONNECTION_FAILURE);
+            return;
+        }
+        hedge.connecting = false;
+        hedge.timing.connect = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - hedge.connect_started);
+    } else if (events & EPOLLERR) {
+        cancel_hedge(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    if (hedge.sent < conn->request_length) {
+        write_hedge(conn);
+        return;
+    }
+
+    // The whole request is out, so the hedge has answered first, or its connection closed
+    char byte;
+    ssize_t peeked = recv(hedge.socket, &byte, 1, MSG_PEEK);
+    if (peeked > 0) {
+        promote_hedge(conn);
+        read_response(conn);
+    } else if (peeked == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        cancel_hedge(conn, RequestOutcome::CONNECTION_FAILURE);
+    }
+}
+
+// Forward the (fully buffered) request on the hedge's connection
+void EventLoop::write_hedge(const std::shared_ptr<Connection>& conn) {
+    Hedge& hedge = conn->hedge;
+    while (hedge.sent < conn->request_length) {
+        ssize_t bytes_sent = send_request(hedge.socket, *conn, hedge.head_sent, hedge.sent);
+        if (bytes_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                cancel_hedge(conn, RequestOutcome::CONNECTION_FAILURE);
+            }
+            return;
+        }
+    }
+
+    hedge.forwarded = std::chrono::steady_clock::now();
+    watch(hedge.socket, EPOLLIN, false);
+}
+
+// The hedge serves the request from now on; the first backend is released unanswered
+void EventLoop::promote_hedge(const std::shared_ptr<Connection>& conn) {
+    Hedge hedge = conn->hedge;
+    conn->hedge = Hedge();
+    release_backend(conn, false);
+
+    conn->backend = hedge.backend;
+    conn->backend_socket = hedge.socket;
+    conn->backend_reused = hedge.reused;
+    conn->backend_selected = hedge.selected;
+    conn->backend_timing = hedge.timing;
+    conn->request_forwarded = hedge.forwarded;
+    reset_exchange(*conn);
+    conn->head_sent = conn->rewritten_head.size();
+    conn->request_sent = conn->request_length;
+    if (Logger::instance().access_log_enabled()) {
+        conn->served_by = conn->backend->address;
+    }
+    metrics.hedges_won.add();
+    watch(conn->backend_socket, EPOLLIN, false);
+}
+
+// Drop the hedge, if any, and release its backend
+void EventLoop::cancel_hedge(const std::shared_ptr<Connection>& conn, RequestOutcome outcome) {
+    Hedge& hedge = conn->hedge;
+    if (hedge.backend == nullptr) {
+        return;
+    }
+    if (hedge.socket >= 0) {
+        connections.erase(hedge.socket);
+        close(hedge.socket); // Never pooled: a response to the request may still be on its way
+    }
+    hedge.timing.total = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - hedge.selected);
+    load_balancer.release_backend(*hedge.backend, outcome, hedge.timing);
+    conn->hedge = Hedge();
+}
+
+// Push a timer unless the pending one comes first (it re-arms when it fires)
+void EventLoop::arm_timer(const std::shared_ptr<Connection>& conn, std::chrono::steady_clock::time_point due) {
+    if (conn->timer_sequence != 0 && conn->timer_due <= due) {
+        return;
+    }
+    if (conn->timer_sequence == 0) {
+        ++live_timers;
+    }
+    conn->timer_sequence = ++last_timer_sequence;
+    conn->timer_due = due;
+    timers.push_back(Timer{due, conn->timer_sequence, conn->client_socket});
+    std::push_heap(timers.begin(), timers.end(), std::greater<Timer>());
+
+    // Closed connections leave their entries behind until they come due; don't let them pile up
+    if (timers.size() > 2 * live_timers + 64) {
+        timers.erase(std::remove_if(timers.begin(), timers.end(),
+                                    [this](const Timer& timer) { return !is_live(timer); }),
+                     timers.end());
+        std::make_heap(timers.begin(), timers.end(), std::greater<Timer>());
+    }
+}
+
+bool EventLoop::is_live(const Timer& timer) const {
+    auto it = connections.find(timer.client_socket);
+    return it != connections.end() && it->second->client_socket == timer.client_socket &&
+           it->second->timer_sequence == timer.sequence;
+}
+
+// Run the timers that have come due, skipping stale ones
+void EventLoop::run_timers() {
+    auto now = std::chrono::steady_clock::now();
+    while (!timers.empty() && timers.front().due <= now) {
+        Timer timer = timers.front();
+        std::pop_heap(timers.begin(), timers.end(), std::greater<Timer>());
+        timers.pop_back();
+        if (!is_live(timer)) {
+            continue;
+        }
+
+        std::shared_ptr<Connection> conn = connections[timer.client_socket];
+        conn->timer_sequence = 0;
+        --live_timers;
+        check_deadlines(conn);
+    }
+}
+
+int EventLoop::next_timer_wait(int max_wait) {
+    if (timers.empty()) {
+        return max_wait;
+    }
+    auto wait = std::chrono::ceil<std::chrono::milliseconds>(timers.front().due - std::chrono::steady_clock::now());
+    return static_cast<int>(std::min<int64_t>(max_wait, std::max<int64_t>(0, wait.count())));
+}
+
+// Act on the deadline of the exchange's current phase if it has passed, else wait for the nearest one
+void EventLoop::check_deadlines(const std::shared_ptr<Connection>& conn) {
+    if (conn->backend == nullptr || conn->client_socket < 0) {
+        return; // No backend exchange in progress
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto due = std::chrono::steady_clock::time_point::max();
+    auto expired = [&now, &due](std::chrono::steady_clock::time_point deadline) {
+        if (now >= deadline) {
+            return true;
+        }
+        due = std::min(due, deadline);
+        return false;
+    };
+
+    if (conn->state == ConnectionState::CONNECTING_BACKEND) {
+        if (options.backend_connect_timeout.count() > 0 &&
+            expired(conn->connect_started + options.backend_connect_timeout)) {
+            backend_failed(conn, RequestOutcome::TIMEOUT);
+            return;
+        }
+    } else if (conn->state == ConnectionState::RELAYING_RESPONSE && conn->response_bytes == 0) {
+        // Waiting for the first byte, on a hedge too if the backend is late
+        if (options.backend_first_byte_timeout.count() > 0 &&
+            expired(conn->request_forwarded + options.backend_first_byte_timeout)) {
+            cancel_hedge(conn, RequestOutcome::TIMEOUT);
+            backend_failed(conn, RequestOutcome::TIMEOUT);
+            return;
+        }
+        if (conn->hedge_delay.count() > 0 && !conn->hedged && expired(conn->request_forwarded + conn->hedge_delay)) {
+            start_hedge(conn);
+        }
+    } else if (options.backend_idle_timeout.count() > 0 && expired(conn->last_activity + options.backend_idle_timeout)) {
+        // Nothing moved: the backend stalled, unless it was the client the proxy was waiting on
+        bool client_stalled = conn->awaiting_request_body || conn->response_sent < conn->response_buffer.size() ||
+                              (conn->relay_pipe && conn->relay_pipe->buffered() > 0);
+        if (client_stalled) {
+            close_connection(conn);
+        } else {
+            backend_failed(conn, RequestOutcome::TIMEOUT);
+        }
+        return;
+    }
+
+    if (due != std::chrono::steady_clock::time_point::max()) {
+        arm_timer(conn, due);
+    }
+}
+
+// Copy relayed response bytes for the cache while this request leads a fetch
+void EventLoop::fill_cache(const std::shared_ptr<Connection>& conn, const char* data, size_t length) {
+    if (!conn->cache_filling) {
+        return;
+    }
+    if (conn->cache_fill.size() + length > cache.max_object_size()) {
+        conn->cache_filling = false;
+        conn->cache_fill.clear();
+        return;
+    }
+    conn->cache_fill.append(data, length);
+}
+
+// Store the fetched response, or mark the key uncacheable, once the response is complete;
+// a fetch cut short lets the next miss try again
+void EventLoop::finish_cache_fill(const std::shared_ptr<Connection>& conn, bool complete) {
+    if (conn->cache_key.empty()) {
+        return;
+    }
+    if (!complete) {
+        cache.abandon_fetch(conn->cache_key);
+    } else {
+        cache.finish_fetch(conn->cache_key, conn->cache_filling ? ResponseCache::make_entry(conn->cache_fill) : nullptr);
+    }
+    conn->cache_key.clear();
+    conn->cache_fill.clear();
+    conn->cache_filling = false;
+}
+
+// Detach the backend socket, returning it to the pool when it can carry another request
+void EventLoop::release_backend(const std::shared_ptr<Connection>& conn, bool reusable) {
+    cancel_hedge(conn, RequestOutcome::ABORTED);
+
+    if (conn->backend_socket >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->backend_socket, nullptr);
+        connections.erase(conn->backend_socket);
+        bool retired = conn->backend->retired.load(std::memory_order_relaxed);
+        connection_pool.checkin(conn->backend->address, conn->backend_socket, reusable && !retired);
+        conn->backend_socket = -1;
+    }
+
+    if (conn->backend != nullptr) {
+        conn->backend_timing.total = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - conn->backend_selected);
+        load_balancer.release_backend(*conn->backend, conn->backend_outcome, conn->backend_timing);
+        conn->backend = nullptr;
+        conn->backend_outcome = RequestOutcome::ABORTED;
+        conn->backend_timing = BackendTiming();
+    }
+}
+
+// Take a spare connection no handler still holds, or make one
+std::shared_ptr<Connection> EventLoop::acquire_connection() {
+    while (!spare_connections.empty()) {
+        std::shared_ptr<Connection> conn = std::move(spare_connections.back());
+        spare_connections.pop_back();
+        if (conn.use_count() == 1) {
+            reuse_connection(*conn);
+            return conn;
+        }
+    }
+    return std::make_shared<Connection>();
+}
+
+// Take an empty relay pipe, or nullptr if none can be created (the body is copied instead)
+std::unique_ptr<SplicePipe> EventLoop::acquire_pipe() {
+    if (!idle_pipes.empty()) {
+        std::unique_ptr<SplicePipe> pipe = std::move(idle_pipes.back());
+        idle_pipes.pop_back();
+        return pipe;
+    }
+
+    std::unique_ptr<SplicePipe> pipe(new SplicePipe());
+    return pipe->is_open() ? std::move(pipe) : nullptr;
+}
+
+// Keep the connection's pipe for reuse if it is empty; bytes left in it would corrupt another response
+void EventLoop::release_pipe(const std::shared_ptr<Connection>& conn) {
+    if (conn->relay_pipe && conn->relay_pipe->buffered() == 0 && idle_pipes.size() < MAX_IDLE_PIPES) {
+        idle_pipes.push_back(std::move(conn->relay_pipe));
+    }
+    conn->relay_pipe.reset();
+}
+
+// Answer the request from the proxy itself instead of a backend
+void EventLoop::respond_locally(const std::shared_ptr<Connection>& conn, const std::string& response) {
+    watch(conn->client_socket, 0, false);
+    conn->response_buffer = response;
+    conn->response_sent = 0;
+    conn->response_complete = true;
+    conn->state = ConnectionState::RELAYING_RESPONSE;
+    write_response(conn);
+}
+
+// Write the access-log line of the request in flight, if any
+void EventLoop::log_request(const std::shared_ptr<Connection>& conn) {
+    if (!conn->request_active) {
+        return;
+    }
+    conn->request_active = false;
+
+    AccessLogEntry access;
+    access.client = conn->client_address;
+    access.method = conn->request_method;
+    access.path = conn->request_path;
+    access.status = conn->response_status;
+    access.response_bytes = conn->response_delivered;
+    access.backend = conn->served_by;
+    access.started = conn->request_started;
+    Logger::instance().log_access(access);
+
+    conn->served_by.clear();
+    conn->response_status = 0;
+    conn->response_delivered = 0;
+}
+
+// Send a short error response and close the connection
+void EventLoop::fail_connection(const std::shared_ptr<Connection>& conn, const std::string& response) {
+    ssize_t sent = send(conn->client_socket, response.c_str(), response.length(), MSG_NOSIGNAL);
+    if (conn->request_active && sent > 0) {
+        conn->response_status = std::atoi(response.c_str() + 9); // Our own "HTTP/1.1 NNN ..." responses
+        conn->response_delivered += static_cast<size_t>(sent);
+    }
+    close_connection(conn);
+}
+
+// Add or modify an fd in the epoll interest list
+void EventLoop::watch(int fd, uint32_t events, bool add) {
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) < 0) {
+        log_error("epoll_ctl failed: %s", strerror(errno));
+    }
+}
+
+// Close both sides of a connection; closing an fd also removes it from epoll
+void EventLoop::close_connection(const std::shared_ptr<Connection>& conn) {
+    log_request(conn);
+    finish_cache_fill(conn, false);
+    release_backend(conn, false);
+    release_pipe(conn);
+
+    if (conn->timer_sequence != 0) {
+        conn->timer_sequence = 0;
+        --live_timers;
+    }
+
+    if (conn->client_socket >= 0) {
+        connections.erase(conn->client_socket);
+        close(conn->client_socket);
+        conn->client_socket = -1;
+        --client_connections;
+        metrics.open_connections.sub();
+        if (spare_connections.size() < MAX_SPARE_CONNECTIONS) {
+            spare_connections.push_back(conn);
+        }
+    }
+}
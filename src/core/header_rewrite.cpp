@@ -0,0 +1,232 @@
+#include "core/header_rewrite.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <random>
+
+namespace {
+
+// Header names are ASCII tokens, so folding A-Z is enough (and cheaper than tolower())
+char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (lower(a[i]) != lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view trim(std::string_view text) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+// Hop-by-hop headers (RFC 7230 section 6.1), except Transfer-Encoding: the body is forwarded as
+// it was framed, so its encoding must go with it
+constexpr std::string_view HOP_BY_HOP_HEADERS[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authorization", "TE", "Trailer", "Upgrade"
+};
+
+// Headers the Connection header cannot have removed: the request would lose its framing or its host
+constexpr std::string_view PROTECTED_HEADERS[] = {"Content-Length", "Transfer-Encoding", "Host"};
+
+// Whether a header only concerns the client's connection to the proxy. connection is the value
+// of the Connection header, whose tokens name more of them.
+bool is_hop_by_hop(std::string_view name, std::string_view connection) {
+    for (std::string_view header : HOP_BY_HOP_HEADERS) {
+        if (equals_ignore_case(name, header)) {
+            return true;
+        }
+    }
+    while (!connection.empty()) {
+        size_t comma = connection.find(',');
+        if (equals_ignore_case(trim(connection.substr(0, comma)), name)) {
+            for (std::string_view header : PROTECTED_HEADERS) {
+                if (equals_ignore_case(name, header)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        connection.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// The IP of an "IP:PORT" address
+std::string_view client_ip(std::string_view address) {
+    size_t colon = address.rfind(':');
+    return colon == std::string_view::npos ? address : address.substr(0, colon);
+}
+
+// 128 random bits as 32 hex digits
+void format_request_id(char* out) {
+    thread_local std::mt19937_64 random(std::random_device{}());
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    for (int half = 0; half < 2; ++half) {
+        uint64_t bits = random();
+        for (int i = 0; i < 16; ++i) {
+            out[half * 16 + i] = HEX_DIGITS[bits & 0xf];
+            bits >>= 4;
+        }
+    }
+}
+
+} // namespace
+
+RewrittenHead::RewrittenHead() : segment_count(0), total(0), original_length(0), fragments_used(0) {}
+
+void RewrittenHead::clear() {
+    segment_count = 0;
+    total = 0;
+    original_length = 0;
+    fragments_used = 0;
+}
+
+void RewrittenHead::add_segment(bool fragment, size_t offset, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    total += length;
+    if (segment_count > 0) {
+        Segment& last = segments[segment_count - 1];
+        if (last.fragment == fragment && last.offset + last.length == offset) {
+            last.length += static_cast<uint32_t>(length);
+            return;
+        }
+    }
+    segments[segment_count++] = Segment{fragment, static_cast<uint32_t>(offset), static_cast<uint32_t>(length)};
+}
+
+size_t RewrittenHead::store(std::string_view text) {
+    size_t offset = fragments_used;
+    size_t length = std::min(text.size(), sizeof(fragments) - fragments_used);
+    std::memcpy(fragments + offset, text.data(), length);
+    fragments_used += length;
+    return offset;
+}
+
+void RewrittenHead::build(std::string_view head, const HttpRequestParser& parsed, std::string_view client_address,
+                          const HeaderRewriteOptions& options) {
+    clear();
+    original_length = parsed.head().header_length;
+    std::string_view connection = options.strip_hop_by_hop ? parsed.get_header("Connection") : std::string_view();
+    std::string_view host = std::string_view(options.host).substr(0, MAX_REWRITE_HOST);
+    std::string_view ip = client_ip(client_address);
+    bool forward_for = options.forwarded_for && !ip.empty();
+
+    // The client is appended to the last X-Forwarded-For, which lists the hops in order. Headers
+    // about to be stripped do not count.
+    std::array<bool, HttpRequestParser::MAX_HEADERS> strip{};
+    size_t forwarded_for_index = parsed.header_count();
+    bool has_request_id = false;
+    bool has_host = false;
+    for (size_t i = 0; i < parsed.header_count(); ++i) {
+        std::string_view name = parsed.header(i).name;
+        strip[i] = options.strip_hop_by_hop && is_hop_by_hop(name, connection);
+        if (strip[i]) {
+            continue;
+        }
+        if (equals_ignore_case(name, "X-Forwarded-For")) {
+            forwarded_for_index = i;
+        } else if (equals_ignore_case(name, "X-Request-Id")) {
+            has_request_id = true;
+        } else if (equals_ignore_case(name, "Host")) {
+            has_host = true;
+        }
+    }
+
+    // Walk the headers, copying nothing: unchanged bytes become spans of the original head
+    size_t host_fragment = 0;
+    bool host_stored = false;
+    size_t cursor = 0;
+    for (size_t i = 0; i < parsed.header_count(); ++i) {
+        HeaderField field = parsed.header(i);
+        size_t name_offset = field.name.data() - head.data();
+        size_t value_offset = field.value.data() - head.data();
+        size_t value_end = value_offset + field.value.size();
+
+        if (strip[i]) {
+            add_segment(false, cursor, name_offset - cursor);
+            cursor = head.find('\n', value_end) + 1;
+        } else if (!host.empty() && equals_ignore_case(field.name, "Host")) {
+            if (!host_stored) {
+                host_fragment = store(host);
+                host_stored = true;
+            }
+            add_segment(false, cursor, value_offset - cursor);
+            add_segment(true, host_fragment, host.size());
+            cursor = value_end;
+        } else if (forward_for && i == forwarded_for_index) {
+            add_segment(false, cursor, value_end - cursor);
+            size_t offset = store(field.value.empty() ? "" : ", ");
+            store(ip);
+            add_segment(true, offset, fragments_used - offset);
+            cursor = value_end;
+        }
+    }
+
+    // New headers go before the blank line ending the head
+    size_t blank_line = original_length - (original_length >= 2 && head[original_length - 2] == '\r' ? 2 : 1);
+    add_segment(false, cursor, blank_line - cursor);
+
+    size_t inserted = fragments_used;
+    if (forward_for && forwarded_for_index == parsed.header_count()) {
+        store("X-Forwarded-For: ");
+        store(ip);
+        store("\r\n");
+    }
+    if (options.request_id && !has_request_id) {
+        char request_id[32];
+        format_request_id(request_id);
+        store("X-Request-Id: ");
+        store(std::string_view(request_id, sizeof(request_id)));
+        store("\r\n");
+    }
+    if (!host.empty() && !has_host) {
+        store("Host: ");
+        store(host);
+        store("\r\n");
+    }
+    add_segment(true, inserted, fragments_used - inserted);
+    add_segment(false, blank_line, original_length - blank_line);
+}
+
+size_t RewrittenHead::to_iov(const char* head, size_t offset, struct iovec* iov, size_t max) const {
+    size_t count = 0;
+    for (size_t i = 0; i < segment_count && count < max; ++i) {
+        const Segment& segment = segments[i];
+        if (offset >= segment.length) {
+            offset -= segment.length;
+            continue;
+        }
+        const char* base = segment.fragment ? fragments : head;
+        iov[count].iov_base = const_cast<char*>(base + segment.offset + offset);
+        iov[count].iov_len = segment.length - offset;
+        ++count;
+        offset = 0;
+    }
+    return count;
+}
+
+void RewrittenHead::append_to(const char* head, std::string& out) const {
+    for (size_t i = 0; i < segment_count; ++i) {
+        const Segment& segment = segments[i];
+        out.append((segment.fragment ? fragments : head) + segment.offset, segment.length);
+    }
+}
@@ -0,0 +1,244 @@
+#include "core/health_checker.h"
+#include "core/utils.h"
+#include "core/logger.h"
+#include "core/read_section.h"
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+HealthChecker::HealthChecker(const std::atomic<const BackendSet*>& backend_set, const HealthCheckOptions& options)
+    : backend_set(backend_set), options(options), epoll_fd(-1), stopping(false) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        log_error("epoll_create1 failed for health checks: %s", strerror(errno));
+    }
+}
+
+HealthChecker::~HealthChecker() {
+    stop();
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+void HealthChecker::start() {
+    if (epoll_fd < 0 || checker_thread.joinable()) {
+        return;
+    }
+
+    checker_thread = std::thread([this] {
+        std::unique_lock<std::mutex> lock(stop_mutex);
+        while (!stopping) {
+            lock.unlock();
+            run_round();
+            lock.lock();
+
+            // Sleep for the interval, waking early on stop()
+            stop_condition.wait_for(lock, options.interval, [this] { return stopping; });
+        }
+    });
+}
+
+void HealthChecker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex);
+        stopping = true;
+    }
+    stop_condition.notify_all();
+
+    if (checker_thread.joinable()) {
+        checker_thread.join();
+    }
+}
+
+// Probe every backend once, waiting at most for the probe timeouts
+void HealthChecker::run_round() {
+    // A round outlasts any read section, so it probes its own references to the backends and a
+    // reload can free the snapshot meanwhile
+    std::vector<std::shared_ptr<Backend>> backends;
+    {
+        ReadSection section;
+        const BackendSet* set = backend_set.load(std::memory_order_acquire);
+        if (set != nullptr) {
+            backends = set->backends;
+        }
+    }
+    if (backends.empty()) {
+        return;
+    }
+
+    // Start every probe at once; probes is never resized, so its elements can be epoll cookies
+    std::vector<Probe> probes(backends.size());
+    size_t pending = 0;
+    for (size_t i = 0; i < probes.size(); ++i) {
+        probes[i].backend = backends[i].get();
+        if (!start_probe(probes[i])) {
+            record(*probes[i].backend, false);
+            continue;
+        }
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLOUT;
+        event.data.ptr = &probes[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, probes[i].socket, &event);
+        ++pending;
+    }
+
+    auto finish = [this, &pending](Probe& probe, bool healthy) {
+        close(probe.socket); // Also removes it from epoll
+        probe.socket = -1;
+        record(*probe.backend, healthy);
+        --pending;
+    };
+
+    epoll_event events[64];
+    while (pending > 0) {
+        // Wake up in time for the earliest deadline
+        auto now = std::chrono::steady_clock::now();
+        auto next_deadline = std::chrono::steady_clock::time_point::max();
+        for (Probe& probe : probes) {
+            if (probe.socket < 0) {
+                continue;
+            }
+            if (probe.deadline <= now) {
+                finish(probe, false);
+                continue;
+            }
+            next_deadline = std::min(next_deadline, probe.deadline);
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_deadline - now).count() + 1;
+        int ready = epoll_wait(epoll_fd, events, 64, static_cast<int>(wait));
+        if (ready < 0 && errno != EINTR) {
+            log_error("epoll_wait failed for health checks: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            Probe& probe = *static_cast<Probe*>(events[i].data.ptr);
+            bool healthy = false;
+            if (probe.socket >= 0 && advance_probe(probe, healthy)) {
+                finish(probe, healthy);
+            }
+        }
+    }
+
+    // Only reached early if epoll failed
+    for (Probe& probe : probes) {
+        if (probe.socket >= 0) {
+            finish(probe, false);
+        }
+    }
+}
+
+// Start a non-blocking connect to the probe's backend
+bool HealthChecker::start_probe(Probe& probe) {
+    struct sockaddr_in address;
+    if (!parse_backend_address(probe.backend->address, address)) {
+        return false;
+    }
+
+    probe.socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (probe.socket < 0) {
+        log_error("Failed to create socket for health check: %s", strerror(errno));
+        return false;
+    }
+
+    if (connect(probe.socket, (struct sockaddr*)&address, sizeof(address)) < 0 && errno != EINPROGRESS) {
+        close(probe.socket);
+        probe.socket = -1;
+        return false;
+    }
+
+    probe.deadline = std::chrono::steady_clock::now() + options.connect_timeout;
+    return true;
+}
+
+// Advance a probe after an epoll event; returns true once it has a verdict in healthy
+bool HealthChecker::advance_probe(Probe& probe, bool& healthy) {
+    if (!probe.connected) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(probe.socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+            return true;
+        }
+        probe.connected = true;
+        probe.deadline = std::chrono::steady_clock::now() + options.read_timeout;
+    }
+
+    if (!probe.request_sent) {
+        std::string request = "GET " + options.path + " HTTP/1.1\r\nHost: " + probe.backend->address +
+                              "\r\nConnection: close\r\n\r\n";
+        // A fresh socket's send buffer always has room for a request this small
+        if (send(probe.socket, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            return true;
+        }
+        probe.request_sent = true;
+
+        epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = &probe;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, probe.socket, &event);
+        return false;
+    }
+
+    char buffer[1024];
+    while (true) {
+        ssize_t bytes_read = recv(probe.socket, buffer, sizeof(buffer), 0);
+        if (bytes_read > 0) {
+            probe.response.append(buffer, bytes_read);
+            break;
+        }
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        return true; // Closed or failed before the status line
+    }
+
+    // Only the status line matters: "HTTP/1.1 200 OK"
+    size_t line_end = probe.response.find("\r\n");
+    if (line_end == std::string::npos) {
+        return probe.response.size() > sizeof(buffer); // Give up on absurd status lines
+    }
+
+    size_t status = probe.response.find(' ');
+    int status_code = status < line_end ? atoi(probe.response.c_str() + status + 1) : 0;
+    healthy = probe.response.compare(0, 5, "HTTP/") == 0 && status_code >= 200 && status_code < 300;
+    return true;
+}
+
+// Apply rise/fall thresholds and publish the verdict
+void HealthChecker::record(Backend& backend, bool healthy) {
+    BackendHealth& state = health[&backend];
+    bool alive = backend.is_alive.load(std::memory_order_relaxed);
+
+    if (healthy) {
+        state.failures = 0;
+        state.successes = std::min(state.successes + 1, options.rise);
+        if (!alive && state.successes >= options.rise) {
+            backend.is_alive.store(true, std::memory_order_relaxed);
+            log_info("Backend %s is UP again!", backend.address.c_str());
+        }
+    } else {
+        state.successes = 0;
+        state.failures = std::min(state.failures + 1, options.fall);
+        if (alive && state.failures >= options.fall) {
+            backend.is_alive.store(false, std::memory_order_relaxed);
+            log_warn("Backend %s failed health check", backend.address.c_str());
+        }
+    }
+}
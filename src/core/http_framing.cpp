@@ -0,0 +1,302 @@
+#include "core/http_framing.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+// Whether one element of a comma-separated list, with the whitespace around it, is exactly token
+bool item_is_token(const char* item, size_t length, const char* token) {
+    while (length > 0 && (*item == ' ' || *item == '\t')) {
+        ++item;
+        --length;
+    }
+    while (length > 0 && (item[length - 1] == ' ' || item[length - 1] == '\t')) {
+        --length;
+    }
+    return length == strlen(token) && strncasecmp(item, token, length) == 0;
+}
+
+// Case-insensitive search for a whole token in a comma-separated header value
+// (e.g. "close" in "Keep-Alive, close", but not in "closed")
+bool value_has_token(const char* value, size_t length, const char* token) {
+    const char* end = value + length;
+    while (true) {
+        const char* comma = static_cast<const char*>(memchr(value, ',', end - value));
+        const char* item_end = comma != nullptr ? comma : end;
+        if (item_is_token(value, item_end - value, token)) {
+            return true;
+        }
+        if (comma == nullptr) {
+            return false;
+        }
+        value = comma + 1;
+    }
+}
+
+// Whether the last element of a comma-separated header value is token (the final transfer coding)
+bool last_token_is(const char* value, size_t length, const char* token) {
+    size_t start = length;
+    while (start > 0 && value[start - 1] != ',') {
+        --start;
+    }
+    return item_is_token(value + start, length - start, token);
+}
+
+bool header_name_is(const char* line, size_t name_length, const char* name) {
+    return name_length == strlen(name) && strncasecmp(line, name, name_length) == 0;
+}
+
+// Headers that decide how a message is framed
+struct FramingHeaders {
+    bool has_content_length = false;
+    size_t content_length = 0;
+    bool has_transfer_encoding = false;
+    bool chunked = false;
+    bool connection_close = false;
+    bool connection_keep_alive = false;
+};
+
+// Scan the header lines between the start line and the blank line ending at `end`
+FramingHeaders scan_framing_headers(const char* line, const char* end) {
+    FramingHeaders headers;
+
+    while (line < end) {
+        const char* line_end = static_cast<const char*>(memmem(line, (end + 2) - line, "\r\n", 2));
+        const char* colon = static_cast<const char*>(memchr(line, ':', line_end - line));
+
+        if (colon != nullptr) {
+            size_t name_length = colon - line;
+            const char* value = colon + 1;
+            size_t value_length = line_end - value;
+
+            if (header_name_is(line, name_length, "content-length")) {
+                headers.has_content_length = true;
+                headers.content_length = strtoull(value, nullptr, 10);
+            } else if (header_name_is(line, name_length, "transfer-encoding")) {
+                // Only a final chunked coding frames the message; the last header line has the last coding
+                headers.has_transfer_encoding = true;
+                headers.chunked = last_token_is(value, value_length, "chunked");
+            } else if (header_name_is(line, name_length, "connection")) {
+                headers.connection_close = value_has_token(value, value_length, "close");
+                headers.connection_keep_alive = value_has_token(value, value_length, "keep-alive");
+            }
+        }
+
+        line = line_end + 2;
+    }
+
+    return headers;
+}
+
+// HTTP/1.1 connections persist unless closed explicitly, HTTP/1.0 ones only on request
+bool is_keep_alive(bool http_11, const FramingHeaders& headers) {
+    return http_11 ? !headers.connection_close : headers.connection_keep_alive;
+}
+
+} // namespace
+
+// Parse a response head once it is fully buffered
+bool parse_response_head(const char* data, size_t length, bool head_request, MessageHead& head) {
+    const char* end = static_cast<const char*>(memmem(data, length, "\r\n\r\n", 4));
+    if (end == nullptr) {
+        return false;
+    }
+
+    head = MessageHead();
+    head.header_length = (end - data) + 4;
+
+    // Status line: "HTTP/1.1 200 OK"
+    const char* line_end = static_cast<const char*>(memmem(data, head.header_length, "\r\n", 2));
+    bool http_11 = (line_end - data) >= 8 && strncmp(data, "HTTP/1.1", 8) == 0;
+    const char* status = static_cast<const char*>(memchr(data, ' ', line_end - data));
+    if (status != nullptr) {
+        head.status_code = atoi(status + 1);
+    }
+
+    FramingHeaders headers = scan_framing_headers(line_end + 2, end);
+    head.content_length = headers.content_length;
+    head.keep_alive = is_keep_alive(http_11, headers);
+
+    if (head_request || (head.status_code >= 100 && head.status_code < 200) ||
+        head.status_code == 204 || head.status_code == 304) {
+        head.framing = BodyFraming::NONE;
+    } else if (headers.chunked) {
+        head.framing = BodyFraming::CHUNKED;
+    } else if (headers.has_content_length && !headers.has_transfer_encoding) {
+        head.framing = BodyFraming::CONTENT_LENGTH;
+    } else {
+        // Also when a coding other than chunked comes last: it overrides Content-Length (RFC 9112 6.3)
+        head.framing = BodyFraming::UNTIL_CLOSE;
+        head.keep_alive = false;
+    }
+
+    return true;
+}
+
+// 1xx responses other than 101 (e.g. 100 Continue) precede the final response of the same exchange
+bool is_interim_response(const MessageHead& head) {
+    return head.status_code >= 100 && head.status_code < 200 && head.status_code != 101;
+}
+
+// Insert "Connection: close" before the blank line of a buffered head
+void add_connection_close(std::string& buffer, size_t head_offset, MessageHead& head) {
+    static const char CONNECTION_CLOSE[] = "Connection: close\r\n";
+    buffer.insert(head_offset + head.header_length - 2, CONNECTION_CLOSE, sizeof(CONNECTION_CLOSE) - 1);
+    head.header_length += sizeof(CONNECTION_CLOSE) - 1;
+    head.keep_alive = false;
+}
+
+ChunkedDecoder::ChunkedDecoder() : state(State::SIZE), chunk_remaining(0), saw_size_digit(false) {}
+
+// Consume bytes; returns how many of them belong to the body
+size_t ChunkedDecoder::consume(const char* data, size_t length) {
+    size_t i = 0;
+
+    while (i < length && state != State::DONE && state != State::ERROR) {
+        char c = data[i];
+
+        switch (state) {
+            case State::SIZE: {
+                int digit = -1;
+                if (c >= '0' && c <= '9') digit = c - '0';
+                else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+
+                if (digit >= 0) {
+                    // Refuse sizes that would overflow
+                    if (chunk_remaining > (UINT64_MAX >> 4)) {
+                        state = State::ERROR;
+                        break;
+                    }
+                    chunk_remaining = (chunk_remaining << 4) | digit;
+                    saw_size_digit = true;
+                } else if (c == '\r' && saw_size_digit) {
+                    state = State::SIZE_LF;
+                } else if ((c == ';' || c == ' ' || c == '\t') && saw_size_digit) {
+                    state = State::SIZE_EXTENSION;
+                } else {
+                    state = State::ERROR;
+                }
+                ++i;
+                break;
+            }
+            case State::SIZE_EXTENSION:
+                if (c == '\r') {
+                    state = State::SIZE_LF;
+                }
+                ++i;
+                break;
+            case State::SIZE_LF:
+                if (c != '\n') {
+                    state = State::ERROR;
+                    break;
+                }
+                state = chunk_remaining == 0 ? State::TRAILER_START : State::DATA;
+                ++i;
+                break;
+            case State::DATA: {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(chunk_remaining, length - i));
+                chunk_remaining -= take;
+                i += take;
+                if (chunk_remaining == 0) {
+                    state = State::DATA_CR;
+                }
+                break;
+            }
+            case State::DATA_CR:
+                state = c == '\r' ? State::DATA_LF : State::ERROR;
+                ++i;
+                break;
+            case State::DATA_LF:
+                if (c != '\n') {
+                    state = State::ERROR;
+                    break;
+                }
+                state = State::SIZE;
+                saw_size_digit = false;
+                ++i;
+                break;
+            case State::TRAILER_START:
+                state = c == '\r' ? State::FINAL_LF : State::TRAILER_LINE;
+                ++i;
+                break;
+            case State::TRAILER_LINE:
+                if (c == '\r') {
+                    state = State::TRAILER_LF;
+                }
+                ++i;
+                break;
+            case State::TRAILER_LF:
+                state = c == '\n' ? State::TRAILER_START : State::ERROR;
+                ++i;
+                break;
+            case State::FINAL_LF:
+                state = c == '\n' ? State::DONE : State::ERROR;
+                ++i;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return i;
+}
+
+BodyFramer::BodyFramer(const MessageHead& head)
+    : framing(head.framing), remaining(head.content_length) {}
+
+// Consume body bytes; returns how many of them belong to this message
+size_t BodyFramer::consume(const char* data, size_t length) {
+    switch (framing) {
+        case BodyFraming::NONE:
+            return 0;
+        case BodyFraming::CONTENT_LENGTH: {
+            size_t take = std::min(remaining, length);
+            remaining -= take;
+            return take;
+        }
+        case BodyFraming::CHUNKED:
+            return chunked.consume(data, length);
+        case BodyFraming::UNTIL_CLOSE:
+        default:
+            return length;
+    }
+}
+
+// The whole body has been seen
+bool BodyFramer::complete() const {
+    switch (framing) {
+        case BodyFraming::NONE:
+            return true;
+        case BodyFraming::CONTENT_LENGTH:
+            return remaining == 0;
+        case BodyFraming::CHUNKED:
+            return chunked.done();
+        case BodyFraming::UNTIL_CLOSE:
+        default:
+            return false;
+    }
+}
+
+// Body bytes that can be relayed without looking at them
+size_t BodyFramer::opaque_remaining() const {
+    switch (framing) {
+        case BodyFraming::CONTENT_LENGTH:
+            return remaining;
+        case BodyFraming::UNTIL_CLOSE:
+            return SIZE_MAX;
+        case BodyFraming::NONE:
+        case BodyFraming::CHUNKED:
+        default:
+            return 0;
+    }
+}
+
+// Account for bytes relayed without being looked at
+void BodyFramer::skip(size_t length) {
+    if (framing == BodyFraming::CONTENT_LENGTH) {
+        remaining -= std::min(remaining, length);
+    }
+}
@@ -0,0 +1,382 @@
+#include "core/http_parser.h"
+#include <algorithm>
+
+namespace {
+
+// tchar from RFC 9110: header names and methods are made of these
+bool is_token_char(unsigned char c) {
+    static const std::array<bool, 256> table = [] {
+        std::array<bool, 256> t{};
+        for (int c = '0'; c <= '9'; ++c) t[c] = true;
+        for (int c = 'a'; c <= 'z'; ++c) t[c] = true;
+        for (int c = 'A'; c <= 'Z'; ++c) t[c] = true;
+        for (char c : std::string_view("!#$%&'*+-.^_`|~")) t[static_cast<unsigned char>(c)] = true;
+        return t;
+    }();
+    return table[c];
+}
+
+// Visible characters, spaces and obs-text are allowed in values; other control characters are not
+bool is_value_char(unsigned char c) {
+    return c == '\t' || (c >= 0x20 && c != 0x7f);
+}
+
+char to_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (to_lower(a[i]) != to_lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Case-insensitive search for a token in a comma-separated header value
+bool contains_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+
+        size_t first = item.find_first_not_of(" \t");
+        size_t last = item.find_last_not_of(" \t");
+        if (first != std::string_view::npos && equals_ignore_case(item.substr(first, last - first + 1), token)) {
+            return true;
+        }
+
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+} // namespace
+
+// Human-readable description of a parse error
+const char* parse_error_message(ParseError error) {
+    switch (error) {
+        case ParseError::NONE: return "no error";
+        case ParseError::BAD_METHOD: return "invalid method";
+        case ParseError::BAD_TARGET: return "invalid request target";
+        case ParseError::BAD_VERSION: return "unsupported HTTP version";
+        case ParseError::BAD_LINE_ENDING: return "line not terminated by CRLF";
+        case ParseError::BAD_HEADER_NAME: return "invalid header name";
+        case ParseError::BAD_HEADER_VALUE: return "invalid character in header value";
+        case ParseError::TOO_MANY_HEADERS: return "too many header fields";
+        case ParseError::HEAD_TOO_LARGE: return "request head too large";
+        case ParseError::BAD_CONTENT_LENGTH: return "invalid Content-Length";
+        case ParseError::BAD_TRANSFER_ENCODING: return "invalid Transfer-Encoding";
+        default: return "unknown error";
+    }
+}
+
+HttpRequestParser::HttpRequestParser() {
+    reset();
+}
+
+// Forget the current request so the parser can be reused for the next one
+void HttpRequestParser::reset() {
+    buffer_base = nullptr;
+    offset = 0;
+    state = State::METHOD;
+    error_code = ParseError::NONE;
+    error_position = 0;
+    method_span = Span();
+    target_span = Span();
+    version_start = 0;
+    minor_version = 1;
+    header_total = 0;
+    current_header = HeaderSpan();
+    value_end = 0;
+    message_head = MessageHead();
+}
+
+ParseStatus HttpRequestParser::status() const {
+    if (state == State::DONE) {
+        return ParseStatus::COMPLETE;
+    }
+    return state == State::FAILED ? ParseStatus::ERROR : ParseStatus::INCOMPLETE;
+}
+
+// Parse the request head at the start of buffer, resuming after the bytes already examined
+ParseStatus HttpRequestParser::parse(std::string_view buffer) {
+    buffer_base = buffer.data();
+    if (state == State::DONE || state == State::FAILED) {
+        return status();
+    }
+
+    size_t end = std::min(buffer.size(), MAX_HEAD_SIZE);
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer.data());
+
+    for (; offset < end; ++offset) {
+        unsigned char c = data[offset];
+
+        switch (state) {
+            case State::METHOD:
+                if (is_token_char(c)) {
+                    break;
+                }
+                if (c != ' ' || offset == method_span.offset) {
+                    return fail(ParseError::BAD_METHOD, offset);
+                }
+                method_span.length = offset - method_span.offset;
+                target_span.offset = offset + 1;
+                state = State::TARGET;
+                break;
+
+            case State::TARGET:
+                while (c > 0x20 && c != 0x7f && offset + 1 < end) {
+                    c = data[++offset];
+                }
+                if (c == ' ') {
+                    if (offset == target_span.offset) {
+                        return fail(ParseError::BAD_TARGET, offset);
+                    }
+                    target_span.length = offset - target_span.offset;
+                    version_start = offset + 1;
+                    state = State::VERSION;
+                } else if (c < 0x21 || c == 0x7f) {
+                    return fail(ParseError::BAD_TARGET, offset);
+                }
+                break;
+
+            case State::VERSION:
+                if (c == '\r') {
+                    std::string_view version(buffer.data() + version_start, offset - version_start);
+                    if (version == "HTTP/1.1") {
+                        minor_version = 1;
+                    } else if (version == "HTTP/1.0") {
+                        minor_version = 0;
+                    } else {
+                        return fail(ParseError::BAD_VERSION, version_start);
+                    }
+                    state = State::REQUEST_LINE_LF;
+                } else if (offset - version_start >= 8) {
+                    return fail(ParseError::BAD_VERSION, version_start);
+                }
+                break;
+
+            case State::REQUEST_LINE_LF:
+                if (c != '\n') {
+                    return fail(ParseError::BAD_LINE_ENDING, offset);
+                }
+                state = State::HEADER_LINE_START;
+                break;
+
+            case State::HEADER_LINE_START:
+                if (c == '\r') {
+                    state = State::FINAL_LF;
+                    break;
+                }
+                // Leading whitespace here would be obsolete line folding, which is rejected
+                if (!is_token_char(c)) {
+                    return fail(ParseError::BAD_HEADER_NAME, offset);
+                }
+                if (header_total == MAX_HEADERS) {
+                    return fail(ParseError::TOO_MANY_HEADERS, offset);
+                }
+                current_header = HeaderSpan();
+                current_header.name.offset = offset;
+                state = State::HEADER_NAME;
+                break;
+
+            case State::HEADER_NAME:
+                // Tight loop over the rest of the name
+                while (is_token_char(c) && offset + 1 < end) {
+                    c = data[++offset];
+                }
+                if (is_token_char(c)) {
+                    break;
+                }
+                if (c != ':') {
+                    return fail(ParseError::BAD_HEADER_NAME, offset);
+                }
+                current_header.name.length = offset - current_header.name.offset;
+                state = State::HEADER_VALUE_START;
+                break;
+
+            case State::HEADER_VALUE_START:
+                if (c == ' ' || c == '\t') {
+                    break;
+                }
+                current_header.value.offset = offset;
+                value_end = offset;
+                if (c == '\r') {
+                    state = State::HEADER_LF;
+                    break;
+                }
+                if (!is_value_char(c)) {
+                    return fail(ParseError::BAD_HEADER_VALUE, offset);
+                }
+                value_end = offset + 1;
+                state = State::HEADER_VALUE;
+                break;
+
+            case State::HEADER_VALUE:
+                // Tight loop over plain value bytes; whitespace and CR are handled below
+                while (c > 0x20 && c != 0x7f && offset + 1 < end) {
+                    value_end = offset + 1;
+                    c = data[++offset];
+                }
+                if (c == '\r') {
+                    state = State::HEADER_LF;
+                } else if (!is_value_char(c)) {
+                    return fail(ParseError::BAD_HEADER_VALUE, offset);
+                } else if (c != ' ' && c != '\t') {
+                    value_end = offset + 1; // Trailing whitespace is not part of the value
+                }
+                break;
+
+            case State::HEADER_LF:
+                if (c != '\n') {
+                    return fail(ParseError::BAD_LINE_ENDING, offset);
+                }
+                current_header.value.length = value_end - current_header.value.offset;
+                headers[header_total++] = current_header;
+                state = State::HEADER_LINE_START;
+                break;
+
+            case State::FINAL_LF:
+                if (c != '\n') {
+                    return fail(ParseError::BAD_LINE_ENDING, offset);
+                }
+                ++offset;
+                return finish_head();
+
+            default:
+                break;
+        }
+    }
+
+    if (buffer.size() >= MAX_HEAD_SIZE) {
+        return fail(ParseError::HEAD_TOO_LARGE, MAX_HEAD_SIZE);
+    }
+    return ParseStatus::INCOMPLETE;
+}
+
+// Validate the framing headers and fill message_head
+ParseStatus HttpRequestParser::finish_head() {
+    message_head = MessageHead();
+    message_head.header_length = offset;
+
+    bool has_content_length = false;
+    bool has_transfer_encoding = false;
+    bool connection_close = false;
+    bool connection_keep_alive = false;
+
+    for (size_t i = 0; i < header_total; ++i) {
+        HeaderField field = header(i);
+
+        if (equals_ignore_case(field.name, "content-length")) {
+            if (field.value.empty() || field.value.size() > 18 ||
+                field.value.find_first_not_of("0123456789") != std::string_view::npos) {
+                return fail(ParseError::BAD_CONTENT_LENGTH, headers[i].value.offset);
+            }
+
+            size_t length = 0;
+            for (char digit : field.value) {
+                length = length * 10 + (digit - '0');
+            }
+
+            // Repeated Content-Length headers must agree, or the request could be smuggled
+            if (has_content_length && length != message_head.content_length) {
+                return fail(ParseError::BAD_CONTENT_LENGTH, headers[i].value.offset);
+            }
+            has_content_length = true;
+            message_head.content_length = length;
+        } else if (equals_ignore_case(field.name, "transfer-encoding")) {
+            // chunked must be the final coding, otherwise the body length is unknowable
+            size_t last_comma = field.value.rfind(',');
+            std::string_view last_coding = field.value.substr(last_comma == std::string_view::npos ? 0 : last_comma + 1);
+            if (!contains_token(last_coding, "chunked")) {
+                return fail(ParseError::BAD_TRANSFER_ENCODING, headers[i].value.offset);
+            }
+            has_transfer_encoding = true;
+        } else if (equals_ignore_case(field.name, "connection")) {
+            connection_close = connection_close || contains_token(field.value, "close");
+            connection_keep_alive = connection_keep_alive || contains_token(field.value, "keep-alive");
+        }
+    }
+
+    if (has_transfer_encoding && has_content_length) {
+        return fail(ParseError::BAD_TRANSFER_ENCODING, 0);
+    }
+
+    if (has_transfer_encoding) {
+        message_head.framing = BodyFraming::CHUNKED;
+    } else if (has_content_length) {
+        message_head.framing = BodyFraming::CONTENT_LENGTH;
+    } else {
+        message_head.framing = BodyFraming::NONE;
+    }
+    message_head.keep_alive = minor_version == 1 ? !connection_close : connection_keep_alive;
+
+    state = State::DONE;
+    return ParseStatus::COMPLETE;
+}
+
+ParseStatus HttpRequestParser::fail(ParseError error, size_t position) {
+    state = State::FAILED;
+    error_code = error;
+    error_position = position;
+    return ParseStatus::ERROR;
+}
+
+std::string_view HttpRequestParser::path() const {
+    std::string_view full_target = target();
+    return full_target.substr(0, full_target.find('?'));
+}
+
+std::string_view HttpRequestParser::query_string() const {
+    std::string_view full_target = target();
+    size_t query_pos = full_target.find('?');
+    return query_pos == std::string_view::npos ? std::string_view() : full_target.substr(query_pos + 1);
+}
+
+HeaderField HttpRequestParser::header(size_t index) const {
+    return {view(headers[index].name), view(headers[index].value)};
+}
+
+// Case-insensitive header lookup; empty if absent
+std::string_view HttpRequestParser::get_header(std::string_view name) const {
+    for (size_t i = 0; i < header_total; ++i) {
+        if (headers[i].name.length == name.size() && equals_ignore_case(view(headers[i].name), name)) {
+            return view(headers[i].value);
+        }
+    }
+    return std::string_view();
+}
+
+// Case-sensitive query parameter lookup; the last occurrence wins, as it did with the map-based parser
+std::string_view HttpRequestParser::get_query_param(std::string_view key) const {
+    std::string_view query = query_string();
+    std::string_view found;
+
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view param = query.substr(0, amp);
+
+        size_t equal_pos = param.find('=');
+        if (equal_pos != std::string_view::npos && param.substr(0, equal_pos) == key) {
+            found = param.substr(equal_pos + 1);
+        }
+
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        query.remove_prefix(amp + 1);
+    }
+    return found;
+}
+
+// The client waits for 100 Continue before sending the body (HTTP/1.1 Expect: 100-continue)
+bool HttpRequestParser::expects_continue() const {
+    return minor_version == 1 && equals_ignore_case(get_header("expect"), "100-continue");
+}
@@ -0,0 +1,232 @@
+#include "core/io_uring.h"
+#include "core/logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Ring indices shared with the kernel: each side publishes its own with a release store
+// and reads the other's with an acquire load
+static unsigned load_acquire(const unsigned* index) {
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned* index, unsigned value) {
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+IoUring::IoUring(unsigned entries)
+    : ring_fd(-1), features(0), sq_ring(nullptr), sq_ring_size(0), cq_ring(nullptr), cq_ring_size(0),
+      sqes(nullptr), sqes_size(0), sq_head(nullptr), sq_tail(nullptr), sq_mask(0), sq_entries(0), sqe_tail(0),
+      cq_head(nullptr), cq_tail(nullptr), cq_mask(0), cqes(nullptr) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = entries * 4;
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd < 0 && errno == EINVAL) {
+        // Kernels before 6.1 run completions in the submitting task without being asked to
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (ring_fd < 0) {
+        log_error("io_uring_setup failed: %s", strerror(errno));
+        return;
+    }
+
+    // Both rings in one mapping and a timeout on waits: 5.11 and later
+    features = params.features;
+    if (!(features & IORING_FEAT_SINGLE_MMAP) || !(features & IORING_FEAT_EXT_ARG)) {
+        log_error("io_uring is too old: Linux 5.11 or later is needed");
+        close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                   IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_memory = sq_ring == MAP_FAILED ? MAP_FAILED
+                                             : mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || sqe_memory == MAP_FAILED) {
+        log_error("io_uring mmap failed: %s", strerror(errno));
+        if (sq_ring != MAP_FAILED) {
+            munmap(sq_ring, sq_ring_size);
+        }
+        sq_ring = nullptr;
+        close(ring_fd);
+        ring_fd = -1;
+        return;
+    }
+    cq_ring = sq_ring;
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+    char* sq = static_cast<char*>(sq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+
+    // Submission entries are used in order, so the indirection array never changes
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; ++i) {
+        array[i] = i;
+    }
+
+    char* cq = static_cast<char*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    if (ring_fd < 0) {
+        return;
+    }
+    munmap(sqes, sqes_size);
+    munmap(sq_ring, sq_ring_size);
+    close(ring_fd);
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    if (sqe_tail - load_acquire(sq_head) >= sq_entries) {
+        submit();
+        if (sqe_tail - load_acquire(sq_head) >= sq_entries) {
+            return nullptr; // The kernel refused the batch (completion queue overflowing)
+        }
+    }
+
+    io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+    ++sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool IoUring::reserve(unsigned count) {
+    if (sq_entries - (sqe_tail - load_acquire(sq_head)) >= count) {
+        return true;
+    }
+    submit();
+    return sq_entries - (sqe_tail - load_acquire(sq_head)) >= count;
+}
+
+int IoUring::submit() {
+    store_release(sq_tail, sqe_tail);
+    unsigned pending = sqe_tail - load_acquire(sq_head);
+    return pending == 0 ? 0 : enter(pending, 0, 0, nullptr, 0);
+}
+
+bool IoUring::submit_and_wait(std::chrono::milliseconds timeout) {
+    store_release(sq_tail, sqe_tail);
+    unsigned pending = sqe_tail - load_acquire(sq_head);
+
+    __kernel_timespec wait_time;
+    wait_time.tv_sec = timeout.count() / 1000;
+    wait_time.tv_nsec = (timeout.count() % 1000) * 1000000;
+    io_uring_getevents_arg argument;
+    memset(&argument, 0, sizeof(argument));
+    argument.ts = reinterpret_cast<uint64_t>(&wait_time);
+
+    int result = enter(pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &argument, sizeof(argument));
+    if (result < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        log_error("io_uring_enter failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+const io_uring_cqe* IoUring::peek_completion() {
+    unsigned head = *cq_head;
+    return head == load_acquire(cq_tail) ? nullptr : &cqes[head & cq_mask];
+}
+
+void IoUring::consume_completion() {
+    store_release(cq_head, *cq_head + 1);
+}
+
+int IoUring::register_buffer_ring(io_uring_buf_reg& registration) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1));
+}
+
+int IoUring::unregister_buffer_ring(uint16_t group) {
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.bgid = group;
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_PBUF_RING, &registration, 1));
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* argument,
+                   size_t argument_size) {
+    int result;
+    do {
+        result = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags,
+                                          argument, argument_size));
+    } while (result < 0 && errno == EINTR && min_complete == 0);
+    return result;
+}
+
+BufferRing::BufferRing(IoUring& ring, uint16_t group, unsigned count, size_t buffer_size)
+    : ring(ring), group_id(group), count(count), size(buffer_size), registered(false), entries(nullptr),
+      entries_size(count * sizeof(io_uring_buf)), buffers(nullptr), tail(0) {
+    void* entry_memory = mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* buffer_memory = mmap(nullptr, count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (entry_memory == MAP_FAILED || buffer_memory == MAP_FAILED) {
+        log_error("Buffer ring allocation failed: %s", strerror(errno));
+        if (entry_memory != MAP_FAILED) {
+            munmap(entry_memory, entries_size);
+        }
+        if (buffer_memory != MAP_FAILED) {
+            munmap(buffer_memory, count * size);
+        }
+        return;
+    }
+    entries = static_cast<io_uring_buf*>(entry_memory);
+    buffers = static_cast<char*>(buffer_memory);
+
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uint64_t>(entries);
+    registration.ring_entries = count;
+    registration.bgid = group;
+    if (ring.register_buffer_ring(registration) < 0) {
+        log_error("Registering the buffer ring failed: %s", strerror(errno));
+        return;
+    }
+    registered = true;
+
+    for (unsigned id = 0; id < count; ++id) {
+        recycle(static_cast<uint16_t>(id));
+    }
+}
+
+BufferRing::~BufferRing() {
+    if (registered) {
+        ring.unregister_buffer_ring(group_id);
+    }
+    if (entries != nullptr) {
+        munmap(entries, entries_size);
+    }
+    if (buffers != nullptr) {
+        munmap(buffers, count * size);
+    }
+}
+
+// The ring's tail is the first entry's reserved field, so entries are written field by field
+void BufferRing::recycle(uint16_t id) {
+    io_uring_buf& entry = entries[tail & (count - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry.len = static_cast<uint32_t>(size);
+    entry.bid = id;
+    ++tail;
+    __atomic_store_n(&entries[0].resv, tail, __ATOMIC_RELEASE);
+}
@@ -1,136 +1,397 @@
 #include "core/load_balancer.h"
-#include <iostream>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <unistd.h>
+#include "core/logger.h"
+#include "core/read_section.h"
+#include <algorithm>
+#include <stdexcept>
 
-LoadBalancer::LoadBalancer(const std::vector<std::string>& backend_addresses) 
-    : current_backend_index(0) {
-    for (const auto& address : backend_addresses) {
-        backends.push_back({address, 0, true}); // Initialize all backends as alive with 0 active connections
+// Weights are clamped so the precomputed round-robin schedule stays small
+static const unsigned int MAX_BACKEND_WEIGHT = 1000;
+
+// Picks a retry makes through the strategy before it takes the least loaded other backend
+static const int RETRY_SELECTIONS = 3;
+
+// A backend's hedge delay is recomputed at most this often...
+static const std::chrono::seconds HEDGE_DELAY_REFRESH(1);
+
+// ...from at least this many new samples; fewer carry over to the next window
+static const uint64_t MIN_HEDGE_SAMPLES = 20;
+
+bool parse_hash_key(const std::string& spec, HashKeyOptions& key) {
+    if (spec == "ip") {
+        key.source = HashKeyOptions::SOURCE_IP;
+        key.name.clear();
+        return true;
+    }
+
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos || colon + 1 == spec.size()) {
+        return false;
+    }
+    std::string kind = spec.substr(0, colon);
+    if (kind == "header") {
+        key.source = HashKeyOptions::HEADER;
+    } else if (kind == "cookie") {
+        key.source = HashKeyOptions::COOKIE;
+    } else if (kind == "query") {
+        key.source = HashKeyOptions::QUERY_PARAM;
+    } else {
+        return false;
+    }
+    key.name = spec.substr(colon + 1);
+    return true;
+}
+
+// Parse "IP:PORT" or "IP:PORT@WEIGHT" entries; weights default to 1
+static std::vector<std::pair<std::string, unsigned int>> parse_backend_entries(const std::vector<std::string>& entries) {
+    std::vector<std::pair<std::string, unsigned int>> parsed;
+    for (const auto& entry : entries) {
+        size_t at = entry.find('@');
+        unsigned int weight = 1;
+        if (at != std::string::npos) {
+            try {
+                weight = static_cast<unsigned int>(std::stoul(entry.substr(at + 1)));
+            } catch (const std::exception&) {
+                log_warn("Invalid weight for backend %s, using 1", entry.c_str());
+            }
+            weight = std::min(std::max(weight, 1u), MAX_BACKEND_WEIGHT);
+        }
+        parsed.emplace_back(entry.substr(0, at), weight);
+    }
+    return parsed;
+}
+
+LoadBalancer::LoadBalancer(const std::vector<std::string>& backend_addresses, const LoadBalancerOptions& options)
+    : backend_set(nullptr), strategy(make_balancing_strategy(options.balancing, options.hash_balance_factor)),
+      hash_routing(is_hash_based(options.balancing)), hash_key(options.hash_key), health_checker(backend_set, options.health_check), outlier_detector(backend_set, options.outlier_detection),
+      concurrency_limiter(options.concurrency_limit), retries(options.retries), retry_budget(options.retries) {
+    std::vector<std::shared_ptr<Backend>> backends;
+    for (const auto& entry : parse_backend_entries(backend_addresses)) {
+        backends.push_back(std::make_shared<Backend>(entry.first, entry.second)); // All alive, no connections
+    }
+    {
+        std::lock_guard<std::mutex> lock(update_mutex);
+        publish_backends(std::move(backends));
     }
 
     // Start the health check thread
     start_health_check();
 }
 
-// Get the next available backend server
-Backend LoadBalancer::get_next_backend() {
-    // Lock the mutex to access the backend list
-    std::lock_guard<std::mutex> lock(backend_mutex);
+LoadBalancer::~LoadBalancer() {
+    stop_health_check();
+}
+
+// Replace the backend snapshot
+void LoadBalancer::publish_backends(std::vector<std::shared_ptr<Backend>> backends) {
+    std::unique_ptr<const BackendSet> previous = std::move(owned_set);
+    owned_set.reset(new BackendSet(std::move(backends)));
+    backend_set.store(owned_set.get(), std::memory_order_release);
+
+    // Selections still running on the previous snapshot finish before it and its tables are freed
+    if (previous) {
+        ReadSection::wait_for_readers();
+        strategy->forget(*previous);
+    }
+}
+
+// Swap in a new backend list; in-flight requests drain on the old snapshot
+void LoadBalancer::update_backends(const std::vector<std::string>& backend_addresses) {
+    std::lock_guard<std::mutex> lock(update_mutex);
+    const BackendSet* current = owned_set.get();
+    size_t added = 0;
+    size_t kept = 0;
+
+    std::vector<std::shared_ptr<Backend>> backends;
+    for (const auto& entry : parse_backend_entries(backend_addresses)) {
+        std::shared_ptr<Backend> previous;
+        for (const std::shared_ptr<Backend>& backend : current->backends) {
+            if (backend->address == entry.first) {
+                previous = backend;
+            }
+        }
 
-    // Find the next available backend server
-    for (size_t i = 0; i < backends.size(); ++i) {
-        Backend& backend = backends[current_backend_index];
-        current_backend_index = (current_backend_index + 1) % backends.size(); // Move to the next backend for the next request
+        if (previous && previous->weight == entry.second) {
+            backends.push_back(previous); // Unchanged: keeps its counters, health and ejection state
+            ++kept;
+            continue;
+        }
+        if (!previous) {
+            ++added;
+        }
 
-        if (backend.is_alive) {
-            backend.active_connections++; // Increment active connections to the backend
-            return backend;
+        // Configured before with this weight: the retired Backend comes back with its state
+        auto retired = std::find_if(retired_backends.begin(), retired_backends.end(),
+                                    [&entry](const std::shared_ptr<Backend>& backend) {
+                                        return backend->address == entry.first && backend->weight == entry.second;
+                                    });
+        if (retired != retired_backends.end()) {
+            std::shared_ptr<Backend> backend = std::move(*retired);
+            retired_backends.erase(retired);
+            backend->retired.store(false, std::memory_order_relaxed);
+            if (previous) {
+                backend->is_alive.store(previous->is_alive.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            backends.push_back(std::move(backend));
+            continue;
         }
 
+        // New, or reweighted: weights are read without synchronization, so a changed one gets a
+        // new Backend that starts from the old one's health
+        auto backend = std::make_shared<Backend>(entry.first, entry.second);
+        if (previous) {
+            backend->is_alive.store(previous->is_alive.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        backends.push_back(std::move(backend));
     }
 
-    // If no backend is available, throw an exception
-    throw std::runtime_error("No available backend servers");
+    // Backends leaving the list stay allocated for the requests that picked them
+    size_t removed = 0;
+    for (const std::shared_ptr<Backend>& backend : current->backends) {
+        if (std::find(backends.begin(), backends.end(), backend) != backends.end()) {
+            continue;
+        }
+        bool remains = std::any_of(backends.begin(), backends.end(), [&backend](const std::shared_ptr<Backend>& next) {
+            return next->address == backend->address;
+        });
+        if (!remains) {
+            backend->retired.store(true, std::memory_order_relaxed);
+            ++removed;
+        }
+        retired_backends.push_back(backend);
+    }
+
+    publish_backends(std::move(backends));
+    version.fetch_add(1, std::memory_order_release);
+    log_info("Backends updated: %zu added, %zu removed, %zu reweighted, %zu unchanged", added, removed,
+             backend_addresses.size() - added - kept, kept);
 }
 
-// Mark a backend server as unavailable
-void LoadBalancer::mark_backend_down(const std::string& address) {
-    // Lock the mutex to access the backend list
-    std::lock_guard<std::mutex> lock(backend_mutex);
+// Pick an available backend and count the request against it
+Backend& LoadBalancer::get_next_backend(uint64_t request_hash, const Backend* avoid) {
+    if (!concurrency_limiter.try_acquire()) {
+        throw OverloadedError();
+    }
+
+    ReadSection section;
+    const BackendSet* set = backend_set.load(std::memory_order_acquire);
 
-    // Find the backend with the specified address
-    for (Backend& backend : backends) {
-        if (backend.address == address) {
-            backend.is_alive = false; // Mark the backend as unavailable
-            std::cout << "Backend " << address << " marked as DOWN" << std::endl;
-            return;
+    Backend* backend = strategy->select(*set, request_hash);
+    if (avoid == nullptr) {
+        retry_budget.deposit();
+    } else if (backend == avoid) {
+        // A hashed key maps to the same backend every time: move it to another point of the ring
+        for (int selection = 1; selection < RETRY_SELECTIONS && backend == avoid; ++selection) {
+            uint64_t moved = request_hash == 0 ? 0 : routing_hash_of(reinterpret_cast<const char*>(&request_hash),
+                                                                     sizeof(request_hash), selection);
+            backend = strategy->select(*set, moved);
         }
+        if (backend == avoid) {
+            Backend* other = least_loaded_other(*set, avoid);
+            backend = other != nullptr ? other : backend;
+        }
+    }
+    if (backend == nullptr) {
+        // If no backend is available, throw an exception
+        concurrency_limiter.release(RequestOutcome::ABORTED, std::chrono::microseconds(0));
+        throw std::runtime_error("No available backend servers");
     }
 
-    // If the backend is not found, throw an exception
-    throw std::runtime_error("Backend server not found. Cannot mark as DOWN");
+    backend->active_connections.fetch_add(1, std::memory_order_relaxed);
+    return *backend;
 }
 
-void LoadBalancer::start_health_check() {
-    // Start the health check thread
-    health_check_thread = std::thread([this]{
-        while (!stop_checking.load()) {
-            perform_health_check(); // Perform health check periodically
-            std::this_thread::sleep_for(std::chrono::seconds(5)); // Check every 5 seconds
+// Least loaded available backend other than avoid, relative to weight; nullptr if there is none
+Backend* LoadBalancer::least_loaded_other(const BackendSet& set, const Backend* avoid) const {
+    Backend* best = nullptr;
+    double best_load = 0;
+    for (const std::shared_ptr<Backend>& backend : set.backends) {
+        if (backend.get() == avoid || !backend->is_available()) {
+            continue;
+        }
+        double load = backend->active_connections.load(std::memory_order_relaxed) / static_cast<double>(backend->weight);
+        if (best == nullptr || load < best_load) {
+            best = backend.get();
+            best_load = load;
         }
-    });
+    }
+    return best;
 }
 
-void LoadBalancer::stop_health_check() {
-    // Stop the health check thread
-    stop_checking.store(true);
-    if (health_check_thread.joinable()) {
-        health_check_thread.join();
+// Recent first-byte quantile of the backend, recomputed by one caller at a time about once a second
+std::chrono::microseconds LoadBalancer::hedge_delay(Backend& backend) {
+    if (!retries.hedging) {
+        return std::chrono::microseconds(0);
     }
+
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t refreshed = backend.hedge_delay_refreshed.load(std::memory_order_relaxed);
+    if (now - refreshed >= std::chrono::duration_cast<std::chrono::nanoseconds>(HEDGE_DELAY_REFRESH).count() &&
+        !backend.hedge_delay_refreshing.exchange(true, std::memory_order_acquire)) {
+        // Only the samples since the last refresh count, so the delay follows the backend's current latency
+        Histogram::Snapshot current = backend.metrics.first_byte_time.snapshot();
+        Histogram::Snapshot window;
+        for (size_t i = 0; i < Histogram::BUCKETS; ++i) {
+            window.counts[i] = current.counts[i] - backend.hedge_delay_baseline.counts[i];
+            window.count += window.counts[i];
+        }
+        if (window.count >= MIN_HEDGE_SAMPLES) {
+            uint64_t min_delay = std::chrono::duration_cast<std::chrono::microseconds>(retries.hedge_min_delay).count();
+            backend.hedge_delay_us.store(std::max(window.quantile(retries.hedge_quantile), min_delay),
+                                         std::memory_order_relaxed);
+            backend.hedge_delay_baseline = current;
+        }
+        backend.hedge_delay_refreshed.store(now, std::memory_order_relaxed);
+        backend.hedge_delay_refreshing.store(false, std::memory_order_release);
+    }
+    return std::chrono::microseconds(backend.hedge_delay_us.load(std::memory_order_relaxed));
 }
 
-void LoadBalancer::perform_health_check() {
-    // Lock the mutex to access the backend list
-    std::lock_guard<std::mutex> lock(backend_mutex);
+bool LoadBalancer::routes_on_client_address() const {
+    return hash_routing && hash_key.source == HashKeyOptions::SOURCE_IP;
+}
 
-    for (Backend& backend : backends) {
+// Value of a cookie in a "name=value; name2=value2" Cookie header; empty if absent
+static std::string_view find_cookie(std::string_view cookies, std::string_view name) {
+    while (!cookies.empty()) {
+        size_t end = cookies.find(';');
+        std::string_view pair = cookies.substr(0, end);
+        cookies = end == std::string_view::npos ? std::string_view() : cookies.substr(end + 1);
 
-        int health_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (health_socket < 0) {
-            perror("Failed to create socket for health check");
-            return;
+        size_t start = pair.find_first_not_of(' ');
+        if (start == std::string_view::npos) {
+            continue;
         }
+        pair.remove_prefix(start);
 
-        struct sockaddr_in backend_address;
-        backend_address.sin_family = AF_INET;
+        size_t equals = pair.find('=');
+        if (equals != std::string_view::npos && pair.substr(0, equals) == name) {
+            return pair.substr(equals + 1);
+        }
+    }
+    return std::string_view();
+}
 
-        // Extract IP and port from the backend address
-        std::string backend_ip = backend.address.substr(0, backend.address.find(':'));
-        int backend_port = std::stoi(backend.address.substr(backend.address.find(':') + 1));
+// Hash of the request's routing key, or 0 when it is not hash-routed or lacks the key
+uint64_t LoadBalancer::routing_hash(const HttpRequestParser& request, std::string_view client_address) const {
+    if (!hash_routing) {
+        return 0;
+    }
 
-        backend_address.sin_port = htons(backend_port);
-        inet_pton(AF_INET, backend_ip.c_str(), &backend_address.sin_addr);
+    std::string_view key;
+    switch (hash_key.source) {
+        case HashKeyOptions::SOURCE_IP:
+            key = client_address.substr(0, client_address.rfind(':'));
+            break;
+        case HashKeyOptions::HEADER:
+            key = request.get_header(hash_key.name);
+            break;
+        case HashKeyOptions::COOKIE:
+            key = find_cookie(request.get_header("Cookie"), hash_key.name);
+            break;
+        case HashKeyOptions::QUERY_PARAM:
+            key = request.get_query_param(hash_key.name);
+            break;
+    }
+    if (key.empty()) {
+        return 0;
+    }
 
-        std::cout << "Performing health check for backend: " << backend.address << std::endl;
+    uint64_t hash = routing_hash_of(key.data(), key.size());
+    return hash != 0 ? hash : 1;
+}
 
-        // Connect to the backend server for health check
-        if (connect(health_socket, (struct sockaddr*)&backend_address, sizeof(backend_address)) < 0) {
-            std::cout << "Backend " << backend.address << " is DOWN" << std::endl;
-            backend.is_alive = false; // Mark the backend as unavailable
-            close(health_socket);
-            continue;
-        }
+// Release a backend once the request routed to it has completed
+void LoadBalancer::release_backend(Backend& backend, RequestOutcome outcome, const BackendTiming& timing) {
+    backend.active_connections.fetch_sub(1, std::memory_order_relaxed);
 
-        // Send GET /health HTTP request to check backend health
-        std::string health_request = "GET /health HTTP/1.1\r\nHost: " + backend.address + "\r\n\r\n";
-        if(send(health_socket, health_request.c_str(), health_request.size(), 0) < 0) {
-            perror("Failed to send health check request");
-            close(health_socket);
-            continue;
-        }
+    BackendMetrics& metrics = backend.metrics;
+    metrics.requests[static_cast<size_t>(outcome)].add();
+    if (timing.connect.count() > 0) {
+        metrics.connect_time.record(timing.connect.count());
+    }
+    if (timing.first_byte.count() > 0) {
+        metrics.first_byte_time.record(timing.first_byte.count());
+    }
+    if (timing.total.count() > 0) {
+        metrics.total_time.record(timing.total.count());
+    }
 
-        char buffer[1024] = {0};
-        ssize_t bytes_read = read(health_socket, buffer, sizeof(buffer));
+    outlier_detector.record(backend, outcome, timing.first_byte);
+    concurrency_limiter.release(outcome, timing.first_byte);
+}
 
-        // Check if the response contains "200 OK" to mark the backend as alive
-        if (strstr(buffer, "200 OK") != nullptr) {
-            // If the Backend was previously marked as down, mark it as alive
-            if(!backend.is_alive) {
-                std::cout << "Backend " << backend.address << " is UP again!" << std::endl;
-            }
-            backend.is_alive = true;
-        } else {
-            // If the Backend was previously marked as alive, mark it as down
-            if(backend.is_alive) {  
-                std::cout << "Backend " << backend.address << " failed haelth check" << std::endl;
-                backend.is_alive = false;
-            }
+// Backend and concurrency-limit metrics, for the metrics page
+void LoadBalancer::write_metrics(MetricsWriter& out) const {
+    static const char* const OUTCOME_NAMES[REQUEST_OUTCOMES] = {
+        "success", "server_error", "connection_failure", "timeout", "aborted"};
+
+    ReadSection section;
+    const BackendSet* set = backend_set.load(std::memory_order_acquire);
+    std::vector<std::string> labels;
+    for (const std::shared_ptr<Backend>& backend : set->backends) {
+        labels.push_back("backend=\"" + backend->address + "\"");
+    }
+
+    out.family("crabby_backend_up", "gauge", "Whether the backend is passing health checks and not ejected.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        out.sample("crabby_backend_up", labels[i], set->backends[i]->is_available() ? 1 : 0);
+    }
+
+    out.family("crabby_backend_active_requests", "gauge", "Requests routed to the backend and not yet finished.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        out.sample("crabby_backend_active_requests", labels[i],
+                   set->backends[i]->active_connections.load(std::memory_order_relaxed));
+    }
+
+    out.family("crabby_backend_requests_total", "counter", "Requests routed to the backend, by outcome.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        for (size_t outcome = 0; outcome < REQUEST_OUTCOMES; ++outcome) {
+            out.sample("crabby_backend_requests_total", labels[i] + ",outcome=\"" + OUTCOME_NAMES[outcome] + "\"",
+                       static_cast<double>(set->backends[i]->metrics.requests[outcome].value()));
         }
+    }
+
+    out.family("crabby_backend_connect_seconds", "histogram", "Time to open a new connection to the backend.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        out.histogram("crabby_backend_connect_seconds", labels[i], set->backends[i]->metrics.connect_time);
+    }
+
+    out.family("crabby_backend_first_byte_seconds", "histogram", "Time from sending a request to its response head.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        out.histogram("crabby_backend_first_byte_seconds", labels[i], set->backends[i]->metrics.first_byte_time);
+    }
 
-        close(health_socket);
+    out.family("crabby_backend_request_seconds", "histogram", "Time a request held the backend, from selection to release.");
+    for (size_t i = 0; i < labels.size(); ++i) {
+        out.histogram("crabby_backend_request_seconds", labels[i], set->backends[i]->metrics.total_time);
     }
+
+    if (concurrency_limiter.enabled()) {
+        out.family("crabby_concurrency_limit", "gauge", "Current adaptive limit on requests in flight to the backends.");
+        out.sample("crabby_concurrency_limit", "", static_cast<double>(concurrency_limiter.limit()));
+        out.family("crabby_concurrency_in_flight", "gauge", "Requests admitted by the adaptive concurrency limit.");
+        out.sample("crabby_concurrency_in_flight", "", static_cast<double>(concurrency_limiter.in_flight()));
+    }
+}
+
+// Addresses of all configured backends
+std::vector<std::string> LoadBalancer::get_backend_addresses() const {
+    ReadSection section;
+    const BackendSet* set = backend_set.load(std::memory_order_acquire);
+
+    std::vector<std::string> addresses;
+    for (const std::shared_ptr<Backend>& backend : set->backends) {
+        addresses.push_back(backend->address);
+    }
+    return addresses;
 }
 
+// Start probing the backends in the background
+void LoadBalancer::start_health_check() {
+    health_checker.start();
+}
+
+void LoadBalancer::stop_health_check() {
+    health_checker.stop();
+}
@@ -0,0 +1,462 @@
+#include "core/logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Longest record payload; longer messages are truncated
+static const size_t MAX_RECORD_LENGTH = 1024;
+
+// Smallest ring, so that a full-length record always fits in an empty one
+static const size_t MIN_RING_CAPACITY = 4096;
+
+// Fewest rings, however few CPUs there are
+static const size_t MIN_RING_COUNT = 4;
+
+static const char* LEVEL_NAMES[] = {"DEBUG", "INFO ", "WARN ", "ERROR", "OFF  "};
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    if (name == "debug") {
+        level = LogLevel::DEBUG;
+    } else if (name == "info") {
+        level = LogLevel::INFO;
+    } else if (name == "warn") {
+        level = LogLevel::WARN;
+    } else if (name == "error") {
+        level = LogLevel::ERROR;
+    } else if (name == "off") {
+        level = LogLevel::OFF;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// "-" is stdout, an empty name the given default; anything else is a file opened for appending
+static int open_log(const std::string& name, int default_fd) {
+    if (name.empty()) {
+        return default_fd;
+    }
+    if (name == "-") {
+        return STDOUT_FILENO;
+    }
+    int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open log file %s: %s\n", name.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+static void close_log(int fd) {
+    if (fd > STDERR_FILENO) {
+        close(fd);
+    }
+}
+
+static void write_all(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return; // Nowhere left to report it
+        }
+        written += static_cast<size_t>(n);
+    }
+}
+
+// "2026-01-31T12:34:56.789Z"; only called by the writer thread, which caches the formatted second
+static void append_timestamp(std::string& out, int64_t timestamp_ns) {
+    static time_t cached_second = -1;
+    static char cached_prefix[32];
+
+    time_t second = static_cast<time_t>(timestamp_ns / 1000000000);
+    if (second != cached_second) {
+        struct tm utc;
+        gmtime_r(&second, &utc);
+        strftime(cached_prefix, sizeof(cached_prefix), "%Y-%m-%dT%H:%M:%S", &utc);
+        cached_second = second;
+    }
+
+    char millis[8];
+    snprintf(millis, sizeof(millis), ".%03dZ", static_cast<int>(timestamp_ns / 1000000 % 1000));
+    out += cached_prefix;
+    out += millis;
+}
+
+// Per-thread xorshift64* generator for access-log sampling
+static uint64_t next_random() {
+    static thread_local uint64_t state =
+        (reinterpret_cast<uintptr_t>(&state) ^ std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+Logger::Ring::Ring(size_t capacity)
+    : data(new char[capacity]), capacity(capacity) {}
+
+void Logger::Ring::copy_in(size_t position, const void* source, size_t length) {
+    size_t offset = position & (capacity - 1);
+    size_t first = std::min(length, capacity - offset);
+    memcpy(data.get() + offset, source, first);
+    memcpy(data.get(), static_cast<const char*>(source) + first, length - first);
+}
+
+void Logger::Ring::copy_out(size_t position, void* destination, size_t length) const {
+    size_t offset = position & (capacity - 1);
+    size_t first = std::min(length, capacity - offset);
+    memcpy(destination, data.get() + offset, first);
+    memcpy(static_cast<char*>(destination) + first, data.get(), length - first);
+}
+
+bool Logger::Ring::push(const RecordHeader& header, const char* payload) {
+    size_t position = head.load(std::memory_order_relaxed);
+    size_t size = sizeof(header) + header.length;
+    if (capacity - (position - tail.load(std::memory_order_acquire)) < size) {
+        return false;
+    }
+    copy_in(position, &header, sizeof(header));
+    copy_in(position + sizeof(header), payload, header.length);
+    head.store(position + size, std::memory_order_release);
+    return true;
+}
+
+Logger& Logger::instance() {
+    static Logger* logger = new Logger();
+    return *logger;
+}
+
+Logger::Logger()
+    : minimum_level(LogLevel::INFO), access_enabled(false), access_sample_threshold(UINT64_MAX),
+      ring_capacity(round_up_to_power_of_two(LogOptions().buffer_size)), block_when_full(false),
+      accepting(true), dropped(0), flush_requested(false), flush_interval(LogOptions().flush_interval),
+      event_fd(STDERR_FILENO), access_fd(-1), stopping(false) {
+    ring_set.store(make_ring_set(ring_capacity.load(std::memory_order_relaxed)), std::memory_order_release);
+    writer = std::thread(&Logger::run_writer, this);
+
+    // Records still buffered when the process exits are written out
+    std::atexit([] { Logger::instance().shutdown(); });
+}
+
+bool Logger::configure(const LogOptions& options) {
+    int new_event_fd = open_log(options.event_log, STDERR_FILENO);
+    int new_access_fd = options.access_log.empty() ? -1 : open_log(options.access_log, STDOUT_FILENO);
+    if (new_event_fd < 0 || (!options.access_log.empty() && new_access_fd < 0)) {
+        close_log(new_event_fd);
+        close_log(new_access_fd);
+        return false;
+    }
+
+    double sample = std::max(0.0, std::min(1.0, options.access_log_sample));
+    uint64_t threshold = sample >= 1.0 ? UINT64_MAX : static_cast<uint64_t>(sample * 18446744073709551616.0);
+
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        close_log(event_fd);
+        close_log(access_fd);
+        event_fd = new_event_fd;
+        access_fd = new_access_fd;
+        flush_interval = std::max(options.flush_interval, std::chrono::milliseconds(1));
+    }
+
+    // New rings when their size changes; the writer drains the old ones, then frees them. Their
+    // RingSet, a few pointers, is left allocated like the Logger itself.
+    size_t capacity = round_up_to_power_of_two(std::max(options.buffer_size, MIN_RING_CAPACITY));
+    if (capacity != ring_capacity.load(std::memory_order_relaxed)) {
+        ring_capacity.store(capacity, std::memory_order_relaxed);
+        RingSet* previous = ring_set.exchange(make_ring_set(capacity), std::memory_order_acq_rel);
+        for (Ring* ring : previous->rings) {
+            ring->abandoned.store(true, std::memory_order_release);
+        }
+    }
+
+    minimum_level.store(options.level, std::memory_order_relaxed);
+    access_sample_threshold.store(threshold, std::memory_order_relaxed);
+    access_enabled.store(new_access_fd >= 0 && threshold > 0, std::memory_order_relaxed);
+    block_when_full.store(options.block_when_full, std::memory_order_relaxed);
+    return true;
+}
+
+void Logger::shutdown() {
+    accepting.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_wakeup.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+// Two rings per CPU: enough that threads logging at the same moment rarely meet on one
+Logger::RingSet* Logger::make_ring_set(size_t capacity) {
+    size_t count = std::max(2 * static_cast<size_t>(std::thread::hardware_concurrency()), MIN_RING_COUNT);
+    RingSet* set = new RingSet();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (size_t i = 0; i < count; ++i) {
+        rings.push_back(std::make_shared<Ring>(capacity));
+        set->rings.push_back(rings.back().get());
+    }
+    return set;
+}
+
+// Lock a ring for pushing, trying each once from the one this thread used last before waiting
+Logger::Ring* Logger::lock_ring() {
+    static thread_local size_t preferred = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    const std::vector<Ring*>& set = ring_set.load(std::memory_order_acquire)->rings;
+    for (size_t i = 0; i < set.size(); ++i) {
+        Ring* ring = set[(preferred + i) % set.size()];
+        if (!ring->producing.load(std::memory_order_relaxed) &&
+            !ring->producing.exchange(true, std::memory_order_acquire)) {
+            preferred += i;
+            return ring;
+        }
+    }
+
+    Ring* ring = set[preferred % set.size()];
+    while (ring->producing.exchange(true, std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    return ring;
+}
+
+void Logger::append(RecordKind kind, LogLevel level, const char* payload, size_t length) {
+    if (!accepting.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Stamped under the ring's lock, so the records of each ring stay in time order
+    Ring* ring = lock_ring();
+    RecordHeader header;
+    header.length = static_cast<uint32_t>(length);
+    header.kind = kind;
+    header.level = level;
+    header.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    bool pushed = ring->push(header, payload);
+    if (!pushed && block_when_full.load(std::memory_order_relaxed)) {
+        // Wake the writer early and give it the CPU to make room
+        do {
+            flush_requested.store(true, std::memory_order_relaxed);
+            writer_wakeup.notify_one();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        } while (accepting.load(std::memory_order_relaxed) && !(pushed = ring->push(header, payload)));
+    }
+    ring->producing.store(false, std::memory_order_release);
+
+    if (!pushed) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Logger::log(LogLevel level, const char* format, va_list arguments) {
+    if (!enabled(level)) {
+        return;
+    }
+
+    char payload[MAX_RECORD_LENGTH];
+    int length = vsnprintf(payload, sizeof(payload), format, arguments);
+    if (length < 0) {
+        return;
+    }
+    size_t size = std::min(static_cast<size_t>(length), sizeof(payload) - 1);
+    while (size > 0 && payload[size - 1] == '\n') {
+        --size;
+    }
+    append(RecordKind::EVENT, level, payload, size);
+}
+
+void Logger::log_access(const AccessLogEntry& entry) {
+    if (!access_log_enabled()) {
+        return;
+    }
+    uint64_t threshold = access_sample_threshold.load(std::memory_order_relaxed);
+    if (threshold != UINT64_MAX && next_random() >= threshold) {
+        return;
+    }
+
+    long long duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - entry.started).count();
+
+    // logfmt; the path is the only field that can contain a quote or backslash
+    char payload[MAX_RECORD_LENGTH];
+    size_t limit = sizeof(payload) - 1;
+    int length = snprintf(payload, sizeof(payload), "client=%.*s method=%.*s path=\"",
+                          static_cast<int>(entry.client.size()), entry.client.data(),
+                          static_cast<int>(entry.method.size()), entry.method.data());
+    size_t size = std::min(static_cast<size_t>(std::max(length, 0)), limit);
+    for (char c : entry.path) {
+        if (size + 2 > limit) {
+            break;
+        }
+        if (c == '"' || c == '\\') {
+            payload[size++] = '\\';
+        }
+        payload[size++] = c;
+    }
+
+    std::string_view backend = entry.backend.empty() ? std::string_view("-") : entry.backend;
+    length = snprintf(payload + size, sizeof(payload) - size, "\" status=%d bytes=%zu backend=%.*s duration_us=%lld",
+                      entry.status, entry.response_bytes,
+                      static_cast<int>(backend.size()), backend.data(), duration_us);
+    size = std::min(size + static_cast<size_t>(std::max(length, 0)), limit);
+
+    append(RecordKind::ACCESS, LogLevel::INFO, payload, size);
+}
+
+void Logger::drain(std::string& events, std::string& access) {
+    std::vector<std::shared_ptr<Ring>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        snapshot = rings;
+    }
+
+    // Merge the rings by timestamp: each is in order already, so the next record out is the
+    // earliest at the front of any ring, kept at the top of a heap of the rings' cursors
+    struct Cursor {
+        Ring* ring;
+        size_t position;
+        size_t end;
+        RecordHeader header;
+    };
+    std::vector<Cursor> cursors;
+    std::vector<Ring*> finished;
+    for (const std::shared_ptr<Ring>& ring : snapshot) {
+        // Read before draining: everything pushed before the ring was replaced is then visible
+        if (ring->abandoned.load(std::memory_order_acquire)) {
+            finished.push_back(ring.get());
+        }
+        Cursor cursor{ring.get(), ring->tail.load(std::memory_order_relaxed),
+                      ring->head.load(std::memory_order_acquire), RecordHeader()};
+        if (cursor.position != cursor.end) {
+            ring->copy_out(cursor.position, &cursor.header, sizeof(cursor.header));
+            cursors.push_back(cursor);
+        }
+    }
+
+    auto later = [](const Cursor& a, const Cursor& b) { return a.header.timestamp_ns > b.header.timestamp_ns; };
+    std::make_heap(cursors.begin(), cursors.end(), later);
+
+    std::string payload;
+    while (!cursors.empty()) {
+        std::pop_heap(cursors.begin(), cursors.end(), later);
+        Cursor& cursor = cursors.back();
+        const RecordHeader& header = cursor.header;
+        payload.resize(header.length);
+        cursor.ring->copy_out(cursor.position + sizeof(header), &payload[0], header.length);
+
+        if (header.kind == RecordKind::ACCESS) {
+            access += "time=";
+            append_timestamp(access, header.timestamp_ns);
+            access += ' ';
+            access += payload;
+            access += '\n';
+        } else {
+            append_timestamp(events, header.timestamp_ns);
+            events += ' ';
+            events += LEVEL_NAMES[static_cast<size_t>(header.level)];
+            events += ' ';
+            events += payload;
+            events += '\n';
+        }
+
+        cursor.position += sizeof(header) + header.length;
+        if (cursor.position == cursor.end) {
+            cursor.ring->tail.store(cursor.position, std::memory_order_release);
+            cursors.pop_back();
+        } else {
+            cursor.ring->copy_out(cursor.position, &cursor.header, sizeof(cursor.header));
+            std::push_heap(cursors.begin(), cursors.end(), later);
+        }
+    }
+
+    if (!finished.empty()) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.erase(std::remove_if(rings.begin(), rings.end(), [&finished](const std::shared_ptr<Ring>& ring) {
+                        return std::find(finished.begin(), finished.end(), ring.get()) != finished.end();
+                    }),
+                    rings.end());
+    }
+}
+
+void Logger::run_writer() {
+    std::string events;
+    std::string access;
+    uint64_t reported_drops = 0;
+
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (true) {
+        writer_wakeup.wait_for(lock, flush_interval,
+                               [this] { return stopping || flush_requested.load(std::memory_order_relaxed); });
+        flush_requested.store(false, std::memory_order_relaxed);
+        bool stop = stopping;
+
+        drain(events, access);
+
+        uint64_t drops = dropped.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            append_timestamp(events, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count());
+            events += " WARN  ⚠️ " + std::to_string(drops - reported_drops) + " log records dropped (buffers full)\n";
+            reported_drops = drops;
+        }
+
+        write_all(event_fd, events);
+        if (access_fd >= 0) {
+            write_all(access_fd, access);
+        }
+        events.clear();
+        access.clear();
+
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void log_debug(const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    Logger::instance().log(LogLevel::DEBUG, format, arguments);
+    va_end(arguments);
+}
+
+void log_info(const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    Logger::instance().log(LogLevel::INFO, format, arguments);
+    va_end(arguments);
+}
+
+void log_warn(const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    Logger::instance().log(LogLevel::WARN, format, arguments);
+    va_end(arguments);
+}
+
+void log_error(const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    Logger::instance().log(LogLevel::ERROR, format, arguments);
+    va_end(arguments);
+}
@@ -0,0 +1,121 @@
+#include "core/metrics.h"
+#include <cstdio>
+
+// Prometheus buckets ("le" bounds) of latency histograms, in seconds
+static const double LATENCY_BUCKETS[] = {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                         0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+
+size_t next_metric_shard() {
+    static std::atomic<size_t> next{0};
+    return next.fetch_add(1, std::memory_order_relaxed) % METRIC_SHARDS;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const Shard& shard : shards) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t Histogram::bucket_index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    if (value >> MAX_VALUE_BITS) {
+        return BUCKETS - 1;
+    }
+
+    // The top SUB_BUCKET_BITS + 1 bits select the bucket: which power of two, then which 16th of it
+    unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return shift * SUB_BUCKETS + static_cast<size_t>(value >> shift);
+}
+
+uint64_t Histogram::bucket_upper_bound(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index / SUB_BUCKETS) - 1;
+    uint64_t sub_bucket = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot merged;
+    for (const Shard& shard : shards) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            merged.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+        }
+        merged.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (uint64_t count : merged.counts) {
+        merged.count += count;
+    }
+    return merged;
+}
+
+uint64_t Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucket_upper_bound(i);
+        }
+    }
+    return bucket_upper_bound(BUCKETS - 1);
+}
+
+void MetricsWriter::family(const char* name, const char* type, const char* help) {
+    output += "# HELP ";
+    output += name;
+    output += ' ';
+    output += help;
+    output += "\n# TYPE ";
+    output += name;
+    output += ' ';
+    output += type;
+    output += '\n';
+}
+
+void MetricsWriter::sample(const char* name, const std::string& labels, double value) {
+    char number[32];
+    snprintf(number, sizeof(number), "%.15g", value);
+
+    output += name;
+    if (!labels.empty()) {
+        output += '{';
+        output += labels;
+        output += '}';
+    }
+    output += ' ';
+    output += number;
+    output += '\n';
+}
+
+void MetricsWriter::histogram(const char* name, const std::string& labels, const Histogram& histogram) {
+    Histogram::Snapshot snapshot = histogram.snapshot();
+    std::string bucket_name = std::string(name) + "_bucket";
+    std::string separator = labels.empty() ? "" : ",";
+
+    // A bucket counts towards every bound its largest value fits under
+    size_t index = 0;
+    uint64_t cumulative = 0;
+    for (double bound : LATENCY_BUCKETS) {
+        uint64_t bound_us = static_cast<uint64_t>(bound * 1e6);
+        while (index < Histogram::BUCKETS && Histogram::bucket_upper_bound(index) <= bound_us) {
+            cumulative += snapshot.counts[index++];
+        }
+
+        char le[32];
+        snprintf(le, sizeof(le), "%g", bound);
+        sample(bucket_name.c_str(), labels + separator + "le=\"" + le + "\"", static_cast<double>(cumulative));
+    }
+    sample(bucket_name.c_str(), labels + separator + "le=\"+Inf\"", static_cast<double>(snapshot.count));
+    sample((std::string(name) + "_sum").c_str(), labels, static_cast<double>(snapshot.sum) / 1e6);
+    sample((std::string(name) + "_count").c_str(), labels, static_cast<double>(snapshot.count));
+}
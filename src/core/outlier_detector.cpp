@@ -0,0 +1,152 @@
+#include "core/outlier_detector.h"
+#include "core/logger.h"
+#include "core/read_section.h"
+#include <algorithm>
+
+namespace {
+
+// Latency outliers are only looked for every this many samples of a backend
+const uint64_t LATENCY_CHECK_INTERVAL = 16;
+const unsigned int MAX_EJECTION_LEVEL = 16;
+
+int64_t steady_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+// SUCCESS or SERVER_ERROR, depending on a response's status code
+OutlierDetector::OutlierDetector(const std::atomic<const BackendSet*>& backend_set, const OutlierOptions& options)
+    : backend_set(backend_set), options(options) {}
+
+// Account for a finished request
+void OutlierDetector::record(Backend& backend, RequestOutcome outcome, std::chrono::microseconds first_byte_latency) {
+    if (outcome == RequestOutcome::ABORTED) {
+        return;
+    }
+
+    int64_t now = steady_now_ns();
+    int64_t ejected_until = backend.ejected_until.load(std::memory_order_relaxed);
+
+    // Requests already in flight when the backend was ejected don't extend the ejection
+    if (ejected_until != 0 && now < ejected_until) {
+        return;
+    }
+
+    switch (outcome) {
+        case RequestOutcome::SUCCESS: {
+            backend.consecutive_server_errors.store(0, std::memory_order_relaxed);
+            backend.consecutive_connection_failures.store(0, std::memory_order_relaxed);
+
+            // A backend that stays healthy for a base ejection time after coming back is forgiven
+            int64_t base = std::chrono::duration_cast<std::chrono::nanoseconds>(options.base_ejection_time).count();
+            if (ejected_until != 0 && now >= ejected_until + base) {
+                backend.ejection_level.store(0, std::memory_order_relaxed);
+                backend.ejected_until.store(0, std::memory_order_relaxed);
+            }
+            track_latency(backend, first_byte_latency, now);
+            break;
+        }
+
+        case RequestOutcome::SERVER_ERROR:
+            backend.consecutive_connection_failures.store(0, std::memory_order_relaxed);
+            if (options.consecutive_server_errors > 0 &&
+                backend.consecutive_server_errors.fetch_add(1, std::memory_order_relaxed) + 1 >=
+                    options.consecutive_server_errors) {
+                eject(backend, now, "consecutive 5xx responses");
+                return;
+            }
+            track_latency(backend, first_byte_latency, now);
+            break;
+
+        case RequestOutcome::CONNECTION_FAILURE:
+        case RequestOutcome::TIMEOUT:
+            if (options.consecutive_connection_failures > 0 &&
+                backend.consecutive_connection_failures.fetch_add(1, std::memory_order_relaxed) + 1 >=
+                    options.consecutive_connection_failures) {
+                eject(backend, now, outcome == RequestOutcome::TIMEOUT ? "timeouts" : "connection failures");
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Fold a sample into the backend's latency average and compare it with its peers now and then
+void OutlierDetector::track_latency(Backend& backend, std::chrono::microseconds latency, int64_t now) {
+    if (options.latency_factor <= 0 || latency.count() <= 0) {
+        return;
+    }
+
+    // EWMA with a weight of 1/8. Concurrent updates may drop a sample, which is fine for a trend.
+    uint64_t sample = static_cast<uint64_t>(latency.count());
+    uint64_t average = backend.latency_ewma_us.load(std::memory_order_relaxed);
+    average = average == 0 ? sample : average - average / 8 + sample / 8;
+    backend.latency_ewma_us.store(average, std::memory_order_relaxed);
+
+    uint64_t samples = backend.latency_samples.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (samples < LATENCY_CHECK_INTERVAL || samples % LATENCY_CHECK_INTERVAL != 0 ||
+        average < static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                      options.min_outlier_latency).count())) {
+        return;
+    }
+
+    // Compare with the other available backends that have enough samples of their own
+    ReadSection section;
+    const BackendSet* set = backend_set.load(std::memory_order_acquire);
+    uint64_t peer_total = 0;
+    size_t peers = 0;
+    for (const std::shared_ptr<Backend>& peer : set->backends) {
+        if (peer.get() == &backend || !peer->is_available() ||
+            peer->latency_samples.load(std::memory_order_relaxed) < LATENCY_CHECK_INTERVAL) {
+            continue;
+        }
+        peer_total += peer->latency_ewma_us.load(std::memory_order_relaxed);
+        ++peers;
+    }
+
+    if (peers > 0 && average > options.latency_factor * (static_cast<double>(peer_total) / peers)) {
+        eject(backend, now, "latency outlier");
+    }
+}
+
+// Take the backend out of rotation for base_ejection_time * 2^level, within max_ejection_percent
+void OutlierDetector::eject(Backend& backend, int64_t now, const char* reason) {
+    std::lock_guard<std::mutex> lock(ejection_mutex);
+
+    // Another thread may have ejected it in the meantime
+    int64_t ejected_until = backend.ejected_until.load(std::memory_order_relaxed);
+    if (ejected_until != 0 && now < ejected_until) {
+        return;
+    }
+
+    ReadSection section;
+    const BackendSet* set = backend_set.load(std::memory_order_acquire);
+    size_t ejected = 0;
+    for (const std::shared_ptr<Backend>& peer : set->backends) {
+        int64_t until = peer->ejected_until.load(std::memory_order_relaxed);
+        if (until != 0 && now < until) {
+            ++ejected;
+        }
+    }
+    if (ejected + 1 > set->backends.size() * options.max_ejection_percent / 100) {
+        return; // Keep enough backends in rotation to avoid a total blackout
+    }
+
+    unsigned int level = backend.ejection_level.load(std::memory_order_relaxed);
+    std::chrono::milliseconds duration = std::min(options.base_ejection_time * (int64_t(1) << level),
+                                                  options.max_ejection_time);
+
+    backend.ejected_until.store(now + std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(),
+                                std::memory_order_relaxed);
+    backend.ejection_level.store(std::min(level + 1, MAX_EJECTION_LEVEL), std::memory_order_relaxed);
+    backend.consecutive_server_errors.store(0, std::memory_order_relaxed);
+    backend.consecutive_connection_failures.store(0, std::memory_order_relaxed);
+    backend.latency_ewma_us.store(0, std::memory_order_relaxed);
+    backend.latency_samples.store(0, std::memory_order_relaxed);
+
+    log_warn("Backend %s ejected for %lldms (%s)", backend.address.c_str(), static_cast<long long>(duration.count()),
+             reason);
+}
@@ -0,0 +1,99 @@
+#include "core/read_section.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Epoch a thread entered its outermost section at; 0 while it is outside every section
+struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch{0};
+    bool in_use = false; // Guarded by Registry::mutex
+};
+
+// Slots of every thread that ever read a snapshot. Never destroyed, so threads exiting during
+// shutdown can still give theirs back.
+struct Registry {
+    std::atomic<uint64_t> epoch{1};
+    std::mutex mutex;        // Taken when a thread reads for the first time or exits, and by writers
+    std::deque<Slot> slots;  // A deque, so slots never move; freed slots are reused by new threads
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+// The calling thread's slot, claimed on first use and released when the thread exits
+struct ThreadSlot {
+    Slot* slot = nullptr;
+    unsigned depth = 0;
+
+    ~ThreadSlot() {
+        if (slot != nullptr) {
+            std::lock_guard<std::mutex> lock(registry().mutex);
+            slot->in_use = false;
+        }
+    }
+};
+
+thread_local ThreadSlot thread_slot;
+
+Slot& claim_slot() {
+    Registry& shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (Slot& slot : shared.slots) {
+        if (!slot.in_use) {
+            slot.in_use = true;
+            return slot;
+        }
+    }
+    shared.slots.emplace_back();
+    shared.slots.back().in_use = true;
+    return shared.slots.back();
+}
+
+} // namespace
+
+ReadSection::ReadSection() {
+    ThreadSlot& current = thread_slot;
+    if (current.depth++ > 0) {
+        return;
+    }
+    if (current.slot == nullptr) {
+        current.slot = &claim_slot();
+    }
+
+    // Publish the slot before the snapshot pointer is read: a writer then either sees this
+    // section or the reader sees the new snapshot
+    current.slot->epoch.store(registry().epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+ReadSection::~ReadSection() {
+    ThreadSlot& current = thread_slot;
+    if (--current.depth == 0) {
+        current.slot->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void ReadSection::wait_for_readers() {
+    Registry& shared = registry();
+
+    // Sections entered from here on record at least target, and see whatever was published before
+    uint64_t target = shared.epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for (Slot& slot : shared.slots) {
+        while (true) {
+            uint64_t epoch = slot.epoch.load(std::memory_order_acquire);
+            if (epoch == 0 || epoch >= target) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
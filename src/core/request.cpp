@@ -1,109 +1,122 @@
 #include "core/request.h"
-#include <sstream>
-#include <algorithm>
-
-
-Request::Request(const std::string& raw_request) : raw_request(raw_request){
-    std::istringstream request_stream(raw_request);
-    std::string request_line;
-
-    getline(request_stream, request_line);
-
-    // Parse the request line (e.g. "GET / HTTP/1.1")
-    std::istringstream request_line_stream(request_line); // Create an input string stream from the request_line string. This allows us to treat the string like an input stream, similar to std::cin or a file stream.
-    request_line_stream >> method >> path; // Extract the method and path from the request line
-    // The >> operator, when used with an istringstream, reads whitespace-separated values from the stream.
-    // In this case, it first reads the "method" (e.g., "GET") and stores it in the 'method' variable.
-    // Then, it reads the "path" (e.g., "/") and stores it in the 'path' variable.
-    // Any subsequent parts of the request line (like "HTTP/1.1") are ignored by this code.
-
-    // Check if the path contains query parameters and parse them
-    size_t query_pos = path.find('?');
-    if (query_pos != std::string::npos) { // If the query string is found
-        std::string query_string = path.substr(query_pos + 1); // Extract the query string from the path
-        path = path.substr(0, query_pos);                      // Update the path to remove the query string
-        parse_query_params(query_string);
-    }
 
-    // Parse the headers
-    std::string header_lines;
-    while (getline(request_stream, header_lines) && header_lines != "\r") {
-        parse_headers(header_lines);
-    }
+
+Request::Request(const std::string& raw_request) : storage(raw_request), raw_request(storage), owned(true) {
+    // The parser records positions in raw_request instead of copying method, path and headers out
+    parser.parse(this->raw_request);
+}
+
+Request::Request(std::string raw_request, const HttpRequestParser& parsed)
+    : storage(std::move(raw_request)), raw_request(storage), owned(true), parser(parsed) {
+    parser.rebase(this->raw_request.data());
+}
+
+Request::Request(std::string_view raw_request, const HttpRequestParser& parsed)
+    : raw_request(raw_request), owned(false), parser(parsed) {
+    parser.rebase(this->raw_request.data());
+}
+
+// Copies and moves of an owning Request must re-point the parser's views at this object's buffer;
+// those of a borrowing one share the bytes it borrows
+Request::Request(const Request& other) : storage(other.storage), owned(other.owned), parser(other.parser) {
+    raw_request = owned ? std::string_view(storage) : other.raw_request;
+    parser.rebase(raw_request.data());
+}
+
+Request::Request(Request&& other) noexcept
+    : storage(std::move(other.storage)), owned(other.owned), parser(other.parser) {
+    raw_request = owned ? std::string_view(storage) : other.raw_request;
+    parser.rebase(raw_request.data());
+}
+
+Request& Request::operator=(const Request& other) {
+    storage = other.storage;
+    owned = other.owned;
+    raw_request = owned ? std::string_view(storage) : other.raw_request;
+    parser = other.parser;
+    parser.rebase(raw_request.data());
+    return *this;
+}
+
+Request& Request::operator=(Request&& other) noexcept {
+    storage = std::move(other.storage);
+    owned = other.owned;
+    raw_request = owned ? std::string_view(storage) : other.raw_request;
+    parser = other.parser;
+    parser.rebase(raw_request.data());
+    return *this;
+}
+
+bool Request::is_valid() const {
+    return parser.status() == ParseStatus::COMPLETE;
+}
+
+ParseError Request::get_parse_error() const {
+    return parser.error();
 }
 
 std::string Request::get_method() const {
-    return method;
+    return std::string(method_view());
 }
 
 std::string Request::get_path() const {
-    return path;
+    return std::string(path_view());
 }
 
 std::string Request::get_raw_request() const {
-    return raw_request;
+    return std::string(raw_request);
 }
 
 // Header retrieval (e.g., Host, User-Agent)
 // Note:  Case-insensitive header retrieval
 std::string Request::get_header(const std::string& key) const {
-    std::string lower_ley = key;
-    std::transform(lower_ley.begin(), lower_ley.end(), lower_ley.begin(), ::tolower);
-
-    auto it = headers.find(lower_ley);
-    if (it != headers.end()) {
-        return it->second;
-    }
-
-        return "";
+    return std::string(header_view(key));
 }
 
 // Query parameter retrieval (e.g., /path?key=value)
 // Note: This function is case-sensitive
 std::string Request::get_query_param(const std::string& key) const {
-    auto it = query_params.find(key);
-    if (it != query_params.end()) {
-        return it->second;
-    }
-
-    return "";
+    return is_valid() ? std::string(parser.get_query_param(key)) : std::string();
 }
 
 std::map<std::string, std::string> Request::get_query_params() const {
-    return query_params;
-}
-
+    std::map<std::string, std::string> query_params;
+    std::string_view query = is_valid() ? parser.query_string() : std::string_view();
 
-// Parse headers from the header lines (e.g., "Host: localhost:8080")
-void Request::parse_headers(const std::string& header_lines) {
-    // Find the position of the colon which separates the header key and value
-    size_t colon_pos = header_lines.find(':');
-    if (colon_pos != std::string::npos) {
-        // Extract the key and value from the header line
-        std::string key = header_lines.substr(0, colon_pos);
-        std::string value = header_lines.substr(colon_pos + 2); // Skip the colon and the space
+    // Split the query string into individual parameters using '&' as the delimiter
+    while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view param = query.substr(0, amp);
 
-        // Convert the key to lowercase to ensure case-insensitive header storage
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        size_t equal_pos = param.find('=');
+        if (equal_pos != std::string_view::npos) {
+            query_params[std::string(param.substr(0, equal_pos))] = std::string(param.substr(equal_pos + 1));
+        }
 
-        // Store the header key-value pair in the map
-        headers[key] = value;
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        query.remove_prefix(amp + 1);
     }
+    return query_params;
 }
 
-// Parse query parameters from the query string (e.g., key1=value1&key2=value2)
-void Request::parse_query_params(const std::string& query_string) {
-    std::istringstream query_stream(query_string); // Create an input string stream from the query string
-    std::string query_param;                       // Declare a string to hold each query parameter
+std::string_view Request::method_view() const {
+    return is_valid() ? parser.method() : std::string_view();
+}
 
-    // Split the query string into individual parameters using '&' as the delimiter
-    while (getline(query_stream, query_param, '&')) {
-        size_t equal_pos = query_param.find('=');  // Find the position of the '=' sign in the query parameter
-        if (equal_pos != std::string::npos) {      // If the '=' sign is found
-            std::string key = query_param.substr(0, equal_pos);      // Extract the key from the beginning of the parameter up to the '=' sign
-            std::string value = query_param.substr(equal_pos + 1);   // Extract the value from after the '=' sign to the end of the parameter
+std::string_view Request::path_view() const {
+    return is_valid() ? parser.path() : std::string_view();
+}
 
-            query_params[key] = value; // Store the key-value pair in the query_params map
-        }
-    }
-}
\ No newline at end of file
+std::string_view Request::header_view(std::string_view key) const {
+    return is_valid() ? parser.get_header(key) : std::string_view();
+}
+
+std::string_view Request::raw_request_view() const {
+    return raw_request;
+}
+
+const HttpRequestParser& Request::parsed() const {
+    return parser;
+}
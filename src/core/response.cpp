@@ -1,36 +1,222 @@
 #include "core/response.h"
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+// Standard status codes and reason phrases (RFC 9110 and the registered extensions)
+#define CRABBY_HTTP_STATUSES(X) \
+    X(100, "Continue") X(101, "Switching Protocols") X(102, "Processing") X(103, "Early Hints") \
+    X(200, "OK") X(201, "Created") X(202, "Accepted") X(203, "Non-Authoritative Information") \
+    X(204, "No Content") X(205, "Reset Content") X(206, "Partial Content") X(207, "Multi-Status") \
+    X(208, "Already Reported") X(226, "IM Used") \
+    X(300, "Multiple Choices") X(301, "Moved Permanently") X(302, "Found") X(303, "See Other") \
+    X(304, "Not Modified") X(305, "Use Proxy") X(307, "Temporary Redirect") X(308, "Permanent Redirect") \
+    X(400, "Bad Request") X(401, "Unauthorized") X(402, "Payment Required") X(403, "Forbidden") \
+    X(404, "Not Found") X(405, "Method Not Allowed") X(406, "Not Acceptable") \
+    X(407, "Proxy Authentication Required") X(408, "Request Timeout") X(409, "Conflict") X(410, "Gone") \
+    X(411, "Length Required") X(412, "Precondition Failed") X(413, "Content Too Large") \
+    X(414, "URI Too Long") X(415, "Unsupported Media Type") X(416, "Range Not Satisfiable") \
+    X(417, "Expectation Failed") X(418, "I'm a teapot") X(421, "Misdirected Request") \
+    X(422, "Unprocessable Content") X(423, "Locked") X(424, "Failed Dependency") X(425, "Too Early") \
+    X(426, "Upgrade Required") X(428, "Precondition Required") X(429, "Too Many Requests") \
+    X(431, "Request Header Fields Too Large") X(451, "Unavailable For Legal Reasons") \
+    X(500, "Internal Server Error") X(501, "Not Implemented") X(502, "Bad Gateway") \
+    X(503, "Service Unavailable") X(504, "Gateway Timeout") X(505, "HTTP Version Not Supported") \
+    X(506, "Variant Also Negotiates") X(507, "Insufficient Storage") X(508, "Loop Detected") \
+    X(510, "Not Extended") X(511, "Network Authentication Required")
+
+namespace {
+
+// Longest "HTTP/1.1 NNN Unknown\r\n" written for a code missing from the table
+const size_t FALLBACK_STATUS_LINE_SIZE = 32;
+
+// The status line of the code, formatted into scratch if it is not a standard one
+std::string_view status_line_of(int status_code, char (&scratch)[FALLBACK_STATUS_LINE_SIZE]) {
+    std::string_view line = Response::status_line(status_code);
+    if (line.empty()) {
+        int length = snprintf(scratch, sizeof(scratch), "HTTP/1.1 %03d Unknown\r\n", status_code % 1000);
+        line = std::string_view(scratch, static_cast<size_t>(length));
+    }
+    return line;
+}
+
+char* append(char* out, std::string_view text) {
+    memcpy(out, text.data(), text.size());
+    return out + text.size();
+}
+
+size_t decimal_length(size_t value) {
+    size_t length = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++length;
+    }
+    return length;
+}
+
+} // namespace
 
 Response::Response(int status_code) : status_code(status_code) {}
 
-void Response::set_body(const std::string& body_content) {
-    body = body_content;
+void Response::set_body(std::string body_content) {
+    body = std::move(body_content);
 }
 
 void Response::add_header(const std::string& key, const std::string& value) {
-    headers[key] = value;
+    for (auto& header : headers) {
+        if (strcasecmp(header.first.c_str(), key.c_str()) == 0) {
+            header.second = value;
+            return;
+        }
+    }
+    headers.emplace_back(key, value);
 }
 
-std::string Response::build_response() const {
-    std::string response;
+std::string_view Response::status_line(int status_code) {
+    switch (status_code) {
+#define CRABBY_STATUS_LINE_CASE(code, reason) \
+        case code: return "HTTP/1.1 " #code " " reason "\r\n";
+        CRABBY_HTTP_STATUSES(CRABBY_STATUS_LINE_CASE)
+#undef CRABBY_STATUS_LINE_CASE
+        default: return std::string_view();
+    }
+}
+
+// Content-Length is ours to add unless the caller framed the body, or the status has none
+bool Response::automatic_content_length() const {
+    if ((status_code >= 100 && status_code < 200) || status_code == 204 || status_code == 304) {
+        return false;
+    }
+    for (const auto& header : headers) {
+        if (strcasecmp(header.first.c_str(), "Content-Length") == 0 ||
+            strcasecmp(header.first.c_str(), "Transfer-Encoding") == 0) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    response += "HTTP/1.1 " + std::to_string(status_code) + " " + get_status_message() + "\r\n";
+size_t Response::head_size() const {
+    char scratch[FALLBACK_STATUS_LINE_SIZE];
+    size_t size = status_line_of(status_code, scratch).size();
+    for (const auto& header : headers) {
+        size += header.first.size() + 2 + header.second.size() + 2; // "key: value\r\n"
+    }
+    if (automatic_content_length()) {
+        size += sizeof("Content-Length: ") - 1 + decimal_length(body.size()) + 2;
+    }
+    return size + 2; // Blank line
+}
 
+size_t Response::write_head(char* buffer, size_t size) const {
+    size_t length = head_size();
+    if (length > size) {
+        return 0;
+    }
+
+    char scratch[FALLBACK_STATUS_LINE_SIZE];
+    char* out = append(buffer, status_line_of(status_code, scratch));
     for (const auto& header : headers) {
-        response += header.first + ": " + header.second + "\r\n";
+        out = append(out, header.first);
+        out = append(out, ": ");
+        out = append(out, header.second);
+        out = append(out, "\r\n");
+    }
+    if (automatic_content_length()) {
+        out = append(out, "Content-Length: ");
+        out = std::to_chars(out, buffer + size, body.size()).ptr;
+        out = append(out, "\r\n");
     }
+    append(out, "\r\n");
+    return length;
+}
 
-    response += "\r\n";
+size_t Response::serialized_size() const {
+    return head_size() + body.size();
+}
 
-    response += body;
+size_t Response::write_to(char* buffer, size_t size) const {
+    size_t head = write_head(buffer, size);
+    if (head == 0 || size - head < body.size()) {
+        return 0;
+    }
+    memcpy(buffer + head, body.data(), body.size());
+    return head + body.size();
+}
+
+size_t Response::write_iov(char* head_buffer, size_t head_size, struct iovec iov[2]) const {
+    size_t head = write_head(head_buffer, head_size);
+    if (head == 0) {
+        return 0;
+    }
+
+    iov[0].iov_base = head_buffer;
+    iov[0].iov_len = head;
+    if (body.empty()) {
+        return 1;
+    }
+    iov[1].iov_base = const_cast<char*>(body.data());
+    iov[1].iov_len = body.size();
+    return 2;
+}
 
+std::string Response::build_response() const {
+    std::string response(serialized_size(), '\0');
+    write_to(&response[0], response.size());
     return response;
 }
 
-std::string Response::get_status_message() const {
-    switch (status_code) {
-        case 200: return "OK";
-        case 404: return "Not Found";
-        case 500: return "Internal Server Error";
-        default: return "Not Implemented";
-    }
-}
\ No newline at end of file
+// Built on first use and never freed, so sending one costs no more than the write itself
+const std::string& Response::canned(CannedResponse which, bool keep_alive) {
+    static const size_t CANNED_COUNT = static_cast<size_t>(CannedResponse::WELCOME) + 1;
+    static const std::vector<std::string> table = [] {
+        std::vector<std::string> responses;
+        for (size_t index = 0; index < CANNED_COUNT; ++index) {
+            for (bool keep : {false, true}) {
+                Response response(200);
+                switch (static_cast<CannedResponse>(index)) {
+                    case CannedResponse::CONTINUE:
+                        response = Response(100);
+                        break;
+                    case CannedResponse::BAD_REQUEST:
+                        response = Response(400);
+                        response.add_header("Connection", "close");
+                        break;
+                    case CannedResponse::NOT_FOUND:
+                        response = Response(404);
+                        response.add_header("Content-Type", "text/html");
+                        response.add_header("Connection", keep ? "keep-alive" : "close");
+                        response.set_body("<h1>404 Not Found</h1>");
+                        break;
+                    case CannedResponse::SERVICE_UNAVAILABLE:
+                        response = Response(503);
+                        response.add_header("Connection", "close");
+                        response.add_header("Retry-After", "1");
+                        break;
+                    case CannedResponse::BAD_GATEWAY:
+                        response = Response(502);
+                        response.add_header("Connection", "close");
+                        break;
+                    case CannedResponse::GATEWAY_TIMEOUT:
+                        response = Response(504);
+                        response.add_header("Connection", "close");
+                        break;
+                    case CannedResponse::HEALTH_OK:
+                        response.add_header("Content-Type", "text/html");
+                        response.add_header("Connection", keep ? "keep-alive" : "close");
+                        response.set_body("OK");
+                        break;
+                    case CannedResponse::WELCOME:
+                        response.add_header("Content-Type", "text/html");
+                        response.add_header("Connection", keep ? "keep-alive" : "close");
+                        response.set_body("<h1>Welcome to CrabbyLB!</h1>");
+                        break;
+                }
+                responses.push_back(response.build_response());
+            }
+        }
+        return responses;
+    }();
+    return table[static_cast<size_t>(which) * 2 + (keep_alive ? 1 : 0)];
+}
@@ -0,0 +1,378 @@
+#include "core/response_cache.h"
+#include "core/http_framing.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+
+// Bookkeeping bytes charged per entry on top of its key and response (list node, index slot, control block)
+static const size_t ENTRY_OVERHEAD = 192;
+
+static bool equals_ignore_case(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool contains_ignore_case(std::string_view haystack, std::string_view needle) {
+    for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+        if (equals_ignore_case(haystack.substr(i, needle.size()), needle)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+    return value;
+}
+
+// Seconds of a delta-seconds value ("max-age=60"); -1 if malformed
+static int64_t parse_seconds(std::string_view value) {
+    if (value.empty() || value.size() > 18) {
+        return -1;
+    }
+    int64_t seconds = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') {
+            return -1;
+        }
+        seconds = seconds * 10 + (c - '0');
+    }
+    return seconds;
+}
+
+// IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), the only format senders may generate; -1 if malformed
+static int64_t parse_http_date(std::string_view value) {
+    char text[64];
+    if (value.size() >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, value.data(), value.size());
+    text[value.size()] = '\0';
+
+    struct tm date;
+    memset(&date, 0, sizeof(date));
+    const char* end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &date);
+    if (end == nullptr || *end != '\0') {
+        return -1;
+    }
+    return static_cast<int64_t>(timegm(&date));
+}
+
+// Statuses a shared cache may store when the response gives an explicit freshness lifetime
+static bool is_cacheable_status(int status_code) {
+    switch (status_code) {
+        case 200: case 203: case 204: case 300: case 301: case 308:
+        case 404: case 405: case 410: case 414: case 501:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t CachedResponse::client_headers(bool keep_alive, char* buffer, size_t size) const {
+    int64_t age = initial_age + std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - stored).count();
+    int length = snprintf(buffer, size, "Age: %lld\r\n%s", static_cast<long long>(age),
+                          keep_alive ? "" : "Connection: close\r\n");
+    return std::min(static_cast<size_t>(std::max(length, 0)), size - 1);
+}
+
+std::string CachedResponse::serialize(bool keep_alive) const {
+    char headers[64];
+    size_t headers_length = client_headers(keep_alive, headers, sizeof(headers));
+
+    std::string response;
+    response.reserve(bytes.size() + headers_length);
+    response.append(bytes, 0, head_end);
+    response.append(headers, headers_length);
+    response.append(bytes, head_end, std::string::npos);
+    return response;
+}
+
+ResponseCache::ResponseCache(const CacheOptions& options)
+    : options(options) {
+    size_t shard_count = std::max<size_t>(1, options.shards);
+    shard_budget = options.memory_budget / shard_count;
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+ResponseCache::Shard& ResponseCache::shard_for(const std::string& key) {
+    return *shards[std::hash<std::string>{}(key) % shards.size()];
+}
+
+bool ResponseCache::make_key(const HttpRequestParser& request, std::string& key) const {
+    if (request.method() != "GET" || request.version_minor() != 1 || request.head().framing != BodyFraming::NONE) {
+        return false;
+    }
+
+    // Responses to authenticated requests are private, and clients may ask to skip caches
+    if (!request.get_header("Authorization").empty() ||
+        contains_ignore_case(request.get_header("Cache-Control"), "no-cache") ||
+        contains_ignore_case(request.get_header("Cache-Control"), "no-store") ||
+        contains_ignore_case(request.get_header("Pragma"), "no-cache")) {
+        return false;
+    }
+
+    // Virtual hosts behind the same backends serve different content at the same path. Host
+    // names are case-insensitive, so the key has the lower-cased value.
+    key.assign("GET ");
+    for (char c : trim(request.get_header("Host"))) {
+        key += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    key.append(request.path());
+    if (options.key_params.empty()) {
+        std::string_view query = request.query_string();
+        if (!query.empty()) {
+            key += '?';
+            key.append(query);
+        }
+        return true;
+    }
+
+    char separator = '?';
+    for (const std::string& name : options.key_params) {
+        key += separator;
+        key += name;
+        key += '=';
+        key.append(request.get_query_param(name));
+        separator = '&';
+    }
+    return true;
+}
+
+std::shared_ptr<CachedResponse> ResponseCache::make_entry(const std::string& response_bytes) {
+    MessageHead head;
+    if (!parse_response_head(response_bytes.data(), response_bytes.size(), false, head) ||
+        !is_cacheable_status(head.status_code) || head.framing == BodyFraming::UNTIL_CLOSE) {
+        return nullptr;
+    }
+
+    auto entry = std::make_shared<CachedResponse>();
+    entry->status_code = head.status_code;
+    entry->bytes.reserve(response_bytes.size());
+
+    int64_t max_age = -1;
+    int64_t shared_max_age = -1;
+    int64_t expires = -1;
+    int64_t date = -1;
+    bool has_expires = false;
+
+    // Copy the status line and every header but the per-connection ones, noting the caching rules
+    size_t line_start = response_bytes.find("\r\n") + 2;
+    entry->bytes.append(response_bytes, 0, line_start);
+    size_t head_end = head.header_length - 2;
+    while (line_start < head_end) {
+        size_t line_end = response_bytes.find("\r\n", line_start);
+        std::string_view line(response_bytes.data() + line_start, line_end - line_start);
+        size_t colon = line.find(':');
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = colon == std::string_view::npos ? std::string_view() : trim(line.substr(colon + 1));
+
+        bool keep = true;
+        if (equals_ignore_case(name, "Cache-Control")) {
+            size_t start = 0;
+            while (start <= value.size()) {
+                size_t comma = value.find(',', start);
+                std::string_view directive = trim(value.substr(start, comma == std::string_view::npos ? comma : comma - start));
+                std::string_view argument;
+                size_t equals = directive.find('=');
+                if (equals != std::string_view::npos) {
+                    argument = trim(directive.substr(equals + 1));
+                    directive = trim(directive.substr(0, equals));
+                }
+
+                if (equals_ignore_case(directive, "no-store") || equals_ignore_case(directive, "no-cache") ||
+                    equals_ignore_case(directive, "private")) {
+                    return nullptr;
+                } else if (equals_ignore_case(directive, "max-age")) {
+                    max_age = parse_seconds(argument);
+                } else if (equals_ignore_case(directive, "s-maxage")) {
+                    shared_max_age = parse_seconds(argument);
+                }
+
+                if (comma == std::string_view::npos) {
+                    break;
+                }
+                start = comma + 1;
+            }
+        } else if (equals_ignore_case(name, "Expires")) {
+            has_expires = true;
+            expires = parse_http_date(value);
+        } else if (equals_ignore_case(name, "Date")) {
+            date = parse_http_date(value);
+        } else if (equals_ignore_case(name, "Age")) {
+            entry->initial_age = std::max<int64_t>(0, parse_seconds(value));
+            keep = false;
+        } else if (equals_ignore_case(name, "Vary") || equals_ignore_case(name, "Set-Cookie")) {
+            // Keys do not cover request headers, and cookies belong to one client
+            if (!value.empty()) {
+                return nullptr;
+            }
+        } else if (equals_ignore_case(name, "Connection") || equals_ignore_case(name, "Keep-Alive") ||
+                   equals_ignore_case(name, "Proxy-Connection")) {
+            keep = false;
+        }
+
+        if (keep) {
+            entry->bytes.append(response_bytes, line_start, line_end + 2 - line_start);
+        }
+        line_start = line_end + 2;
+    }
+
+    // s-maxage, then max-age, then Expires relative to the backend's clock
+    int64_t lifetime;
+    if (shared_max_age >= 0) {
+        lifetime = shared_max_age;
+    } else if (max_age >= 0) {
+        lifetime = max_age;
+    } else if (has_expires) {
+        lifetime = expires < 0 ? 0 : expires - (date >= 0 ? date : static_cast<int64_t>(time(nullptr)));
+    } else {
+        return nullptr; // No heuristic freshness: only what the backend allows explicitly is cached
+    }
+    if (lifetime - entry->initial_age <= 0) {
+        return nullptr;
+    }
+
+    entry->head_end = entry->bytes.size();
+    entry->bytes.append(response_bytes, head_end, std::string::npos);
+    entry->bytes.shrink_to_fit();
+    entry->stored = std::chrono::steady_clock::now();
+    entry->expires = entry->stored + std::chrono::seconds(lifetime - entry->initial_age);
+    return entry;
+}
+
+CacheLookup ResponseCache::lookup(const std::string& key, bool wait_for_fetch,
+                                  std::shared_ptr<const CachedResponse>& response) {
+    Shard& shard = shard_for(key);
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + options.coalesce_timeout;
+    bool waited = false;
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true) {
+        auto found = shard.index.find(key);
+        if (found != shard.index.end()) {
+            std::list<Entry>::iterator entry = found->second;
+            if (entry->response->expires > now) {
+                if (entry->response->uncacheable) {
+                    bypassed.add();
+                    return CacheLookup::BYPASS;
+                }
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+                response = entry->response;
+                (waited ? coalesced : hits).add();
+                return CacheLookup::HIT;
+            }
+            erase(shard, entry);
+        }
+
+        if (shard.fetching.insert(key).second) {
+            misses.add();
+            return CacheLookup::FETCH;
+        }
+        if (!wait_for_fetch || shard.fetch_done.wait_until(lock, deadline) == std::cv_status::timeout) {
+            bypassed.add();
+            return CacheLookup::BYPASS;
+        }
+        waited = true;
+        now = std::chrono::steady_clock::now();
+    }
+}
+
+void ResponseCache::finish_fetch(const std::string& key, std::shared_ptr<CachedResponse> response) {
+    if (!response || response->bytes.size() > options.max_object_size) {
+        response = std::make_shared<CachedResponse>();
+        response->uncacheable = true;
+        response->stored = std::chrono::steady_clock::now();
+        response->expires = response->stored + options.uncacheable_ttl;
+    } else {
+        stores.add();
+    }
+
+    Shard& shard = shard_for(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.fetching.erase(key);
+        insert(shard, key, std::move(response));
+    }
+    shard.fetch_done.notify_all();
+}
+
+void ResponseCache::abandon_fetch(const std::string& key) {
+    Shard& shard = shard_for(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.fetching.erase(key);
+    }
+    shard.fetch_done.notify_all();
+}
+
+void ResponseCache::insert(Shard& shard, const std::string& key, std::shared_ptr<const CachedResponse> response) {
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+        erase(shard, found->second);
+    }
+
+    size_t charge = key.size() + response->bytes.size() + ENTRY_OVERHEAD;
+    if (charge > shard_budget) {
+        return;
+    }
+
+    shard.lru.push_front(Entry{key, std::move(response), charge});
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    shard.bytes += charge;
+    bytes_used.add(static_cast<int64_t>(charge));
+    entries.add();
+
+    while (shard.bytes > shard_budget) {
+        erase(shard, std::prev(shard.lru.end()));
+        evictions.add();
+    }
+}
+
+void ResponseCache::erase(Shard& shard, std::list<Entry>::iterator entry) {
+    shard.index.erase(entry->key); // Before the key it views goes away
+    shard.bytes -= entry->charge;
+    bytes_used.sub(static_cast<int64_t>(entry->charge));
+    entries.sub();
+    shard.lru.erase(entry);
+}
+
+void ResponseCache::write_metrics(MetricsWriter& out) const {
+    if (!enabled()) {
+        return;
+    }
+
+    out.family("crabby_cache_requests_total", "counter", "Cacheable requests by how the cache answered them.");
+    out.sample("crabby_cache_requests_total", "result=\"hit\"", static_cast<double>(hits.value()));
+    out.sample("crabby_cache_requests_total", "result=\"coalesced\"", static_cast<double>(coalesced.value()));
+    out.sample("crabby_cache_requests_total", "result=\"miss\"", static_cast<double>(misses.value()));
+    out.sample("crabby_cache_requests_total", "result=\"bypass\"", static_cast<double>(bypassed.value()));
+    out.family("crabby_cache_stores_total", "counter", "Responses stored in the cache.");
+    out.sample("crabby_cache_stores_total", "", static_cast<double>(stores.value()));
+    out.family("crabby_cache_evictions_total", "counter", "Entries evicted to stay within the memory budget.");
+    out.sample("crabby_cache_evictions_total", "", static_cast<double>(evictions.value()));
+    out.family("crabby_cache_bytes", "gauge", "Bytes charged against the cache memory budget.");
+    out.sample("crabby_cache_bytes", "", static_cast<double>(bytes_used.value()));
+    out.family("crabby_cache_entries", "gauge", "Entries in the cache, including uncacheable-key markers.");
+    out.sample("crabby_cache_entries", "", static_cast<double>(entries.value()));
+}
@@ -0,0 +1,56 @@
+#include "core/retry_budget.h"
+#include <algorithm>
+
+// Low bits of the allowance word counting the retries of the current second
+static const unsigned ALLOWANCE_BITS = 24;
+static const uint64_t ALLOWANCE_MASK = (uint64_t(1) << ALLOWANCE_BITS) - 1;
+
+// Seconds of the per-second minimum that unused deposits may bank
+static const int64_t BANKED_SECONDS = 10;
+
+bool is_idempotent_method(std::string_view method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "TRACE" ||
+           method == "PUT" || method == "DELETE";
+}
+
+RetryBudget::RetryBudget(const RetryOptions& options)
+    : deposit_millitokens(static_cast<int64_t>(std::max(0.0, options.budget_ratio) * 1000)),
+      max_millitokens(std::max<int64_t>(1, static_cast<int64_t>(options.budget_min_per_second) * BANKED_SECONDS) * 1000),
+      min_per_second(std::min<uint64_t>(options.budget_min_per_second, ALLOWANCE_MASK)),
+      balance(0), allowance(0) {}
+
+// Add a first attempt's share of a retry, up to the cap
+void RetryBudget::deposit() {
+    int64_t current = balance.load(std::memory_order_relaxed);
+    while (current < max_millitokens &&
+           !balance.compare_exchange_weak(current, std::min(current + deposit_millitokens, max_millitokens),
+                                          std::memory_order_relaxed)) {
+    }
+}
+
+// Spend the per-second minimum first, then banked deposits
+bool RetryBudget::try_withdraw() {
+    if (min_per_second > 0) {
+        uint64_t second = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        uint64_t current = allowance.load(std::memory_order_relaxed);
+        while (true) {
+            uint64_t taken = (current >> ALLOWANCE_BITS) == second ? current & ALLOWANCE_MASK : 0;
+            if (taken >= min_per_second) {
+                break;
+            }
+            if (allowance.compare_exchange_weak(current, (second << ALLOWANCE_BITS) | (taken + 1),
+                                                std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    int64_t current = balance.load(std::memory_order_relaxed);
+    while (current >= 1000) {
+        if (balance.compare_exchange_weak(current, current - 1000, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
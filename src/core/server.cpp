@@ -1,24 +1,178 @@
 #include "core/server.h"
 #include "core/utils.h"
+#include "core/logger.h"
+#include "core/buffer_pool.h"
+#include "core/event_loop.h"
+#include "core/uring_loop.h"
+#include "core/http_framing.h"
+#include "core/splice_pipe.h"
+#include "core/config.h"
 #include <thread>
-#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <csignal>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+// Largest response head accepted from a backend
+static const size_t MAX_RESPONSE_HEAD_SIZE = 64 * 1024;
+
+// How long an upgrade waits for the new process to take over the listeners
+static const std::chrono::milliseconds UPGRADE_READY_TIMEOUT(30000);
+
+// One relay pipe per thread, created on first use and replaced when a failed relay left bytes in it
+static SplicePipe* relay_pipe() {
+    thread_local std::unique_ptr<SplicePipe> pipe;
+    if (!pipe || pipe->buffered() > 0) {
+        pipe.reset(new SplicePipe());
+    }
+    return pipe->is_open() ? pipe.get() : nullptr;
+}
+
+// Relay the rest of a body that needs no scanning from backend to client through a pipe.
+// Returns 1 once the body is complete, 0 if the backend closed the connection first and -1 on error.
+// Bytes passed on to the client are added to relayed.
+static int splice_body(SplicePipe& pipe, int backend_socket, int client_socket, BodyFramer& body, size_t& relayed) {
+    while (!body.complete()) {
+        ssize_t moved = pipe.fill(backend_socket, body.opaque_remaining());
+        if (moved <= 0) {
+            return static_cast<int>(moved);
+        }
+        body.skip(moved);
+
+        while (pipe.buffered() > 0) {
+            ssize_t drained = pipe.drain(client_socket);
+            if (drained < 0) {
+                return -1;
+            }
+            relayed += static_cast<size_t>(drained);
+        }
+    }
+    return 1;
+}
+
+// Read the rest of a request body from the client in chunks of read_size and pass it on to the
+// backend, or discard it when backend_socket is -1. The request's own bytes fill buffer up to
+// start and are left alone; bytes past the end of the body (a pipelined request) are left after them.
+static bool stream_request_body(int client_socket, int backend_socket, BodyFramer& body, std::string& buffer,
+                                size_t start, size_t read_size) {
+    while (!body.complete()) {
+        if (buffer.size() == start && read_data(client_socket, buffer, read_size) <= 0) {
+            return false;
+        }
+
+        size_t used = body.consume(buffer.data() + start, buffer.size() - start);
+        if (body.failed() || (backend_socket >= 0 && !send_all(backend_socket, buffer.data() + start, used))) {
+            return false;
+        }
+        buffer.erase(start, used);
+    }
+    return true;
+}
+
+// Send a request to a backend: its head as rewritten (as received when rewritten is empty), then
+// the body bytes buffered with it, gathered into as few sendmsg() calls as possible
+static bool send_request(int socket, std::string_view raw_request, const RewrittenHead& rewritten) {
+    if (rewritten.empty()) {
+        return send_all(socket, raw_request.data(), raw_request.size());
+    }
+    struct iovec iov[RewrittenHead::MAX_SEGMENTS + 1];
+    size_t count = rewritten.to_iov(raw_request.data(), 0, iov, RewrittenHead::MAX_SEGMENTS);
+    if (raw_request.size() > rewritten.original_size()) {
+        iov[count].iov_base = const_cast<char*>(raw_request.data()) + rewritten.original_size();
+        iov[count].iov_len = raw_request.size() - rewritten.original_size();
+        ++count;
+    }
+    return send_iov(socket, iov, count);
+}
+
+// Milliseconds poll() may wait to return by deadline, rounded up; -1 for no deadline
+static int poll_timeout(std::chrono::steady_clock::time_point deadline) {
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+        return -1;
+    }
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<int64_t>(0, remaining.count()));
+}
+
+// Wait until the socket has bytes to read or was closed; false if the deadline passed first
+static bool wait_readable(int socket, std::chrono::steady_clock::time_point deadline) {
+    while (true) {
+        struct pollfd waiting = {socket, POLLIN, 0};
+        int ready = poll(&waiting, 1, poll_timeout(deadline));
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        return ready > 0;
+    }
+}
 
 // Constructor to initialize port and mode with optional backend addresses
-Server::Server(int port, ServerMode mode, const std::vector<std::string>& backend_addresses)
-    : port(port), mode(mode), thread_pool(10), load_balancer(backend_addresses) {}
+Server::Server(int port, ServerMode mode, const std::vector<std::string>& backend_addresses,
+               const ServerOptions& options)
+    : port(port), mode(mode), options(options), upgrade_socket(-1),
+      drain_event(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), draining(false),
+      signal_stop_event(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      thread_pool(options.worker_threads, options.max_queued_connections),
+      load_balancer(backend_addresses, options.load_balancing), connection_pool(options.backend_pool),
+      cache(options.cache) {
+    BufferPool::configure(options.buffers.read_size,
+                          std::max(options.buffers.max_request_buffer, options.buffers.max_response_buffer));
+}
 
 
 // Destructor
 Server::~Server() {
-    std::cout << "Shutting down CrabbyLB..." << std::endl;
+    log_info("Shutting down CrabbyLB...");
+    close(drain_event);
+    close(signal_stop_event);
+}
+
+// Remember the command line for binary upgrades
+void Server::set_command_line(int argc, char* argv[]) {
+    command_line.assign(argv, argv + argc);
+
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (length > 0) {
+        executable.assign(path, static_cast<size_t>(length));
+        // The link of a binary replaced by a rename points at the old, now deleted, file
+        const std::string deleted = " (deleted)";
+        if (executable.size() > deleted.size() &&
+            executable.compare(executable.size() - deleted.size(), deleted.size(), deleted) == 0) {
+            executable.resize(executable.size() - deleted.size());
+        }
+    }
+}
+
+// Receive the listening sockets of the process being upgraded
+bool Server::inherit_listeners(int socket) {
+    if (!receive_fds(socket, inherited_listeners)) {
+        log_error("No listening sockets received from the previous process; binding new ones");
+        close(socket);
+        return false;
+    }
+    upgrade_socket = socket;
+    log_info("Took over %zu listening socket(s) from the previous process", inherited_listeners.size());
+    return true;
 }
 
 // Start server based on selected mode
 void Server::start() {
+    open_listeners();
+    signal_thread = std::thread(&Server::handle_signals, this);
+
     switch (mode) {
         case ServerMode::BASIC:
             start_basic();
@@ -32,181 +186,985 @@ void Server::start() {
         case ServerMode::LOAD_BALANCER:
             start_load_balancer();
             break;
+        case ServerMode::EVENT_LOOP:
+            start_event_loop();
+            break;
         default:
-            std::cerr << "Invalid server mode!" << std::endl;
+            log_error("Invalid server mode!");
             exit(1);
     }
+
+    // A reload or upgrade still in progress finishes before the server it uses goes away
+    uint64_t one = 1;
+    if (write(signal_stop_event, &one, sizeof(one)) != sizeof(one)) {
+        log_error("Could not stop the signal thread: %s", strerror(errno));
+    }
+    signal_thread.join();
+
+    for (int listen_socket : listen_sockets) {
+        close(listen_socket);
+    }
 }
 
-// Basic HTTP server (single-threaded)
-void Server::start_basic() {
-    int server_fd = create_listening_socket(port);
-    std::cout << "🦾 Starting Basic HTTP Server on port " << port << "..." << std::endl;
+// Bind the listeners, or adopt those handed over by an upgrade
+void Server::open_listeners() {
+    size_t count = mode == ServerMode::EVENT_LOOP ? std::max<size_t>(1, options.reactor_threads) : 1;
 
-    while (true) {
-        struct sockaddr_in address;
-        int addrlen = sizeof(address);
-        int client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
+    if (inherited_listeners.empty()) {
+        for (size_t i = 0; i < count; ++i) {
+            listen_sockets.push_back(create_listening_socket(port, count > 1, options.listen_backlog));
+        }
+    } else {
+        // Reactors beyond the inherited listeners share them; a new bind could conflict with
+        // their SO_REUSEPORT setting. Extra inherited ones are closed, dropping what they queued.
+        for (size_t i = 0; i < count; ++i) {
+            listen_sockets.push_back(inherited_listeners[i % inherited_listeners.size()]);
+        }
+        for (size_t i = count; i < inherited_listeners.size(); ++i) {
+            log_warn("Closing inherited listener %zu: run the same number of reactors to keep every one", i);
+            close(inherited_listeners[i]);
+        }
+        inherited_listeners.clear();
+    }
 
-        if (client_socket < 0) {
-            perror("Accept failed");
-            continue;
+    // The previous process stops accepting as soon as it hears from us
+    if (upgrade_socket >= 0) {
+        char ready = 1;
+        if (write(upgrade_socket, &ready, 1) != 1) {
+            log_warn("Could not tell the previous process we are ready: %s", strerror(errno));
         }
+        close(upgrade_socket);
+        upgrade_socket = -1;
+    }
+}
+
+// Basic HTTP server (single-threaded)
+void Server::start_basic() {
+    int server_fd = listen_sockets[0];
+    log_info("🦾 Starting Basic HTTP Server on port %d...", port);
 
+    int client_socket;
+    while ((client_socket = accept_client(server_fd)) >= 0) {
         handle_request(client_socket);
     }
 }
 
 // Multi-threaded server (one thread per request)
 void Server::start_multi_threaded() {
-    int server_fd = create_listening_socket(port);
-    std::cout << "🧵 Starting Multi-Threaded Server on port " << port << "..." << std::endl;
-
-    while (true) {
-        struct sockaddr_in address;
-        int addrlen = sizeof(address);
-        int client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
-
-        if (client_socket < 0) {
-            perror("Accept failed");
-            continue;
-        }
+    int server_fd = listen_sockets[0];
+    log_info("🧵 Starting Multi-Threaded Server on port %d...", port);
 
-        std::thread request_thread(&Server::handle_request, this, client_socket);
+    int client_socket;
+    while ((client_socket = accept_client(server_fd)) >= 0) {
+        metrics.open_connections.add();
+        std::thread request_thread(&Server::serve_connection, this, client_socket);
         request_thread.detach();
     }
+    wait_for_connections();
 }
 
 // ThreadPool-based server
 void Server::start_thread_pool() {
-    int server_fd = create_listening_socket(port);
-    std::cout << "⚡️ Starting ThreadPool-Based Server on port " << port << "..." << std::endl;
-
-    while (true) {
-        struct sockaddr_in address;
-        int addrlen = sizeof(address);
-        int client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
+    int server_fd = listen_sockets[0];
+    log_info("⚡️ Starting ThreadPool-Based Server on port %d...", port);
 
-        if (client_socket < 0) {
-            perror("Accept failed");
+    int client_socket;
+    while ((client_socket = accept_client(server_fd)) >= 0) {
+        if (!admit_connection(client_socket)) {
             continue;
         }
 
-        thread_pool.enqueue_task([this, client_socket] {
-            handle_request(client_socket);
+        // Shed the connection rather than letting the queue, and the wait in it, grow without bound
+        metrics.queued_connections.add();
+        bool queued = thread_pool.try_enqueue_task([this, client_socket] {
+            metrics.queued_connections.sub();
+            serve_connection(client_socket);
         });
+        if (!queued) {
+            metrics.queued_connections.sub();
+            metrics.open_connections.sub();
+            metrics.connections_rejected.add();
+            reject_connection(client_socket, Response::service_unavailable());
+        }
     }
+    wait_for_connections();
 }
 
 // Load Balancer with Health Checks and Auto-Restart
 void Server::start_load_balancer() {
-    int server_fd = create_listening_socket(port);
-    std::cout << "🌐 Starting Load Balancer with Health Checks on port " << port << "..." << std::endl;
+    int server_fd = listen_sockets[0];
+    log_info("🌐 Starting Load Balancer with Health Checks on port %d...", port);
 
-    while (true) {
-        struct sockaddr_in address;
-        int addrlen = sizeof(address);
-        int client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
+    for (const std::string& address : load_balancer.get_backend_addresses()) {
+        connection_pool.prewarm(address);
+    }
 
-        if (client_socket < 0) {
-            perror("Accept failed");
+    int client_socket;
+    while ((client_socket = accept_client(server_fd)) >= 0) {
+        if (!admit_connection(client_socket)) {
             continue;
         }
 
-        std::thread request_thread(&Server::handle_request, this, client_socket);
+        std::thread request_thread(&Server::serve_connection, this, client_socket);
         request_thread.detach();
     }
+    wait_for_connections();
 }
 
-// Handle incoming HTTP requests
-// Handle incoming HTTP requests
-void Server::handle_request(int client_socket) {
-    std::string request_data = read_data(client_socket);
-    if (request_data.empty()) {
-        close(client_socket);
+// Event-driven Load Balancer (one epoll reactor per thread, non-blocking sockets)
+void Server::start_event_loop() {
+    size_t reactor_count = listen_sockets.size();
+    log_info("🌀 Starting Event-Loop Load Balancer on port %d with %zu reactor(s)...", port, reactor_count);
+
+    if (reactor_count == 1) {
+        run_reactor(0);
+        return;
+    }
+
+    // Every reactor owns its listener, epoll instance and connections; the kernel
+    // spreads new connections across the SO_REUSEPORT listeners, so there is no shared accept lock
+    std::vector<std::thread> reactors;
+    for (size_t i = 0; i < reactor_count; ++i) {
+        reactors.emplace_back(&Server::run_reactor, this, i);
+    }
+
+    for (std::thread& reactor : reactors) {
+        reactor.join();
+    }
+}
+
+// Run one event-loop reactor on its own SO_REUSEPORT listener
+void Server::run_reactor(size_t reactor_index) {
+    if (options.pin_reactors) {
+        unsigned int cpu_count = std::max(1u, std::thread::hardware_concurrency());
+        pin_current_thread_to_cpu(reactor_index % cpu_count);
+    }
+
+    if (options.io_engine == IoEngine::IO_URING) {
+        UringLoop uring_loop(listen_sockets[reactor_index], drain_event, load_balancer, cache, metrics, options);
+        if (uring_loop.is_open()) {
+            uring_loop.run();
+            return;
+        }
+        log_warn("io_uring is unavailable, reactor %zu falls back to epoll", reactor_index);
+    }
+
+    EventLoop event_loop(listen_sockets[reactor_index], drain_event, load_balancer, cache, metrics, options);
+    event_loop.run();
+}
+
+// Accept the next client, waiting on the listener and the drain event
+int Server::accept_client(int server_fd) {
+    // Non-blocking, so accept() never sleeps where begin_drain() cannot wake it
+    set_non_blocking(server_fd);
+
+    while (!draining.load(std::memory_order_acquire)) {
+        int client_socket = accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_socket >= 0) {
+            return client_socket;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd waiting[2] = {{server_fd, POLLIN, 0}, {drain_event, POLLIN, 0}};
+            if (poll(waiting, 2, -1) < 0 && errno != EINTR) {
+                log_error("poll failed: %s", strerror(errno));
+                return -1;
+            }
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            log_error("Accept failed: %s", strerror(errno));
+        }
+    }
+    return -1;
+}
+
+// Wait for the connections still open to finish
+void Server::wait_for_connections() {
+    auto deadline = std::chrono::steady_clock::now() + options.drain_timeout;
+    while (metrics.open_connections.value() > 0) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            // Their threads are still using the server, so it cannot be destroyed: leave at once
+            log_warn("Drain timeout: cutting %lld connection(s) still open",
+                     static_cast<long long>(metrics.open_connections.value()));
+            Logger::instance().shutdown(); // _exit() skips the atexit flush
+            _exit(EXIT_FAILURE);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    log_info("All connections drained");
+}
+
+// Stop accepting; connections in flight finish and keep-alive ones close after their response
+void Server::begin_drain() {
+    if (draining.exchange(true, std::memory_order_acq_rel)) {
         return;
     }
+    log_info("Draining: no longer accepting connections (waiting up to %lld ms)",
+             static_cast<long long>(options.drain_timeout.count()));
+
+    uint64_t one = 1;
+    if (write(drain_event, &one, sizeof(one)) != sizeof(one)) {
+        log_error("Could not signal the drain: %s", strerror(errno));
+    }
+}
 
-    Request request(request_data);
+// Handle the signals every other thread blocks
+void Server::handle_signals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
 
-    if (mode == ServerMode::LOAD_BALANCER) {
-        forward_request_to_backend(client_socket, request);
-    } else {
-        process_request(client_socket, request);
+    // Every thread blocks these signals, so they queue for the signalfd
+    int signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        log_error("signalfd failed: %s", strerror(errno));
+        return;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = signal_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = signal_stop_event;
+    fds[1].events = POLLIN;
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("poll failed on signals: %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        struct signalfd_siginfo info;
+        if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) {
+            continue;
+        }
+        int signal_number = static_cast<int>(info.ssi_signo);
+
+        switch (signal_number) {
+            case SIGHUP:
+                reload_config();
+                break;
+            case SIGUSR2:
+                upgrade_binary();
+                break;
+            default:
+                if (draining.load(std::memory_order_acquire)) {
+                    log_warn("Second %s: exiting without waiting for connections", strsignal(signal_number));
+                    Logger::instance().shutdown(); // _exit() skips the atexit flush
+                    _exit(EXIT_FAILURE);
+                }
+                log_info("%s received: shutting down gracefully", strsignal(signal_number));
+                begin_drain();
+                break;
+        }
     }
+    close(signal_fd);
 }
 
-// Process request and generate appropriate response
-void Server::process_request(int client_socket, const Request& request) {
-    std::string response_body;
-    int status_code = 200;
-
-    if (request.get_path() == "/") {
-        response_body = "<h1>Welcome to CrabbyLB!</h1>";
-    } else if (request.get_path() == "/health") {
-        response_body = "OK";
+// Exec the binary again, hand it the listeners, and drain once it is serving
+void Server::upgrade_binary() {
+    if (draining.load(std::memory_order_acquire)) {
+        log_warn("Upgrade ignored: already draining");
+        return;
+    }
+    if (executable.empty() || command_line.empty()) {
+        log_error("Upgrade failed: the executable's path is unknown");
+        return;
+    }
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) {
+        log_error("Upgrade failed: socketpair: %s", strerror(errno));
+        return;
+    }
+
+    // Everything exec needs is built before fork(): between the two only async-signal-safe calls are allowed
+    std::vector<char*> argv;
+    for (std::string& argument : command_line) {
+        argv.push_back(&argument[0]);
+    }
+    argv.push_back(nullptr);
+
+    std::string upgrade_prefix = std::string(UPGRADE_FD_VARIABLE) + "=";
+    std::string upgrade_variable = upgrade_prefix + std::to_string(sockets[1]);
+    std::vector<char*> envp;
+    for (char** variable = environ; *variable != nullptr; ++variable) {
+        if (strncmp(*variable, upgrade_prefix.c_str(), upgrade_prefix.size()) != 0) {
+            envp.push_back(*variable);
+        }
+    }
+    envp.push_back(&upgrade_variable[0]);
+    envp.push_back(nullptr);
+
+    log_info("Upgrading: starting %s", executable.c_str());
+    pid_t child = fork();
+    if (child == 0) {
+        // Every other descriptor is close-on-exec; only the child's end of the socket pair crosses over.
+        // The new process must not inherit our blocked signal mask either.
+        sigset_t none;
+        sigemptyset(&none);
+        pthread_sigmask(SIG_SETMASK, &none, nullptr);
+        fcntl(sockets[1], F_SETFD, 0);
+        execve(executable.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    close(sockets[1]);
+    if (child < 0) {
+        log_error("Upgrade failed: fork: %s", strerror(errno));
+        close(sockets[0]);
+        return;
+    }
+
+    // Hand over the listeners, then wait for the new process to say it is serving
+    bool ready = false;
+    if (send_fds(sockets[0], listen_sockets)) {
+        struct pollfd reply = {sockets[0], POLLIN, 0};
+        int timeout = static_cast<int>(UPGRADE_READY_TIMEOUT.count());
+        char byte = 0;
+        ready = poll(&reply, 1, timeout) == 1 && read(sockets[0], &byte, 1) == 1;
+    }
+    close(sockets[0]);
+
+    if (!ready) {
+        log_error("Upgrade failed: new process %d did not take over; carrying on", static_cast<int>(child));
+        kill(child, SIGKILL);
+        waitpid(child, nullptr, 0);
+        return;
+    }
+
+    log_info("New process %d is serving; draining this one", static_cast<int>(child));
+    begin_drain();
+}
+
+// Apply the reloadable settings of the configuration file
+void Server::reload_config() {
+    if (options.config_path.empty()) {
+        log_warn("SIGHUP ignored: the server was not started with --config");
+        return;
+    }
+
+    // Built the way main() built it, so options on the command line still override the file
+    ServerConfig config;
+    std::string error;
+    bool loaded;
+    if (command_line.size() >= 2) {
+        loaded = load_server_config(std::vector<std::string>(command_line.begin() + 2, command_line.end()), config,
+                                    error);
     } else {
-        status_code = 404;
-        response_body = "<h1>404 Not Found</h1>";
+        config.options = options;
+        loaded = load_config_file(options.config_path, config, error);
+    }
+    if (!loaded) {
+        log_error("Configuration not reloaded: %s", error.c_str());
+        return;
     }
 
-    Response response(status_code);
-    response.add_header("Content-Type", "text/html");
-    response.set_body(response_body);
+    log_info("Reloading configuration from %s", options.config_path.c_str());
+    Logger::instance().set_level(config.options.logging.level);
 
-    std::string final_response = response.build_response();
-    send_data(client_socket, final_response);
-    close(client_socket);
+    if ((mode == ServerMode::LOAD_BALANCER || mode == ServerMode::EVENT_LOOP) && !config.backends.empty()) {
+        load_balancer.update_backends(config.backends);
+
+        // Reactors prune their own pools; the threaded proxy shares this one
+        if (mode == ServerMode::LOAD_BALANCER) {
+            std::vector<std::string> addresses = load_balancer.get_backend_addresses();
+            connection_pool.retain_only(addresses);
+            for (const std::string& address : addresses) {
+                connection_pool.prewarm(address);
+            }
+        }
+    }
 }
 
+// Count an accepted connection against max_connections
+bool Server::admit_connection(int client_socket) {
+    metrics.connections_accepted.add();
+    int64_t open = metrics.open_connections.add();
+    if (options.max_connections > 0 && static_cast<size_t>(open) >= options.max_connections) {
+        metrics.open_connections.sub();
+        metrics.connections_rejected.add();
+        reject_connection(client_socket, Response::service_unavailable());
+        return false;
+    }
+    return true;
+}
 
-// Forward request to backend and send response to client
-void Server::forward_request_to_backend(int client_socket, const Request& request) {
-    try {
-        Backend backend = load_balancer.get_next_backend();  // Get next backend
-        std::cout << "🔄 Routing request to backend: " << backend.address << "\n";
+// Serve an admitted connection, then release its slot
+void Server::serve_connection(int client_socket) {
+    handle_request(client_socket);
+    metrics.open_connections.sub();
+}
+
+// Handle incoming HTTP requests, serving keep-alive and pipelined requests in order
+void Server::handle_request(int client_socket) {
+    // The basic server handles one connection at a time, so an idle keep-alive client would stall it
+    bool keep_alive_allowed = mode != ServerMode::BASIC;
+    set_receive_timeout(client_socket, options.keep_alive_timeout);
 
-        std::string backend_ip = backend.address.substr(0, backend.address.find(":"));
-        int backend_port = std::stoi(backend.address.substr(backend.address.find(":") + 1));
+    // The receive buffer comes from this thread's pool and each request is served where it was
+    // received, so a steady stream of connections neither allocates nor copies for them
+    PooledBuffer pooled_buffer;
+    std::string& buffer = *pooled_buffer;
+    HttpRequestParser parser;
+    size_t requests_served = 0;
 
-        int backend_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (backend_socket < 0) {
-            perror("Backend socket creation failed");
-            load_balancer.mark_backend_down(backend.address);
+    // Looked up once per connection, and only when the access log or source-IP hashing uses it
+    bool need_client = Logger::instance().access_log_enabled() || load_balancer.routes_on_client_address() ||
+                       options.header_rewrite.forwarded_for;
+    std::string client = need_client ? peer_address(client_socket) : "";
+
+    while (true) {
+        // Parse the head incrementally; pipelined requests may already be buffered
+        ParseStatus status;
+        while ((status = parser.parse(buffer)) == ParseStatus::INCOMPLETE) {
+            if (read_data(client_socket, buffer, options.buffers.read_size) <= 0) {
+                close(client_socket);
+                return;
+            }
+        }
+
+        if (status == ParseStatus::ERROR) {
+            log_warn("⚠️ Rejecting malformed request: %s at byte %zu", parse_error_message(parser.error()),
+                     parser.error_offset());
+            send_data(client_socket, Response::canned(CannedResponse::BAD_REQUEST));
             close(client_socket);
             return;
         }
 
-        struct sockaddr_in backend_address;
-        backend_address.sin_family = AF_INET;
-        backend_address.sin_port = htons(backend_port);
-        inet_pton(AF_INET, backend_ip.c_str(), &backend_address.sin_addr);
+        MessageHead head = parser.head();
+        BodyFramer body(head);
+        size_t request_length = head.header_length +
+                                body.consume(buffer.data() + head.header_length, buffer.size() - head.header_length);
+
+        if (!body.complete() && parser.expects_continue()) {
+            send_data(client_socket, Response::canned(CannedResponse::CONTINUE));
+        }
+
+        // Small bodies are buffered with the head; the rest of a large one is streamed
+        // by whoever handles the request, so memory stays bounded whatever its size
+        while (!body.complete() && !body.failed() && buffer.size() < options.buffers.max_request_buffer) {
+            size_t scanned = buffer.size();
+            if (read_data(client_socket, buffer, options.buffers.read_size) <= 0) {
+                close(client_socket);
+                return;
+            }
+            request_length += body.consume(buffer.data() + scanned, buffer.size() - scanned);
+        }
 
-        // Connect to the backend
-        if (connect(backend_socket, (struct sockaddr*)&backend_address, sizeof(backend_address)) < 0) {
-            perror("Connection to backend server failed");
-            load_balancer.mark_backend_down(backend.address);
-            close(backend_socket);
+        if (body.failed()) {
+            send_data(client_socket, Response::canned(CannedResponse::BAD_REQUEST));
             close(client_socket);
             return;
         }
 
-        // Forward request to backend
-        std::string raw_request = request.get_raw_request();
-        send(backend_socket, raw_request.c_str(), raw_request.length(), 0);
+        // The request borrows the front of buffer until it is done. Streaming the rest of its body
+        // appends at most read_size bytes at a time after it, so with this room buffer never moves.
+        if (!body.complete()) {
+            buffer.reserve(request_length + options.buffers.read_size);
+        }
+        Request request(std::string_view(buffer.data(), request_length), parser);
+        parser.reset();
+
+        bool keep_alive = keep_alive_allowed && head.keep_alive && !draining.load(std::memory_order_relaxed) &&
+                          ++requests_served < options.max_requests_per_connection;
+
+        metrics.requests.add();
 
-        // Receive response from backend
-        char response_buffer[1024];
-        ssize_t bytes_read;
-        while ((bytes_read = read(backend_socket, response_buffer, sizeof(response_buffer))) > 0) {
-            send(client_socket, response_buffer, bytes_read, 0);
+        AccessLogEntry access;
+        access.client = client;
+        access.method = request.method_view();
+        access.path = request.path_view();
+        access.started = std::chrono::steady_clock::now();
+
+        bool connection_ok;
+        if (!options.metrics_path.empty() && request.path_view() == options.metrics_path) {
+            // Reserved for the proxy's own metrics in every mode, never forwarded
+            std::string response = metrics.build_response(load_balancer, cache, keep_alive);
+            access.status = 200;
+            connection_ok = stream_request_body(client_socket, -1, body, buffer, request_length,
+                                                options.buffers.read_size) &&
+                            send_data(client_socket, response);
+            access.response_bytes = connection_ok ? response.size() : 0;
+        } else if (mode == ServerMode::LOAD_BALANCER) {
+            connection_ok = forward_request_to_backend(client_socket, request, body, buffer, keep_alive, access);
+        } else {
+            // The built-in pages ignore the body, but it must be read before the next request
+            connection_ok = stream_request_body(client_socket, -1, body, buffer, request_length,
+                                                options.buffers.read_size) &&
+                            process_request(client_socket, request, keep_alive, access);
         }
+        Logger::instance().log_access(access);
+        buffer.erase(0, request_length);
 
-        close(backend_socket);
-    } catch (const std::runtime_error& e) {
-        std::cerr << "⚠️ Error forwarding request: " << e.what() << "\n";
-        send_data(client_socket, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        if (!connection_ok || !keep_alive) {
+            break;
+        }
     }
 
     close(client_socket);
-}
\ No newline at end of file
+}
+
+// Process request and generate appropriate response
+bool Server::process_request(int client_socket, const Request& request, bool keep_alive, AccessLogEntry& access) {
+    // Every page the server itself has is fixed, so it is sent pre-serialized
+    CannedResponse page = CannedResponse::NOT_FOUND;
+    int status_code = 404;
+    if (request.path_view() == "/") {
+        page = CannedResponse::WELCOME;
+        status_code = 200;
+    } else if (request.path_view() == "/health") {
+        page = CannedResponse::HEALTH_OK;
+        status_code = 200;
+    }
+
+    const std::string& final_response = Response::canned(page, keep_alive);
+    access.status = status_code;
+    if (!send_data(client_socket, final_response)) {
+        return false;
+    }
+    access.response_bytes = final_response.size();
+    return true;
+}
+
+
+// Forward request to backend and send response to client
+bool Server::forward_request_to_backend(int client_socket, const Request& request, BodyFramer& body,
+                                        std::string& client_buffer, bool& keep_alive, AccessLogEntry& access) {
+    // Cacheable GETs are answered from memory; concurrent misses of one key wait for a single fetch
+    std::string cache_key;
+    if (cache.enabled() && cache.make_key(request.parsed(), cache_key)) {
+        std::shared_ptr<const CachedResponse> cached;
+        CacheLookup lookup = cache.lookup(cache_key, true, cached);
+        if (lookup == CacheLookup::HIT) {
+            return send_cached_response(client_socket, *cached, keep_alive, access);
+        }
+        if (lookup == CacheLookup::BYPASS) {
+            cache_key.clear();
+        }
+    }
+
+    bool connection_ok = false;
+
+    try {
+        // Hash-based strategies route on the request's key (access.client holds the client address)
+        uint64_t request_hash = load_balancer.routing_hash(request.parsed(), access.client);
+
+        // Only a request held in full can go to a second backend, and only if sending it twice is harmless
+        bool replayable = body.complete() && is_idempotent_method(request.method_view());
+
+        // Headers are rewritten once, as a list of spans sent with the untouched bytes around them
+        RewrittenHead rewritten;
+        if (options.header_rewrite.enabled()) {
+            rewritten.build(request.raw_request_view(), request.parsed(), access.client, options.header_rewrite);
+        }
+        BackendAttempt attempt;
+        size_t retries = 0;
+
+        while (true) {
+            attempt.backend = &load_balancer.get_next_backend(request_hash, attempt.backend);
+            attempt.selected = std::chrono::steady_clock::now();
+            attempt.response = BackendResponse();
+            attempt.response.capture = !cache_key.empty();
+            access.backend = attempt.backend->address;
+
+            ExchangeResult result = attempt_backend(attempt, client_socket, request, rewritten, body, client_buffer,
+                                                    request_hash, replayable, keep_alive);
+            RequestOutcome outcome = attempt.response.outcome;
+            access.status = attempt.response.status_code;
+            access.response_bytes = attempt.response.bytes;
+            finish_attempt(attempt, result == ExchangeResult::REUSABLE);
+
+            if (result != ExchangeResult::STALE && result != ExchangeResult::UNANSWERED) {
+                connection_ok = result == ExchangeResult::REUSABLE || result == ExchangeResult::COMPLETE;
+                break;
+            }
+
+            // Nothing reached the client yet: another backend may answer, or the client learns why none did
+            if (result == ExchangeResult::STALE && replayable && retries < load_balancer.retry_options().max_retries) {
+                if (load_balancer.try_retry()) {
+                    ++retries;
+                    metrics.retries.add();
+                    continue;
+                }
+                metrics.retries_denied.add();
+            }
+            keep_alive = false;
+            bool timed_out = outcome == RequestOutcome::TIMEOUT;
+            const std::string& error = Response::canned(timed_out ? CannedResponse::GATEWAY_TIMEOUT
+                                                                  : CannedResponse::BAD_GATEWAY);
+            access.status = timed_out ? 504 : 502;
+            access.response_bytes = send_data(client_socket, error) ? error.size() : 0;
+            break;
+        }
+
+        if (!cache_key.empty()) {
+            if (connection_ok) {
+                cache.finish_fetch(cache_key, attempt.response.capture ? ResponseCache::make_entry(attempt.response.captured)
+                                                                       : nullptr);
+            } else {
+                cache.abandon_fetch(cache_key);
+            }
+            cache_key.clear();
+        }
+    } catch (const OverloadedError&) {
+        metrics.requests_shed.add();
+        keep_alive = false; // Shed quietly and hand the connection back, logging would only add to the load
+        connection_ok = send_data(client_socket, Response::service_unavailable());
+        access.status = 503;
+        if (!cache_key.empty()) {
+            cache.abandon_fetch(cache_key);
+        }
+    } catch (const std::runtime_error& e) {
+        log_warn("⚠️ Error forwarding request: %s", e.what());
+        keep_alive = false;
+        connection_ok = send_data(client_socket, Response::service_unavailable());
+        access.status = 503;
+        if (!cache_key.empty()) {
+            cache.abandon_fetch(cache_key);
+        }
+    }
+
+    return connection_ok;
+}
+
+// Send the request to the attempt's backend, on a pooled connection if one is idle
+ExchangeResult Server::attempt_backend(BackendAttempt& attempt, int client_socket, const Request& request,
+                                       const RewrittenHead& rewritten, BodyFramer& body, std::string& client_buffer, uint64_t request_hash,
+                                       bool hedgeable, bool& keep_alive) {
+    // A pooled connection may have been closed by the backend while idle. If it fails before
+    // any response byte arrives, retry once on a fresh connection.
+    for (int tries = 0; tries < 2; ++tries) {
+        attempt.socket = tries == 0 ? connection_pool.checkout(attempt.backend->address) : -1;
+        attempt.reused = attempt.socket >= 0;
+        attempt.response.timing.connect = std::chrono::microseconds(0);
+
+        if (!attempt.reused && !connect_attempt(attempt)) {
+            return ExchangeResult::STALE;
+        }
+
+        ExchangeResult result = exchange_with_backend(attempt, client_socket, request.raw_request_view(), rewritten,
+                                                      body, client_buffer, request.method_view() == "HEAD", request_hash,
+                                                      hedgeable, keep_alive);
+        if (result == ExchangeResult::STALE && attempt.reused &&
+            attempt.response.outcome == RequestOutcome::CONNECTION_FAILURE) {
+            close(attempt.socket);
+            attempt.socket = -1;
+            continue;
+        }
+        return result;
+    }
+    return ExchangeResult::STALE;
+}
+
+// Open a new connection to the attempt's backend within the connect timeout
+bool Server::connect_attempt(BackendAttempt& attempt) {
+    auto connect_started = std::chrono::steady_clock::now();
+    attempt.socket = open_backend_socket(attempt.backend->address, options.backend_connect_timeout);
+    if (attempt.socket < 0) {
+        attempt.response.outcome = errno == ETIMEDOUT ? RequestOutcome::TIMEOUT : RequestOutcome::CONNECTION_FAILURE;
+        return false;
+    }
+    attempt.response.timing.connect = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - connect_started);
+    return true;
+}
+
+// Hand the attempt's connection back to the pool (or close it) and release its backend
+void Server::finish_attempt(BackendAttempt& attempt, bool reusable) {
+    if (attempt.socket >= 0) {
+        reusable = reusable && !attempt.backend->retired.load(std::memory_order_relaxed);
+        connection_pool.checkin(attempt.backend->address, attempt.socket, reusable);
+        attempt.socket = -1;
+    }
+    attempt.response.timing.total = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - attempt.selected);
+    load_balancer.release_backend(*attempt.backend, attempt.response.outcome, attempt.response.timing);
+}
+
+// Wait for the first response byte, hedging on a second backend once the first is late
+bool Server::await_first_byte(BackendAttempt& attempt, std::string_view raw_request,
+                              const RewrittenHead& rewritten, uint64_t request_hash, bool hedgeable) {
+    auto deadline = options.backend_first_byte_timeout.count() > 0
+                        ? attempt.sent + options.backend_first_byte_timeout
+                        : std::chrono::steady_clock::time_point::max();
+
+    std::chrono::microseconds hedge_delay(0);
+    if (hedgeable) {
+        hedge_delay = load_balancer.hedge_delay(*attempt.backend);
+    }
+    if (hedge_delay.count() == 0 || attempt.sent + hedge_delay >= deadline ||
+        wait_readable(attempt.socket, attempt.sent + hedge_delay)) {
+        return wait_readable(attempt.socket, deadline);
+    }
+    if (!load_balancer.try_retry()) {
+        metrics.retries_denied.add();
+        return wait_readable(attempt.socket, deadline);
+    }
+
+    // The same request goes to another backend; the first to answer serves it
+    BackendAttempt hedge;
+    try {
+        hedge.backend = &load_balancer.get_next_backend(request_hash, attempt.backend);
+    } catch (const std::runtime_error&) {
+        return wait_readable(attempt.socket, deadline);
+    }
+    hedge.selected = std::chrono::steady_clock::now();
+    hedge.socket = connection_pool.checkout(hedge.backend->address);
+    hedge.reused = hedge.socket >= 0;
+    if (!hedge.reused && !connect_attempt(hedge)) {
+        finish_attempt(hedge, false);
+        return wait_readable(attempt.socket, deadline);
+    }
+    if (options.backend_idle_timeout.count() > 0) {
+        set_receive_timeout(hedge.socket, options.backend_idle_timeout);
+        set_send_timeout(hedge.socket, options.backend_idle_timeout);
+    }
+    if (!send_request(hedge.socket, raw_request, rewritten)) {
+        hedge.response.outcome = RequestOutcome::CONNECTION_FAILURE;
+        finish_attempt(hedge, false);
+        return wait_readable(attempt.socket, deadline);
+    }
+    hedge.sent = std::chrono::steady_clock::now();
+    metrics.hedges.add();
+
+    // A connection that closes instead of answering drops out, leaving the other to answer
+    bool primary_waiting = true;
+    bool hedge_waiting = true;
+    while (primary_waiting || hedge_waiting) {
+        struct pollfd waiting[2] = {{primary_waiting ? attempt.socket : -1, POLLIN, 0},
+                                    {hedge_waiting ? hedge.socket : -1, POLLIN, 0}};
+        int ready = poll(waiting, 2, poll_timeout(deadline));
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            break;
+        }
+
+        char byte;
+        if (primary_waiting && waiting[0].revents != 0) {
+            if (recv(attempt.socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) {
+                hedge.response.outcome = RequestOutcome::ABORTED;
+                finish_attempt(hedge, false);
+                return true;
+            }
+            primary_waiting = false;
+        }
+        if (hedge_waiting && waiting[1].revents != 0) {
+            if (recv(hedge.socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) {
+                // The hedge takes the primary's place; the primary is cut off unanswered
+                metrics.hedges_won.add();
+                attempt.response.outcome = primary_waiting ? RequestOutcome::ABORTED : RequestOutcome::CONNECTION_FAILURE;
+                std::swap(attempt.backend, hedge.backend);
+                std::swap(attempt.socket, hedge.socket);
+                std::swap(attempt.selected, hedge.selected);
+                std::swap(attempt.sent, hedge.sent);
+                std::swap(attempt.reused, hedge.reused);
+                std::swap(attempt.response.outcome, hedge.response.outcome);
+                std::swap(attempt.response.timing, hedge.response.timing);
+                finish_attempt(hedge, false);
+                return true;
+            }
+            hedge_waiting = false;
+        }
+    }
+
+    // Neither answered in time, or both closed: the primary reports it, the hedge is released here
+    hedge.response.outcome = hedge_waiting ? RequestOutcome::TIMEOUT : RequestOutcome::CONNECTION_FAILURE;
+    finish_attempt(hedge, false);
+    if (!primary_waiting) {
+        return true; // Let the read see the primary's close
+    }
+    return false;
+}
+
+// Answer a request from a cached response: the stored bytes go out as they are, with the
+// per-client headers slotted in before the blank line
+bool Server::send_cached_response(int client_socket, const CachedResponse& cached, bool keep_alive,
+                                  AccessLogEntry& access) {
+    char headers[64];
+    size_t headers_length = cached.client_headers(keep_alive, headers, sizeof(headers));
+
+    struct iovec iov[3];
+    iov[0].iov_base = const_cast<char*>(cached.bytes.data());
+    iov[0].iov_len = cached.head_end;
+    iov[1].iov_base = headers;
+    iov[1].iov_len = headers_length;
+    iov[2].iov_base = const_cast<char*>(cached.bytes.data()) + cached.head_end;
+    iov[2].iov_len = cached.bytes.size() - cached.head_end;
+
+    access.status = cached.status_code;
+    if (!send_iov(client_socket, iov, 3)) {
+        return false;
+    }
+    access.response_bytes = cached.bytes.size() + headers_length;
+    return true;
+}
+
+// Send the request on a backend connection, stream the rest of its body and relay the framed response to the client
+ExchangeResult Server::exchange_with_backend(BackendAttempt& attempt, int client_socket,
+                                             std::string_view raw_request, const RewrittenHead& rewritten,
+                                             BodyFramer& request_body,
+                                             std::string& client_buffer, bool head_request, uint64_t request_hash,
+                                             bool hedgeable, bool& keep_alive) {
+    BackendResponse& response = attempt.response;
+    response.outcome = RequestOutcome::ABORTED;
+    response.timing.first_byte = std::chrono::microseconds(0);
+    response.status_code = 0;
+    response.bytes = 0;
+    response.captured.clear();
+
+    // The final response is copied for the cache as it is relayed, up to the largest object kept
+    auto capture = [&](const char* data, size_t length) {
+        if (!response.capture) {
+            return;
+        }
+        if (response.captured.size() + length > cache.max_object_size()) {
+            response.capture = false;
+            response.captured.clear();
+            return;
+        }
+        response.captured.append(data, length);
+    };
+
+    // Blocking reads and writes on the backend give up once nothing has moved for the idle timeout
+    if (options.backend_idle_timeout.count() > 0) {
+        set_receive_timeout(attempt.socket, options.backend_idle_timeout);
+        set_send_timeout(attempt.socket, options.backend_idle_timeout);
+    }
+    auto failure = [](int error) {
+        return error == EAGAIN || error == EWOULDBLOCK ? RequestOutcome::TIMEOUT : RequestOutcome::CONNECTION_FAILURE;
+    };
+
+    if (!send_request(attempt.socket, raw_request, rewritten)) {
+        response.outcome = failure(errno);
+        return ExchangeResult::STALE;
+    }
+
+    // Once body bytes have been consumed from the client the request can no longer be replayed
+    bool replayable = request_body.complete();
+    if (!stream_request_body(client_socket, attempt.socket, request_body, client_buffer, raw_request.size(),
+                             options.buffers.read_size)) {
+        return ExchangeResult::FAILED;
+    }
+    attempt.sent = std::chrono::steady_clock::now();
+
+    // Nothing has reached the client until the first interim or final response head is relayed
+    ExchangeResult unanswered = replayable ? ExchangeResult::STALE : ExchangeResult::UNANSWERED;
+    if (!await_first_byte(attempt, raw_request, rewritten, request_hash, hedgeable && replayable)) {
+        response.outcome = RequestOutcome::TIMEOUT;
+        return unanswered;
+    }
+    int backend_socket = attempt.socket;
+
+    // Read until the final response head is complete, relaying interim ones (e.g. 100 Continue) as they are
+    PooledBuffer pooled_head;
+    std::string& head_buffer = *pooled_head;
+    MessageHead head;
+    while (true) {
+        while (!parse_response_head(head_buffer.data(), head_buffer.size(), head_request, head)) {
+            if (head_buffer.size() > MAX_RESPONSE_HEAD_SIZE) {
+                response.outcome = RequestOutcome::CONNECTION_FAILURE;
+                return response.bytes == 0 ? ExchangeResult::UNANSWERED : ExchangeResult::FAILED;
+            }
+            if (read_data(backend_socket, head_buffer, options.buffers.read_size) <= 0) {
+                response.outcome = failure(errno);
+                if (response.bytes > 0) {
+                    return ExchangeResult::FAILED;
+                }
+                return head_buffer.empty() ? unanswered : ExchangeResult::UNANSWERED;
+            }
+        }
+
+        if (!is_interim_response(head)) {
+            break;
+        }
+        if (!send_all(client_socket, head_buffer.data(), head.header_length)) {
+            return ExchangeResult::FAILED;
+        }
+        response.bytes += head.header_length;
+        head_buffer.erase(0, head.header_length);
+    }
+    response.outcome = outcome_for_status(head.status_code);
+    response.status_code = head.status_code;
+    response.timing.first_byte = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - attempt.sent);
+    bool backend_keep_alive = head.keep_alive;
+
+    // The client connection can only continue if the response has an end the client can see
+    keep_alive = keep_alive && backend_keep_alive;
+    if (!keep_alive && head.keep_alive) {
+        add_connection_close(head_buffer, 0, head);
+    }
+
+    // Relay the head and whatever part of the body arrived with it
+    BodyFramer body(head);
+    size_t body_available = head_buffer.size() - head.header_length;
+    size_t body_used = body.consume(head_buffer.data() + head.header_length, body_available);
+    bool trailing_bytes = body_used < body_available;
+
+    if (!send_all(client_socket, head_buffer.data(), head.header_length + body_used)) {
+        return ExchangeResult::FAILED;
+    }
+    response.bytes += head.header_length + body_used;
+    capture(head_buffer.data(), head.header_length + body_used);
+
+    // Large Content-Length and until-close bodies move through a pipe inside the kernel,
+    // unless they are copied into the cache
+    SplicePipe* pipe = nullptr;
+    bool cacheable_size = response.captured.size() + body.opaque_remaining() <= cache.max_object_size();
+    if (options.splice_threshold > 0 && body.opaque_remaining() >= options.splice_threshold &&
+        !(response.capture && cacheable_size)) {
+        pipe = relay_pipe();
+    }
+    if (pipe != nullptr) {
+        response.capture = false;
+        int spliced = splice_body(*pipe, backend_socket, client_socket, body, response.bytes);
+        if (spliced == 0 && head.framing == BodyFraming::UNTIL_CLOSE) {
+            return ExchangeResult::COMPLETE;
+        }
+        if (spliced <= 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                response.outcome = RequestOutcome::TIMEOUT;
+            }
+            return ExchangeResult::FAILED;
+        }
+    }
+
+    // Otherwise copy the rest of the body until its framing says it is complete
+    thread_local std::vector<char> relay_buffer;
+    relay_buffer.resize(options.buffers.max_response_buffer);
+    char* buffer = relay_buffer.data();
+    while (!body.complete()) {
+        ssize_t bytes_read = read(backend_socket, buffer, relay_buffer.size());
+        if (bytes_read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read == 0 && head.framing == BodyFraming::UNTIL_CLOSE) {
+            return ExchangeResult::COMPLETE;
+        }
+        if (bytes_read <= 0) {
+            if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                response.outcome = RequestOutcome::TIMEOUT;
+            }
+            return ExchangeResult::FAILED;
+        }
+
+        size_t used = body.consume(buffer, bytes_read);
+        if (body.failed() || !send_all(client_socket, buffer, used)) {
+            return ExchangeResult::FAILED;
+        }
+        response.bytes += used;
+        capture(buffer, used);
+        trailing_bytes = trailing_bytes || used < static_cast<size_t>(bytes_read);
+    }
+
+    // Bytes past the end of the response mean the connection is out of sync
+    return backend_keep_alive && !trailing_bytes ? ExchangeResult::REUSABLE : ExchangeResult::COMPLETE;
+}
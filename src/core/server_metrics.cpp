@@ -0,0 +1,38 @@
+#include "core/server_metrics.h"
+#include "core/response.h"
+
+// Complete HTTP response with every metric in the Prometheus text format
+std::string ServerMetrics::build_response(const LoadBalancer& load_balancer, const ResponseCache& cache,
+                                          bool keep_alive) const {
+    MetricsWriter out;
+
+    out.family("crabby_connections_accepted_total", "counter", "Client connections accepted.");
+    out.sample("crabby_connections_accepted_total", "", static_cast<double>(connections_accepted.value()));
+    out.family("crabby_connections_rejected_total", "counter", "Client connections answered with 503 on accept.");
+    out.sample("crabby_connections_rejected_total", "", static_cast<double>(connections_rejected.value()));
+    out.family("crabby_open_connections", "gauge", "Client connections currently open.");
+    out.sample("crabby_open_connections", "", static_cast<double>(open_connections.value()));
+    out.family("crabby_queued_connections", "gauge", "Accepted connections waiting for a thread-pool worker.");
+    out.sample("crabby_queued_connections", "", static_cast<double>(queued_connections.value()));
+    out.family("crabby_requests_total", "counter", "Requests received from clients.");
+    out.sample("crabby_requests_total", "", static_cast<double>(requests.value()));
+    out.family("crabby_requests_shed_total", "counter", "Requests answered with 503 by the concurrency limit.");
+    out.sample("crabby_requests_shed_total", "", static_cast<double>(requests_shed.value()));
+    out.family("crabby_retries_total", "counter", "Requests sent to a backend again after a failed attempt.");
+    out.sample("crabby_retries_total", "", static_cast<double>(retries.value()));
+    out.family("crabby_hedges_total", "counter", "Second copies sent of requests a backend was slow to answer.");
+    out.sample("crabby_hedges_total", "", static_cast<double>(hedges.value()));
+    out.family("crabby_hedges_won_total", "counter", "Hedged requests answered first by the second copy.");
+    out.sample("crabby_hedges_won_total", "", static_cast<double>(hedges_won.value()));
+    out.family("crabby_retries_denied_total", "counter", "Retries and hedges not sent because the retry budget was spent.");
+    out.sample("crabby_retries_denied_total", "", static_cast<double>(retries_denied.value()));
+
+    load_balancer.write_metrics(out);
+    cache.write_metrics(out);
+
+    Response response(200);
+    response.add_header("Content-Type", "text/plain; version=0.0.4");
+    response.add_header("Connection", keep_alive ? "keep-alive" : "close");
+    response.set_body(out.text());
+    return response.build_response();
+}
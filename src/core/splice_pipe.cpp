@@ -0,0 +1,63 @@
+#include "core/splice_pipe.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Larger pipes mean fewer splice() calls per response; the kernel may refuse and keep its default
+static const int PREFERRED_PIPE_SIZE = 256 * 1024;
+static const size_t DEFAULT_PIPE_SIZE = 64 * 1024;
+
+SplicePipe::SplicePipe() : read_end(-1), write_end(-1), capacity(0), pending(0) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        return;
+    }
+    read_end = fds[0];
+    write_end = fds[1];
+
+    int size = fcntl(write_end, F_SETPIPE_SZ, PREFERRED_PIPE_SIZE);
+    if (size < 0) {
+        size = fcntl(write_end, F_GETPIPE_SZ);
+    }
+    capacity = size > 0 ? static_cast<size_t>(size) : DEFAULT_PIPE_SIZE;
+}
+
+SplicePipe::~SplicePipe() {
+    if (is_open()) {
+        close(read_end);
+        close(write_end);
+    }
+}
+
+// Move up to length bytes from a socket into the pipe
+ssize_t SplicePipe::fill(int socket, size_t length) {
+    length = std::min(length, space());
+    if (length == 0) {
+        errno = EAGAIN; // A full pipe is not an EOF
+        return -1;
+    }
+
+    ssize_t moved;
+    do {
+        moved = splice(socket, nullptr, write_end, nullptr, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (moved < 0 && errno == EINTR);
+
+    if (moved > 0) {
+        pending += moved;
+    }
+    return moved;
+}
+
+// Move buffered bytes from the pipe to a socket
+ssize_t SplicePipe::drain(int socket) {
+    ssize_t moved;
+    do {
+        moved = splice(read_end, nullptr, socket, nullptr, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } while (moved < 0 && errno == EINTR);
+
+    if (moved > 0) {
+        pending -= moved;
+    }
+    return moved;
+}
@@ -0,0 +1,140 @@
+#include "core/task_queue.h"
+
+static size_t round_up_to_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+WorkStealingDeque::WorkStealingDeque(size_t capacity)
+    : slots(new Slot[round_up_to_power_of_two(capacity)]),
+      mask(round_up_to_power_of_two(capacity) - 1), top(0), bottom(0) {}
+
+bool WorkStealingDeque::push(Task& task) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    if (b - t > static_cast<int64_t>(mask)) {
+        return false;
+    }
+
+    Slot& slot = slots[b & mask];
+    if (slot.full.load(std::memory_order_acquire)) {
+        return false; // A thief is still moving the previous task out of this slot
+    }
+    slot.task = std::move(task);
+    slot.full.store(true, std::memory_order_relaxed);
+
+    // Publish the task before the new bottom makes it visible to thieves
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+}
+
+bool WorkStealingDeque::pop(Task& task) {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed); // Empty
+        return false;
+    }
+
+    if (t == b) {
+        // Last task: thieves may be after it too, whoever moves top first gets it
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        if (!won) {
+            return false;
+        }
+    }
+
+    Slot& slot = slots[b & mask];
+    task = std::move(slot.task);
+    slot.full.store(false, std::memory_order_release);
+    return true;
+}
+
+bool WorkStealingDeque::steal(Task& task) {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+        return false;
+    }
+
+    // Claim the slot before touching it; the owner cannot reuse it until full is cleared
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return false;
+    }
+
+    Slot& slot = slots[t & mask];
+    task = std::move(slot.task);
+    slot.full.store(false, std::memory_order_release);
+    return true;
+}
+
+bool WorkStealingDeque::empty() const {
+    return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+}
+
+BoundedTaskQueue::BoundedTaskQueue(size_t capacity)
+    : cells(new Cell[round_up_to_power_of_two(capacity)]),
+      mask(round_up_to_power_of_two(capacity) - 1), enqueue_position(0), dequeue_position(0) {
+    for (size_t i = 0; i <= mask; ++i) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool BoundedTaskQueue::push(Task& task) {
+    size_t position = enqueue_position.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (difference == 0) {
+            if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // The consumer of the previous lap has not emptied the cell yet: full
+        } else {
+            position = enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->task = std::move(task);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool BoundedTaskQueue::pop(Task& task) {
+    size_t position = dequeue_position.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+        if (difference == 0) {
+            if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // Nothing published in this cell yet: empty
+        } else {
+            position = dequeue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    task = std::move(cell->task);
+    cell->sequence.store(position + mask + 1, std::memory_order_release);
+    return true;
+}
+
+bool BoundedTaskQueue::empty() const {
+    return dequeue_position.load(std::memory_order_relaxed) >= enqueue_position.load(std::memory_order_relaxed);
+}
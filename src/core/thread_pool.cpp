@@ -1,72 +1,164 @@
 #include "core/thread_pool.h"
-#include <iostream>
+#include <algorithm>
+
+// The pool and index of the worker running on this thread, so tasks it enqueues stay local
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+static constexpr size_t SPIN_ROUNDS = 64;
+
+// Hint to the CPU that this is a spin-wait loop
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
 
 // Constructor to create a thread pool with a specified number of threads
-ThreadPool::ThreadPool(size_t num_threads) : stop(false) {
-    for(size_t i = 0; i < num_threads; ++i){
-        // Create worker threads and bind them to the worker_thread function
-        workers.emplace_back([this]{
-            this->worker_thread();
+ThreadPool::ThreadPool(size_t num_threads, size_t queue_capacity)
+    : injection_queue(queue_capacity), stop(false), parked(0), wake_epoch(0) {
+    size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    if (num_threads == 0) {
+        num_threads = cpus;
+    }
+    spin_rounds = cpus > 1 ? SPIN_ROUNDS : 0;
+
+    // Create every deque before any worker starts stealing from them
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers[i]->thread = std::thread([this, i] {
+            this->worker_thread(i);
         });
     }
 }
 
 // Destructor to clean up and stop all threads
-ThreadPool::~ThreadPool(){
+ThreadPool::~ThreadPool() {
     {
-        // Lock the mutex to ensure no tasks are added while stopping
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
+        std::lock_guard<std::mutex> lock(park_mutex);
+        stop.store(true, std::memory_order_release);
     }
 
-    // Notify all threads that it's time to stop
-    condition.notify_all();
+    // Wake every parked worker; they exit once no task is left anywhere
+    park_condition.notify_all();
 
-    // Join all threads to wait for them to finish
-    for(std::thread &worker: workers){
-        worker.join();
+    for (std::unique_ptr<Worker>& worker : workers) {
+        worker->thread.join();
     }
 }
 
-// Add a task to the task queue
-void ThreadPool::enqueue_task(std::function<void()> task){
-    {
-        // Lock the mutex to ensure no other thread modifies the task queue
-        std::unique_lock<std::mutex> lock(queue_mutex);
+// Add a task to the pool
+void ThreadPool::enqueue_task(Task task) {
+    if (current_pool == this && workers[current_worker]->deque.push(task)) {
+        wake_one();
+        return;
+    }
 
-        // Add the task to the queue
-        tasks_queue.push(std::move(task));
+    while (!injection_queue.push(task)) {
+        // Full: let the workers catch up
+        wake_one();
+        std::this_thread::yield();
     }
+    wake_one();
+}
 
-    // Notify one thread that a new task is available
-    condition.notify_one();
+// Add a task to the pool unless the queue is full
+bool ThreadPool::try_enqueue_task(Task task) {
+    if ((current_pool == this && workers[current_worker]->deque.push(task)) || injection_queue.push(task)) {
+        wake_one();
+        return true;
+    }
+    return false;
 }
 
-// Worker thread that processes tasks from the task queue
-void ThreadPool::worker_thread() {
-    while(true) {
-        std::function<void()> task;
+// Worker thread that runs tasks until the pool is destroyed
+void ThreadPool::worker_thread(size_t index) {
+    current_pool = this;
+    current_worker = index;
+
+    Task task;
+    size_t idle_rounds = 0;
+    while (true) {
+        if (find_task(index, task)) {
+            task();
+            task.reset();
+            idle_rounds = 0;
+            continue;
+        }
+
+        if (stop.load(std::memory_order_acquire)) {
+            return;
+        }
 
-        {
-            // Lock the mutex to access the task queue
-            std::unique_lock<std::mutex> lock(queue_mutex);
+        // Work tends to arrive in bursts: poll again for a while before going to sleep
+        if (idle_rounds < spin_rounds) {
+            cpu_relax();
+        } else if (idle_rounds < spin_rounds + YIELD_ROUNDS) {
+            std::this_thread::yield();
+        } else {
+            park();
+            idle_rounds = 0;
+            continue;
+        }
+        ++idle_rounds;
+    }
+}
 
-            // Wait until a task is available or shutdown signal is received
-            condition.wait(lock, [this]{
-                return !tasks_queue.empty() || stop;
-            });
+bool ThreadPool::find_task(size_t index, Task& task) {
+    if (workers[index]->deque.pop(task) || injection_queue.pop(task)) {
+        return true;
+    }
 
-            // If the thread was woken up to stop, exit the loop
-            if(stop && tasks_queue.empty()){
-                return;
-            }
+    for (size_t offset = 1; offset < workers.size(); ++offset) {
+        if (workers[(index + offset) % workers.size()]->deque.steal(task)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-            // Get the next task from the queue
-            task = std::move(tasks_queue.front());
-            tasks_queue.pop();
+bool ThreadPool::has_work() const {
+    if (!injection_queue.empty()) {
+        return true;
+    }
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        if (!worker->deque.empty()) {
+            return true;
         }
+    }
+    return false;
+}
+
+void ThreadPool::park() {
+    std::unique_lock<std::mutex> lock(park_mutex);
 
-        // Execute the task
-        task();
+    // Announce the worker before the last look at the queues. Paired with the fence in
+    // wake_one(), either this check sees a new task or its producer sees parked > 0.
+    parked.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (!has_work() && !stop.load(std::memory_order_acquire)) {
+        uint64_t epoch = wake_epoch;
+        park_condition.wait(lock, [this, epoch] {
+            return wake_epoch != epoch || stop.load(std::memory_order_acquire);
+        });
+    }
+    parked.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::wake_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(park_mutex);
+        ++wake_epoch;
     }
+    park_condition.notify_one();
 }
@@ -0,0 +1,1091 @@
+#include "core/uring_loop.h"
+#include "core/utils.h"
+#include "core/logger.h"
+#include "core/response.h"
+#include "core/buffer_pool.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const unsigned RING_ENTRIES = 1024;
+const unsigned BUFFER_COUNT = 512; // Receive buffers shared by every socket of the reactor
+const uint16_t BUFFER_GROUP = 0;
+const size_t MAX_RESPONSE_HEAD_SIZE = 64 * 1024;
+const int IDLE_SWEEP_INTERVAL_MS = 1000;
+const size_t MAX_SPARE_CONNECTIONS = 64;
+
+// User data of an operation: connection id (0 for the listener), backend attempt, operation
+uint64_t make_user_data(uint64_t id, uint16_t attempt, uint8_t operation) {
+    return id << 24 | static_cast<uint64_t>(attempt) << 8 | operation;
+}
+
+void set_timeout(__kernel_timespec& timeout, std::chrono::steady_clock::duration duration) {
+    auto micros = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    timeout.tv_sec = micros / 1000000;
+    timeout.tv_nsec = (micros % 1000000) * 1000;
+}
+
+// Forget what was sent to and received from a backend that failed before answering
+void reset_exchange(UringConnection& conn) {
+    conn.request_sent = 0;
+    conn.backend_out.clear();
+    conn.backend_out_sent = 0;
+    conn.backend_timed_out = false;
+    conn.backend_eof = false;
+    conn.response_bytes = 0;
+    conn.response_head.clear();
+    conn.backend_in_sync = true;
+    conn.cache_fill.clear();
+    conn.cache_filling = !conn.cache_key.empty();
+}
+
+} // namespace
+
+UringLoop::UringLoop(int listen_socket, int drain_event, LoadBalancer& load_balancer, ResponseCache& cache,
+                     ServerMetrics& metrics, const ServerOptions& options)
+    : listen_socket(listen_socket), drain_event(drain_event), draining(false),
+      load_balancer(load_balancer), cache(cache), metrics(metrics), options(options),
+      connection_pool(options.backend_pool), pooled_backends_version(load_balancer.backends_version()),
+      last_connection_id(0), client_connections(0), accepting(false),
+      ring(RING_ENTRIES), buffers(ring, BUFFER_GROUP, BUFFER_COUNT, options.buffers.read_size) {
+    if (!is_open()) {
+        return;
+    }
+
+    set_non_blocking(listen_socket);
+    accept_connections();
+    if (drain_event >= 0) {
+        io_uring_sqe* sqe = queue(nullptr, Operation::DRAIN);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = drain_event;
+        sqe->poll32_events = POLLIN;
+    }
+
+    for (const std::string& address : load_balancer.get_backend_addresses()) {
+        connection_pool.prewarm(address);
+    }
+}
+
+UringLoop::~UringLoop() {
+    for (auto& entry : connections) {
+        UringConnection& conn = *entry.second;
+        if (conn.client_socket >= 0) {
+            close(conn.client_socket);
+        }
+        if (conn.backend_socket >= 0) {
+            close(conn.backend_socket);
+        }
+    }
+    for (int socket : closing_sockets) {
+        close(socket);
+    }
+}
+
+// Submit what the last batch queued, wait for completions and handle them
+void UringLoop::run() {
+    auto last_idle_sweep = std::chrono::steady_clock::now();
+
+    while (true) {
+        if (!ring.submit_and_wait(std::chrono::milliseconds(IDLE_SWEEP_INTERVAL_MS))) {
+            return;
+        }
+
+        // Every operation on these sockets has now reached the kernel
+        for (int socket : closing_sockets) {
+            close(socket);
+        }
+        closing_sockets.clear();
+
+        while (const io_uring_cqe* cqe = ring.peek_completion()) {
+            io_uring_cqe completion = *cqe;
+            ring.consume_completion();
+            handle_completion(completion);
+        }
+
+        for (uint64_t id : closed_connections) {
+            auto it = connections.find(id);
+            if (it != connections.end() && it->second->pending == 0) {
+                free_connection(it);
+            }
+        }
+        closed_connections.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (draining && (client_connections == 0 || now >= drain_deadline)) {
+            if (client_connections > 0) {
+                log_warn("Drain timeout: cutting %zu connection(s) still open", client_connections);
+            }
+            return;
+        }
+        if (now - last_idle_sweep >= std::chrono::milliseconds(IDLE_SWEEP_INTERVAL_MS)) {
+            sweep_idle_connections();
+            last_idle_sweep = now;
+
+            // A reload removed backends: their idle connections would never be used again
+            uint64_t backends_version = load_balancer.backends_version();
+            if (backends_version != pooled_backends_version) {
+                connection_pool.retain_only(load_balancer.get_backend_addresses());
+                pooled_backends_version = backends_version;
+            }
+        }
+    }
+}
+
+void UringLoop::handle_completion(const io_uring_cqe& cqe) {
+    Operation operation = static_cast<Operation>(cqe.user_data & 0xff);
+    uint16_t attempt = static_cast<uint16_t>(cqe.user_data >> 8);
+    uint64_t id = cqe.user_data >> 24;
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    // Received bytes are copied out by the handlers, so the buffer goes back to the ring afterwards
+    const char* data = nullptr;
+    uint16_t buffer_id = 0;
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        data = buffers.buffer(buffer_id);
+    }
+
+    if (id == 0) {
+        if (operation == Operation::ACCEPT) {
+            if (cqe.res >= 0) {
+                add_connection(cqe.res);
+            } else if (cqe.res != -ECANCELED) {
+                log_error("Accept failed: %s", strerror(-cqe.res));
+            }
+            if (!more) {
+                accepting = false;
+                if (!draining) {
+                    accept_connections();
+                }
+            }
+        } else if (operation == Operation::DRAIN) {
+            start_draining();
+        }
+    } else {
+        auto it = connections.find(id);
+        if (it != connections.end()) {
+            UringConnection& conn = *it->second;
+            if (!more) {
+                --conn.pending;
+            }
+
+            // Backend operations of a socket given up on (attempt changed) are ignored
+            bool current = attempt == conn.attempt;
+            switch (operation) {
+                case Operation::CLIENT_RECEIVE:
+                    if (!more) {
+                        conn.client_receiving = false;
+                    }
+                    handle_client_receive(conn, cqe.res, data);
+                    break;
+                case Operation::CLIENT_SEND:
+                    handle_client_send(conn, cqe.res);
+                    break;
+                case Operation::CONNECT:
+                    if (current) {
+                        handle_connect(conn, cqe.res);
+                    }
+                    break;
+                case Operation::BACKEND_SEND:
+                    if (current) {
+                        handle_backend_send(conn, cqe.res);
+                    }
+                    break;
+                case Operation::BACKEND_RECEIVE:
+                    if (current) {
+                        handle_backend_receive(conn, cqe.res, data);
+                    }
+                    break;
+                default:
+                    break; // Linked timeouts and cancellations report nothing the handlers need
+            }
+
+            if (conn.closed && conn.pending == 0) {
+                free_connection(it);
+            }
+        }
+    }
+
+    if (data != nullptr) {
+        buffers.recycle(buffer_id);
+    }
+}
+
+io_uring_sqe* UringLoop::queue(UringConnection* conn, Operation operation) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    if (sqe == nullptr) {
+        log_error("io_uring submission queue is full");
+        return nullptr;
+    }
+
+    // Client operations outlive backend attempts, so only backend ones carry the attempt
+    bool backend_operation = operation == Operation::CONNECT || operation == Operation::BACKEND_SEND ||
+                             operation == Operation::BACKEND_RECEIVE || operation == Operation::LINK_TIMEOUT;
+    uint64_t id = conn != nullptr ? conn->id : 0;
+    uint16_t attempt = conn != nullptr && backend_operation ? conn->attempt : 0;
+    sqe->user_data = make_user_data(id, attempt, static_cast<uint8_t>(operation));
+    if (conn != nullptr) {
+        ++conn->pending;
+    }
+    return sqe;
+}
+
+// Arm one multishot accept; it posts a completion per connection until cancelled
+void UringLoop::accept_connections() {
+    io_uring_sqe* sqe = queue(nullptr, Operation::ACCEPT);
+    if (sqe == nullptr) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_socket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    accepting = true;
+}
+
+void UringLoop::add_connection(int client_socket) {
+    metrics.connections_accepted.add();
+    if (options.max_connections > 0 && client_connections >= options.max_connections) {
+        metrics.connections_rejected.add();
+        reject_connection(client_socket, Response::service_unavailable());
+        return;
+    }
+    ++client_connections;
+    metrics.open_connections.add();
+
+    // A spare connection is reset for its new client, keeping the buffers it grew
+    std::unique_ptr<UringConnection> conn;
+    if (spare_connections.empty()) {
+        conn.reset(new UringConnection());
+    } else {
+        conn = std::move(spare_connections.back());
+        spare_connections.pop_back();
+
+        std::string request_buffer;
+        std::string backend_out;
+        std::string response_head;
+        std::string response_buffer;
+        std::string client_out;
+        request_buffer.swap(conn->request_buffer);
+        backend_out.swap(conn->backend_out);
+        response_head.swap(conn->response_head);
+        response_buffer.swap(conn->response_buffer);
+        client_out.swap(conn->client_out);
+
+        *conn = UringConnection();
+
+        recycle_buffer(request_buffer);
+        recycle_buffer(backend_out);
+        recycle_buffer(response_head);
+        recycle_buffer(response_buffer);
+        recycle_buffer(client_out);
+        conn->request_buffer.swap(request_buffer);
+        conn->backend_out.swap(backend_out);
+        conn->response_head.swap(response_head);
+        conn->response_buffer.swap(response_buffer);
+        conn->client_out.swap(client_out);
+    }
+    conn->id = ++last_connection_id;
+    conn->client_socket = client_socket;
+    if (Logger::instance().access_log_enabled() || load_balancer.routes_on_client_address() ||
+        options.header_rewrite.forwarded_for) {
+        conn->client_address = peer_address(client_socket);
+    }
+    conn->last_activity = std::chrono::steady_clock::now();
+
+    UringConnection& added = *conn;
+    connections.emplace(added.id, std::move(conn));
+    receive_client(added);
+}
+
+void UringLoop::free_connection(std::unordered_map<uint64_t, std::unique_ptr<UringConnection>>::iterator it) {
+    if (spare_connections.size() < MAX_SPARE_CONNECTIONS) {
+        spare_connections.push_back(std::move(it->second));
+    }
+    connections.erase(it);
+}
+
+// Stop accepting; the listener stays open for the other reactors or the process taking over
+void UringLoop::start_draining() {
+    draining = true;
+    drain_deadline = std::chrono::steady_clock::now() + options.drain_timeout;
+    if (accepting) {
+        io_uring_sqe* sqe = queue(nullptr, Operation::CANCEL);
+        if (sqe != nullptr) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = make_user_data(0, 0, static_cast<uint8_t>(Operation::ACCEPT));
+        }
+    }
+}
+
+// Close client connections waiting too long for their next request, and end backend exchanges
+// in which nothing moved for the idle timeout (connects and first bytes have linked timeouts)
+void UringLoop::sweep_idle_connections() {
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<UringConnection*> idle;
+    std::vector<UringConnection*> stalled;
+    for (const auto& entry : connections) {
+        UringConnection& conn = *entry.second;
+        if (conn.closed) {
+            continue;
+        }
+        if (conn.state == ConnectionState::READING_REQUEST) {
+            if (now - conn.last_activity > options.keep_alive_timeout) {
+                idle.push_back(&conn);
+            }
+            continue;
+        }
+        bool linked_timeout = conn.state == ConnectionState::CONNECTING_BACKEND ||
+                              (conn.state == ConnectionState::RELAYING_RESPONSE && conn.response_bytes == 0);
+        if (conn.backend != nullptr && !linked_timeout && options.backend_idle_timeout.count() > 0 &&
+            now - conn.last_activity > options.backend_idle_timeout) {
+            stalled.push_back(&conn);
+        }
+    }
+
+    for (UringConnection* conn : idle) {
+        close_connection(*conn);
+    }
+    for (UringConnection* conn : stalled) {
+        // Nothing moved: the backend stalled, unless it was the client the proxy was waiting on
+        bool client_stalled = conn->client_sending ||
+                              (conn->state == ConnectionState::WRITING_REQUEST && !conn->backend_sending);
+        if (client_stalled) {
+            close_connection(*conn);
+        } else {
+            conn->backend_timed_out = true;
+            shutdown(conn->backend_socket, SHUT_RDWR); // Its pending operation ends and reports the timeout
+        }
+    }
+}
+
+void UringLoop::receive_client(UringConnection& conn) {
+    if (conn.closed || conn.client_receiving || conn.client_paused || conn.client_eof) {
+        return;
+    }
+    io_uring_sqe* sqe = queue(&conn, Operation::CLIENT_RECEIVE);
+    if (sqe == nullptr) {
+        close_connection(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.client_socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers.group();
+    conn.client_receiving = true;
+}
+
+// Cancel the multishot receive; bytes already on their way are still buffered
+void UringLoop::pause_client(UringConnection& conn) {
+    if (conn.client_paused) {
+        return;
+    }
+    conn.client_paused = true;
+    if (conn.client_receiving) {
+        io_uring_sqe* sqe = queue(&conn, Operation::CANCEL);
+        if (sqe != nullptr) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = make_user_data(conn.id, 0, static_cast<uint8_t>(Operation::CLIENT_RECEIVE));
+        }
+    }
+}
+
+void UringLoop::resume_client(UringConnection& conn) {
+    conn.client_paused = false;
+    receive_client(conn); // Re-armed when the cancelled receive ends, if it has not yet
+}
+
+void UringLoop::handle_client_receive(UringConnection& conn, int result, const char* data) {
+    if (conn.closed) {
+        return;
+    }
+    if (result > 0) {
+        conn.request_buffer.append(data, static_cast<size_t>(result));
+    } else if (result == 0) {
+        conn.client_eof = true;
+    } else if (result != -ECANCELED && result != -ENOBUFS) {
+        close_connection(conn);
+        return;
+    }
+
+    if (result >= 0) {
+        conn.last_activity = std::chrono::steady_clock::now();
+        if (conn.state == ConnectionState::READING_REQUEST) {
+            dispatch_request(conn);
+        } else if (conn.backend != nullptr && !conn.request_body.complete()) {
+            // More of a body being streamed to the backend
+            if (!frame_request(conn)) {
+                fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+                return;
+            }
+            if (conn.client_eof) {
+                if (!conn.request_body.complete()) {
+                    close_connection(conn);
+                    return;
+                }
+                conn.client_keep_alive = false;
+            }
+            if (conn.state == ConnectionState::WRITING_REQUEST) {
+                send_request(conn);
+            }
+        } else if (conn.client_eof) {
+            conn.client_keep_alive = false; // Close once the response is out
+        }
+    }
+    if (conn.closed) {
+        return;
+    }
+
+    // Stop buffering a client that is ahead of its backend; re-arm a receive that ran out of buffers.
+    // Bytes copied into backend_out count until the kernel has actually sent them.
+    size_t unsent = conn.request_buffer.size() - conn.request_sent + conn.backend_out.size() - conn.backend_out_sent;
+    if (conn.state != ConnectionState::READING_REQUEST && unsent > options.buffers.max_request_buffer) {
+        pause_client(conn);
+    }
+    receive_client(conn);
+}
+
+// Start forwarding the first buffered request once its head is complete; the body follows as it arrives
+void UringLoop::dispatch_request(UringConnection& conn) {
+    ParseStatus status = conn.request_parser.parse(conn.request_buffer);
+    if (status == ParseStatus::ERROR) {
+        fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+        return;
+    }
+    if (status == ParseStatus::INCOMPLETE) {
+        if (conn.client_eof) {
+            close_connection(conn);
+        }
+        return;
+    }
+
+    const MessageHead& head = conn.request_parser.head();
+    conn.request_body = BodyFramer(head);
+    conn.request_length = head.header_length;
+    if (!frame_request(conn)) {
+        fail_connection(conn, Response::canned(CannedResponse::BAD_REQUEST));
+        return;
+    }
+
+    if (!conn.request_body.complete()) {
+        if (conn.client_eof) {
+            close_connection(conn);
+            return;
+        }
+        if (conn.request_parser.expects_continue()) {
+            const std::string& interim = Response::canned(CannedResponse::CONTINUE);
+            send(conn.client_socket, interim.data(), interim.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    conn.requests_served++;
+    conn.client_keep_alive = head.keep_alive && !conn.client_eof && !draining &&
+                             conn.requests_served < options.max_requests_per_connection;
+    metrics.requests.add();
+    conn.request_active = true;
+    conn.request_started = std::chrono::steady_clock::now();
+    if (Logger::instance().access_log_enabled()) {
+        conn.request_method.assign(conn.request_parser.method());
+        conn.request_path.assign(conn.request_parser.path());
+    }
+
+    if (!options.metrics_path.empty() && conn.request_parser.path() == options.metrics_path) {
+        // A body is not worth waiting for: answer now and close instead of reading it
+        conn.client_keep_alive = conn.client_keep_alive && conn.request_body.complete();
+        conn.response_status = 200;
+        respond_locally(conn, metrics.build_response(load_balancer, cache, conn.client_keep_alive));
+        return;
+    }
+
+    // As in EventLoop, a miss on a key another request is fetching is not coalesced
+    if (cache.enabled() && cache.make_key(conn.request_parser, conn.cache_key)) {
+        std::shared_ptr<const CachedResponse> cached;
+        CacheLookup lookup = cache.lookup(conn.cache_key, false, cached);
+        if (lookup == CacheLookup::HIT) {
+            conn.cache_key.clear();
+            conn.response_status = cached->status_code;
+            respond_locally(conn, cached->serialize(conn.client_keep_alive));
+            return;
+        }
+        if (lookup == CacheLookup::BYPASS) {
+            conn.cache_key.clear();
+        }
+        conn.cache_filling = lookup == CacheLookup::FETCH;
+    }
+
+    if (options.header_rewrite.enabled()) {
+        conn.rewritten_head.build(conn.request_buffer, conn.request_parser, conn.client_address,
+                                  options.header_rewrite);
+    }
+    connect_to_backend(conn);
+}
+
+// Frame newly buffered body bytes; everything framed so far can be forwarded
+bool UringLoop::frame_request(UringConnection& conn) {
+    size_t framed = conn.request_length;
+    conn.request_length += conn.request_body.consume(conn.request_buffer.data() + framed,
+                                                     conn.request_buffer.size() - framed);
+    return !conn.request_body.failed();
+}
+
+// Reset the connection for the next request once a keep-alive response has been sent
+void UringLoop::finish_request(UringConnection& conn) {
+    log_request(conn);
+
+    conn.request_buffer.erase(0, conn.request_length);
+    conn.request_parser.reset();
+    conn.request_length = 0;
+    conn.request_sent = 0;
+    conn.request_streamed = false;
+    conn.head_request = false;
+    conn.retries = 0;
+    conn.rewritten_head.clear();
+    conn.backend_out.clear();
+    conn.backend_out_sent = 0;
+
+    conn.backend_reused = false;
+    conn.backend_timed_out = false;
+    conn.response_head.clear();
+    conn.have_response_head = false;
+    conn.response_bytes = 0;
+    conn.response_complete = false;
+    conn.backend_in_sync = true;
+    conn.backend_eof = false;
+
+    conn.state = ConnectionState::READING_REQUEST;
+    conn.last_activity = std::chrono::steady_clock::now();
+    resume_client(conn);
+
+    // A pipelined request may already be buffered
+    dispatch_request(conn);
+}
+
+// Pick a backend and start forwarding the request to it
+void UringLoop::connect_to_backend(UringConnection& conn) {
+    conn.request_hash = load_balancer.routing_hash(conn.request_parser, conn.client_address);
+    if (!select_backend(conn, nullptr)) {
+        return;
+    }
+
+    conn.head_request = conn.request_parser.method() == "HEAD";
+    open_backend_connection(conn, true);
+}
+
+// Pick a backend for the request, answering 503 when none can take it
+bool UringLoop::select_backend(UringConnection& conn, const Backend* avoid) {
+    try {
+        conn.backend = &load_balancer.get_next_backend(conn.request_hash, avoid);
+        conn.backend_selected = std::chrono::steady_clock::now();
+        if (Logger::instance().access_log_enabled()) {
+            conn.served_by = conn.backend->address;
+        }
+        return true;
+    } catch (const OverloadedError&) {
+        metrics.requests_shed.add();
+        fail_connection(conn, Response::service_unavailable()); // Shed quietly: logging would only add to the load
+    } catch (const std::runtime_error& e) {
+        log_warn("⚠️ Error forwarding request: %s", e.what());
+        fail_connection(conn, Response::service_unavailable());
+    }
+    return false;
+}
+
+// Use an idle pooled connection when there is one, otherwise submit a connect linked to the
+// send of the request, so both go to the kernel in the same batch
+void UringLoop::open_backend_connection(UringConnection& conn, bool allow_reuse) {
+    ++conn.attempt;
+    int backend_socket = allow_reuse ? connection_pool.checkout(conn.backend->address) : -1;
+    conn.backend_reused = backend_socket >= 0;
+
+    if (conn.backend_reused) {
+        conn.backend_socket = backend_socket;
+        conn.state = ConnectionState::WRITING_REQUEST;
+        conn.last_activity = std::chrono::steady_clock::now();
+        send_request(conn);
+        return;
+    }
+
+    conn.connect_started = std::chrono::steady_clock::now();
+    if (!parse_backend_address(conn.backend->address, conn.backend_address)) {
+        log_error("Invalid backend address: %s", conn.backend->address.c_str());
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+    backend_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (backend_socket < 0) {
+        log_error("Backend socket creation failed: %s", strerror(errno));
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+    conn.backend_socket = backend_socket;
+    conn.state = ConnectionState::CONNECTING_BACKEND;
+
+    // connect -> [timeout] -> send: when the connect fails or times out, the send is cancelled
+    bool timed = options.backend_connect_timeout.count() > 0;
+    if (!ring.reserve(timed ? 3 : 2)) {
+        backend_failed(conn, RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+    io_uring_sqe* sqe = queue(&conn, Operation::CONNECT);
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = backend_socket;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.backend_address);
+    sqe->off = sizeof(conn.backend_address);
+    sqe->flags = IOSQE_IO_LINK;
+    if (timed) {
+        set_timeout(conn.timeout, options.backend_connect_timeout);
+        sqe = queue(&conn, Operation::LINK_TIMEOUT);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.timeout);
+        sqe->len = 1;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+    send_request(conn);
+}
+
+void UringLoop::handle_connect(UringConnection& conn, int result) {
+    if (conn.closed) {
+        return;
+    }
+    if (result < 0) {
+        // Cancelled means the linked timeout fired first
+        if (result != -ECANCELED) {
+            log_warn("Connection to backend server failed: %s", strerror(-result));
+        }
+        backend_failed(conn, result == -ECANCELED ? RequestOutcome::TIMEOUT : RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    conn.last_activity = std::chrono::steady_clock::now();
+    conn.backend_timing.connect = std::chrono::duration_cast<std::chrono::microseconds>(
+        conn.last_activity - conn.connect_started);
+    conn.state = ConnectionState::WRITING_REQUEST;
+}
+
+// Send what has been framed of the request; once all of it is out, wait for the response
+void UringLoop::send_request(UringConnection& conn) {
+    if (conn.backend_sending) {
+        return;
+    }
+    if (conn.backend_out_sent == conn.backend_out.size() && conn.request_sent < conn.request_length) {
+        // The kernel sends from backend_out, which this copy is needed for anyway: a rewritten head
+        // is assembled there from its segments, followed by the bytes after the original head
+        size_t from = conn.request_sent;
+        conn.backend_out.clear();
+        if (from == 0 && !conn.rewritten_head.empty()) {
+            conn.rewritten_head.append_to(conn.request_buffer.data(), conn.backend_out);
+            from = conn.rewritten_head.original_size();
+        }
+        conn.backend_out.append(conn.request_buffer, from, conn.request_length - from);
+        conn.backend_out_sent = 0;
+        conn.request_sent = conn.request_length;
+    }
+
+    if (conn.backend_out_sent < conn.backend_out.size()) {
+        io_uring_sqe* sqe = queue(&conn, Operation::BACKEND_SEND);
+        if (sqe == nullptr) {
+            close_connection(conn);
+            return;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn.backend_socket;
+        sqe->addr = reinterpret_cast<uint64_t>(conn.backend_out.data() + conn.backend_out_sent);
+        sqe->len = static_cast<uint32_t>(conn.backend_out.size() - conn.backend_out_sent);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        conn.backend_sending = true;
+        return;
+    }
+
+    if (!conn.request_body.complete()) {
+        // Drop what was forwarded so a large body streams through in bounded memory
+        conn.request_buffer.erase(0, conn.request_sent);
+        conn.request_length -= conn.request_sent;
+        conn.request_sent = 0;
+        conn.request_streamed = true;
+        conn.rewritten_head.clear(); // Erased with the head: the rest is sent as it is
+        resume_client(conn);
+        return;
+    }
+
+    conn.state = ConnectionState::RELAYING_RESPONSE;
+    conn.request_forwarded = std::chrono::steady_clock::now();
+    conn.last_activity = conn.request_forwarded;
+    receive_response(conn);
+}
+
+void UringLoop::handle_backend_send(UringConnection& conn, int result) {
+    conn.backend_sending = false;
+    if (conn.closed || conn.state == ConnectionState::CONNECTING_BACKEND) {
+        return; // A send cancelled with its connect: the connect's completion handles it
+    }
+    if (result < 0) {
+        if (conn.backend_reused && !conn.request_streamed && !conn.backend_timed_out) {
+            retry_backend(conn);
+        } else {
+            backend_failed(conn, conn.backend_timed_out ? RequestOutcome::TIMEOUT
+                                                         : RequestOutcome::CONNECTION_FAILURE);
+        }
+        return;
+    }
+
+    conn.backend_out_sent += static_cast<size_t>(result);
+    conn.last_activity = std::chrono::steady_clock::now();
+    send_request(conn);
+}
+
+// Receive the next piece of the response into a provided buffer, while there is room for it.
+// The first receive is linked to a timeout for the rest of the first-byte deadline.
+void UringLoop::receive_response(UringConnection& conn) {
+    if (conn.closed || conn.backend_socket < 0 || conn.backend_receiving ||
+        conn.state != ConnectionState::RELAYING_RESPONSE || conn.response_complete || conn.backend_eof ||
+        conn.response_buffer.size() >= options.buffers.max_response_buffer) {
+        return;
+    }
+
+    bool first_byte = conn.response_bytes == 0 && options.backend_first_byte_timeout.count() > 0;
+    if (!ring.reserve(first_byte ? 2 : 1)) {
+        close_connection(conn);
+        return;
+    }
+    io_uring_sqe* sqe = queue(&conn, Operation::BACKEND_RECEIVE);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.backend_socket;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers.group();
+    if (first_byte) {
+        sqe->flags |= IOSQE_IO_LINK;
+        set_timeout(conn.timeout, conn.request_forwarded + options.backend_first_byte_timeout -
+                                      std::chrono::steady_clock::now());
+        sqe = queue(&conn, Operation::LINK_TIMEOUT);
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.timeout);
+        sqe->len = 1;
+    }
+    conn.backend_receiving = true;
+}
+
+void UringLoop::handle_backend_receive(UringConnection& conn, int result, const char* data) {
+    conn.backend_receiving = false;
+    if (conn.closed) {
+        return;
+    }
+    if (result == -ENOBUFS) {
+        receive_response(conn);
+        return;
+    }
+    if (result == -ECANCELED) {
+        backend_failed(conn, RequestOutcome::TIMEOUT); // The first-byte timeout fired
+        return;
+    }
+
+    if (result > 0) {
+        conn.last_activity = std::chrono::steady_clock::now();
+        if (!frame_response(conn, data, static_cast<size_t>(result))) {
+            if (!conn.have_response_head) {
+                conn.backend_outcome = RequestOutcome::CONNECTION_FAILURE;
+            }
+            conn.backend_eof = true; // Malformed response: relay what we have, then close
+        }
+    } else {
+        // The backend closed (or reset) the connection, or the idle sweep shut it down
+        if (conn.response_bytes == 0 && conn.backend_reused && !conn.request_streamed && !conn.backend_timed_out) {
+            retry_backend(conn);
+            return;
+        }
+        if (!conn.have_response_head) {
+            conn.backend_outcome = RequestOutcome::CONNECTION_FAILURE;
+        }
+        conn.backend_eof = true;
+    }
+
+    // Nothing usable came back, or the backend went quiet mid-response
+    if (conn.backend_eof && (!conn.have_response_head || conn.backend_timed_out)) {
+        backend_failed(conn, conn.backend_timed_out ? RequestOutcome::TIMEOUT : RequestOutcome::CONNECTION_FAILURE);
+        return;
+    }
+
+    if (conn.response_complete && conn.backend_socket >= 0) {
+        finish_cache_fill(conn, true);
+        release_backend(conn, conn.backend_keep_alive && conn.backend_in_sync);
+    }
+
+    send_response(conn);
+    receive_response(conn);
+}
+
+// Queue received bytes for the client, tracking where the response ends
+bool UringLoop::frame_response(UringConnection& conn, const char* data, size_t length) {
+    conn.response_bytes += length;
+
+    if (!conn.have_response_head) {
+        conn.response_head.append(data, length);
+
+        // Relay interim responses (e.g. 100 Continue) as they are and wait for the final one
+        while (parse_response_head(conn.response_head.data(), conn.response_head.size(),
+                                   conn.head_request, conn.response_info)) {
+            if (!is_interim_response(conn.response_info)) {
+                conn.have_response_head = true;
+                break;
+            }
+            conn.response_buffer.append(conn.response_head, 0, conn.response_info.header_length);
+            conn.response_head.erase(0, conn.response_info.header_length);
+        }
+        if (!conn.have_response_head) {
+            return conn.response_head.size() <= MAX_RESPONSE_HEAD_SIZE;
+        }
+
+        conn.backend_outcome = outcome_for_status(conn.response_info.status_code);
+        conn.response_status = conn.response_info.status_code;
+        conn.backend_timing.first_byte = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - conn.request_forwarded);
+
+        conn.backend_keep_alive = conn.response_info.keep_alive;
+        conn.response_body = BodyFramer(conn.response_info);
+
+        // The client connection can only continue if the response has an end the client can see
+        conn.client_keep_alive = conn.client_keep_alive && conn.backend_keep_alive;
+        if (!conn.client_keep_alive && conn.response_info.keep_alive) {
+            add_connection_close(conn.response_head, 0, conn.response_info);
+        }
+
+        const std::string& head = conn.response_head;
+        size_t header_length = conn.response_info.header_length;
+        size_t body_available = head.size() - header_length;
+        size_t body_used = conn.response_body.consume(head.data() + header_length, body_available);
+
+        conn.response_buffer.append(head, 0, header_length + body_used);
+        fill_cache(conn, head.data(), header_length + body_used);
+        conn.backend_in_sync = body_used == body_available;
+        conn.response_head.clear();
+    } else {
+        size_t used = conn.response_body.consume(data, length);
+        conn.response_buffer.append(data, used);
+        fill_cache(conn, data, used);
+        conn.backend_in_sync = conn.backend_in_sync && used == length;
+    }
+
+    conn.response_complete = conn.response_body.complete();
+    return !conn.response_body.failed();
+}
+
+// Send the pending response bytes; one send is in flight at a time, and what the backend
+// delivers meanwhile waits in response_buffer
+void UringLoop::send_response(UringConnection& conn) {
+    if (conn.closed || conn.client_sending) {
+        return;
+    }
+    if (conn.client_out_sent == conn.client_out.size()) {
+        conn.client_out.clear();
+        conn.client_out_sent = 0;
+        if (conn.response_buffer.empty()) {
+            response_drained(conn);
+            return;
+        }
+        conn.client_out.swap(conn.response_buffer);
+    }
+
+    io_uring_sqe* sqe = queue(&conn, Operation::CLIENT_SEND);
+    if (sqe == nullptr) {
+        close_connection(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn.client_socket;
+    sqe->addr = reinterpret_cast<uint64_t>(conn.client_out.data() + conn.client_out_sent);
+    sqe->len = static_cast<uint32_t>(conn.client_out.size() - conn.client_out_sent);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    conn.client_sending = true;
+}
+
+void UringLoop::handle_client_send(UringConnection& conn, int result) {
+    conn.client_sending = false;
+    if (conn.closed) {
+        return;
+    }
+    if (result < 0) {
+        close_connection(conn);
+        return;
+    }
+
+    conn.client_out_sent += static_cast<size_t>(result);
+    conn.response_delivered += static_cast<size_t>(result);
+    conn.last_activity = std::chrono::steady_clock::now();
+    send_response(conn);
+    receive_response(conn); // There may be room for more of the response again
+}
+
+void UringLoop::response_drained(UringConnection& conn) {
+    if (conn.response_complete && conn.client_keep_alive) {
+        finish_request(conn);
+        return;
+    }
+    if (conn.response_complete || conn.backend_eof) {
+        close_connection(conn);
+        return;
+    }
+    receive_response(conn);
+}
+
+// Copy relayed response bytes for the cache while this request leads a fetch
+void UringLoop::fill_cache(UringConnection& conn, const char* data, size_t length) {
+    if (!conn.cache_filling) {
+        return;
+    }
+    if (conn.cache_fill.size() + length > cache.max_object_size()) {
+        conn.cache_filling = false;
+        conn.cache_fill.clear();
+        return;
+    }
+    conn.cache_fill.append(data, length);
+}
+
+// Store the fetched response, or mark the key uncacheable, once the response is complete;
+// a fetch cut short lets the next miss try again
+void UringLoop::finish_cache_fill(UringConnection& conn, bool complete) {
+    if (conn.cache_key.empty()) {
+        return;
+    }
+    if (!complete) {
+        cache.abandon_fetch(conn.cache_key);
+    } else {
+        cache.finish_fetch(conn.cache_key, conn.cache_filling ? ResponseCache::make_entry(conn.cache_fill) : nullptr);
+    }
+    conn.cache_key.clear();
+    conn.cache_fill.clear();
+    conn.cache_filling = false;
+}
+
+// Retry on a fresh connection after a pooled one turned out to be stale
+void UringLoop::retry_backend(UringConnection& conn) {
+    retire_socket(conn.backend_socket);
+    conn.backend_socket = -1;
+    conn.backend_receiving = false;
+    conn.backend_sending = false;
+    reset_exchange(conn);
+
+    open_backend_connection(conn, false);
+}
+
+void UringLoop::backend_failed(UringConnection& conn, RequestOutcome outcome) {
+    conn.backend_outcome = outcome;
+    if (conn.response_delivered > 0 || !conn.response_buffer.empty() || !conn.client_out.empty()) {
+        close_connection(conn); // Part of a response is out: the client can only see the connection close
+        return;
+    }
+
+    bool replayable = conn.response_bytes == 0 && !conn.request_streamed &&
+                      is_idempotent_method(conn.request_parser.method());
+    if (replayable && conn.retries < load_balancer.retry_options().max_retries) {
+        if (load_balancer.try_retry()) {
+            ++conn.retries;
+            metrics.retries.add();
+            const Backend* failed = conn.backend;
+            release_backend(conn, false);
+            reset_exchange(conn);
+            if (select_backend(conn, failed)) {
+                open_backend_connection(conn, true);
+            }
+            return;
+        }
+        metrics.retries_denied.add();
+    }
+
+    fail_connection(conn, Response::canned(outcome == RequestOutcome::TIMEOUT ? CannedResponse::GATEWAY_TIMEOUT
+                                                                             : CannedResponse::BAD_GATEWAY));
+}
+
+// Detach the backend socket. Only a socket with no operation pending is pooled; any other is shut
+// down, and what its operations report afterwards is ignored.
+void UringLoop::release_backend(UringConnection& conn, bool reusable) {
+    if (conn.backend_socket >= 0) {
+        bool retired = conn.backend->retired.load(std::memory_order_relaxed);
+        if (reusable && !retired) {
+            connection_pool.checkin(conn.backend->address, conn.backend_socket, true);
+        } else {
+            retire_socket(conn.backend_socket);
+        }
+        conn.backend_socket = -1;
+        conn.backend_receiving = false;
+        conn.backend_sending = false;
+        ++conn.attempt;
+    }
+
+    if (conn.backend != nullptr) {
+        conn.backend_timing.total = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - conn.backend_selected);
+        load_balancer.release_backend(*conn.backend, conn.backend_outcome, conn.backend_timing);
+        conn.backend = nullptr;
+        conn.backend_outcome = RequestOutcome::ABORTED;
+        conn.backend_timing = BackendTiming();
+    }
+}
+
+void UringLoop::retire_socket(int socket) {
+    shutdown(socket, SHUT_RDWR);
+    closing_sockets.push_back(socket);
+}
+
+// Answer the request from the proxy itself instead of a backend
+void UringLoop::respond_locally(UringConnection& conn, const std::string& response) {
+    conn.response_buffer = response;
+    conn.response_complete = true;
+    conn.state = ConnectionState::RELAYING_RESPONSE;
+    send_response(conn);
+}
+
+// Write the access-log line of the request in flight, if any
+void UringLoop::log_request(UringConnection& conn) {
+    if (!conn.request_active) {
+        return;
+    }
+    conn.request_active = false;
+
+    AccessLogEntry access;
+    access.client = conn.client_address;
+    access.method = conn.request_method;
+    access.path = conn.request_path;
+    access.status = conn.response_status;
+    access.response_bytes = conn.response_delivered;
+    access.backend = conn.served_by;
+    access.started = conn.request_started;
+    Logger::instance().log_access(access);
+
+    conn.served_by.clear();
+    conn.response_status = 0;
+    conn.response_delivered = 0;
+}
+
+// Send a short error response and close the connection; nothing else is being sent to the client then
+void UringLoop::fail_connection(UringConnection& conn, const std::string& response) {
+    ssize_t sent = send(conn.client_socket, response.c_str(), response.length(), MSG_NOSIGNAL);
+    if (conn.request_active && sent > 0) {
+        conn.response_status = std::atoi(response.c_str() + 9); // Our own "HTTP/1.1 NNN ..." responses
+        conn.response_delivered += static_cast<size_t>(sent);
+    }
+    close_connection(conn);
+}
+
+// Shut both sides down; the connection is freed once its pending operations have completed
+void UringLoop::close_connection(UringConnection& conn) {
+    if (conn.closed) {
+        return;
+    }
+    log_request(conn);
+    finish_cache_fill(conn, false);
+    release_backend(conn, false);
+
+    conn.closed = true;
+    retire_socket(conn.client_socket);
+    conn.client_socket = -1;
+    --client_connections;
+    metrics.open_connections.sub();
+    closed_connections.push_back(conn.id);
+}
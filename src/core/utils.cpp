@@ -1,26 +1,38 @@
 #include "core/utils.h"
+#include "core/logger.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
 #include <cstring>
-#include <iostream>
+#include <cerrno>
 
 // Create a listening socket
-int create_listening_socket(int port) {
+int create_listening_socket(int port, bool reuse_port, int backlog) {
     int server_fd;
     struct sockaddr_in address;
     int opt = 1;
     int addrlen = sizeof(address);
 
-    // Create socket (IPv4, TCP)
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        perror("Socket creation failed");
+    // Create socket (IPv4, TCP); an upgrade hands it over explicitly, so exec must not leak it
+    if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+        log_error("Socket creation failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
     // Reuse address and port
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
-        perror("setsockopt failed");
+        log_error("setsockopt failed: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Let the kernel spread incoming connections across every socket bound to this port
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt))) {
+        log_error("setsockopt(SO_REUSEPORT) failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -31,13 +43,13 @@ int create_listening_socket(int port) {
 
     // Bind the socket
     if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        perror("Bind failed");
+        log_error("Bind failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
     // Start listening
-    if (listen(server_fd, 10) < 0) {
-        perror("Listen failed");
+    if (listen(server_fd, backlog) < 0) {
+        log_error("Listen failed: %s", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
@@ -45,17 +57,298 @@ int create_listening_socket(int port) {
 }
 
 // Send data over a socket
-void send_data(int socket, const std::string& data) {
-    send(socket, data.c_str(), data.length(), 0);
+bool send_data(int socket, const std::string& data) {
+    return send_all(socket, data.data(), data.length());
+}
+
+// Send a whole buffer, retrying partial writes; never raises SIGPIPE
+bool send_all(int socket, const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t result = send(socket, data + sent, length - sent, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// Answer a connection that will not be served and close it
+void reject_connection(int socket, const std::string& response) {
+    char discard[4096];
+    for (int reads = 0; reads < 4 && recv(socket, discard, sizeof(discard), MSG_DONTWAIT) > 0; ++reads) {
+    }
+
+    // Never wait on a client that is not reading: a shed connection must not tie up the acceptor
+    send(socket, response.data(), response.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    shutdown(socket, SHUT_WR);
+    close(socket);
 }
 
-// Read data from a socket
-std::string read_data(int socket) {
-    char buffer[1024] = {0};
-    int valread = read(socket, buffer, 1024);
+// Send every byte of several buffers with as few system calls as possible; never raises SIGPIPE
+bool send_iov(int socket, struct iovec* iov, size_t count) {
+    while (count > 0) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+
+        ssize_t result = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            return false;
+        }
+
+        // Skip the buffers that went out whole, then the sent part of the next one
+        size_t sent = static_cast<size_t>(result);
+        while (count > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return true;
+}
+
+// Read whatever is available from a socket and append it to buffer
+ssize_t read_data(int socket, std::string& buffer, size_t max_bytes) {
+    ssize_t valread = receive_into(socket, buffer, max_bytes);
     if (valread < 0) {
-        perror("Failed to read from socket");
+        // A receive timeout is how idle keep-alive connections end, not an error worth reporting
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNRESET) {
+            log_error("Failed to read from socket: %s", strerror(errno));
+        }
+        return -1;
+    }
+    return valread;
+}
+
+// The buffer is grown by max_bytes for the kernel to fill and cut back to what it wrote; a pooled
+// buffer has the capacity already, so this does not allocate
+ssize_t receive_into(int socket, std::string& buffer, size_t max_bytes) {
+    size_t size = buffer.size();
+    buffer.resize(size + max_bytes);
+
+    ssize_t received;
+    do {
+        received = recv(socket, &buffer[size], max_bytes, 0);
+    } while (received < 0 && errno == EINTR);
+
+    int saved_errno = errno;
+    buffer.resize(size + static_cast<size_t>(std::max<ssize_t>(received, 0)));
+    errno = saved_errno;
+    return received;
+}
+
+// Bound how long blocking reads on the socket may wait
+void set_receive_timeout(int socket, std::chrono::milliseconds timeout) {
+    struct timeval tv;
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+// Bound how long blocking writes on the socket may wait
+void set_send_timeout(int socket, std::chrono::milliseconds timeout) {
+    struct timeval tv;
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+// Switch a socket to non-blocking mode
+bool set_non_blocking(int socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    if (flags < 0) {
+        log_error("fcntl(F_GETFL) failed: %s", strerror(errno));
+        return false;
+    }
+    if (fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+        log_error("fcntl(F_SETFL) failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Pin the calling thread to a single CPU
+bool pin_current_thread_to_cpu(int cpu) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (result != 0) {
+        log_warn("Failed to pin thread to CPU %d: %s", cpu, strerror(result));
+        return false;
+    }
+    return true;
+}
+
+// Resolve an "IP:PORT" backend address
+bool parse_backend_address(const std::string& address, struct sockaddr_in& backend_address) {
+    size_t colon = address.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    memset(&backend_address, 0, sizeof(backend_address));
+    backend_address.sin_family = AF_INET;
+    try {
+        backend_address.sin_port = htons(std::stoi(address.substr(colon + 1)));
+    } catch (const std::exception&) {
+        return false;
+    }
+    return inet_pton(AF_INET, address.substr(0, colon).c_str(), &backend_address.sin_addr) == 1;
+}
+
+// "IP:PORT" of the remote end of a connected socket
+std::string peer_address(int socket) {
+    struct sockaddr_in address;
+    socklen_t length = sizeof(address);
+    char ip[INET_ADDRSTRLEN];
+    if (getpeername(socket, (struct sockaddr*)&address, &length) < 0 || address.sin_family != AF_INET ||
+        inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip)) == nullptr) {
         return "";
     }
-    return std::string(buffer, valread);
+    return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+// Open a TCP connection to a backend
+int open_backend_socket(const std::string& address, bool non_blocking) {
+    struct sockaddr_in backend_address;
+    if (!parse_backend_address(address, backend_address)) {
+        log_error("Invalid backend address: %s", address.c_str());
+        return -1;
+    }
+
+    int backend_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (non_blocking ? SOCK_NONBLOCK : 0), 0);
+    if (backend_socket < 0) {
+        log_error("Backend socket creation failed: %s", strerror(errno));
+        return -1;
+    }
+
+    if (connect(backend_socket, (struct sockaddr*)&backend_address, sizeof(backend_address)) < 0 &&
+        !(non_blocking && errno == EINPROGRESS)) {
+        log_error("Connection to backend server failed: %s", strerror(errno));
+        close(backend_socket);
+        return -1;
+    }
+
+    return backend_socket;
+}
+
+// Connect without blocking, wait for the outcome, then make the socket blocking again
+int open_backend_socket(const std::string& address, std::chrono::milliseconds connect_timeout) {
+    if (connect_timeout.count() <= 0) {
+        return open_backend_socket(address, false);
+    }
+
+    int backend_socket = open_backend_socket(address, true);
+    if (backend_socket < 0) {
+        return -1;
+    }
+
+    struct pollfd connecting = {backend_socket, POLLOUT, 0};
+    int ready;
+    do {
+        ready = poll(&connecting, 1, static_cast<int>(connect_timeout.count()));
+    } while (ready < 0 && errno == EINTR);
+
+    int error = ready == 0 ? ETIMEDOUT : 0;
+    socklen_t length = sizeof(error);
+    if (ready < 0) {
+        error = errno;
+    } else if (ready > 0 && getsockopt(backend_socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        error = errno;
+    }
+    if (error == 0 && fcntl(backend_socket, F_SETFL, fcntl(backend_socket, F_GETFL, 0) & ~O_NONBLOCK) < 0) {
+        error = errno;
+    }
+    if (error != 0) {
+        log_warn("Connection to backend server %s failed: %s", address.c_str(), strerror(error));
+        close(backend_socket);
+        errno = error;
+        return -1;
+    }
+    return backend_socket;
+}
+
+// Send the descriptors as ancillary data of a one-byte message holding their count
+bool send_fds(int socket, const std::vector<int>& fds) {
+    if (fds.empty() || fds.size() > MAX_PASSED_FDS) {
+        return false;
+    }
+
+    unsigned char count = static_cast<unsigned char>(fds.size());
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = 1;
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+    memset(control, 0, sizeof(control));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == 1;
+}
+
+bool receive_fds(int socket, std::vector<int>& fds) {
+    unsigned char count = 0;
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = 1;
+
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_PASSED_FDS)];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received != 1) {
+        return false;
+    }
+
+    fds.clear();
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t passed = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < passed; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            fds.push_back(fd);
+        }
+    }
+    return !fds.empty() && fds.size() == count;
 }
@@ -1,21 +1,39 @@
 #include "core/server.h"
+#include "core/config.h"
 #include <iostream>
 #include <string>
 #include <vector>
-
-// Helper function to parse backend addresses
-std::vector<std::string> parse_backend_addresses(int argc, char* argv[]) {
-    std::vector<std::string> backend_addresses;
-    for (int i = 2; i < argc; ++i) {
-        backend_addresses.push_back(argv[i]);
-    }
-    return backend_addresses;
-}
+#include <csignal>
+#include <pthread.h>
+#include <cstdlib>
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: ./crabbyLB <mode> [backend_addresses]\n";
-        std::cerr << "Modes: basic, multi_thread, thread_pool, load_balancer\n";
+        std::cerr << "Usage: ./crabbyLB <mode> [backend_addresses] [--options]\n";
+        std::cerr << "Options: --config=PATH --port=N --listen-backlog=N --backend=IP:PORT[@WEIGHT]\n";
+        std::cerr << "         --drain-timeout-ms=MS\n";
+        std::cerr << "         --balance=round_robin|least_conn|p2c|random|ring_hash|maglev --threads=N --reactors=N --pin-cpus\n";
+        std::cerr << "         --io-engine=epoll|io_uring\n";
+        std::cerr << "         --hash-on=ip|header:NAME|cookie:NAME|query:NAME --hash-balance-factor=X\n";
+        std::cerr << "         --pool-min=N --pool-max=N --pool-idle-timeout-ms=MS\n";
+        std::cerr << "         --keep-alive-timeout-ms=MS --max-requests-per-connection=N --splice-threshold=BYTES\n";
+        std::cerr << "         --read-buffer-kb=N --request-buffer-kb=N --response-buffer-kb=N\n";
+        std::cerr << "         --connect-timeout-ms=MS --first-byte-timeout-ms=MS --backend-idle-timeout-ms=MS\n";
+        std::cerr << "         --retries=N --retry-budget=RATIO --retry-budget-min=N\n";
+        std::cerr << "         --hedge --hedge-quantile=Q --hedge-min-delay-ms=MS\n";
+        std::cerr << "         --forwarded-for --request-id --rewrite-host=HOST --strip-hop-by-hop\n";
+        std::cerr << "         --metrics-path=PATH\n";
+        std::cerr << "         --cache --cache-size-mb=N --cache-max-object-kb=N --cache-key-params=NAME,NAME...\n";
+        std::cerr << "         --log-level=debug|info|warn|error|off --log-file=PATH --access-log[=PATH|-]\n";
+        std::cerr << "         --access-log-sample=FRACTION --log-buffer-kb=N --log-block-when-full\n";
+        std::cerr << "         --health-interval-ms=MS --health-connect-timeout-ms=MS --health-read-timeout-ms=MS\n";
+        std::cerr << "         --health-path=PATH --health-rise=N --health-fall=N\n";
+        std::cerr << "         --outlier-5xx=N --outlier-connect-failures=N --outlier-latency-factor=X\n";
+        std::cerr << "         --outlier-min-latency-ms=MS --outlier-ejection-ms=MS --outlier-max-ejection-ms=MS\n";
+        std::cerr << "         --outlier-max-percent=N\n";
+        std::cerr << "         --max-connections=N --max-queued-connections=N --adaptive-concurrency\n";
+        std::cerr << "         --concurrency-initial=N --concurrency-min=N --concurrency-max=N --concurrency-tolerance=X\n";
+        std::cerr << "Modes: basic, multi_thread, thread_pool, load_balancer, event_loop\n";
         return 1;
     }
 
@@ -32,28 +50,59 @@ int main(int argc, char* argv[]) {
         mode = ServerMode::THREAD_POOL;
     } else if (mode_str == "load_balancer") {
         mode = ServerMode::LOAD_BALANCER;
+    } else if (mode_str == "event_loop") {
+        mode = ServerMode::EVENT_LOOP;
     } else {
-        std::cerr << "Invalid mode specified! Use: basic, multi_thread, thread_pool, load_balancer\n";
+        std::cerr << "Invalid mode specified! Use: basic, multi_thread, thread_pool, load_balancer, event_loop\n";
         return 1;
     }
 
-    // ✅ Parse backend addresses if mode is load_balancer
-    std::vector<std::string> backend_addresses;
-    if (mode == ServerMode::LOAD_BALANCER) {
-        if (argc < 3) {
-            std::cerr << "❗️ For load_balancer mode, specify at least one backend address.\n";
+    // splice(2) cannot be told MSG_NOSIGNAL, so a client disconnecting mid-response must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    // Reload, upgrade and shutdown signals are taken by the server's signal thread; every thread inherits this mask
+    sigset_t server_signals;
+    sigemptyset(&server_signals);
+    sigaddset(&server_signals, SIGHUP);
+    sigaddset(&server_signals, SIGUSR2);
+    sigaddset(&server_signals, SIGTERM);
+    sigaddset(&server_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &server_signals, nullptr);
+
+    ServerConfig config;
+    std::string error;
+    if (!load_server_config(std::vector<std::string>(argv + 2, argv + argc), config, error)) {
+        std::cerr << "Invalid configuration: " << error << "\n";
+        return 1;
+    }
+    if (!Logger::instance().configure(config.options.logging)) {
+        return 1;
+    }
+
+    // ✅ Backend addresses are required if mode is load_balancer or event_loop
+    if (mode == ServerMode::LOAD_BALANCER || mode == ServerMode::EVENT_LOOP) {
+        if (config.backends.empty()) {
+            std::cerr << "❗️ For " << mode_str << " mode, specify at least one backend address.\n";
             return 1;
         }
-        backend_addresses = parse_backend_addresses(argc, argv);
         std::cout << "Backend Addresses: ";
-        for (const auto& address : backend_addresses) {
+        for (const auto& address : config.backends) {
             std::cout << address << " ";
         }
         std::cout << std::endl;
     }
 
     // ✅ Create server instance with selected mode and backend addresses
-    Server server(8080, mode, backend_addresses);
+    Server server(config.options.port, mode, config.backends, config.options);
+    server.set_command_line(argc, argv);
+
+    // Started by a binary upgrade: serve on the listening sockets of the process being replaced
+    const char* upgrade_fd = getenv(UPGRADE_FD_VARIABLE);
+    if (upgrade_fd != nullptr) {
+        server.inherit_listeners(atoi(upgrade_fd));
+        unsetenv(UPGRADE_FD_VARIABLE);
+    }
+
     server.start();
 
     return 0;